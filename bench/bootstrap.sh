@@ -0,0 +1,117 @@
+#!/bin/sh
+#
+# bench/bootstrap.sh - install vs install --bootstrap into empty roots
+#
+#   bench/bootstrap.sh [FLAPPY] [RUNS]
+#
+# Builds a 101-package repository: p000..p099 with 300 files of 1 KiB
+# each (30k files), chained in fives (p001 depends on p000, ... p004
+# on p003; p005 starts a new chain), and "all" depending on every
+# chain's end.  It is served from loopback and the package cache is
+# warmed once, so the runs time unpacking and registering, not the
+# network.
+#
+# Each run installs "all" into a fresh root, with `install` and then
+# with `install --bootstrap`, prints both wall times and checks that
+# the two roots hold the same /usr and package list.  The median of each
+# is printed last.
+#
+# Uses the sandbox of tests/run.sh (root, unshare, ip, python3, zstd).
+# The roots are created under TMPDIR (default /tmp): point it at the
+# filesystem to measure.
+
+set -u
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+TESTS=$BENCH/../tests
+FLAPPY=$(realpath "${1:-$BENCH/../flappy}")
+RUNS=${2:-5}
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "bench/bootstrap.sh needs root" >&2
+    exit 1
+fi
+
+if [ -z "${FLAPPY_TEST_NS:-}" ]; then
+    FLAPPY_TEST_NS=1 exec unshare -m -n --propagation private \
+        "$0" "$FLAPPY" "$RUNS"
+fi
+
+ip link set lo up || exit 1
+
+T=$(mktemp -d "${TMPDIR:-/tmp}/flappy-bench.XXXXXX")
+. "$TESTS/lib.sh"
+trap 'stop_all; rm -rf "$T"' EXIT
+
+for d in etc:/etc/flappy lib:/var/lib/flappy cache:/var/cache/flappy; do
+    mkdir -p "$T/${d%%:*}" "${d#*:}"
+    mount --bind "$T/${d%%:*}" "${d#*:}" || exit 1
+done
+
+# --- fixture ---
+set --
+for i in $(seq 0 99); do
+    p=$(printf "p%03d" "$i")
+    set -- "$@" "$p=1.0@1x300"
+    if [ $((i % 5)) -ne 0 ]; then
+        set -- "$@" "dep:$p,$(printf "p%03d" $((i - 1))),,"
+    fi
+    if [ $((i % 5)) -eq 4 ]; then
+        set -- "$@" "dep:all,$p,,"
+    fi
+done
+echo "building the repository..."
+mkrepo "$T/repo" "$@" all=1.0
+
+serve repo "$T/repo"
+repos_conf "$(url repo)"
+
+# fresh_root NAME: an initialised, empty root at $T/NAME
+fresh_root() {
+    rm -rf "${T:?}/$1"
+    mkdir "$T/$1"
+    "$FLAPPY" --root "$T/$1" --init-db >/dev/null 2>&1 || exit 1
+}
+
+# timed NAME ARGS...: flappy on root NAME; prints the wall time in ms
+timed() {
+    root=$1
+    shift
+    start=$(date +%s%N)
+    "$FLAPPY" --root "$T/$root" "$@" >"$T/$root.out" 2>&1 ||
+        { cat "$T/$root.out" >&2; exit 1; }
+    echo $(( ($(date +%s%N) - start) / 1000000 ))
+}
+
+median() {
+    sort -n | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+fresh_root warm
+"$FLAPPY" --root "$T/warm" update >/dev/null 2>&1 || exit 1
+timed warm install --bootstrap all >/dev/null
+rm -rf "$T/warm"
+
+: > "$T/normal.ms"
+: > "$T/bootstrap.ms"
+for run in $(seq "$RUNS"); do
+    fresh_root normal
+    fresh_root boot
+    sync
+
+    n=$(timed normal install all)
+    b=$(timed boot install --bootstrap all)
+    echo "$n" >> "$T/normal.ms"
+    echo "$b" >> "$T/bootstrap.ms"
+    echo "run $run: install ${n}ms, install --bootstrap ${b}ms"
+
+    diff -r "$T/normal/usr" "$T/boot/usr" >/dev/null ||
+        { echo "run $run: the roots' files differ" >&2; exit 1; }
+    "$FLAPPY" --root "$T/normal" list > "$T/normal.list"
+    "$FLAPPY" --root "$T/boot" list > "$T/boot.list"
+    cmp -s "$T/normal.list" "$T/boot.list" ||
+        { echo "run $run: the roots' packages differ" >&2; exit 1; }
+done
+
+echo "median of $RUNS: install $(median < "$T/normal.ms")ms," \
+     "install --bootstrap $(median < "$T/bootstrap.ms")ms"
@@ -0,0 +1,162 @@
+/*
+ * bench/version_match.c - Constraint matching microbenchmark (make bench)
+ *
+ *   bench/version_match [CANDIDATES] [ROUNDS]
+ *
+ * The resolver tests one dependency constraint against every version
+ * a repository offers for the name.  This times three ways of doing
+ * that over the same candidates and constraints:
+ *
+ *   satisfies   version_satisfies per candidate: both strings are
+ *               parsed again for every comparison
+ *   keyed       version_constraint_compile once, version_key per
+ *               candidate, then version_constraint_match (the SQL
+ *               fallback without a version_key column)
+ *   match       version_constraint_match on keys computed beforehand
+ *               (repo.idx and the version_key column store them)
+ *
+ * and checks that all three find the same number of matches.
+ * Candidates are pseudo-random "a.b.c" and "a.b.c-r" versions from a
+ * fixed seed, so runs are comparable.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "version.h"
+#include "pkg_meta.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_CANDIDATES 64
+#define DEFAULT_ROUNDS     20000
+
+static const struct {
+    dep_op_t    op;
+    const char *version;
+} CONSTRAINTS[] = {
+    { DEP_OP_GE, "3.2"     },
+    { DEP_OP_LT, "5.0.1"   },
+    { DEP_OP_LE, "7.10-2"  },
+    { DEP_OP_GT, "1.9.9"   },
+    { DEP_OP_EQ, "4.4.4-1" },
+};
+#define NCONSTRAINTS (sizeof(CONSTRAINTS) / sizeof(CONSTRAINTS[0]))
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* xorshift32: the same candidates on every run */
+static unsigned next_rand(unsigned *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+static void report(const char *name, double secs, size_t tests,
+                   double base)
+{
+    printf("  %-10s %8.3f s  %7.1f ns/test  %5.1fx\n",
+           name, secs, secs * 1e9 / (double)tests, base / secs);
+}
+
+int main(int argc, char **argv)
+{
+    size_t n      = argc > 1 ? strtoul(argv[1], NULL, 10)
+                             : DEFAULT_CANDIDATES;
+    size_t rounds = argc > 2 ? strtoul(argv[2], NULL, 10)
+                             : DEFAULT_ROUNDS;
+    if (n == 0 || rounds == 0) {
+        fprintf(stderr, "usage: %s [CANDIDATES] [ROUNDS]\n", argv[0]);
+        return 2;
+    }
+
+    char (*versions)[32] = calloc(n, sizeof(*versions));
+    unsigned char (*keys)[VERSION_KEY_MAX] = calloc(n, sizeof(*keys));
+    struct version_key_ref *refs = calloc(n, sizeof(*refs));
+    unsigned char *match = calloc(n, 1);
+    if (!versions || !keys || !refs || !match) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    unsigned seed = 2463534242u;
+    for (size_t i = 0; i < n; i++) {
+        unsigned a = next_rand(&seed) % 10, b = next_rand(&seed) % 12;
+        unsigned c = next_rand(&seed) % 20, r = next_rand(&seed) % 4;
+        if (r)
+            snprintf(versions[i], sizeof(versions[i]), "%u.%u.%u-%u",
+                     a, b, c, r);
+        else
+            snprintf(versions[i], sizeof(versions[i]), "%u.%u.%u",
+                     a, b, c);
+    }
+
+    /* --- satisfies: parse per comparison --- */
+    size_t hits_satisfies = 0;
+    double t = now();
+    for (size_t r = 0; r < rounds; r++)
+        for (size_t k = 0; k < NCONSTRAINTS; k++)
+            for (size_t i = 0; i < n; i++)
+                hits_satisfies += (size_t)version_satisfies(
+                    versions[i], CONSTRAINTS[k].op,
+                    CONSTRAINTS[k].version);
+    double t_satisfies = now() - t;
+
+    /* --- keyed: compile once, key each candidate, match --- */
+    size_t hits_keyed = 0;
+    t = now();
+    for (size_t r = 0; r < rounds; r++)
+        for (size_t k = 0; k < NCONSTRAINTS; k++) {
+            struct version_constraint c;
+            version_constraint_compile(&c, CONSTRAINTS[k].op,
+                                       CONSTRAINTS[k].version);
+            for (size_t i = 0; i < n; i++) {
+                refs[i].key = keys[i];
+                if (version_key(versions[i], keys[i], &refs[i].len) != 0)
+                    refs[i].key = NULL;
+            }
+            hits_keyed += version_constraint_match(&c, refs, n, match);
+        }
+    double t_keyed = now() - t;
+
+    /* --- match: keys computed beforehand --- */
+    struct version_constraint cs[NCONSTRAINTS];
+    for (size_t k = 0; k < NCONSTRAINTS; k++)
+        version_constraint_compile(&cs[k], CONSTRAINTS[k].op,
+                                   CONSTRAINTS[k].version);
+
+    size_t hits_match = 0;
+    t = now();
+    for (size_t r = 0; r < rounds; r++)
+        for (size_t k = 0; k < NCONSTRAINTS; k++)
+            hits_match += version_constraint_match(&cs[k], refs, n, match);
+    double t_match = now() - t;
+
+    size_t tests = rounds * NCONSTRAINTS * n;
+    printf("%zu candidates x %zu constraints x %zu rounds "
+           "(%zu matches per round)\n",
+           n, NCONSTRAINTS, rounds, hits_satisfies / rounds);
+    report("satisfies", t_satisfies, tests, t_satisfies);
+    report("keyed",     t_keyed,     tests, t_satisfies);
+    report("match",     t_match,     tests, t_satisfies);
+
+    free(versions);
+    free(keys);
+    free(refs);
+    free(match);
+
+    if (hits_keyed != hits_satisfies || hits_match != hits_satisfies) {
+        fprintf(stderr, "MISMATCH: satisfies %zu, keyed %zu, match %zu\n",
+                hits_satisfies, hits_keyed, hits_match);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+/*
+ * blake3.h - BLAKE3 hash (plain hash mode, 32-byte output)
+ *
+ * BLAKE3 splits its input into 1 KiB chunks and hashes them as the
+ * leaves of a binary tree, so distinct parts of one file can be hashed
+ * on distinct cores and combined afterwards.  The file layer
+ * (digest.c) does that: it hashes aligned power-of-two runs of chunks
+ * with blake3_subtree_cv on worker threads, then feeds the results to
+ * one hasher in order with blake3_push_subtree.
+ *
+ * Everything else is the usual incremental interface.  Pure
+ * computation: no I/O, no allocation, no threads.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLAKE3_OUT_LEN    32
+#define BLAKE3_BLOCK_LEN  64
+#define BLAKE3_CHUNK_LEN  1024
+#define BLAKE3_MAX_DEPTH  54        /* 2^54 chunks: 2^64 bytes */
+
+struct blake3_chunk {
+    uint32_t  cv[8];
+    uint64_t  counter;              /* index of this chunk in the input */
+    uint8_t   block[BLAKE3_BLOCK_LEN];
+    uint8_t   block_len;
+    uint8_t   blocks;               /* compressed so far */
+};
+
+/* Zero-initialise, or blake3_init. */
+struct blake3_hasher {
+    struct blake3_chunk  chunk;
+    uint32_t             stack[BLAKE3_MAX_DEPTH][8];
+    uint8_t              stack_len;
+};
+
+void blake3_init(struct blake3_hasher *h);
+void blake3_update(struct blake3_hasher *h, const void *data, size_t len);
+void blake3_final(const struct blake3_hasher *h,
+                  uint8_t out[BLAKE3_OUT_LEN]);
+
+/*
+ * blake3_subtree_cv
+ *
+ * Chaining value of the `len` bytes at `in`, which start at chunk
+ * `first_chunk` of the input.  `len` must be a power of two number of
+ * chunks, at least two, and `first_chunk` a multiple of that number.
+ * The subtree must not be the whole input: its root is not the root.
+ */
+void blake3_subtree_cv(const uint8_t *in, size_t len, uint64_t first_chunk,
+                       uint32_t cv[8]);
+
+/*
+ * blake3_push_subtree
+ *
+ * Appends a subtree of `len` bytes, hashed with blake3_subtree_cv, to
+ * `h`.  Only valid while `h` has been given nothing but subtrees of
+ * that same `len`; more input must follow.
+ */
+void blake3_push_subtree(struct blake3_hasher *h, const uint32_t cv[8],
+                         size_t len);
+
+#endif /* BLAKE3_H */
@@ -0,0 +1,30 @@
+#ifndef BOOTSTRAP_H
+#define BOOTSTRAP_H
+
+/*
+ * bootstrap.h - Fast population of an empty root
+ *
+ * bootstrap_install(pkgs, n)
+ *
+ *   `flappy [--root DIR] install --bootstrap <pkg>...`: installs the
+ *   full dependency closure of `pkgs` into a root with nothing
+ *   installed yet.  Trades the per-package guarantees of the normal
+ *   path for speed — a failed bootstrap leaves a partial root that is
+ *   meant to be thrown away, not repaired:
+ *
+ *     - archives are extracted in parallel straight into the root
+ *       (no staging, no per-package conflict pass; a path shipped by
+ *       two packages fails the run)
+ *     - every package is registered in one DB transaction with the
+ *       rollback journal off
+ *     - hooks run once everything is on disk, in dependency order
+ *     - one syncfs() on the root at the end instead of a journal sync
+ *       per package
+ *
+ *   Refuses a root whose installed DB already has packages.
+ *   Requires root.  Returns 0 on success, 1 on failure (reason printed).
+ */
+
+int bootstrap_install(const char *const *pkgs, int n);
+
+#endif /* BOOTSTRAP_H */
@@ -0,0 +1,35 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+/*
+ * bundle.h - Offline install bundles
+ *
+ * A bundle carries everything needed to install a set of packages on
+ * a host with no route to any repository: the exact archives, the
+ * install plan computed on the exporting host, and repo.db trimmed to
+ * the bundled packages.  It is an uncompressed ustar archive, so every
+ * member sits at a fixed offset and is copied out in place — nothing
+ * is unpacked that is not installed.
+ *
+ * bundle_create(path, pkgs, n)
+ *
+ *   Resolves the full dependency closure of `pkgs` (as for a bare
+ *   host, see resolve_closure), downloads every archive into the
+ *   package cache and writes the bundle to `path`.
+ *
+ * bundle_install(path)
+ *
+ *   Installs the plan of the bundle at `path`, in its order, skipping
+ *   packages already installed.  No repository is consulted and
+ *   nothing is re-resolved.  Each package goes through the standard
+ *   pipeline from verify on (install_package_file).  Requires root.
+ *
+ * Both return 0 on success, 1 on failure (reason printed).
+ */
+
+#define BUNDLE_FORMAT_VERSION 1
+
+int bundle_create(const char *path, const char *const *pkgs, int n);
+int bundle_install(const char *path);
+
+#endif /* BUNDLE_H */
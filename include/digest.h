@@ -0,0 +1,104 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stddef.h>
+
+/*
+ * digest.h - Shared file and stream digests (SHA256, BLAKE3)
+ *
+ * Every checksum flappy computes goes through here, whatever the
+ * algorithm: SHA256 by OpenSSL EVP, BLAKE3 by blake3.c.
+ *
+ * Checksums published in repository metadata name their algorithm:
+ *
+ *   "<64 hex>"          SHA256, what every repository publishes
+ *   "blake3:<64 hex>"   BLAKE3, from the optional packages.blake3
+ *
+ * so a package checksum travels through lookups, downloads, bundles
+ * and deltas as one string; digest_parse splits it where it is
+ * checked.  Digests computed here are always written as a bare
+ * 64-character lowercase hex string plus NUL, for either algorithm.
+ *
+ * A large file digested with BLAKE3 is hashed as a tree, its
+ * DIGEST_READ_SIZE pieces on up to DIGEST_MAX_WORKERS threads (one
+ * per online CPU), so one big package is not bound by one core.
+ */
+
+enum digest_alg {
+    DIGEST_SHA256,
+    DIGEST_BLAKE3,
+};
+
+#define DIGEST_BLAKE3_PREFIX "blake3:"
+#define DIGEST_READ_SIZE     (128 * 1024)
+#define DIGEST_MAX_WORKERS   16
+
+/*
+ * digest_parse
+ *
+ * Splits a published checksum into its algorithm and its hex digest
+ * (pointing into `checksum`).  Returns 0, or 1 for an algorithm this
+ * build does not know.
+ */
+int digest_parse(const char *checksum, enum digest_alg *alg,
+                 const char **hex);
+
+/* "sha256" or "blake3" */
+const char *digest_name(enum digest_alg alg);
+
+/*
+ * digest_file(alg, path, out)
+ *
+ *   Computes the digest of the file at `path` and writes it as hex
+ *   into `out` (at least 65 bytes).
+ *
+ *   Returns:
+ *     0  success
+ *     1  any error (open, read, digest failure); reason printed to stderr
+ */
+int digest_file(enum digest_alg alg, const char *path, char out[65]);
+
+/*
+ * Incremental digest, for data that never exists as a whole file
+ * (e.g. the decompressed repo.db stream in repo_update.c).
+ *
+ *   digest_stream_new     NULL on allocation / init failure
+ *   digest_stream_update  0 success, 1 digest failure
+ *   digest_stream_final   writes 64 hex chars + NUL; 0 / 1 as above
+ *   digest_stream_free    NULL is a no-op
+ */
+struct digest_stream;
+
+struct digest_stream *digest_stream_new(enum digest_alg alg);
+int  digest_stream_update(struct digest_stream *s,
+                          const void *data, size_t len);
+int  digest_stream_final(struct digest_stream *s, char out[65]);
+void digest_stream_free(struct digest_stream *s);
+
+/*
+ * Batch digest, for many files at once (deep verify, staged installs).
+ *
+ * digest_batch(alg, dirfd, oflags, jobs, count)
+ *
+ *   Hashes every job's file, opened with openat(dirfd, path) and
+ *   `oflags` (e.g. O_NOFOLLOW) on top of O_RDONLY, on up to
+ *   DIGEST_MAX_WORKERS threads (twice the online CPUs: hashing a cold
+ *   file is mostly waiting on the disk).  Never fails as a whole and
+ *   prints nothing: each job gets its own digest or errno.
+ *
+ *   With dirfd DIGEST_AT_ROOT the paths are paths inside the root,
+ *   opened through root_at() (root.h) instead.
+ */
+#define DIGEST_AT_ROOT (-2)
+
+struct digest_job {
+    const char  *path;          /* relative to dirfd, or absolute; borrowed */
+    char         hex[65];       /* filled when err == 0 */
+    long long    bytes;         /* bytes hashed */
+    int          err;           /* 0, or the errno of open/read (EIO: digest) */
+};
+
+void digest_batch(enum digest_alg alg, int dirfd, int oflags,
+                  struct digest_job *jobs, size_t count);
+
+#endif /* DIGEST_H */
@@ -24,6 +24,13 @@ void log_error(const char *fmt, ...);
  * ===================== */
 int cli_dispatch(int argc, char **argv);
 
+/*
+ * Applies a leading `--root DIR` / `--root=DIR` global option (root.h).
+ * Runs before environment and log setup, which already depend on it.
+ * Returns 0, or 2 on an invalid root.
+ */
+int cli_apply_root(int argc, char **argv);
+
 /* =====================
  * Commands
  * ===================== */
@@ -48,7 +55,10 @@ int cmd_clean(int argc, char **argv);
  * ===================== */
 #define FLAPPY_DB_DIR  "/var/lib/flappy"
 #define FLAPPY_DB_PATH "/var/lib/flappy/flappy.db"
-#define FLAPPY_SCHEMA_VERSION 2
+#define FLAPPY_SCHEMA_VERSION 8
+
+/* Downloaded archives, deltas and the chunk store (chunks/) */
+#define FLAPPY_PKG_CACHE_DIR "/var/cache/flappy/packages"
 
 /* DB access */
 sqlite3 *db_handle(void);
@@ -56,10 +66,23 @@ sqlite3 *db_handle(void);
 /* DB bootstrap (install-time) */
 int db_bootstrap_install(void);
 
+/*
+ * Upgrade an older installed DB to FLAPPY_SCHEMA_VERSION in place.
+ * Returns 0 on success, 1 if `from` has no migration path or a step
+ * failed (that step is rolled back).
+ */
+int db_migrate(sqlite3 *db, int from);
+
 /* DB runtime */
 void db_open_or_die(void);
 void db_close(void);
 
+/*
+ * 1 if `name` is in the installed DB (under the root), 0 if not or
+ * the DB cannot be read.  Uses the open connection if there is one.
+ */
+int db_pkg_installed(const char *name);
+
 #endif /* FLAPPY_H */
 
 /*
@@ -47,6 +47,32 @@ int graph_add_package(
     size_t depends_count
 );
 
+/*
+ * graph_upgrade_package
+ *
+ * Upgrade an installed package node in place.
+ *
+ * Behavior:
+ *   - Fails if package is not installed
+ *   - Keeps package id, explicit flag and reverse dependency edges
+ *   - Replaces the package's own dependency edges
+ *   - Fails if any new dependency is missing
+ *   - Fails if resulting graph would contain a cycle
+ *
+ * Same transaction contract as graph_add_package: caller holds
+ * BEGIN IMMEDIATE and commits or rolls back.
+ *
+ * Returns:
+ *   0 on success
+ *   non-zero on failure
+ */
+int graph_upgrade_package(
+    const char *name,
+    const char *version,
+    const char **depends,
+    size_t depends_count
+);
+
 /*
  * graph_depends
  *
@@ -17,8 +17,8 @@
  *
  *   pre_install()              called before files are written
  *   post_install()             called after files are written
- *   pre_upgrade(old_ver)       called before files are written
- *   post_upgrade(new_ver, old) called after files are written
+ *   pre_upgrade(new, old)      called before files are written
+ *   post_upgrade(new, old)     called after files are written
  *   pre_remove(ver)            called before files are deleted
  *   post_remove(ver)           called after files are deleted
  *
@@ -48,7 +48,8 @@ int run_hook(const char *script_path,
 /*
  * hook_path
  *
- * Writes the canonical hook file path for `pkgname` into `out`.
+ * Writes the canonical hook file path for `pkgname` into `out`, as
+ * seen inside the installation root (root.h).
  * `out` must be at least 256 bytes.
  */
 void hook_path(const char *pkgname, char *out, size_t outsz);
@@ -10,6 +10,261 @@
  *   guard → lookup → download → verify → extract → commit
  */
 
-int install_package(const char *pkgname);
+#include <stddef.h>
 
-#endif
\ No newline at end of file
+/* Installs repository version `version` of `pkgname` (NULL: newest) */
+int install_package(const char *pkgname, const char *version);
+
+/*
+ * install_package_file
+ *
+ * The pipeline from verify on, for an archive already on disk
+ * (install_package after its download; `install --bundle`).
+ * install_guard must have passed.
+ */
+int install_package_file(const char *pkgname, const char *pkgpath,
+                         const char *checksum);
+
+/* =====================
+ * Pipeline stages
+ *
+ * Shared by install_package and the upgrade executor (upgrade.c).
+ * ===================== */
+
+int install_guard(void);
+int install_lookup(const char *pkg, char *filename, char *checksum,
+                   char *base_url);
+
+/*
+ * install_lookup_version
+ *
+ * install_lookup for one repository version of `pkg` (matched by
+ * version_key, so "1.0" finds "1"); NULL means the newest.
+ */
+int install_lookup_version(const char *pkg, const char *version,
+                           char *filename, char *checksum, char *base_url);
+int install_download(const char *filename, const char *base_url,
+                     char *local_path, const char *expected_checksum);
+int install_verify(const char *path, const char *checksum);
+int install_extract(const char *pkgfile, char *staging_dir);
+int install_conflict_staged(const char *pkgname, const char *staging_dir);
+
+/* A package of an upgrade set and where its new version is staged */
+struct staged_pkg {
+    const char *name;
+    const char *staging_dir;
+};
+
+/*
+ * install_conflict_staged_set
+ *
+ * install_conflict_staged for one package of an upgrade set: a path
+ * owned by another package of `set` is no conflict when that package's
+ * staged new version no longer ships it.  The path moves with the
+ * upgrade; install_commit_upgrade takes its files row over.
+ */
+int install_conflict_staged_set(const char *pkgname, const char *staging_dir,
+                                const struct staged_pkg *set, size_t count);
+
+/*
+ * install_conflict_within
+ *
+ * The staged packages of `set` against each other: a path two of them
+ * ship is a conflict even when no installed package owns it yet.
+ */
+int install_conflict_within(const struct staged_pkg *set, size_t count);
+int install_commit(const char *pkgname, const char *pkgfile,
+                   const char *staging_dir);
+
+/*
+ * One installed file or symlink as packaged: what files.size / mode /
+ * sha256 record, and what an upgrade compares to decide whether the
+ * file changed.  For a symlink, size and sha256 describe the link
+ * target string, and link_target holds it (files.link_target).
+ * sha256 is "" when unknown.
+ */
+struct install_file {
+    char      *path;           /* root-relative: "usr/bin/x" */
+    long long  size;
+    unsigned   mode;           /* st_mode: type and permission bits */
+    char       sha256[65];
+    char      *link_target;    /* symlinks only, else NULL; owned */
+};
+
+void install_files_free(struct install_file *files, size_t count);
+
+/*
+ * install_extract_direct
+ *
+ * Bootstrap extraction: writes the archive straight into the root
+ * (root.h) with no staging, under the same path rules as
+ * install_extract.  Nothing already present is replaced and no symlink
+ * on disk is followed: an existing path, or one reached through a
+ * symlink, fails the extraction.  (Two packages extracting the same
+ * path at the same instant can both pass; registering both then fails
+ * on files.path.)
+ *
+ * On success *files holds every regular file and symlink written,
+ * *count of them, fingerprinted while they were written; release with
+ * install_files_free.  Returns 0 on success, 1 on failure (files
+ * already written stay).
+ */
+int install_extract_direct(const char *pkgfile,
+                           struct install_file **files, size_t *count);
+
+/*
+ * install_register
+ *
+ * Records an installed package: checks its version constraints, adds
+ * the package row and dependency edges (graph_add_package) and one
+ * files row per entry of `files`.  The caller holds the DB open inside
+ * a transaction and commits or rolls back.
+ *
+ * Returns the new package id, or -1 on failure.
+ */
+struct flappy_pkg;
+
+long long install_register(const struct flappy_pkg *meta,
+                           const struct install_file *files, size_t count);
+
+/*
+ * install_commit_upgrade
+ *
+ * Replaces an installed package with the staged new version,
+ * differentially: a staged file whose size, mode and content hash
+ * match its files row (and which is still on disk) is left untouched.
+ * Changed and new files are written beside their destination; then one
+ * transaction updates the DB row by row and rename()s each written
+ * file into place, and commits only if every rename succeeded.  Paths
+ * the new version no longer ships are removed after the commit.
+ *
+ * Returns 0 on success, 1 on failure.  A failure puts back every file
+ * already replaced and leaves the old version installed and registered.
+ */
+int install_commit_upgrade(const char *pkgname, const char *pkgfile,
+                           const char *staging_dir);
+
+/*
+ * install_upgrade_recover
+ *
+ * Finishes or undoes the file swaps of an install_commit_upgrade that
+ * a crash interrupted, by whether its transaction committed, and
+ * removes the .flappy-new / .flappy-old files it left.  Does nothing
+ * while another upgrade runs, or without write access.  Returns the
+ * number of paths recovered, or -1 on a DB error.  Run by
+ * db_open_or_die.
+ */
+int install_upgrade_recover(void);
+
+/* =====================
+ * Batch download
+ * ===================== */
+
+/*
+ * install_filename_ok
+ *
+ * 1 if `name` — an archive, delta or chunk index name read from
+ * repo.db or a bundle — is a plain file name that stays inside
+ * FLAPPY_PKG_CACHE_DIR: not empty, no '/', not "." or "..".
+ */
+int install_filename_ok(const char *name);
+
+/*
+ * install_part_path
+ *
+ * The temporary file a cache entry is written to before it is renamed
+ * to `local_path`: "<local_path>.<pid>.part".  The cache is shared by
+ * every --root, so two flappy processes may write the same archive at
+ * once; each writes its own file and a cache lookup never sees a
+ * partial one.  `out` holds INSTALL_PART_PATH_MAX bytes.
+ */
+#define INSTALL_PART_PATH_MAX 544
+
+void install_part_path(char *out, const char *local_path);
+
+/*
+ * One package to fetch.  filename/checksum/base_url are inputs (as
+ * returned by install_lookup); local_path and status are filled in by
+ * install_download_batch.
+ */
+struct download_req {
+    const char *filename;
+    const char *checksum;
+    const char *base_url;        /* owning repository */
+    int         quiet;           /* chunk store fetch: no per-file
+                                    output, never chunked itself */
+    char        local_path[512];
+    int         status;          /* 0 = cached file is ready, 1 = failed */
+    void       *user;            /* caller cookie, untouched */
+};
+
+typedef void (*download_done_fn)(struct download_req *req, void *ctx);
+
+/*
+ * install_download_batch
+ *
+ * Downloads every request concurrently into the package cache.
+ * Valid cache entries are reused (same SHA256 check as install_download).
+ * An archive the repository publishes chunked is assembled from the
+ * chunk store instead (install_chunks_fetch).
+ * `done` is called once per request, on the calling thread, as soon as
+ * that request has finished or failed.
+ *
+ * Returns 0 if every request succeeded, 1 otherwise.
+ */
+int install_download_batch(struct download_req *reqs, size_t n,
+                           download_done_fn done, void *ctx);
+
+/* =====================
+ * Chunked transport (install_chunks.c)
+ * ===================== */
+
+/*
+ * install_chunks_fetch
+ *
+ * For an archive the repository describes by a chunk index: fetches
+ * the chunks missing from the local chunk store, reassembles the
+ * archive at req->local_path (filled in by the caller) and verifies it
+ * against req->checksum.  Returns 0 when the archive is in place; 1
+ * when the archive is not chunked or assembly failed — download it
+ * whole then.
+ */
+int install_chunks_fetch(struct download_req *req);
+
+/* =====================
+ * Delta packages (install_delta.c)
+ * ===================== */
+
+/* A delta that rebuilds an archive from a cached older one */
+struct delta_info {
+    char filename[256];          /* delta file, fetched like an archive */
+    char checksum[128];          /* SHA256 of the delta file */
+    char base_path[512];         /* cached archive it applies to */
+};
+
+/*
+ * install_delta_find
+ *
+ * Looks in repo.db for a delta of `pkg` that rebuilds `filename` from
+ * an archive still in the package cache.  Returns 0 and fills *out
+ * when one applies; 1 when there is none, or `filename` is cached
+ * already.
+ */
+int install_delta_find(const char *pkg, const char *filename,
+                       struct delta_info *out);
+
+/*
+ * install_delta_apply
+ *
+ * Rebuilds `filename` in the package cache from delta->base_path and
+ * the downloaded delta at `delta_path`, and verifies it against
+ * `checksum` (install_verify).  The delta file is removed either way.
+ * On success local_path (at least 512 bytes) names the archive.
+ * Returns 0 on success, 1 on failure — fetch the full archive then.
+ */
+int install_delta_apply(const struct delta_info *delta,
+                        const char *delta_path,
+                        const char *filename, const char *checksum,
+                        char *local_path);
+
+#endif
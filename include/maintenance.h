@@ -8,7 +8,38 @@
  * clean_cache   : remove cached/staging files
  */
 
-int verify_system(void);
+#include <stddef.h>
+
+/*
+ * verify_system
+ *
+ * Checks the files rows in `scope` (NULL: all of them) against the
+ * disk (type, symlink target).  Prints one line per problem.  Returns
+ * 0 if they are consistent, 1 otherwise or if a named package is not
+ * installed.
+ *
+ *   VERIFY_DEEP  also compare the content of every regular file with
+ *                its recorded SHA256, hashed in parallel; files whose
+ *                metadata has not changed since the last deep check
+ *                found them intact are not rehashed
+ *   VERIFY_FULL  VERIFY_DEEP, rehashing every file
+ */
+#define VERIFY_DEEP 0x1
+#define VERIFY_FULL 0x2
+
+/*
+ * The files of the named packages (none: every package), restricted to
+ * those at or under one of the path prefixes (none: anywhere).
+ * Prefixes are absolute with no trailing slash; "" is the whole root.
+ */
+struct verify_scope {
+    char   **pkgs;
+    size_t   npkgs;
+    char   **paths;
+    size_t   npaths;
+};
+
+int verify_system(int flags, const struct verify_scope *scope);
 int clean_cache(int all);
 
 #endif /* MAINTENANCE_H */
\ No newline at end of file
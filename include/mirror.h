@@ -0,0 +1,82 @@
+#ifndef MIRROR_H
+#define MIRROR_H
+
+/*
+ * mirror.h - Mirror ranking and failover
+ *
+ * A repository may be served by several mirrors (repos.conf `url` +
+ * `mirror` lines).  Every transfer reports how it went: connect time
+ * and time to first byte on success, a failure otherwise.  Mirrors
+ * are ranked by a moving average of first-byte latency; one that has
+ * just failed is pushed to the back for a back-off period that grows
+ * with consecutive failures.  The ranking is kept in
+ * FLAPPY_MIRROR_STATE_PATH between runs.
+ *
+ * Stalls are detected by curl itself (mirror_curl_setopts): a transfer
+ * below MIRROR_LOW_SPEED_LIMIT bytes/s for MIRROR_LOW_SPEED_TIME
+ * seconds is aborted, reported as a failure, and the caller moves on
+ * to the next mirror.
+ *
+ * All functions are thread-safe.
+ */
+
+#include "repo.h"
+
+#include <curl/curl.h>
+#include <stddef.h>
+
+#define FLAPPY_MIRROR_STATE_PATH "/var/lib/flappy/mirrors.state"
+
+#define MIRROR_CONNECT_TIMEOUT  10L     /* seconds */
+#define MIRROR_LOW_SPEED_LIMIT  1024L   /* bytes/s ... */
+#define MIRROR_LOW_SPEED_TIME   20L     /* ... for this long = stalled */
+#define MIRROR_PROBE_TIMEOUT_MS 5000L
+
+/* Mirrors of one repository, best first. */
+struct mirror_list {
+    size_t count;
+    char   url[REPO_MIRROR_MAX][REPO_URL_MAX];
+};
+
+/*
+ * mirror_list_for
+ *
+ * The ranked mirrors of the configured repository that `base_url`
+ * belongs to.  A URL not in repos.conf (e.g. `flappy update <url>`)
+ * yields a list of just itself.
+ */
+void mirror_list_for(const char *base_url, struct mirror_list *out);
+
+/* mirror_list_from: the ranked mirrors of `src`. */
+void mirror_list_from(const struct repo_source *src, struct mirror_list *out);
+
+/*
+ * mirror_probe
+ *
+ * Measures every mirror in `list` concurrently (HEAD of
+ * repo.db.sha256), records the results and re-ranks `list`.
+ * A single-entry list is left alone.
+ */
+void mirror_probe(struct mirror_list *list);
+
+/* Stall detection and connect timeout for a transfer. */
+void mirror_curl_setopts(CURL *curl);
+
+/*
+ * mirror_record
+ *
+ * Records the outcome of a finished transfer from `mirror` (the base
+ * URL, not the file URL).  An HTTP 4xx means the mirror is up but
+ * lacks the file: timings are kept and no failure is counted.
+ */
+void mirror_record(const char *mirror, CURL *curl, CURLcode res);
+
+/*
+ * mirror_state_save
+ *
+ * Writes the ranking to FLAPPY_MIRROR_STATE_PATH if anything was
+ * recorded.  Failure (e.g. not root) only loses the update.
+ */
+void mirror_state_save(void);
+
+#endif /* MIRROR_H */
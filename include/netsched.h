@@ -0,0 +1,117 @@
+#ifndef NETSCHED_H
+#define NETSCHED_H
+
+/*
+ * netsched.h - Download scheduler
+ *
+ * Every transfer that carries data — packages, chunks, deltas,
+ * repository metadata — is admitted here before it starts and reports
+ * its bytes as they arrive:
+ *
+ *   connections  at most `max_connections` transfers in the process,
+ *                and at most `connections` to any one host
+ *   bandwidth    each host's `rate` is split evenly between its
+ *                transfers.  The process `rate` is split evenly too,
+ *                except that what a host-capped transfer cannot use
+ *                goes to the others.  Each transfer's part is handed
+ *                to curl as its receive speed limit.  Nothing sleeps
+ *                in a callback, so the other transfers of a curl
+ *                multi handle keep running.  Shares are not adapted
+ *                to servers slower than their part.
+ *   priority     a process is interactive (the default) or background
+ *                (`upgrade --download-only`).  Interactive processes
+ *                hold a shared lock on NETSCHED_LOCK_PATH once they
+ *                start downloading; a background process that sees it
+ *                held drops to `background_yield_rate` until it is
+ *                released.
+ *
+ * Limits are read from NETSCHED_CONF_PATH, which is optional:
+ *
+ *   max_connections       = 16     transfers per process
+ *   host_connections      = 8      per host, unless the host says
+ *   rate                  = 0      bytes/s for the process, 0 = none
+ *   background_rate       = 0      same, for background processes
+ *   background_yield_rate = 64K    background, while interactive runs
+ *
+ *   [pkgs.example.org]             a host, as in its URLs
+ *   connections           = 2
+ *   rate                  = 1M
+ *
+ * Rates take a K, M or G suffix (binary units).  A malformed file is
+ * reported and ignored.  HEAD probes (mirror ranking, range detection)
+ * are not scheduled.
+ *
+ * All functions are thread-safe.
+ */
+
+#include <curl/curl.h>
+#include <stddef.h>
+
+#define NETSCHED_CONF_PATH "/etc/flappy/download.conf"
+#define NETSCHED_LOCK_PATH "/var/lib/flappy/download.lock"
+
+enum netsched_class {
+    NETSCHED_INTERACTIVE,
+    NETSCHED_BACKGROUND,
+};
+
+typedef size_t (*netsched_write_fn)(char *ptr, size_t size, size_t nmemb,
+                                    void *arg);
+
+struct netsched_host;
+
+/* One admitted transfer.  Zero-initialise; owned by the caller. */
+struct netsched_xfer {
+    struct netsched_host *host;     /* non-NULL while admitted */
+    CURL                 *curl;
+    netsched_write_fn     write;
+    void                 *arg;
+    curl_off_t            cap;      /* receive limit set on curl */
+};
+
+/*
+ * netsched_set_class / netsched_set_rate
+ *
+ * Select the priority class of this process, and override the rate of
+ * that class from the config file (bytes per second, 0 = keep the
+ * configured one).  Call before the first transfer.
+ */
+void netsched_set_class(enum netsched_class cls);
+void netsched_set_rate(long long bytes_per_sec);
+
+/*
+ * netsched_parse_rate
+ *
+ * "500K", "2M", "1G" or plain bytes per second, at least 1.
+ * Returns 0 on success.
+ */
+int netsched_parse_rate(const char *s, long long *out);
+
+/*
+ * netsched_begin
+ *
+ * Admits a transfer of `url` on `curl` and routes its body through
+ * `write(ptr, size, nmemb, arg)` (the handle's CURLOPT_WRITEFUNCTION
+ * and CURLOPT_WRITEDATA are set here).  With `wait`, blocks until a
+ * connection slot is free; without, returns 1 at once if none is.
+ * Returns 0 when admitted; netsched_end releases the slot.
+ *
+ * Call after mirror_curl_setopts: under a low rate cap the stall
+ * detector is relaxed here so throttled transfers are not aborted.
+ */
+int netsched_begin(struct netsched_xfer *x, CURL *curl, const char *url,
+                   netsched_write_fn write, void *arg, int wait);
+
+/* Releases the slot of an admitted transfer; a no-op otherwise. */
+void netsched_end(struct netsched_xfer *x);
+
+/*
+ * netsched_slots
+ *
+ * How many transfers of `url` may run at once in this process (the
+ * lower of the host and process limits).  For callers that open
+ * several connections to one file.
+ */
+int netsched_slots(const char *url);
+
+#endif /* NETSCHED_H */
@@ -16,6 +16,26 @@ typedef enum {
     DEP_OP_EQ          /* depend = libssl = 3.0    */
 } dep_op_t;
 
+/*
+ * Upper bound on a binary version key (see version_key in version.h).
+ */
+#define VERSION_KEY_MAX 128
+
+/*
+ * A version constraint compiled once from (op, version string) by
+ * version_constraint_compile().  The required version is held as its
+ * binary sort key, so testing a candidate is a single memcmp.
+ *
+ * valid is 0 when the required version string is invalid; such a
+ * constraint is never satisfied (DEP_OP_NONE always is).
+ */
+struct version_constraint {
+    dep_op_t      op;
+    unsigned char valid;
+    unsigned char len;
+    unsigned char key[VERSION_KEY_MAX];
+};
+
 /*
  * A single dependency entry.
  */
@@ -23,6 +43,9 @@ struct dep_entry {
     char    *name;
     dep_op_t op;
     char    *version;
+
+    /* compiled form of (op, version), filled in by the parser */
+    struct version_constraint constraint;
 };
 
 /*
@@ -5,7 +5,13 @@
 #define FLAPPY_REPO_DB_PATH    "/var/lib/flappy/repo.db"
 #define FLAPPY_REPO_TMP_PATH   "/var/lib/flappy/repo.db.tmp"
 #define FLAPPY_REPO_SHA_PATH   "/var/lib/flappy/repo.db.sha256"
+#define FLAPPY_REPO_TRIGRAM_PATH "/var/lib/flappy/repo.trigram"
+#define FLAPPY_REPO_INDEX_PATH "/var/lib/flappy/repo.idx"
 #define FLAPPY_REPO_SCHEMA_VERSION 1
+#define FLAPPY_REPOS_CONF_PATH "/etc/flappy/repos.conf"
+#define FLAPPY_REPOS_DIR       "/var/lib/flappy/repos"
+
+#include <stddef.h>
 
 /*
  * repo.h - Repository metadata layer (Trail-5)
@@ -14,7 +20,7 @@
  *   - Repository DB download
  *   - Repository DB validation
  *   - Metadata search
- *   - Upgrade inspection (dry-run)
+ *   - Upgrade inspection (dry-run); execution lives in upgrade.c
  *
  * This layer does NOT:
  *   - Install packages
@@ -24,31 +30,134 @@
  * Repository DB is fully separate from installed DB.
  */
 
+/*
+ * Configured repositories (FLAPPY_REPOS_CONF_PATH).
+ *
+ *   # comment
+ *   [core]
+ *   url      = https://flucidos.github.io/flappy-repo
+ *   priority = 10
+ *
+ *   [overlay]
+ *   url      = https://pkgs.example.internal/flappy
+ *   mirror   = https://pkgs-b.example.internal/flappy
+ *   priority = 50
+ *
+ * Section names are [a-z0-9_-].  `url` is the repository's canonical
+ * URL (its identity in the merged repo.db); each `mirror` adds another
+ * server with the same content.  Mirrors are ranked and failed over
+ * by mirror.c.  A package name provided by several repositories
+ * comes only from the one with the highest priority (ties: earlier
+ * section wins).  Without a config file there is one repository,
+ * "core", at FLAPPY_DEFAULT_REPO_URL.
+ */
+#define REPO_NAME_MAX 32
+#define REPO_URL_MAX  512
+#define REPO_MAX      16
+#define REPO_MIRROR_MAX 8
+
+struct repo_source {
+    char   name[REPO_NAME_MAX];
+    char   mirrors[REPO_MIRROR_MAX][REPO_URL_MAX];  /* [0] = url */
+    size_t nmirrors;
+    int    priority;
+};
+
+struct repo_config {
+    struct repo_source repos[REPO_MAX];   /* highest priority first */
+    size_t             count;
+};
+
+/*
+ * repo_config_load
+ *
+ * Reads FLAPPY_REPOS_CONF_PATH into `cfg`, sorted by priority.
+ *
+ * Returns:
+ *   0 on success (including the built-in default)
+ *   non-zero on a malformed file (reason already printed)
+ */
+int repo_config_load(struct repo_config *cfg);
+
+/*
+ * repo_config_find
+ *
+ * The configured repository one of whose URLs is `url` (trailing '/'
+ * ignored), or NULL.
+ */
+const struct repo_source *repo_config_find(const struct repo_config *cfg,
+                                           const char *url);
+
 /*
  * repo_update
  *
- * Downloads repository database and validates it.
+ * Downloads and validates every configured repository concurrently
+ * into FLAPPY_REPOS_DIR/<name>/, then merges them by priority into
+ * FLAPPY_REPO_DB_PATH, which every reader (lookup, search, resolver,
+ * upgrade) uses.  A non-NULL `url` updates just that repository,
+ * as "core", ignoring the config file.
  *
  * Requires root privileges.
  *
  * Returns:
  *   0 on success
- *   non-zero on failure
+ *   non-zero on failure (a repository that failed to update keeps
+ *   its previously cached copy in the merge)
  */
 int repo_update(const char *url);
 
+/*
+ * repo_published_sha
+ *
+ * Reads the SHA256 of the installed (merged) repo.db (the first 64
+ * hex chars of FLAPPY_REPO_SHA_PATH) into `out`, unterminated.
+ * Derived indexes (trigram.h, repo_index.h) record this value and are
+ * ignored when it no longer matches.
+ *
+ * Returns 0 on success, 1 if the file is missing or short.
+ */
+int repo_published_sha(char out[64]);
+
 /*
  * repo_search
  *
- * Search repository database.
+ * Search repository database by name prefix.
  *
  * If term == NULL, prints all packages.
+ * limit <= 0 prints every match; page (1-based) selects which
+ * `limit`-sized slice to print.
  *
  * Returns:
  *   0 on success
  *   non-zero on failure
  */
-int repo_search(const char *term);
+int repo_search(const char *term, long limit, long page);
+
+/*
+ * repo_search_text
+ *
+ * Ranked full-text search over package names and descriptions
+ * (FTS5 index built by repo_update).  Every word must match, as a
+ * prefix; names rank above descriptions.  limit / page as above.
+ *
+ * Returns:
+ *   0 on success (empty output if no matches)
+ *   non-zero on failure (including a repo.db without the index)
+ */
+int repo_search_text(const char *text, long limit, long page);
+
+/*
+ * repo_search_glob
+ *
+ * Names matching a '*' / '?' pattern (case-insensitive), answered from
+ * the trigram index (trigram.h) built by repo_update.  Output, order
+ * and limit / page as repo_search.
+ *
+ * Returns:
+ *   0 on success (empty output if no matches)
+ *   non-zero on failure (including a missing or stale index)
+ */
+int repo_search_glob(const char *pattern, long limit, long page);
 
 /*
  * repo_upgrade
@@ -62,6 +171,34 @@ int repo_search(const char *term);
  */
 int repo_upgrade(void);
 
+/*
+ * Upgrade plan — one entry per installed package with a newer
+ * version in the repository, sorted by name (BINARY).
+ */
+struct upgrade_entry {
+    char *name;
+    char *from;     /* installed version */
+    char *to;       /* newest repository version */
+};
+
+struct upgrade_plan {
+    struct upgrade_entry *entries;
+    size_t                count;
+};
+
+/*
+ * repo_upgrade_plan
+ *
+ * Computes the upgrade plan without printing it.
+ * The caller releases it with repo_upgrade_plan_free.
+ *
+ * Returns:
+ *   0 on success (plan->count may be 0)
+ *   non-zero on failure (reason already printed)
+ */
+int repo_upgrade_plan(struct upgrade_plan *plan);
+void repo_upgrade_plan_free(struct upgrade_plan *plan);
+
 int repo_install(const char *repo);
 
 #endif /* REPO_H */
\ No newline at end of file
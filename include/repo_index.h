@@ -0,0 +1,96 @@
+#ifndef REPO_INDEX_H
+#define REPO_INDEX_H
+
+/*
+ * repo_index.h - Memory-mapped binary repository index
+ *
+ * A read-only snapshot of repo.db (FLAPPY_REPO_INDEX_PATH) written by
+ * repo_update.  Readers map it and use it in place — no SQLite open,
+ * no schema parse, no copies:
+ *
+ *   - names in BINARY order (prefix search, ordered listing)
+ *   - a minimal perfect hash from name to name id (exact lookup)
+ *   - per name: every repository version, newest first, with its
+ *     version key, filename, checksum and owning repository's URL
+ *   - per name: declared dependencies
+ *   - meta base_url
+ *
+ * repo.db stays the source of truth.  The index records the published
+ * repo.db SHA256 it was built from and repo_index_open refuses an
+ * index that does not match FLAPPY_REPO_SHA_PATH, so every caller
+ * falls back to SQLite when the index is missing or stale.
+ */
+
+#include "pkg_meta.h"
+
+#include <sqlite3.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct repo_index;
+
+/* One repository row.  All pointers point into the mapping. */
+struct repo_index_pkg {
+    const char          *name;
+    const char          *version;
+    const char          *filename;
+    const char          *checksum;
+    const char          *base_url;   /* owning repository, may be NULL */
+    const unsigned char *vkey;       /* NULL if the version is invalid */
+    size_t               vkey_len;
+};
+
+/* One dependency edge.  version is "" when op is DEP_OP_NONE. */
+struct repo_index_dep {
+    const char *name;
+    dep_op_t    op;
+    const char *version;
+};
+
+/*
+ * repo_index_build
+ *
+ * Writes the index for `repo` (a repo.db already carrying version_key,
+ * see repo_update) to `path` via path.tmp + rename.  `repo_sha` is the
+ * published checksum of that repo.db (64 hex chars).
+ *
+ * Returns 0 on success, 1 on failure.
+ */
+int repo_index_build(sqlite3 *repo, const char *repo_sha, const char *path);
+
+/*
+ * repo_index_open / repo_index_close
+ *
+ * Maps FLAPPY_REPO_INDEX_PATH.  Returns NULL if it is missing,
+ * malformed or stale; callers then read repo.db instead.
+ */
+struct repo_index *repo_index_open(void);
+void repo_index_close(struct repo_index *idx);
+
+/* meta base_url, or NULL if repo.db had none */
+const char *repo_index_base_url(const struct repo_index *idx);
+
+/*
+ * Name ids run 0 .. repo_index_names()-1 in BINARY name order.
+ *
+ * repo_index_find      exact lookup; returns 1 and sets *id if found
+ * repo_index_prefix    first id whose name is >= prefix
+ */
+uint32_t    repo_index_names(const struct repo_index *idx);
+const char *repo_index_name(const struct repo_index *idx, uint32_t id);
+int         repo_index_find(const struct repo_index *idx, const char *name,
+                            uint32_t *id);
+uint32_t    repo_index_prefix(const struct repo_index *idx,
+                              const char *prefix);
+
+/* versions of name `id`, k = 0 is the newest */
+size_t repo_index_versions(const struct repo_index *idx, uint32_t id);
+void   repo_index_version(const struct repo_index *idx, uint32_t id,
+                          size_t k, struct repo_index_pkg *out);
+
+/* dependencies of name `id` */
+size_t repo_index_deps(const struct repo_index *idx, uint32_t id);
+void   repo_index_dep(const struct repo_index *idx, uint32_t id,
+                      size_t k, struct repo_index_dep *out);
+
+#endif /* REPO_INDEX_H */
@@ -20,4 +20,28 @@
  */
 int resolve_and_install(const char *pkgname);
 
+/*
+ * resolve_closure(pkgs, n, out)
+ *
+ *   Fills `out` with the full transitive dependency closure of `pkgs`,
+ *   dependencies first, as if nothing were installed: the plan is for
+ *   another host (`flappy bundle`).  Version constraints are checked
+ *   against the repository only; each entry carries the version chosen
+ *   for it (the newest that satisfies its dependents), to be fetched
+ *   with install_lookup_version.
+ *
+ *   Returns:
+ *     0   `out` holds the plan
+ *     1   resolution failed (cycle, missing dep, queue full)
+ */
+#define RESOLVE_MAX 256
+
+struct resolve_plan {
+    char  names[RESOLVE_MAX][64];
+    char  versions[RESOLVE_MAX][64];    /* repository version to install */
+    int   count;
+};
+
+int resolve_closure(const char *const *pkgs, int n, struct resolve_plan *out);
+
 #endif /* RESOLVE_H */
\ No newline at end of file
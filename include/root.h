@@ -0,0 +1,91 @@
+#ifndef ROOT_H
+#define ROOT_H
+
+/*
+ * root.h - Installation root (`flappy --root DIR`)
+ *
+ * Everything that describes one installed system lives under the
+ * root: the installed DB, hooks, staging, the log and the installed
+ * files themselves.  Repository metadata (repo.db, repos.conf, mirror
+ * ranking) and the package cache describe the host and are shared by
+ * every root, so a build farm downloads each archive once however many
+ * images it populates.
+ *
+ * Installed files are reached through root_at(): it opens the
+ * directory holding a path as if the root were "/", so ".." in that
+ * directory's path stops at the root and a symlink on the way (also an
+ * absolute one, or one the image ships such as /lib -> usr/lib) is
+ * resolved inside it; /proc magic links are refused.  The last
+ * component is then used with an *at() call that does not follow it
+ * (unlinkat, mkdirat, symlinkat, renameat, readlinkat, O_NOFOLLOW,
+ * AT_SYMLINK_NOFOLLOW), so nothing reached this way is outside the
+ * root.  Without openat2 (Linux < 5.6) a symlink or ".." in the
+ * directory's path is refused instead of resolved.
+ *
+ * APIs that only take path strings (SQLite, libarchive, fopen) use
+ * root_path().  The host resolves those: a symlink the image has in
+ * place of flappy's own state (/var/lib/flappy, the staging area, the
+ * log) is followed out of the root.
+ *
+ * The default root is "/"; nothing changes for a normal invocation.
+ */
+
+#include <stddef.h>
+
+/*
+ * root_set
+ *
+ * Selects `dir` (an existing directory) as the root for the rest of
+ * the process.  Call before anything else touches the filesystem.
+ * Returns 0 on success, 1 with a message if `dir` cannot be opened.
+ */
+int root_set(const char *dir);
+
+/* 1 when --root selected something other than "/". */
+int root_is_alt(void);
+
+/* Canonical root directory: "/" or e.g. "/srv/images/a". */
+const char *root_dir(void);
+
+/* Directory fd of the root; reach paths under it with root_at(). */
+int root_fd(void);
+
+/*
+ * root_rel
+ *
+ * `abs` (an absolute path inside the root) with its leading slashes
+ * stripped, "/" itself becoming ".".  A string operation only: it is
+ * the form files.path takes in package file lists.
+ */
+const char *root_rel(const char *abs);
+
+/* root_at flag: create missing parent directories (0755) */
+#define ROOT_AT_MKDIR 1
+
+/*
+ * root_at
+ *
+ * Opens the directory that holds `abs` (a path inside the root; the
+ * leading '/' may be left off, as in package file lists), resolved
+ * as described above, and points *leaf at the part of `abs` to pass
+ * to the *at() call with that fd.  A final ".." is refused (EINVAL).
+ * Returns the fd, or -1 with errno set; release it with
+ * root_at_done().  For the root "/" this is root_fd() with no syscall,
+ * unless ROOT_AT_MKDIR has directories to create.
+ */
+int  root_at(const char *abs, int flags, const char **leaf);
+void root_at_done(int dfd);
+
+/* unlinkat() and renameat() through root_at(); -1 with errno. */
+int root_unlink(const char *abs);
+int root_rename(const char *from, const char *to);
+
+/*
+ * root_path
+ *
+ * Writes `abs` as seen from the host ("<root><abs>") into `out`.
+ * Returns 0, or 1 if it does not fit.
+ */
+int root_path(char *out, size_t outsz, const char *abs);
+
+#endif /* ROOT_H */
@@ -0,0 +1,52 @@
+#ifndef STATX_BATCH_H
+#define STATX_BATCH_H
+
+/*
+ * statx_batch.h - Batched metadata lookups under the root
+ *
+ * One lstat per installed file is bound by syscall latency, not by
+ * the filesystem: a 500k-file system spends most of a verify waiting
+ * for lookups issued one at a time.  statx_batch keeps hundreds in
+ * flight instead:
+ *
+ *   io_uring     IORING_OP_STATX submitted in rings of STATX_RING_DEPTH,
+ *                when the kernel supports it and io_uring is allowed
+ *   thread pool  otherwise: up to STATX_MAX_WORKERS threads calling
+ *                statx (or fstatat) on slices of the batch
+ *
+ * Lookups stay inside the root (root_at(), root.h; an alternate root
+ * always takes the thread pool) and never follow a final symlink.
+ * Results land in each request, so the caller reads them in its own
+ * order whatever order the lookups completed in.
+ */
+
+#include <stddef.h>
+
+#define STATX_RING_DEPTH  256
+#define STATX_MAX_WORKERS 32
+
+/* What verify needs of an lstat, independent of statx(2) headers */
+struct file_meta {
+    unsigned            mode;       /* st_mode: type and permissions */
+    long long           size;
+    unsigned long long  dev;
+    unsigned long long  ino;
+    long long           mtime_ns;
+    long long           ctime_ns;
+};
+
+struct statx_req {
+    const char       *path;     /* absolute, inside the root; borrowed */
+    struct file_meta  meta;     /* filled when err == 0 */
+    int               err;      /* 0, or the errno of the lookup */
+};
+
+/*
+ * statx_batch
+ *
+ * Looks up every request.  Never fails as a whole: each request gets
+ * its own result or errno.
+ */
+void statx_batch(struct statx_req *reqs, size_t count);
+
+#endif /* STATX_BATCH_H */
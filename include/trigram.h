@@ -0,0 +1,81 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+/*
+ * trigram.h - Trigram index over repository package names
+ *
+ * A compact, read-only sidecar to repo.db (FLAPPY_REPO_TRIGRAM_PATH),
+ * written by repo_update and memory-mapped by readers.  It answers:
+ *
+ *   - glob / substring queries ("*ssl*", "lib?url")  — trigram_glob
+ *   - near-miss suggestions for unknown names         — trigram_suggest
+ *
+ * by intersecting or counting posting lists instead of scanning every
+ * package row.
+ *
+ * The file records the published repo.db SHA256 it was built from;
+ * trigram_open rejects it if that no longer matches
+ * FLAPPY_REPO_SHA_PATH, so a stale index is never consulted.
+ */
+
+#include <sqlite3.h>
+#include <stddef.h>
+
+struct trigram_index;
+
+/*
+ * trigram_build
+ *
+ * Writes an index of every distinct packages.name in `repo` to `path`
+ * (via path.tmp + rename).  `repo_sha` is the published checksum of
+ * the repo.db being indexed (64 hex chars).
+ *
+ * Returns 0 on success, 1 on failure.
+ */
+int trigram_build(sqlite3 *repo, const char *repo_sha, const char *path);
+
+/*
+ * trigram_open / trigram_close
+ *
+ * Maps the index at `path`.  Returns NULL if it is missing, malformed,
+ * or was built for a different repo.db.
+ */
+struct trigram_index *trigram_open(const char *path);
+void trigram_close(struct trigram_index *idx);
+
+/*
+ * trigram_glob
+ *
+ * Calls `cb` for every name matching the fnmatch-style `pattern`
+ * ('*' and '?'; matching is case-insensitive), in BINARY name order.
+ * A pattern without wildcards is treated as a substring ("*pattern*").
+ *
+ * Returns the number of matches.
+ */
+typedef void (*trigram_match_fn)(const char *name, void *ctx);
+
+size_t trigram_glob(const struct trigram_index *idx, const char *pattern,
+                    trigram_match_fn cb, void *ctx);
+
+/*
+ * trigram_suggest
+ *
+ * Fills `out` with up to `max` names within edit distance `max_dist`
+ * of `name`, closest first.  The returned pointers stay valid until
+ * trigram_close.
+ *
+ * Returns the number of suggestions.
+ */
+size_t trigram_suggest(const struct trigram_index *idx, const char *name,
+                       int max_dist, const char **out, size_t max);
+
+/*
+ * trigram_did_you_mean
+ *
+ * Prints "did you mean: a, b, c?" to stderr for `name` using the
+ * installed index.  Prints nothing if there is no index or no close
+ * match.
+ */
+void trigram_did_you_mean(const char *name);
+
+#endif /* TRIGRAM_H */
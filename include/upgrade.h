@@ -0,0 +1,51 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+/*
+ * upgrade.h - Full-system upgrade executor
+ *
+ * upgrade_apply()
+ *
+ *   Upgrades every package listed by repo_upgrade_plan():
+ *
+ *     fetch    all archives concurrently (install_download_batch)
+ *     prepare  verify + extract on worker threads, each package as
+ *              soon as its download completes
+ *     commit   one package at a time, dependencies first, through
+ *              pre_upgrade → install_commit_upgrade → post_upgrade
+ *
+ *   Nothing is committed unless every package prepared successfully.
+ *   Each commit is atomic per package; if one fails, the packages
+ *   after it are left at their old version.
+ *
+ *   Requires root privileges.
+ *
+ *   Returns:
+ *     0   system is up to date, or every upgrade committed
+ *     1   any failure (reason printed)
+ */
+int upgrade_apply(void);
+
+/*
+ * upgrade_download_only(rate_limit)
+ *
+ *   Prefetch for a later upgrade_apply(): the same plan, lookup and
+ *   concurrent fetch, then each archive is verified (or rebuilt from
+ *   its delta and verified) and left in the package cache.  Nothing is
+ *   extracted or installed.
+ *
+ *   Safe to run from a timer: a second prefetch while one is running
+ *   exits at once, and the process runs at nice 19 in the idle I/O
+ *   class.  rate_limit caps the total download rate in bytes per
+ *   second; 0 means no cap.
+ *
+ *   Requires root privileges.
+ *
+ *   Returns:
+ *     0   every archive is cached and verified, the system is up to
+ *         date, or another prefetch is running
+ *     1   any failure (reason printed)
+ */
+int upgrade_download_only(long long rate_limit);
+
+#endif /* UPGRADE_H */
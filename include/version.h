@@ -3,6 +3,7 @@
 
 #include "pkg_meta.h"
 #include <limits.h>
+#include <sqlite3.h>
 
 /*
  * version_is_valid
@@ -43,4 +44,98 @@ int version_satisfies(const char *installed,
                       dep_op_t    op,
                       const char *required);
 
+/*
+ * Binary sort keys
+ *
+ * version_key encodes a valid version into a byte string whose memcmp
+ * order (shorter prefix sorts first) is exactly version_cmp order.
+ * Each segment is written as a length byte followed by its value in
+ * big-endian with leading zero bytes dropped; trailing zero segments
+ * are omitted so "1.0" and "1" produce the same key.  This is also the
+ * order SQLite uses for BLOB values, so keys can be indexed and
+ * compared with plain < / > / max() in SQL.
+ *
+ * Keys are stored in packages.version_key in the installed DB and
+ * added to repo.db by repo_update.  VERSION_KEY_MAX lives in
+ * pkg_meta.h because struct version_constraint embeds a key.
+ */
+/*
+ * version_key
+ *
+ * Encodes `v` into `key` (at least VERSION_KEY_MAX bytes) and stores
+ * the key length in *len.
+ *
+ * Returns 0 on success, -1 if `v` is invalid or a segment does not
+ * fit in 64 bits.
+ */
+int version_key(const char *v, unsigned char *key, size_t *len);
+
+/*
+ * version_key_cmp
+ *
+ * Compares two keys produced by version_key.
+ * Returns 1, 0 or -1 with the same meaning as version_cmp.
+ */
+int version_key_cmp(const unsigned char *a, size_t alen,
+                    const unsigned char *b, size_t blen);
+
+/*
+ * version_constraint_compile
+ *
+ * Compiles (op, required) into `c`.  `required` is ignored for
+ * DEP_OP_NONE and may be NULL.
+ *
+ * Returns 0 on success, -1 if `required` is invalid (c->valid = 0;
+ * the constraint will reject every candidate).
+ */
+int version_constraint_compile(struct version_constraint *c,
+                               dep_op_t op, const char *required);
+
+/*
+ * version_constraint_test
+ *
+ * Tests one candidate key.  A NULL key (invalid candidate version)
+ * never satisfies a constraint other than DEP_OP_NONE.
+ *
+ * Returns 1 if satisfied, 0 otherwise.
+ */
+int version_constraint_test(const struct version_constraint *c,
+                            const unsigned char *key, size_t len);
+
+/*
+ * A candidate for version_constraint_match: a key produced by
+ * version_key (key == NULL marks an invalid version).
+ */
+struct version_key_ref {
+    const unsigned char *key;
+    size_t               len;
+};
+
+/*
+ * version_constraint_match
+ *
+ * Tests one constraint against `n` candidates.  If `match` is non-NULL
+ * match[i] is set to 1 or 0 per candidate.
+ *
+ * Returns the number of candidates that satisfy the constraint.
+ */
+size_t version_constraint_match(const struct version_constraint *c,
+                                const struct version_key_ref *cands,
+                                size_t n, unsigned char *match);
+
+/*
+ * version_sql_register
+ *
+ * Registers version ordering on a SQLite connection so queries can
+ * compare versions without a round-trip through C per row:
+ *
+ *   version_cmp(a, b)   scalar: 1, 0, -1, or NULL if either is invalid
+ *   version_key(v)      scalar: BLOB sort key, NULL if invalid
+ *
+ * Both are deterministic and use the same rules as version_cmp().
+ *
+ * Returns SQLITE_OK or the SQLite error code.
+ */
+int version_sql_register(sqlite3 *db);
+
 #endif /* VERSION_H */
\ No newline at end of file
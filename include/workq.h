@@ -0,0 +1,54 @@
+#ifndef WORKQ_H
+#define WORKQ_H
+
+/*
+ * workq.h - Hand-off queue between a download batch and its workers
+ *
+ * install_download_batch reports each finished download on the calling
+ * thread; bootstrap and upgrade push the job onto a workq from that
+ * callback and a few worker threads pop it to verify and unpack while
+ * the rest are still downloading.  Every job is pushed at most once,
+ * so the caller sizes `items` for all of them up front and the queue
+ * never grows or wraps.
+ *
+ *   struct workq q = WORKQ_INIT(slots);
+ *   ... workers: while ((job = workq_pop(&q)) != NULL) ...
+ *   ... callback: workq_push(&q, job);
+ *   workq_close(&q);          then join the workers
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+
+struct workq {
+    pthread_mutex_t   lock;
+    pthread_cond_t    cond;
+    void            **items;        /* room for every push; borrowed */
+    size_t            head;
+    size_t            tail;
+    int               closed;
+};
+
+#define WORKQ_INIT(slots) {                 \
+    .lock  = PTHREAD_MUTEX_INITIALIZER,     \
+    .cond  = PTHREAD_COND_INITIALIZER,      \
+    .items = (slots),                       \
+}
+
+void  workq_push(struct workq *q, void *item);
+
+/* No more pushes: workq_pop returns NULL once the queue is drained. */
+void  workq_close(struct workq *q);
+
+/* Blocks for the next item; NULL when closed and empty. */
+void *workq_pop(struct workq *q);
+
+/*
+ * workq_workers
+ *
+ * Worker threads for `jobs` jobs: one per online CPU, at most `max`
+ * and at most one per job.
+ */
+int   workq_workers(size_t jobs, int max);
+
+#endif /* WORKQ_H */
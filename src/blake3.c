@@ -0,0 +1,459 @@
+/*
+ * blake3.c - BLAKE3 hash (plain hash mode, 32-byte output)
+ *
+ * A portable implementation of the BLAKE3 specification: the
+ * compression function, the chunk state and the chaining-value stack
+ * that merges completed subtrees as input arrives.
+ *
+ * Whole chunks are hashed LANES at a time, each state word held for
+ * all lanes in one GCC vector (lane_t), so every step of a round is
+ * one SIMD operation per vector register: SSE2 on any x86-64, plus an
+ * AVX2 copy of the same code picked at run time where the CPU has it.
+ * Plain loops over lanes were not vectorised at all.  The Makefile
+ * builds this file with -O3 for the same reason.  Partial chunks, the
+ * last chunk of the input and parent nodes use the scalar compression
+ * function.
+ *
+ * Only the 32-byte digest of plain hashing is implemented; keyed
+ * hashing, key derivation and extendable output have no caller.
+ */
+
+#include "blake3.h"
+
+#include <string.h>
+
+#define LANES          8
+#define SUBTREE_LEAVES 64       /* chunk CVs reduced on the stack at once */
+
+enum {
+    CHUNK_START = 1 << 0,
+    CHUNK_END   = 1 << 1,
+    PARENT      = 1 << 2,
+    ROOT        = 1 << 3,
+};
+
+static const uint32_t IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+/* Message word order of each round: the permutation applied r times */
+static const uint8_t SCHEDULE[7][16] = {
+    { 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+    { 2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8},
+    { 3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1},
+    {10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6},
+    {12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4},
+    { 9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7},
+    {11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13},
+};
+
+static uint32_t load32(const uint8_t *p)
+{
+    return (uint32_t)p[0]         | (uint32_t)p[1] << 8 |
+           (uint32_t)p[2] << 16   | (uint32_t)p[3] << 24;
+}
+
+static void store32(uint8_t *p, uint32_t w)
+{
+    p[0] = (uint8_t)w;
+    p[1] = (uint8_t)(w >> 8);
+    p[2] = (uint8_t)(w >> 16);
+    p[3] = (uint8_t)(w >> 24);
+}
+
+static uint32_t rotr(uint32_t w, unsigned c)
+{
+    return (w >> c) | (w << (32 - c));
+}
+
+/* =========================================================================
+ * Compression function
+ * ========================================================================= */
+
+static void g(uint32_t v[16], int a, int b, int c, int d,
+              uint32_t x, uint32_t y)
+{
+    v[a] = v[a] + v[b] + x;
+    v[d] = rotr(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];
+    v[b] = rotr(v[b] ^ v[c], 12);
+    v[a] = v[a] + v[b] + y;
+    v[d] = rotr(v[d] ^ v[a], 8);
+    v[c] = v[c] + v[d];
+    v[b] = rotr(v[b] ^ v[c], 7);
+}
+
+/* The first half of the compression output: a chaining value.  `out`
+ * may alias `cv`. */
+static void compress(const uint32_t cv[8], const uint32_t m[16],
+                     uint64_t counter, uint32_t block_len, uint32_t flags,
+                     uint32_t out[8])
+{
+    uint32_t v[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        IV[0], IV[1], IV[2], IV[3],
+        (uint32_t)counter, (uint32_t)(counter >> 32), block_len, flags,
+    };
+
+    for (int r = 0; r < 7; r++) {
+        const uint8_t *s = SCHEDULE[r];
+        g(v, 0, 4,  8, 12, m[s[0]],  m[s[1]]);
+        g(v, 1, 5,  9, 13, m[s[2]],  m[s[3]]);
+        g(v, 2, 6, 10, 14, m[s[4]],  m[s[5]]);
+        g(v, 3, 7, 11, 15, m[s[6]],  m[s[7]]);
+        g(v, 0, 5, 10, 15, m[s[8]],  m[s[9]]);
+        g(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+        g(v, 2, 7,  8, 13, m[s[12]], m[s[13]]);
+        g(v, 3, 4,  9, 14, m[s[14]], m[s[15]]);
+    }
+
+    for (int i = 0; i < 8; i++)
+        out[i] = v[i] ^ v[i + 8];
+}
+
+static void block_words(const uint8_t block[BLAKE3_BLOCK_LEN],
+                        uint32_t m[16])
+{
+    for (int i = 0; i < 16; i++)
+        m[i] = load32(block + 4 * i);
+}
+
+static void parent_cv(const uint32_t left[8], const uint32_t right[8],
+                      uint32_t out[8])
+{
+    uint32_t m[16];
+    memcpy(m, left, 8 * sizeof(uint32_t));
+    memcpy(m + 8, right, 8 * sizeof(uint32_t));
+    compress(IV, m, 0, BLAKE3_BLOCK_LEN, PARENT, out);
+}
+
+/* =========================================================================
+ * LANES whole chunks at once
+ * ========================================================================= */
+
+/* One state word of every lane */
+typedef uint32_t lane_t __attribute__((vector_size(4 * LANES)));
+
+#define ROTR_LANES(w, c) (((w) >> (c)) | ((w) << (32 - (c))))
+
+#define G_LANES(v, a, b, c, d, x, y) do {               \
+        v[a] = v[a] + v[b] + (x);                       \
+        v[d] = ROTR_LANES(v[d] ^ v[a], 16);             \
+        v[c] = v[c] + v[d];                             \
+        v[b] = ROTR_LANES(v[b] ^ v[c], 12);             \
+        v[a] = v[a] + v[b] + (y);                       \
+        v[d] = ROTR_LANES(v[d] ^ v[a], 8);              \
+        v[c] = v[c] + v[d];                             \
+        v[b] = ROTR_LANES(v[b] ^ v[c], 7);              \
+    } while (0)
+
+/*
+ * hash_chunks_lanes
+ *
+ * Chaining values of the LANES chunks at `in`, the first numbered
+ * `counter`.  None of them may be the root.  Inlined into one copy per
+ * instruction set below.
+ */
+static inline __attribute__((always_inline))
+void hash_chunks_lanes(const uint8_t *in, uint64_t counter,
+                       uint32_t out[LANES][8])
+{
+    lane_t cv[8], lo, hi;
+
+    for (int l = 0; l < LANES; l++) {
+        for (int i = 0; i < 8; i++)
+            cv[i][l] = IV[i];
+        lo[l] = (uint32_t)(counter + (uint64_t)l);
+        hi[l] = (uint32_t)((counter + (uint64_t)l) >> 32);
+    }
+
+    for (int b = 0; b < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; b++) {
+        lane_t m[16], v[16];
+        uint32_t flags = (b == 0 ? CHUNK_START : 0) |
+                         (b == BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN - 1
+                              ? CHUNK_END : 0);
+
+        for (int w = 0; w < 16; w++)
+            for (int l = 0; l < LANES; l++)
+                m[w][l] = load32(in + l * BLAKE3_CHUNK_LEN +
+                                 b * BLAKE3_BLOCK_LEN + 4 * w);
+
+        for (int i = 0; i < 8; i++)
+            v[i] = cv[i];
+        for (int i = 0; i < 4; i++)
+            v[8 + i] = (lane_t){0} + IV[i];
+        v[12] = lo;
+        v[13] = hi;
+        v[14] = (lane_t){0} + BLAKE3_BLOCK_LEN;
+        v[15] = (lane_t){0} + flags;
+
+        for (int r = 0; r < 7; r++) {
+            const uint8_t *s = SCHEDULE[r];
+            G_LANES(v, 0, 4,  8, 12, m[s[0]],  m[s[1]]);
+            G_LANES(v, 1, 5,  9, 13, m[s[2]],  m[s[3]]);
+            G_LANES(v, 2, 6, 10, 14, m[s[4]],  m[s[5]]);
+            G_LANES(v, 3, 7, 11, 15, m[s[6]],  m[s[7]]);
+            G_LANES(v, 0, 5, 10, 15, m[s[8]],  m[s[9]]);
+            G_LANES(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+            G_LANES(v, 2, 7,  8, 13, m[s[12]], m[s[13]]);
+            G_LANES(v, 3, 4,  9, 14, m[s[14]], m[s[15]]);
+        }
+
+        for (int i = 0; i < 8; i++)
+            cv[i] = v[i] ^ v[i + 8];
+    }
+
+    for (int l = 0; l < LANES; l++)
+        for (int i = 0; i < 8; i++)
+            out[l][i] = cv[i][l];
+}
+
+static void hash_chunks_base(const uint8_t *in, uint64_t counter,
+                             uint32_t out[LANES][8])
+{
+    hash_chunks_lanes(in, counter, out);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void hash_chunks_avx2(const uint8_t *in, uint64_t counter,
+                             uint32_t out[LANES][8])
+{
+    hash_chunks_lanes(in, counter, out);
+}
+#endif
+
+static void hash_chunks(const uint8_t *in, uint64_t counter,
+                        uint32_t out[LANES][8])
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+        hash_chunks_avx2(in, counter, out);
+        return;
+    }
+#endif
+    hash_chunks_base(in, counter, out);
+}
+
+/* =========================================================================
+ * Chunk state
+ * ========================================================================= */
+
+/* A node whose chaining value or root output is still to be taken */
+struct output {
+    uint32_t  cv[8];
+    uint32_t  m[16];
+    uint64_t  counter;
+    uint32_t  block_len;
+    uint32_t  flags;
+};
+
+static void output_cv(const struct output *o, uint32_t out[8])
+{
+    compress(o->cv, o->m, o->counter, o->block_len, o->flags, out);
+}
+
+static void chunk_init(struct blake3_chunk *c, uint64_t counter)
+{
+    memcpy(c->cv, IV, sizeof(c->cv));
+    c->counter   = counter;
+    memset(c->block, 0, sizeof(c->block));
+    c->block_len = 0;
+    c->blocks    = 0;
+}
+
+static size_t chunk_len(const struct blake3_chunk *c)
+{
+    return (size_t)c->blocks * BLAKE3_BLOCK_LEN + c->block_len;
+}
+
+static uint32_t chunk_start(const struct blake3_chunk *c)
+{
+    return c->blocks == 0 ? CHUNK_START : 0;
+}
+
+static void chunk_update(struct blake3_chunk *c, const uint8_t *in,
+                         size_t len)
+{
+    while (len > 0) {
+        if (c->block_len == BLAKE3_BLOCK_LEN) {
+            uint32_t m[16];
+            block_words(c->block, m);
+            compress(c->cv, m, c->counter, BLAKE3_BLOCK_LEN,
+                     chunk_start(c), c->cv);
+            c->blocks++;
+            c->block_len = 0;
+            memset(c->block, 0, sizeof(c->block));
+        }
+
+        size_t take = BLAKE3_BLOCK_LEN - c->block_len;
+        if (take > len)
+            take = len;
+        memcpy(c->block + c->block_len, in, take);
+        c->block_len += (uint8_t)take;
+        in  += take;
+        len -= take;
+    }
+}
+
+static void chunk_output(const struct blake3_chunk *c, struct output *o)
+{
+    memcpy(o->cv, c->cv, sizeof(o->cv));
+    block_words(c->block, o->m);
+    o->counter   = c->counter;
+    o->block_len = c->block_len;
+    o->flags     = chunk_start(c) | CHUNK_END;
+}
+
+/* =========================================================================
+ * Hasher
+ * ========================================================================= */
+
+/*
+ * push_cv
+ *
+ * Adds the chaining value of a completed subtree that brings the input
+ * to `total` units (chunks, or subtrees of one size), merging every
+ * pair of siblings that is now complete.  A run is only pushed once
+ * more input follows it, so nothing merged here is the root.
+ */
+static void push_cv(struct blake3_hasher *h, const uint32_t cv[8],
+                    uint64_t total)
+{
+    uint32_t cur[8];
+    memcpy(cur, cv, sizeof(cur));
+
+    while ((total & 1) == 0) {
+        parent_cv(h->stack[--h->stack_len], cur, cur);
+        total >>= 1;
+    }
+
+    memcpy(h->stack[h->stack_len++], cur, sizeof(cur));
+}
+
+void blake3_init(struct blake3_hasher *h)
+{
+    chunk_init(&h->chunk, 0);
+    h->stack_len = 0;
+}
+
+void blake3_update(struct blake3_hasher *h, const void *data, size_t len)
+{
+    const uint8_t *in = data;
+
+    while (len > 0) {
+        if (chunk_len(&h->chunk) == BLAKE3_CHUNK_LEN) {
+            struct output o;
+            uint32_t cv[8];
+            chunk_output(&h->chunk, &o);
+            output_cv(&o, cv);
+
+            uint64_t total = h->chunk.counter + 1;
+            push_cv(h, cv, total);
+            chunk_init(&h->chunk, total);
+        }
+
+        /* Whole chunks with more input after them: all lanes at once */
+        while (chunk_len(&h->chunk) == 0 &&
+               len > LANES * BLAKE3_CHUNK_LEN) {
+            uint32_t cvs[LANES][8];
+            uint64_t counter = h->chunk.counter;
+
+            hash_chunks(in, counter, cvs);
+            for (int l = 0; l < LANES; l++)
+                push_cv(h, cvs[l], counter + (uint64_t)l + 1);
+            chunk_init(&h->chunk, counter + LANES);
+
+            in  += LANES * BLAKE3_CHUNK_LEN;
+            len -= LANES * BLAKE3_CHUNK_LEN;
+        }
+
+        size_t take = BLAKE3_CHUNK_LEN - chunk_len(&h->chunk);
+        if (take > len)
+            take = len;
+        chunk_update(&h->chunk, in, take);
+        in  += take;
+        len -= take;
+    }
+}
+
+void blake3_final(const struct blake3_hasher *h,
+                  uint8_t out[BLAKE3_OUT_LEN])
+{
+    struct output o;
+    chunk_output(&h->chunk, &o);
+
+    for (size_t i = h->stack_len; i-- > 0; ) {
+        uint32_t right[8];
+        output_cv(&o, right);
+
+        memcpy(o.m, h->stack[i], 8 * sizeof(uint32_t));
+        memcpy(o.m + 8, right, 8 * sizeof(uint32_t));
+        memcpy(o.cv, IV, sizeof(o.cv));
+        o.counter   = 0;
+        o.block_len = BLAKE3_BLOCK_LEN;
+        o.flags     = PARENT;
+    }
+
+    uint32_t words[8];
+    compress(o.cv, o.m, 0, o.block_len, o.flags | ROOT, words);
+    for (int i = 0; i < 8; i++)
+        store32(out + 4 * i, words[i]);
+}
+
+/* =========================================================================
+ * Subtrees
+ * ========================================================================= */
+
+/* Chaining value of one chunk that is not the root */
+static void chunk_cv(const uint8_t *in, uint64_t counter, uint32_t out[8])
+{
+    struct blake3_chunk c;
+    struct output o;
+
+    chunk_init(&c, counter);
+    chunk_update(&c, in, BLAKE3_CHUNK_LEN);
+    chunk_output(&c, &o);
+    output_cv(&o, out);
+}
+
+void blake3_subtree_cv(const uint8_t *in, size_t len, uint64_t first_chunk,
+                       uint32_t cv[8])
+{
+    size_t n = len / BLAKE3_CHUNK_LEN;
+
+    if (n > SUBTREE_LEAVES) {
+        uint32_t left[8], right[8];
+        blake3_subtree_cv(in, len / 2, first_chunk, left);
+        blake3_subtree_cv(in + len / 2, len / 2, first_chunk + n / 2, right);
+        parent_cv(left, right, cv);
+        return;
+    }
+
+    uint32_t leaves[SUBTREE_LEAVES][8];
+    size_t i = 0;
+
+    for (; i + LANES <= n; i += LANES)
+        hash_chunks(in + i * BLAKE3_CHUNK_LEN, first_chunk + i,
+                    &leaves[i]);
+    for (; i < n; i++)
+        chunk_cv(in + i * BLAKE3_CHUNK_LEN, first_chunk + i, leaves[i]);
+
+    /* Pairwise up to the subtree's own root */
+    for (; n > 1; n /= 2)
+        for (i = 0; i < n / 2; i++)
+            parent_cv(leaves[2 * i], leaves[2 * i + 1], leaves[i]);
+
+    memcpy(cv, leaves[0], 8 * sizeof(uint32_t));
+}
+
+void blake3_push_subtree(struct blake3_hasher *h, const uint32_t cv[8],
+                         size_t len)
+{
+    uint64_t n = len / BLAKE3_CHUNK_LEN;
+    uint64_t end = h->chunk.counter + n;
+
+    push_cv(h, cv, end / n);
+    chunk_init(&h->chunk, end);
+}
@@ -0,0 +1,327 @@
+/*
+ * bootstrap.c - Fast population of an empty root (see bootstrap.h)
+ *
+ * PIPELINE
+ *
+ *   plan      resolve_closure — dependencies first, as for a bare host
+ *   lookup    install_lookup_version for the planned version of every
+ *             entry
+ *   fetch     install_download_batch, all archives at once
+ *   unpack    worker threads verify each archive and extract it
+ *             straight into the root (install_extract_direct) the
+ *             moment its download completes
+ *   register  one transaction, journal_mode=OFF, synchronous=OFF:
+ *             install_register for every package in plan order
+ *   hooks     post_install for every package in plan order
+ *   sync      syncfs() on the root
+ *
+ * The normal path pays, per package, for a staging copy, a conflict
+ * pass against the DB, a journalled commit and the file copy out of
+ * staging.  Here none of that buys anything: the root is empty, so
+ * the only possible conflict is between two packages of the plan,
+ * which NO_OVERWRITE extraction catches; and nothing needs to survive
+ * a crash half way, because the answer to a failed image build is to
+ * discard the root.
+ *
+ * pre_install hooks are not run — nothing is "before" once the files
+ * have been written in parallel.  post_install runs for each package
+ * after all files of the plan are in place, so a hook may rely on any
+ * package of the plan, not only its own dependencies.
+ *
+ * UX contract:
+ *   [INFO] bootstrapping N package(s) into <root>:
+ *   downloading <file>            (one line per transfer)
+ *   [OK] unpacked <pkg> <ver>
+ *   [OK] registered N package(s)
+ *   [OK] bootstrapped N package(s) into <root>
+ */
+
+#define _GNU_SOURCE     /* syncfs */
+
+#include "bootstrap.h"
+#include "flappy.h"
+#include "hooks.h"
+#include "install.h"
+#include "pkg_meta.h"
+#include "repo.h"
+#include "resolve.h"
+#include "root.h"
+#include "ui.h"
+#include "workq.h"
+
+#include <sqlite3.h>
+#include <pthread.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_UNPACK_WORKERS 8
+
+struct boot_job {
+    const char          *name;
+    char                 filename[256];
+    char                 checksum[128];
+    char                 base_url[REPO_URL_MAX];
+    struct download_req *req;
+    struct install_file *files;      /* written by install_extract_direct */
+    size_t               nfiles;
+    struct flappy_pkg   *meta;
+    int                  unpacked;
+};
+
+/* =========================================================================
+ * Unpack queue — filled by the download callback, drained by workers
+ * ========================================================================= */
+
+static void on_downloaded(struct download_req *req, void *ctx)
+{
+    if (req->status == 0)
+        workq_push(ctx, req->user);
+}
+
+static void *unpack_worker(void *arg)
+{
+    struct workq *q = arg;
+    struct boot_job *job;
+
+    while ((job = workq_pop(q)) != NULL) {
+        if (install_verify(job->req->local_path, job->checksum) != 0) {
+            ui_error("integrity verification failed: %s", job->filename);
+            continue;
+        }
+
+        job->meta = pkg_read_from_file(job->req->local_path);
+        if (!job->meta || strcmp(job->meta->name, job->name) != 0) {
+            ui_error("package metadata mismatch: %s", job->filename);
+            continue;
+        }
+
+        if (install_extract_direct(job->req->local_path,
+                                   &job->files, &job->nfiles) != 0) {
+            ui_error("extraction failed: %s", job->filename);
+            continue;
+        }
+
+        job->unpacked = 1;
+        ui_ok("unpacked %s %s", job->name, job->meta->version);
+    }
+
+    return NULL;
+}
+
+/* =========================================================================
+ * Helpers
+ * ========================================================================= */
+
+static int installed_count(void)
+{
+    sqlite3_stmt *st = NULL;
+    int n = -1;
+
+    db_open_or_die();
+    if (sqlite3_prepare_v2(db_handle(), "SELECT COUNT(*) FROM packages;",
+                           -1, &st, NULL) == SQLITE_OK &&
+        sqlite3_step(st) == SQLITE_ROW)
+        n = sqlite3_column_int(st, 0);
+    sqlite3_finalize(st);
+    db_close();
+    return n;
+}
+
+/*
+ * register_all
+ *
+ * One transaction for the whole plan.  The rollback journal is off:
+ * a failure here means the root is discarded, never rolled back.
+ * journal_mode=OFF is not persistent, so later runs on the finished
+ * root journal as usual.
+ */
+static int register_all(struct boot_job *jobs, int n)
+{
+    db_open_or_die();
+    sqlite3 *db = db_handle();
+
+    sqlite3_exec(db, "PRAGMA journal_mode = OFF;", NULL, NULL, NULL);
+    sqlite3_exec(db, "PRAGMA synchronous = OFF;", NULL, NULL, NULL);
+
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) {
+        ui_error("bootstrap: could not begin transaction");
+        db_close();
+        return 1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (install_register(jobs[i].meta, jobs[i].files,
+                             jobs[i].nfiles) < 0) {
+            ui_error("bootstrap: cannot register %s", jobs[i].name);
+            sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+            db_close();
+            return 1;
+        }
+    }
+
+    if (sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        ui_error("bootstrap: transaction commit failed: %s",
+                 sqlite3_errmsg(db));
+        db_close();
+        return 1;
+    }
+
+    db_close();
+    ui_ok("registered %d package(s)", n);
+    return 0;
+}
+
+static void run_hooks(struct boot_job *jobs, int n)
+{
+    for (int i = 0; i < n; i++) {
+        const char *name = jobs[i].name;
+
+        if (hook_install_from_pkg(name, jobs[i].req->local_path) != 0) {
+            ui_warn("cannot install hook script for %s", name);
+            continue;
+        }
+
+        char hook[256];
+        hook_path(name, hook, sizeof(hook));
+        if (run_hook(hook, "post_install", jobs[i].meta->version,
+                     NULL) != 0)
+            ui_warn("post_install hook failed for %s", name);
+    }
+}
+
+/* =========================================================================
+ * Public entry
+ * ========================================================================= */
+
+int bootstrap_install(const char *const *pkgs, int n)
+{
+    if (install_guard()) {
+        ui_error("root privileges required");
+        return 1;
+    }
+
+    int installed = installed_count();
+    if (installed != 0) {
+        if (installed > 0)
+            ui_error("install --bootstrap needs an empty root: "
+                     "%d package(s) already installed in %s",
+                     installed, root_dir());
+        else
+            ui_error("cannot read the installed database in %s",
+                     root_dir());
+        return 1;
+    }
+
+    struct resolve_plan *plan = malloc(sizeof(*plan));
+    if (!plan) {
+        ui_error("out of memory");
+        return 1;
+    }
+
+    ui_step("resolving packages...");
+    if (resolve_closure(pkgs, n, plan) != 0) {
+        free(plan);
+        return 1;
+    }
+
+    int count = plan->count;
+    struct boot_job      *jobs  = calloc((size_t)count, sizeof(*jobs));
+    struct download_req  *reqs  = calloc((size_t)count, sizeof(*reqs));
+    void                **slots = calloc((size_t)count, sizeof(*slots));
+    int rc = 1;
+
+    if (!jobs || !reqs || !slots) {
+        ui_error("out of memory");
+        goto out;
+    }
+
+    /* --- lookup --- */
+    for (int i = 0; i < count; i++) {
+        struct boot_job *job = &jobs[i];
+        job->name = plan->names[i];
+
+        if (install_lookup_version(job->name, plan->versions[i],
+                                   job->filename, job->checksum,
+                                   job->base_url) != 0) {
+            ui_error("package not found in repository: %s %s",
+                     job->name, plan->versions[i]);
+            goto out;
+        }
+
+        reqs[i].filename = job->filename;
+        reqs[i].checksum = job->checksum;
+        reqs[i].base_url = job->base_url;
+        reqs[i].user     = job;
+        job->req         = &reqs[i];
+    }
+
+    ui_info("bootstrapping %d package(s) into %s:", count, root_dir());
+    for (int i = 0; i < count; i++)
+        fprintf(stderr, "  %d. %s\n", i + 1, jobs[i].name);
+    fprintf(stderr, "\n");
+
+    log_info("bootstrap: %d package(s) into %s", count, root_dir());
+
+    /* --- fetch + unpack, overlapped --- */
+    struct workq q = WORKQ_INIT(slots);
+
+    int nworkers = workq_workers((size_t)count, MAX_UNPACK_WORKERS);
+    pthread_t workers[MAX_UNPACK_WORKERS];
+    int started = 0;
+
+    for (int i = 0; i < nworkers; i++) {
+        if (pthread_create(&workers[i], NULL, unpack_worker, &q) != 0)
+            break;
+        started++;
+    }
+
+    if (started == 0) {
+        ui_error("cannot start worker threads");
+        goto out;
+    }
+
+    install_download_batch(reqs, (size_t)count, on_downloaded, &q);
+
+    workq_close(&q);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    int failed = 0;
+    for (int i = 0; i < count; i++)
+        failed |= !jobs[i].unpacked;
+
+    /* --- register, hooks, sync --- */
+    if (failed || register_all(jobs, count) != 0) {
+        ui_error("bootstrap failed — %s is incomplete, discard it",
+                 root_dir());
+        log_error("bootstrap: failed, %s left incomplete", root_dir());
+        goto out;
+    }
+
+    run_hooks(jobs, count);
+
+    if (syncfs(root_fd()) != 0) {
+        ui_error("syncfs %s: %s", root_dir(), strerror(errno));
+        goto out;
+    }
+
+    ui_ok("bootstrapped %d package(s) into %s", count, root_dir());
+    log_info("bootstrap: %d package(s) into %s complete",
+             count, root_dir());
+    rc = 0;
+
+out:
+    for (int i = 0; jobs && i < count; i++) {
+        install_files_free(jobs[i].files, jobs[i].nfiles);
+        pkg_meta_free(jobs[i].meta);
+    }
+    free(jobs);
+    free(reqs);
+    free(slots);
+    free(plan);
+    return rc;
+}
@@ -0,0 +1,721 @@
+/*
+ * bundle.c - Offline install bundles (see bundle.h)
+ *
+ * LAYOUT
+ *
+ *   POSIX ustar, uncompressed (the archives inside already are),
+ *   members in this order:
+ *
+ *     plan              "flappy-bundle <format>", then one line per
+ *                       package in install order:
+ *                         <name> <filename> <sha256>
+ *     repo.db           repo.db with only the bundled package rows
+ *                       (derived search index dropped)
+ *     packages/<file>   the archives, in plan order
+ *
+ *   Any tar can list or unpack a bundle.  flappy itself only reads the
+ *   512-byte headers to find each member's offset and size, then copies
+ *   the member straight into the package cache with copy_file_range —
+ *   a reflink or an in-kernel copy where the filesystem allows it.
+ *
+ * The bundle is written to <path>.part and renamed into place, so an
+ * interrupted export never leaves a truncated bundle under the final
+ * name.  Every archive is checked against its repo.db checksum before
+ * it goes in, and again by install_verify when it comes out.
+ */
+
+#define _GNU_SOURCE     /* copy_file_range */
+
+#include "bundle.h"
+#include "flappy.h"
+#include "install.h"
+#include "repo.h"
+#include "resolve.h"
+#include "ui.h"
+
+#include <sqlite3.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TAR_BLOCK     512
+#define TAR_SIZE_MAX  077777777777ULL      /* 11 octal digits */
+#define PLAN_MEMBER   "plan"
+#define REPO_MEMBER   "repo.db"
+#define PKG_PREFIX    "packages"
+#define PLAN_MAX      (1024 * 1024)
+#define MEMBERS_MAX   (RESOLVE_MAX + 2)
+
+struct bundle_pkg {
+    char name[64];
+    char filename[256];
+    char checksum[128];
+    char base_url[REPO_URL_MAX];
+};
+
+/* =========================================================================
+ * I/O helpers
+ * ========================================================================= */
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        p   += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+/*
+ * copy_range
+ *
+ * Copies `len` bytes of `in`, starting at `off`, to the current
+ * position of `out`.  Falls back to pread/write where copy_file_range
+ * is unavailable or refuses the pair of files.
+ */
+static int copy_range(int in, off_t off, int out, off_t len)
+{
+    int fallback = 0;
+    char buf[65536];
+
+    while (len > 0) {
+        size_t want = len < (off_t)sizeof(buf) ? (size_t)len : sizeof(buf);
+        ssize_t n;
+
+        if (!fallback) {
+            n = copy_file_range(in, &off, out, NULL, (size_t)len, 0);
+            if (n < 0 && (errno == ENOSYS || errno == EXDEV ||
+                          errno == EINVAL || errno == EOPNOTSUPP)) {
+                fallback = 1;
+                continue;
+            }
+        } else {
+            n = pread(in, buf, want, off);
+            if (n > 0) {
+                if (write_all(out, buf, (size_t)n) != 0)
+                    return 1;
+                off += n;
+            }
+        }
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        if (n == 0) {           /* source shorter than it claimed */
+            errno = EIO;
+            return 1;
+        }
+        len -= n;
+    }
+    return 0;
+}
+
+/* =========================================================================
+ * ustar
+ * ========================================================================= */
+
+static void tar_octal(unsigned char *field, size_t width,
+                      unsigned long long v)
+{
+    char tmp[24];
+    snprintf(tmp, sizeof(tmp), "%0*llo", (int)width - 1, v);
+    memcpy(field, tmp, width - 1);
+    field[width - 1] = '\0';
+}
+
+static unsigned long long tar_parse_octal(const unsigned char *field,
+                                          size_t width)
+{
+    unsigned long long v = 0;
+    size_t i = 0;
+    while (i < width && field[i] == ' ')
+        i++;
+    for (; i < width && field[i] >= '0' && field[i] <= '7'; i++)
+        v = v * 8 + (unsigned long long)(field[i] - '0');
+    return v;
+}
+
+/* header checksum: every byte summed, the checksum field read as spaces */
+static unsigned tar_checksum(const unsigned char *h)
+{
+    unsigned sum = 0;
+    for (size_t i = 0; i < TAR_BLOCK; i++)
+        sum += (i >= 148 && i < 156) ? ' ' : h[i];
+    return sum;
+}
+
+static int tar_header(int fd, const char *prefix, const char *name,
+                      unsigned long long size)
+{
+    unsigned char h[TAR_BLOCK];
+    size_t nlen = strlen(name), plen = strlen(prefix);
+
+    if (nlen >= 100 || plen >= 155 || size > TAR_SIZE_MAX) {
+        ui_error("bundle: cannot store %s%s%s (name or size too large)",
+                 prefix, plen ? "/" : "", name);
+        return 1;
+    }
+
+    memset(h, 0, sizeof(h));
+    memcpy(h, name, nlen);
+    tar_octal(h + 100, 8, 0644);            /* mode */
+    tar_octal(h + 108, 8, 0);               /* uid */
+    tar_octal(h + 116, 8, 0);               /* gid */
+    tar_octal(h + 124, 12, size);
+    tar_octal(h + 136, 12, 0);              /* mtime: reproducible */
+    h[156] = '0';                           /* regular file */
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    memcpy(h + 265, "root", 4);
+    memcpy(h + 297, "root", 4);
+    memcpy(h + 345, prefix, plen);
+
+    char sum[8];
+    snprintf(sum, sizeof(sum), "%06o", tar_checksum(h) & 0777777);
+    memcpy(h + 148, sum, 7);
+    h[155] = ' ';
+
+    return write_all(fd, h, sizeof(h));
+}
+
+static int tar_pad(int fd, unsigned long long size)
+{
+    static const unsigned char zero[TAR_BLOCK];
+    size_t pad = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+    return write_all(fd, zero, pad);
+}
+
+static int tar_add_buffer(int fd, const char *name, const char *buf,
+                          size_t len)
+{
+    return tar_header(fd, "", name, len) ||
+           write_all(fd, buf, len) ||
+           tar_pad(fd, len);
+}
+
+static int tar_add_file(int fd, const char *prefix, const char *name,
+                        const char *path)
+{
+    int in = open(path, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        ui_error("bundle: cannot open %s: %s", path, strerror(errno));
+        return 1;
+    }
+
+    struct stat st;
+    int rc = fstat(in, &st) != 0 ||
+             tar_header(fd, prefix, name, (unsigned long long)st.st_size) ||
+             copy_range(in, 0, fd, st.st_size) ||
+             tar_pad(fd, (unsigned long long)st.st_size);
+
+    if (rc)
+        ui_error("bundle: cannot add %s: %s", path, strerror(errno));
+    close(in);
+    return rc;
+}
+
+/* =========================================================================
+ * Export
+ * ========================================================================= */
+
+/*
+ * trim_repo_db
+ *
+ * Writes a copy of repo.db to `tmp` holding only the package rows in
+ * `pkgs` and their dependency rows.
+ */
+static int trim_repo_db(const char *tmp, const struct bundle_pkg *pkgs,
+                        int n)
+{
+    int in = open(FLAPPY_REPO_DB_PATH, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        ui_error("bundle: cannot open repository database "
+                 "(run 'flappy update')");
+        return 1;
+    }
+
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    struct stat st;
+    int rc = out < 0 || fstat(in, &st) != 0 ||
+             copy_range(in, 0, out, st.st_size);
+    close(in);
+    if (out >= 0 && close(out) != 0)
+        rc = 1;
+    if (rc) {
+        ui_error("bundle: cannot copy repository database: %s",
+                 strerror(errno));
+        return 1;
+    }
+
+    sqlite3 *db = NULL;
+    if (sqlite3_open_v2(tmp, &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+        ui_error("bundle: cannot open %s", tmp);
+        sqlite3_close(db);
+        return 1;
+    }
+
+    rc = sqlite3_exec(db,
+            "CREATE TEMP TABLE keep (filename TEXT PRIMARY KEY);",
+            NULL, NULL, NULL) != SQLITE_OK;
+
+    sqlite3_stmt *st_keep = NULL;
+    if (!rc)
+        rc = sqlite3_prepare_v2(db,
+                "INSERT OR IGNORE INTO keep VALUES (?);",
+                -1, &st_keep, NULL) != SQLITE_OK;
+
+    for (int i = 0; !rc && i < n; i++) {
+        sqlite3_bind_text(st_keep, 1, pkgs[i].filename, -1, SQLITE_STATIC);
+        rc = sqlite3_step(st_keep) != SQLITE_DONE;
+        sqlite3_reset(st_keep);
+    }
+    sqlite3_finalize(st_keep);
+
+    if (!rc)
+        rc = sqlite3_exec(db,
+                "DROP TABLE IF EXISTS packages_fts;"
+                "DELETE FROM packages "
+                "WHERE filename NOT IN (SELECT filename FROM keep);",
+                NULL, NULL, NULL) != SQLITE_OK;
+
+    /* repo.db without a deps table has nothing to trim there */
+    if (!rc)
+        sqlite3_exec(db,
+            "DELETE FROM deps "
+            "WHERE package NOT IN (SELECT name FROM packages);",
+            NULL, NULL, NULL);
+
+    if (!rc)
+        rc = sqlite3_exec(db, "VACUUM;", NULL, NULL, NULL) != SQLITE_OK;
+
+    if (rc)
+        ui_error("bundle: cannot trim repository database: %s",
+                 sqlite3_errmsg(db));
+
+    sqlite3_close(db);
+    return rc;
+}
+
+static char *build_plan(const struct bundle_pkg *pkgs, int n, size_t *len)
+{
+    size_t cap = 64;
+    for (int i = 0; i < n; i++)
+        cap += strlen(pkgs[i].name) + strlen(pkgs[i].filename) +
+               strlen(pkgs[i].checksum) + 3;
+
+    char *buf = malloc(cap);
+    if (!buf)
+        return NULL;
+
+    size_t off = (size_t)snprintf(buf, cap, "flappy-bundle %d\n",
+                                  BUNDLE_FORMAT_VERSION);
+    for (int i = 0; i < n; i++)
+        off += (size_t)snprintf(buf + off, cap - off, "%s %s %s\n",
+                                pkgs[i].name, pkgs[i].filename,
+                                pkgs[i].checksum);
+    *len = off;
+    return buf;
+}
+
+static int write_bundle(const char *part, const char *dbtmp,
+                        const struct bundle_pkg *pkgs,
+                        const struct download_req *reqs, int n)
+{
+    size_t plan_len = 0;
+    char *plan = build_plan(pkgs, n, &plan_len);
+    if (!plan) {
+        ui_error("out of memory");
+        return 1;
+    }
+
+    int fd = open(part, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ui_error("bundle: cannot create %s: %s", part, strerror(errno));
+        free(plan);
+        return 1;
+    }
+
+    int rc = tar_add_buffer(fd, PLAN_MEMBER, plan, plan_len) ||
+             tar_add_file(fd, "", REPO_MEMBER, dbtmp);
+    free(plan);
+
+    for (int i = 0; !rc && i < n; i++)
+        rc = tar_add_file(fd, PKG_PREFIX, pkgs[i].filename,
+                          reqs[i].local_path);
+
+    /* end of archive: two zero blocks */
+    static const unsigned char eof[2 * TAR_BLOCK];
+    if (!rc)
+        rc = write_all(fd, eof, sizeof(eof)) || fsync(fd) != 0;
+
+    if (close(fd) != 0)
+        rc = 1;
+    if (rc)
+        ui_error("bundle: cannot write %s: %s", part, strerror(errno));
+    return rc;
+}
+
+int bundle_create(const char *path, const char *const *names, int n)
+{
+    struct resolve_plan *plan = malloc(sizeof(*plan));
+    if (!plan) {
+        ui_error("out of memory");
+        return 1;
+    }
+
+    ui_step("resolving packages...");
+    if (resolve_closure(names, n, plan) != 0) {
+        free(plan);
+        return 1;
+    }
+
+    int count = plan->count;
+    struct bundle_pkg   *pkgs = calloc((size_t)count, sizeof(*pkgs));
+    struct download_req *reqs = calloc((size_t)count, sizeof(*reqs));
+    int rc = 1;
+
+    if (!pkgs || !reqs) {
+        ui_error("out of memory");
+        goto out;
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct bundle_pkg *p = &pkgs[i];
+        snprintf(p->name, sizeof(p->name), "%s", plan->names[i]);
+
+        if (install_lookup_version(p->name, plan->versions[i], p->filename,
+                                   p->checksum, p->base_url)) {
+            ui_error("package not found in repository: %s %s",
+                     p->name, plan->versions[i]);
+            goto out;
+        }
+        if (strpbrk(p->filename, " \t\n") || strpbrk(p->checksum, " \t\n")) {
+            ui_error("bundle: unsupported file name for %s", p->name);
+            goto out;
+        }
+
+        reqs[i].filename = p->filename;
+        reqs[i].checksum = p->checksum;
+        reqs[i].base_url = p->base_url;
+    }
+
+    ui_info("bundling %d package(s):", count);
+    for (int i = 0; i < count; i++)
+        fprintf(stderr, "  %d. %s\n", i + 1, pkgs[i].name);
+
+    if (install_download_batch(reqs, (size_t)count, NULL, NULL) != 0) {
+        ui_error("bundle: download failed — no bundle written");
+        goto out;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (install_verify(reqs[i].local_path, pkgs[i].checksum) != 0) {
+            ui_error("bundle: %s failed verification", pkgs[i].filename);
+            goto out;
+        }
+    }
+
+    char part[4096], dbtmp[4096];
+    if (snprintf(part, sizeof(part), "%s.part", path) >= (int)sizeof(part) ||
+        snprintf(dbtmp, sizeof(dbtmp), "%s.repo.db", path)
+            >= (int)sizeof(dbtmp)) {
+        ui_error("bundle: path too long");
+        goto out;
+    }
+
+    ui_step("writing bundle...");
+    rc = trim_repo_db(dbtmp, pkgs, count) ||
+         write_bundle(part, dbtmp, pkgs, reqs, count);
+    unlink(dbtmp);
+
+    if (!rc && rename(part, path) != 0) {
+        ui_error("bundle: cannot rename %s: %s", part, strerror(errno));
+        rc = 1;
+    }
+    if (rc) {
+        unlink(part);
+        goto out;
+    }
+
+    log_info("bundle: wrote %s (%d packages)", path, count);
+    ui_ok("bundle written: %s", path);
+
+out:
+    free(reqs);
+    free(pkgs);
+    free(plan);
+    return rc;
+}
+
+/* =========================================================================
+ * Import
+ * ========================================================================= */
+
+struct member {
+    char  name[264];    /* prefix "/" name */
+    off_t off;          /* of the data, past the header */
+    off_t size;
+};
+
+/*
+ * read_members
+ *
+ * Walks the ustar headers of `fd`.  Fails on a damaged header or a
+ * member that runs past the end of the file (truncated copy).
+ */
+static int read_members(int fd, struct member *m, int max, int *count)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return 1;
+
+    unsigned char h[TAR_BLOCK];
+    off_t pos = 0;
+    *count = 0;
+
+    for (;;) {
+        if (pread(fd, h, TAR_BLOCK, pos) != TAR_BLOCK)
+            return 1;
+
+        int zero = 1;
+        for (size_t i = 0; i < TAR_BLOCK && zero; i++)
+            zero = h[i] == 0;
+        if (zero)
+            return 0;
+
+        if (memcmp(h + 257, "ustar", 5) != 0 ||
+            tar_parse_octal(h + 148, 8) != tar_checksum(h))
+            return 1;
+
+        unsigned long long size = tar_parse_octal(h + 124, 12);
+        off_t data = pos + TAR_BLOCK;
+        if (size > (unsigned long long)(st.st_size - data))
+            return 1;
+
+        if (h[156] == '0' || h[156] == '\0') {
+            if (*count == max)
+                return 1;
+            struct member *e = &m[(*count)++];
+            if (h[345])
+                snprintf(e->name, sizeof(e->name), "%.155s/%.100s",
+                         (const char *)h + 345, (const char *)h);
+            else
+                snprintf(e->name, sizeof(e->name), "%.100s",
+                         (const char *)h);
+            e->off  = data;
+            e->size = (off_t)size;
+        }
+
+        pos = data + (off_t)((size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK);
+    }
+}
+
+static const struct member *find_member(const struct member *m, int n,
+                                        const char *prefix, const char *name)
+{
+    char full[sizeof(m->name)];
+    snprintf(full, sizeof(full), "%s%s%s", prefix, *prefix ? "/" : "", name);
+    for (int i = 0; i < n; i++)
+        if (strcmp(m[i].name, full) == 0)
+            return &m[i];
+    return NULL;
+}
+
+/*
+ * read_plan
+ *
+ * Parses the plan member into `pkgs` (RESOLVE_MAX entries).
+ * Returns the number of packages, or -1.
+ */
+static int read_plan(int fd, const struct member *pm, struct bundle_pkg *pkgs)
+{
+    if (pm->size > PLAN_MAX)
+        return -1;
+
+    char *buf = malloc((size_t)pm->size + 1);
+    if (!buf || pread(fd, buf, (size_t)pm->size, pm->off) != pm->size) {
+        free(buf);
+        return -1;
+    }
+    buf[pm->size] = '\0';
+
+    int n = 0, version = 0;
+    char *save = NULL;
+    char *line = strtok_r(buf, "\n", &save);
+
+    if (!line || sscanf(line, "flappy-bundle %d", &version) != 1 ||
+        version != BUNDLE_FORMAT_VERSION) {
+        ui_error("bundle: unsupported format (expected flappy-bundle %d)",
+                 BUNDLE_FORMAT_VERSION);
+        free(buf);
+        return -1;
+    }
+
+    while ((line = strtok_r(NULL, "\n", &save)) != NULL) {
+        if (n == RESOLVE_MAX ||
+            sscanf(line, "%63s %255s %127s", pkgs[n].name,
+                   pkgs[n].filename, pkgs[n].checksum) != 3) {
+            free(buf);
+            return -1;
+        }
+        /* the file name becomes a path under the package cache */
+        if (!install_filename_ok(pkgs[n].filename)) {
+            ui_error("bundle: invalid file name in plan: %s",
+                     pkgs[n].filename);
+            free(buf);
+            return -1;
+        }
+        pkgs[n].base_url[0] = '\0';
+        n++;
+    }
+
+    free(buf);
+    return n;
+}
+
+/*
+ * extract_member
+ *
+ * Copies a package member into the package cache (via
+ * install_part_path + rename, like a download) and returns its path
+ * in `local_path`.  `filename` has passed install_filename_ok
+ * (read_plan).
+ */
+static int extract_member(int fd, const struct member *m,
+                          const char *filename, char *local_path)
+{
+    if (mkdir(FLAPPY_PKG_CACHE_DIR, 0755) != 0 && errno != EEXIST) {
+        ui_error("cannot create cache directory: %s", strerror(errno));
+        return 1;
+    }
+
+    char part[INSTALL_PART_PATH_MAX];
+    snprintf(local_path, 512, "%s/%s", FLAPPY_PKG_CACHE_DIR, filename);
+    install_part_path(part, local_path);
+
+    int out = open(part, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC |
+                         O_NOFOLLOW, 0644);
+    if (out < 0) {
+        ui_error("cannot open %s: %s", part, strerror(errno));
+        return 1;
+    }
+
+    int rc = copy_range(fd, m->off, out, m->size);
+    if (close(out) != 0)
+        rc = 1;
+    if (!rc && rename(part, local_path) != 0)
+        rc = 1;
+    if (rc) {
+        ui_error("cannot copy %s out of bundle: %s", filename,
+                 strerror(errno));
+        unlink(part);
+    }
+    return rc;
+}
+
+int bundle_install(const char *path)
+{
+    if (install_guard()) {
+        ui_error("root privileges required");
+        return 1;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ui_error("cannot open bundle %s: %s", path, strerror(errno));
+        return 1;
+    }
+
+    struct member     *members = calloc(MEMBERS_MAX, sizeof(*members));
+    struct bundle_pkg *pkgs    = calloc(RESOLVE_MAX, sizeof(*pkgs));
+    const struct member **pm   = calloc(RESOLVE_MAX, sizeof(*pm));
+    int nmembers = 0, rc = 1;
+
+    if (!members || !pkgs || !pm) {
+        ui_error("out of memory");
+        goto out;
+    }
+
+    if (read_members(fd, members, MEMBERS_MAX, &nmembers) != 0) {
+        ui_error("bundle: %s is damaged or not a flappy bundle", path);
+        goto out;
+    }
+
+    const struct member *plan_m = find_member(members, nmembers,
+                                              "", PLAN_MEMBER);
+    int n = plan_m ? read_plan(fd, plan_m, pkgs) : -1;
+    if (n < 0) {
+        ui_error("bundle: missing or invalid install plan in %s", path);
+        goto out;
+    }
+
+    /* every archive must be present before anything is installed */
+    for (int i = 0; i < n; i++) {
+        pm[i] = find_member(members, nmembers, PKG_PREFIX,
+                            pkgs[i].filename);
+        if (!pm[i]) {
+            ui_error("bundle: %s is missing from %s", pkgs[i].filename,
+                     path);
+            goto out;
+        }
+    }
+
+    /* and nothing else: every member is the plan, repo.db or planned */
+    for (int i = 0; i < nmembers; i++) {
+        int known = strcmp(members[i].name, PLAN_MEMBER) == 0 ||
+                    strcmp(members[i].name, REPO_MEMBER) == 0;
+        for (int j = 0; j < n && !known; j++)
+            known = pm[j] == &members[i];
+        if (!known) {
+            ui_error("bundle: unexpected member %s in %s",
+                     members[i].name, path);
+            goto out;
+        }
+    }
+
+    ui_info("install order:");
+    for (int i = 0; i < n; i++)
+        fprintf(stderr, "  %d. %s\n", i + 1, pkgs[i].name);
+    fprintf(stderr, "\n");
+
+    log_info("bundle: installing %d package(s) from %s", n, path);
+
+    rc = 0;
+    for (int i = 0; i < n && !rc; i++) {
+        if (db_pkg_installed(pkgs[i].name)) {
+            ui_info("%s is already installed", pkgs[i].name);
+            continue;
+        }
+
+        char local_path[512];
+        ui_step("unpacking %s", pkgs[i].filename);
+        rc = extract_member(fd, pm[i], pkgs[i].filename, local_path) ||
+             install_package_file(pkgs[i].name, local_path,
+                                  pkgs[i].checksum);
+
+        if (rc)
+            ui_error("failed to install '%s' — stopping "
+                     "(subsequent packages not installed)", pkgs[i].name);
+    }
+
+out:
+    free(pm);
+    free(pkgs);
+    free(members);
+    close(fd);
+    return rc;
+}
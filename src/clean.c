@@ -4,8 +4,8 @@
  * flappy clean       : remove staging directory contents only
  * flappy clean --all : remove staging + cached package files
  *
- * Staging dir  : /var/cache/flappy/staging/
- * Package cache: /var/cache/flappy/packages/
+ * Staging dir  : /var/cache/flappy/staging/   (inside --root)
+ * Package cache: /var/cache/flappy/packages/  (host, shared by all roots)
  *
  * Exit codes:
  *   0 - success
@@ -22,6 +22,7 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include "flappy.h"
+#include "root.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,7 +35,6 @@
 #include <fcntl.h>
 
 #define STAGING_DIR  "/var/cache/flappy/staging"
-#define PACKAGES_DIR "/var/cache/flappy/packages"
 
 /* =========================================================================
  * remove_tree
@@ -207,15 +207,19 @@ int clean_cache(int all)
 {
     int errors = 0;
 
+    char staging[PATH_MAX];
+    if (root_path(staging, sizeof(staging), STAGING_DIR) != 0)
+        return 1;
+
     /* Always clean staging */
-    errors += clean_directory(STAGING_DIR);
+    errors += clean_directory(staging);
     if (errors == 0)
         printf("cleaned staging directory\n");
     else
         fprintf(stderr, "clean: errors while cleaning staging\n");
 
     if (all) {
-        int pkg_errors = clean_directory(PACKAGES_DIR);
+        int pkg_errors = clean_directory(FLAPPY_PKG_CACHE_DIR);
         if (pkg_errors == 0)
             printf("removed cached packages\n");
         else
@@ -1,15 +1,21 @@
 /*
  * cli.c - Command line dispatcher for Flappy
  *
- * getopt_long only processes global flags (--help, --version, --init-db).
+ * getopt_long only processes global flags (--help, --version, --init-db,
+ * --root).
  * Everything after the command name is passed raw to the handler.
  * POSIXLY_CORRECT behaviour: stop at first non-option argument.
  */
 
 #include "flappy.h"
+#include "bundle.h"
+#include "netsched.h"
 #include "repo.h"
+#include "root.h"
+#include "upgrade.h"
 
 #include <getopt.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -17,25 +23,130 @@ int cmd_install(int argc, char **argv);
 
 int cmd_update(int argc, char **argv)
 {
-    const char *url = FLAPPY_DEFAULT_REPO_URL;
+    /* no URL: every repository in repos.conf (or the default) */
+    const char *url = NULL;
     if (argc >= 1 && argv[0] && strlen(argv[0]) > 0)
         url = argv[0];
     return repo_update(url);
 }
 
+#define SEARCH_TEXT_DEFAULT_LIMIT 20
+
+static int parse_count(const char *s, long *out)
+{
+    char *end = NULL;
+    long v = strtol(s, &end, 10);
+    if (!s[0] || *end || v < 1)
+        return 1;
+    *out = v;
+    return 0;
+}
+
 int cmd_search(int argc, char **argv)
 {
     const char *term = NULL;
-    if (argc > 0)
-        term = argv[0];
-    return repo_search(term);
+    int  text  = 0;
+    long limit = 0;
+    long page  = 1;
+    int  limit_set = 0;
+
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--text") == 0) {
+            text = 1;
+        } else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+            if (parse_count(argv[++i], &limit))
+                goto usage;
+            limit_set = 1;
+        } else if (strcmp(argv[i], "--page") == 0 && i + 1 < argc) {
+            if (parse_count(argv[++i], &page))
+                goto usage;
+        } else if (argv[i][0] == '-' || term) {
+            goto usage;
+        } else {
+            term = argv[i];
+        }
+    }
+
+    if (text) {
+        if (!term)
+            goto usage;
+        if (!limit_set)
+            limit = SEARCH_TEXT_DEFAULT_LIMIT;
+        return repo_search_text(term, limit, page);
+    }
+
+    if (page > 1 && !limit_set)
+        goto usage;
+
+    if (term && strpbrk(term, "*?"))
+        return repo_search_glob(term, limit, page);
+
+    return repo_search(term, limit, page);
+
+usage:
+    fprintf(stderr,
+            "usage: flappy search [term] [--limit N] [--page P]\n"
+            "       flappy search --text <query> [--limit N] [--page P]\n");
+    return 2;
 }
 
 int cmd_upgrade(int argc, char **argv)
 {
-    (void)argc;
-    (void)argv;
-    return repo_upgrade();
+    int apply = 0;
+    int download_only = 0;
+    long long rate = 0;
+
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--apply") == 0) {
+            apply = 1;
+        } else if (strcmp(argv[i], "--download-only") == 0) {
+            download_only = 1;
+        } else if (strcmp(argv[i], "--limit-rate") == 0 && i + 1 < argc) {
+            if (netsched_parse_rate(argv[++i], &rate))
+                goto usage;
+        } else {
+            goto usage;
+        }
+    }
+
+    if ((apply && download_only) || (rate && !download_only))
+        goto usage;
+
+    if (download_only)
+        return upgrade_download_only(rate);
+    return apply ? upgrade_apply() : repo_upgrade();
+
+usage:
+    fprintf(stderr,
+            "usage: flappy upgrade [--apply]\n"
+            "       flappy upgrade --download-only [--limit-rate RATE]\n");
+    return 2;
+}
+
+#define BUNDLE_DEFAULT_PATH "flappy-bundle.tar"
+
+int cmd_bundle(int argc, char **argv)
+{
+    const char *out = BUNDLE_DEFAULT_PATH;
+    int first = 0;
+
+    if (argc >= 2 && strcmp(argv[0], "-o") == 0) {
+        out   = argv[1];
+        first = 2;
+    }
+
+    if (first >= argc)
+        goto usage;
+    for (int i = first; i < argc; i++)
+        if (argv[i][0] == '-')
+            goto usage;
+
+    return bundle_create(out, (const char *const *)&argv[first],
+                         argc - first);
+
+usage:
+    fprintf(stderr, "usage: flappy bundle [-o file] <pkg>...\n");
+    return 2;
 }
 
 struct command {
@@ -59,6 +170,7 @@ static const struct command commands[] = {
     { "search",     0, cmd_search     },
     { "upgrade",    0, cmd_upgrade    },
     { "install",    1, cmd_install    },
+    { "bundle",     1, cmd_bundle     },
     { "remove",     1, cmd_remove     },
     { "purge",      1, cmd_purge      },
     { "autoremove", 0, cmd_autoremove },
@@ -83,6 +195,20 @@ static int handle_command(const char *cmd, int argc, char **argv)
     return 127;
 }
 
+int cli_apply_root(int argc, char **argv)
+{
+    /* same scope as getopt below: options before the command name */
+    for (int i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0)
+            break;
+        if (strcmp(argv[i], "--root") == 0 && i + 1 < argc)
+            return root_set(argv[++i]) ? 2 : 0;
+        if (strncmp(argv[i], "--root=", 7) == 0)
+            return root_set(argv[i] + 7) ? 2 : 0;
+    }
+    return 0;
+}
+
 int cli_dispatch(int argc, char **argv)
 {
     /*
@@ -95,6 +221,7 @@ int cli_dispatch(int argc, char **argv)
         { "help",    no_argument, 0, 'h'  },
         { "version", no_argument, 0, 'v'  },
         { "init-db", no_argument, 0, 1001 },
+        { "root",    required_argument, 0, 1002 },
         { 0, 0, 0, 0 }
     };
 
@@ -104,6 +231,7 @@ int cli_dispatch(int argc, char **argv)
         case 'h':   return cmd_help(0, NULL);
         case 'v':   return cmd_version(0, NULL);
         case 1001:  return db_bootstrap_install();
+        case 1002:  break;      /* applied by cli_apply_root */
         default:
             fprintf(stderr, "Invalid option\nTry 'flappy help'\n");
             log_error("invalid CLI option");
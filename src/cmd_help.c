@@ -8,11 +8,12 @@ int cmd_help(int argc, char **argv)
     printf(
         "Flappy - Package manager for FlucidOS\n\n"
         "Usage:\n"
-        "  flappy <command> [args]\n\n"
+        "  flappy [--root <dir>] <command> [args]\n\n"
         "Core:\n"
         "  help\n"
         "  version\n"
-        "  --init-db\n\n"
+        "  --init-db\n"
+        "  --root <dir> <command>\n\n"
         "Query:\n"
         "  list\n"
         "  info <pkg>\n"
@@ -23,18 +24,24 @@ int cmd_help(int argc, char **argv)
         "  rdepends <pkg>\n"
         "  orphans\n\n"
         "Repository:\n"
-        "  update\n"
+        "  update [url]\n"
         "  search [term]\n"
-        "  upgrade\n\n"
+        "  search --text <query>\n"
+        "  upgrade\n"
+        "  upgrade --apply\n"
+        "  upgrade --download-only [--limit-rate RATE]\n\n"
         "Install:\n"
-        "  install <pkg>\n\n"
+        "  install <pkg>\n"
+        "  install --bundle <file>\n"
+        "  install --bootstrap <pkg>...\n"
+        "  bundle [-o file] <pkg>...\n\n"
         "Removal:\n"
         "  remove <pkg>\n"
         "  purge <pkg>\n"
         "  purge --force <pkg>\n"
         "  autoremove\n\n"
         "Maintenance:\n"
-        "  verify\n"
+        "  verify [--deep | --full] [--path PREFIX]... [pkg...]\n"
         "  clean\n"
         "  clean --all\n\n"
     );
@@ -12,19 +12,48 @@
  * All atomicity and integrity guarantees are preserved per-package.
  * If any package in the chain fails, installation stops and the
  * remaining packages are not attempted.
+ *
+ * `install --bundle <file>` installs the plan stored in an offline
+ * bundle (bundle.h) instead: no repository, no resolution.
+ *
+ * `install --bootstrap <pkg>...` populates an empty root (usually with
+ * --root) through the fast path in bootstrap.h.
  */
 
 #include "flappy.h"
+#include "bootstrap.h"
+#include "bundle.h"
 #include "resolve.h"
 
 #include <stdio.h>
+#include <string.h>
 
 int cmd_install(int argc, char **argv)
 {
-    if (argc < 1) {
-        fprintf(stderr, "usage: flappy install <package>\n");
-        return 2;
+    if (argc >= 1 && strcmp(argv[0], "--bundle") == 0) {
+        if (argc != 2)
+            goto usage;
+        return bundle_install(argv[1]);
+    }
+
+    if (argc >= 1 && strcmp(argv[0], "--bootstrap") == 0) {
+        if (argc < 2)
+            goto usage;
+        for (int i = 1; i < argc; i++)
+            if (argv[i][0] == '-')
+                goto usage;
+        return bootstrap_install((const char *const *)&argv[1], argc - 1);
     }
 
+    if (argc < 1 || argv[0][0] == '-')
+        goto usage;
+
     return resolve_and_install(argv[0]);
+
+usage:
+    fprintf(stderr,
+            "usage: flappy install <package>\n"
+            "       flappy install --bundle <file>\n"
+            "       flappy install --bootstrap <package>...\n");
+    return 2;
 }
\ No newline at end of file
@@ -1,29 +1,77 @@
 /*
  * cmd_verify.c - CLI handler for `flappy verify`
  *
- * Checks every installed file exists on disk.
- * Reports missing or invalid files with owning package.
- * Never mutates anything.
+ * Checks every installed file is on disk as packaged: regular files
+ * are regular files, symlinks point where they were packaged to.
+ * With --deep, also rehashes every file whose metadata changed since
+ * the last deep check against its recorded SHA256; --full rehashes
+ * every file.  Package names and --path prefixes narrow the check to
+ * those packages' files and to files under those paths.  Reports
+ * missing, invalid and modified files with owning package.  Never
+ * touches installed files; a deep check records what it found intact
+ * in the verify cache.
  *
  * Usage:
- *   flappy verify
+ *   flappy verify [--deep | --full] [--path PREFIX]... [pkg...]
  *
  * Exit codes:
- *   0 - system consistent
- *   1 - inconsistencies found
+ *   0 - checked files consistent
+ *   1 - inconsistencies found, or a package is not installed
+ *   2 - invalid usage
  */
 
 #include "flappy.h"
 #include "maintenance.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 int cmd_verify(int argc, char **argv)
 {
-    (void)argc;
-    (void)argv;
+    int flags = 0;
+    struct verify_scope scope = {0};
+    int rc = 2;
+
+    /* Every argument could be a package or a prefix */
+    scope.pkgs  = calloc((size_t)argc + 1, sizeof(*scope.pkgs));
+    scope.paths = calloc((size_t)argc + 1, sizeof(*scope.paths));
+    if (!scope.pkgs || !scope.paths) {
+        rc = 1;
+        goto out;
+    }
+
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--deep") == 0) {
+            flags |= VERIFY_DEEP;
+        } else if (strcmp(argv[i], "--full") == 0) {
+            flags |= VERIFY_FULL;
+        } else if (strcmp(argv[i], "--path") == 0 && i + 1 < argc &&
+                   argv[i + 1][0] == '/') {
+            /* "/usr/lib/" and "/usr/lib" alike; "/" becomes "" */
+            char *p = argv[++i];
+            size_t len = strlen(p);
+            while (len > 0 && p[len - 1] == '/')
+                p[--len] = '\0';
+            scope.paths[scope.npaths++] = p;
+        } else if (argv[i][0] != '-') {
+            scope.pkgs[scope.npkgs++] = argv[i];
+        } else {
+            goto usage;
+        }
+    }
 
     db_open_or_die();
-    int rc = verify_system();
+    rc = verify_system(flags, &scope);
     db_close();
+    goto out;
 
+usage:
+    fprintf(stderr,
+            "usage: flappy verify [--deep | --full] [--path PREFIX]... "
+            "[pkg...]\n");
+out:
+    free(scope.pkgs);
+    free(scope.paths);
     return rc;
-}
\ No newline at end of file
+}
@@ -5,12 +5,22 @@
  * Maintains a global database connection that persists throughout application runtime.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 /**
  * db_open_or_die - Open database connection and validate schema version
  *
  * Opens the SQLite database specified by FLAPPY_DB_PATH and validates that the
- * schema version matches the expected FLAPPY_SCHEMA_VERSION. If any step fails
- * or schema mismatch is detected, logs an error and terminates the application.
+ * schema version matches the expected FLAPPY_SCHEMA_VERSION. Older schemas
+ * with a migration path are upgraded in place (db_migrate); this needs write
+ * access to the database. If any step fails or schema mismatch is detected,
+ * logs an error and terminates the application.
+ *
+ * The connection has the version SQL functions registered
+ * (version_sql_register), so queries may use version_key() etc.
+ * An upgrade a crash interrupted is then finished or undone
+ * (install_upgrade_recover); that too needs write access, and is
+ * skipped without it.
  *
  * Fatal errors trigger immediate application exit with exit code 1.
  * Errors include: database open failure, schema metadata query failure,
@@ -29,8 +39,12 @@
  */
 #include "flappy.h"
 #include "db_guard.h"
+#include "install.h"
+#include "root.h"
+#include "version.h"
 
 #include <sqlite3.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -42,7 +56,13 @@ sqlite3 *db_handle(void) {
 }
 
 void db_open_or_die(void) {
-    int rc = sqlite3_open(FLAPPY_DB_PATH, &G_DB);
+    char path[PATH_MAX];
+    if (root_path(path, sizeof(path), FLAPPY_DB_PATH) != 0) {
+        fprintf(stderr, "Fatal: root path too long\n");
+        exit(1);
+    }
+
+    int rc = sqlite3_open(path, &G_DB);
     if (rc != SQLITE_OK)
         db_die(G_DB, rc, "open");
 
@@ -62,6 +82,9 @@ void db_open_or_die(void) {
     int v = sqlite3_column_int(st, 0);
     sqlite3_finalize(st);
 
+    if (v < FLAPPY_SCHEMA_VERSION && db_migrate(G_DB, v) == 0)
+        v = FLAPPY_SCHEMA_VERSION;
+
     if (v != FLAPPY_SCHEMA_VERSION) {
         log_error("schema version mismatch: got=%d expected=%d",
                   v, FLAPPY_SCHEMA_VERSION);
@@ -70,7 +93,15 @@ void db_open_or_die(void) {
         exit(1);
     }
 
+    rc = version_sql_register(G_DB);
+    if (rc != SQLITE_OK)
+        db_die(G_DB, rc, "register functions");
+
     sqlite3_exec(G_DB, "PRAGMA foreign_keys = ON;", NULL, NULL, NULL);
+
+    if (install_upgrade_recover() < 0)
+        log_error("cannot recover an interrupted upgrade: %s",
+                  sqlite3_errmsg(G_DB));
 }
 
 void db_close(void) {
@@ -78,3 +109,29 @@ void db_close(void) {
     G_DB = NULL;
 }
 
+int db_pkg_installed(const char *name) {
+    sqlite3 *db = G_DB;
+    char path[PATH_MAX];
+
+    /* Resolvers ask while the DB is closed: a short-lived read-only one */
+    if (!db && (root_path(path, sizeof(path), FLAPPY_DB_PATH) != 0 ||
+                sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY,
+                                NULL) != SQLITE_OK)) {
+        sqlite3_close(db);
+        return 0;
+    }
+
+    sqlite3_stmt *st = NULL;
+    int found = 0;
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM packages WHERE name = ?;",
+                           -1, &st, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(st, 1, name, -1, SQLITE_STATIC);
+        found = sqlite3_step(st) == SQLITE_ROW;
+    }
+
+    sqlite3_finalize(st);
+    if (db != G_DB)
+        sqlite3_close(db);
+    return found;
+}
+
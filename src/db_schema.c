@@ -1,5 +1,9 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "flappy.h"
 #include "db_guard.h"
+#include "root.h"
+#include "version.h"
 #include "ui.h"
 
 #include <sqlite3.h>
@@ -7,6 +11,8 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -24,18 +30,37 @@ static const char *SCHEMA_SQL =
     "  schema_version INTEGER NOT NULL"
     ");"
     "DELETE FROM meta;"
-    "INSERT INTO meta(schema_version) VALUES (2);"
+    "INSERT INTO meta(schema_version) VALUES (8);"
     "CREATE TABLE IF NOT EXISTS packages ("
     "  id INTEGER PRIMARY KEY,"
     "  name TEXT UNIQUE NOT NULL,"
     "  version TEXT NOT NULL,"
-    "  explicit INTEGER NOT NULL CHECK (explicit IN (0,1))"
+    "  explicit INTEGER NOT NULL CHECK (explicit IN (0,1)),"
+    "  version_key BLOB"
     ");"
+    "CREATE INDEX IF NOT EXISTS packages_version_key"
+    "  ON packages(version_key);"
     "CREATE TABLE IF NOT EXISTS files ("
     "  path TEXT PRIMARY KEY,"
     "  package_id INTEGER NOT NULL,"
+    "  size INTEGER,"
+    "  mode INTEGER,"
+    "  sha256 TEXT,"
+    "  link_target TEXT,"
     "  FOREIGN KEY(package_id) REFERENCES packages(id) ON DELETE CASCADE"
     ");"
+    "CREATE INDEX IF NOT EXISTS files_package_id"
+    "  ON files(package_id);"
+    "CREATE TABLE IF NOT EXISTS verify_cache ("
+    "  path TEXT PRIMARY KEY"
+    "    REFERENCES files(path) ON DELETE CASCADE,"
+    "  sha256 TEXT NOT NULL,"
+    "  dev INTEGER NOT NULL,"
+    "  ino INTEGER NOT NULL,"
+    "  size INTEGER NOT NULL,"
+    "  mtime INTEGER NOT NULL,"
+    "  ctime INTEGER NOT NULL"
+    ");"
     "CREATE TABLE IF NOT EXISTS dependencies ("
     "  package_id INTEGER NOT NULL,"
     "  depends_on INTEGER NOT NULL,"
@@ -43,14 +68,131 @@ static const char *SCHEMA_SQL =
     "  FOREIGN KEY(package_id) REFERENCES packages(id) ON DELETE CASCADE,"
     "  FOREIGN KEY(depends_on) REFERENCES packages(id) ON DELETE CASCADE"
     ");"
+    "CREATE TABLE IF NOT EXISTS upgrade_swaps ("
+    "  path TEXT PRIMARY KEY,"
+    "  package TEXT NOT NULL,"
+    "  stage INTEGER NOT NULL"
+    ");"
     "COMMIT;";
 
+/*
+ * Migration ladder.
+ *
+ * MIGRATIONS[i] upgrades schema version (i + 2) to (i + 3).  Each step
+ * runs in its own BEGIN IMMEDIATE transaction and ends by bumping
+ * meta.schema_version, so an interrupted migration resumes from the
+ * last completed step on the next open.
+ *
+ *   v2 -> v3  packages.version_key (see version_key() in version.c)
+ *   v3 -> v4  files.size / mode / sha256: the packaged content of each
+ *             file, for differential upgrades.  NULL on migrated rows
+ *             (unknown), so their next upgrade rewrites them.
+ *   v4 -> v5  files.link_target: what a symlink points to, for verify.
+ *             NULL for other files and on migrated rows; verify then
+ *             checks a link against its sha256.
+ *   v5 -> v6  verify_cache: the metadata of each file as it was when
+ *             `verify --deep` last hashed it and found it intact.
+ *   v6 -> v7  files_package_id: the files of one package by index
+ *             (verify <pkg>, files, removal) instead of a table scan.
+ *   v7 -> v8  upgrade_swaps: the paths an in-place upgrade is
+ *             replacing, until it has finished (install_commit.c).
+ */
+static const char *MIGRATIONS[] = {
+    /* v2 -> v3 */
+    "ALTER TABLE packages ADD COLUMN version_key BLOB;"
+    "UPDATE packages SET version_key = version_key(version);"
+    "CREATE INDEX IF NOT EXISTS packages_version_key"
+    "  ON packages(version_key);"
+    "UPDATE meta SET schema_version = 3;",
+
+    /* v3 -> v4 */
+    "ALTER TABLE files ADD COLUMN size INTEGER;"
+    "ALTER TABLE files ADD COLUMN mode INTEGER;"
+    "ALTER TABLE files ADD COLUMN sha256 TEXT;"
+    "UPDATE meta SET schema_version = 4;",
+
+    /* v4 -> v5 */
+    "ALTER TABLE files ADD COLUMN link_target TEXT;"
+    "UPDATE meta SET schema_version = 5;",
+
+    /* v5 -> v6 */
+    "CREATE TABLE IF NOT EXISTS verify_cache ("
+    "  path TEXT PRIMARY KEY"
+    "    REFERENCES files(path) ON DELETE CASCADE,"
+    "  sha256 TEXT NOT NULL,"
+    "  dev INTEGER NOT NULL,"
+    "  ino INTEGER NOT NULL,"
+    "  size INTEGER NOT NULL,"
+    "  mtime INTEGER NOT NULL,"
+    "  ctime INTEGER NOT NULL"
+    ");"
+    "UPDATE meta SET schema_version = 6;",
+
+    /* v6 -> v7 */
+    "CREATE INDEX IF NOT EXISTS files_package_id"
+    "  ON files(package_id);"
+    "UPDATE meta SET schema_version = 7;",
+
+    /* v7 -> v8 */
+    "CREATE TABLE IF NOT EXISTS upgrade_swaps ("
+    "  path TEXT PRIMARY KEY,"
+    "  package TEXT NOT NULL,"
+    "  stage INTEGER NOT NULL"
+    ");"
+    "UPDATE meta SET schema_version = 8;",
+};
+
+#define MIGRATION_BASE 2
+#define MIGRATION_COUNT (sizeof(MIGRATIONS) / sizeof(MIGRATIONS[0]))
+
+int db_migrate(sqlite3 *db, int from)
+{
+    if (from < MIGRATION_BASE ||
+        from >= MIGRATION_BASE + (int)MIGRATION_COUNT)
+        return 1;
+
+    /* migration SQL calls version_key() */
+    if (version_sql_register(db) != SQLITE_OK)
+        return 1;
+
+    for (int v = from; v < MIGRATION_BASE + (int)MIGRATION_COUNT; v++) {
+        if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL)
+                != SQLITE_OK) {
+            log_error("migration v%d: begin failed: %s",
+                      v, sqlite3_errmsg(db));
+            return 1;
+        }
+
+        if (sqlite3_exec(db, MIGRATIONS[v - MIGRATION_BASE],
+                         NULL, NULL, NULL) != SQLITE_OK) {
+            log_error("migration v%d -> v%d failed: %s",
+                      v, v + 1, sqlite3_errmsg(db));
+            sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+            return 1;
+        }
+
+        if (sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+            log_error("migration v%d: commit failed: %s",
+                      v, sqlite3_errmsg(db));
+            sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+            return 1;
+        }
+
+        log_info("database migrated: schema v%d -> v%d", v, v + 1);
+    }
+
+    return 0;
+}
+
 static void mkdir_or_die(const char *p) {
-    if (mkdir(p, 0755) == -1 && errno != EEXIST) {
+    const char *leaf;
+    int dfd = root_at(p, 0, &leaf);
+    if (dfd < 0 || (mkdirat(dfd, leaf, 0755) == -1 && errno != EEXIST)) {
         log_error("mkdir failed: %s: %s", p, strerror(errno));
         fprintf(stderr, "Fatal: cannot create %s\n", p);
         exit(1);
     }
+    root_at_done(dfd);
 }
 
 int db_bootstrap_install(void) {
@@ -59,7 +201,13 @@ int db_bootstrap_install(void) {
 
     mkdir_or_die(FLAPPY_DB_DIR);
 
-    rc = sqlite3_open(FLAPPY_DB_PATH, &db);
+    char path[PATH_MAX];
+    if (root_path(path, sizeof(path), FLAPPY_DB_PATH) != 0) {
+        fprintf(stderr, "Fatal: root path too long\n");
+        exit(1);
+    }
+
+    rc = sqlite3_open(path, &db);
     if (rc != SQLITE_OK) db_die(db, rc, "open");
 
     /* Apply PRAGMA outside the transaction — SQLite ignores it inside one */
@@ -71,7 +219,7 @@ int db_bootstrap_install(void) {
 
     sqlite3_close(db);
 
-    if (chown(FLAPPY_DB_PATH, 0, 0) != 0 || chmod(FLAPPY_DB_PATH, 0600) != 0) {
+    if (chown(path, 0, 0) != 0 || chmod(path, 0600) != 0) {
         log_error("permission set failed on db");
         fprintf(stderr, "Fatal: cannot secure database file\n");
         exit(1);
@@ -0,0 +1,575 @@
+/*
+ * digest.c - Shared file and stream digests (SHA256, BLAKE3)
+ *
+ * Extracted from install_verify.c so that both install_verify.c and
+ * repo_update.c use the same OpenSSL EVP implementation.
+ *
+ * Previously repo_update.c used popen("sha256sum ...") which:
+ *   - depends on sha256sum existing on the target
+ *   - uses an uncontrolled PATH lookup
+ *   - could silently accept a truncated hash via fscanf("%64s")
+ *   - has a different security boundary than the package integrity check
+ *
+ * This file centralises the implementation once.  It was sha256.c
+ * until BLAKE3 package checksums arrived; a digest_stream now wraps
+ * either an EVP context or a blake3_hasher, and everything above it
+ * (file reads, batches, threads) is shared.
+ *
+ * Files are read with read(2), bypassing stdio's extra copy, in
+ * DIGEST_READ_SIZE blocks into a page-aligned buffer.  Larger blocks
+ * measured slower on page-cached files: the block no longer stays in
+ * L2 between the copy and the digest.  A file that fills the first
+ * block is hinted POSIX_FADV_SEQUENTIAL so readahead runs ahead of the
+ * digest; smaller ones are not worth the extra syscall.
+ *
+ * digest_batch hashes many files on a pool of threads, one stream
+ * and one buffer per thread, reset rather than reallocated between
+ * files.  The SHA256 digest is OpenSSL's, which picks the SHA-NI or
+ * AVX2 kernel for the CPU at run time.  SHA256 is fetched from the
+ * provider once per process: OpenSSL 3 otherwise repeats the lookup on
+ * every init, which triples the cost of the init.
+ *
+ * A BLAKE3 file larger than DIGEST_TREE_MIN is hashed as a tree
+ * instead (blake3_tree): every DIGEST_READ_SIZE piece but the last is
+ * a complete subtree, read with pread and hashed by whichever worker
+ * claims it, and the pieces' chaining values are combined in order on
+ * the calling thread with the tail.  The pieces are claimed in file
+ * order, so the disk still sees one mostly sequential stream.  It is
+ * used on one CPU too, the pieces then hashed inline: it measured
+ * about 15% faster there than streaming the file through a hasher.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "digest.h"
+#include "blake3.h"
+#include "root.h"
+
+#include <openssl/evp.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DIGEST_TREE_MIN (1024 * 1024)
+
+/*
+ * hex_encode
+ *
+ * Converts raw digest bytes into a lowercase hex string.
+ * out must be at least (digest_len * 2 + 1) bytes.
+ */
+static void hex_encode(const unsigned char *digest,
+                       unsigned int digest_len,
+                       char *out)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    for (unsigned int i = 0; i < digest_len; i++) {
+        out[i * 2]     = hex[(digest[i] >> 4) & 0xF];
+        out[i * 2 + 1] = hex[digest[i] & 0xF];
+    }
+
+    out[digest_len * 2] = '\0';
+}
+
+int digest_parse(const char *checksum, enum digest_alg *alg,
+                 const char **hex)
+{
+    size_t plen = strlen(DIGEST_BLAKE3_PREFIX);
+
+    if (strncmp(checksum, DIGEST_BLAKE3_PREFIX, plen) == 0) {
+        *alg = DIGEST_BLAKE3;
+        *hex = checksum + plen;
+        return 0;
+    }
+
+    /* Some later algorithm: refuse rather than compare against SHA256 */
+    if (strchr(checksum, ':'))
+        return 1;
+
+    *alg = DIGEST_SHA256;
+    *hex = checksum;
+    return 0;
+}
+
+const char *digest_name(enum digest_alg alg)
+{
+    return alg == DIGEST_BLAKE3 ? "blake3" : "sha256";
+}
+
+/* =========================================================================
+ * Streams
+ * ========================================================================= */
+
+/* The SHA256 implementation, fetched once */
+static const EVP_MD *fetched_md;
+
+static void fetch_md(void)
+{
+    fetched_md = EVP_MD_fetch(NULL, "SHA256", NULL);
+}
+
+static const EVP_MD *sha256_md(void)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    pthread_once(&once, fetch_md);
+    return fetched_md ? fetched_md : EVP_sha256();
+}
+
+struct digest_stream {
+    enum digest_alg       alg;
+    EVP_MD_CTX           *ctx;      /* DIGEST_SHA256 */
+    struct blake3_hasher  b3;       /* DIGEST_BLAKE3 */
+};
+
+/* Internal steps print nothing: batches report per job.  0, or -1. */
+static int stream_reset(struct digest_stream *s)
+{
+    if (s->alg == DIGEST_BLAKE3) {
+        blake3_init(&s->b3);
+        return 0;
+    }
+    return EVP_DigestInit_ex(s->ctx, sha256_md(), NULL) == 1 ? 0 : -1;
+}
+
+static int stream_update(struct digest_stream *s, const void *data,
+                         size_t len)
+{
+    if (s->alg == DIGEST_BLAKE3) {
+        blake3_update(&s->b3, data, len);
+        return 0;
+    }
+    return EVP_DigestUpdate(s->ctx, data, len) == 1 ? 0 : -1;
+}
+
+static int stream_final(struct digest_stream *s, char out[65])
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int  digest_len = 0;
+
+    if (s->alg == DIGEST_BLAKE3) {
+        blake3_final(&s->b3, digest);
+        digest_len = BLAKE3_OUT_LEN;
+    } else if (EVP_DigestFinal_ex(s->ctx, digest, &digest_len) != 1) {
+        return -1;
+    }
+
+    hex_encode(digest, digest_len, out);
+    return 0;
+}
+
+/* A stream that still needs stream_reset; NULL on allocation failure */
+static struct digest_stream *stream_alloc(enum digest_alg alg)
+{
+    struct digest_stream *s = malloc(sizeof(*s));
+    if (!s)
+        return NULL;
+
+    s->alg = alg;
+    s->ctx = NULL;
+    if (alg == DIGEST_SHA256 && !(s->ctx = EVP_MD_CTX_new())) {
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+struct digest_stream *digest_stream_new(enum digest_alg alg)
+{
+    struct digest_stream *s = stream_alloc(alg);
+
+    if (!s || stream_reset(s) != 0) {
+        fprintf(stderr, "%s: digest init failed\n", digest_name(alg));
+        digest_stream_free(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+int digest_stream_update(struct digest_stream *s,
+                         const void *data, size_t len)
+{
+    if (stream_update(s, data, len) != 0) {
+        fprintf(stderr, "%s: digest update failed\n", digest_name(s->alg));
+        return 1;
+    }
+    return 0;
+}
+
+int digest_stream_final(struct digest_stream *s, char out[65])
+{
+    if (stream_final(s, out) != 0) {
+        fprintf(stderr, "%s: digest final failed\n", digest_name(s->alg));
+        return 1;
+    }
+    return 0;
+}
+
+void digest_stream_free(struct digest_stream *s)
+{
+    if (!s)
+        return;
+    EVP_MD_CTX_free(s->ctx);
+    free(s);
+}
+
+/* =========================================================================
+ * Files
+ * ========================================================================= */
+
+/*
+ * hash_fd
+ *
+ * Digests everything left to read on `fd` through `s`, reading into
+ * `buf` (`bufsize` bytes, at most DIGEST_READ_SIZE).  *bytes is the
+ * amount read.  Returns 0, the errno of a failed read, or -1 if the
+ * digest failed.
+ */
+static int hash_fd(struct digest_stream *s, int fd, unsigned char *buf,
+                   size_t bufsize, char out[65], long long *bytes)
+{
+    *bytes = 0;
+
+    if (stream_reset(s) != 0)
+        return -1;
+
+    for (;;) {
+        ssize_t got = read(fd, buf, bufsize);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        if (got == 0)
+            break;
+
+        if (*bytes == 0 && got == DIGEST_READ_SIZE)
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        if (stream_update(s, buf, (size_t)got) != 0)
+            return -1;
+        *bytes += got;
+    }
+
+    return stream_final(s, out);
+}
+
+static unsigned char *read_buffer(size_t size)
+{
+    void *buf = NULL;
+    if (posix_memalign(&buf, 4096, size) != 0)
+        return NULL;
+    return buf;
+}
+
+/* Reads exactly `len` bytes at `off`.  0, or an errno (EIO: file shrank) */
+static int pread_full(int fd, unsigned char *buf, size_t len, off_t off)
+{
+    while (len > 0) {
+        ssize_t got = pread(fd, buf, len, off);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        if (got == 0)
+            return EIO;
+        buf += got;
+        len -= (size_t)got;
+        off += got;
+    }
+    return 0;
+}
+
+static int online_cpus(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus < 1 ? 1 : cpus > DIGEST_MAX_WORKERS ? DIGEST_MAX_WORKERS
+                                                    : (int)cpus;
+}
+
+/* ---- BLAKE3 tree ---- */
+
+struct tree {
+    int                 fd;
+    uint32_t          (*cvs)[8];    /* one per piece */
+    size_t              npieces;
+    size_t              next;
+    int                 err;
+    pthread_mutex_t     lock;
+};
+
+static void *tree_worker(void *arg)
+{
+    struct tree   *t   = arg;
+    unsigned char *buf = read_buffer(DIGEST_READ_SIZE);
+
+    for (;;) {
+        pthread_mutex_lock(&t->lock);
+        size_t i = t->next < t->npieces ? t->next++ : (size_t)-1;
+        pthread_mutex_unlock(&t->lock);
+
+        if (i == (size_t)-1)
+            break;
+
+        off_t off = (off_t)i * DIGEST_READ_SIZE;
+        int err = buf ? pread_full(t->fd, buf, DIGEST_READ_SIZE, off)
+                      : ENOMEM;
+        if (err) {
+            pthread_mutex_lock(&t->lock);
+            if (!t->err)
+                t->err = err;
+            t->next = t->npieces;       /* the others stop too */
+            pthread_mutex_unlock(&t->lock);
+            break;
+        }
+
+        blake3_subtree_cv(buf, DIGEST_READ_SIZE,
+                          (uint64_t)off / BLAKE3_CHUNK_LEN, t->cvs[i]);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+/*
+ * blake3_tree
+ *
+ * BLAKE3 of the `size`-byte file on `fd`, its pieces hashed on up to
+ * `nworkers` threads.  Returns 0 or an errno, like hash_fd.
+ */
+static int blake3_tree(int fd, off_t size, int nworkers,
+                       unsigned char *buf, char out[65], long long *bytes)
+{
+    struct tree t = {
+        .fd      = fd,
+        .npieces = (size_t)((size - 1) / DIGEST_READ_SIZE),
+    };
+
+    *bytes = 0;
+    t.cvs = malloc(t.npieces * sizeof(*t.cvs));
+    if (!t.cvs)
+        return ENOMEM;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    pthread_mutex_init(&t.lock, NULL);
+
+    pthread_t workers[DIGEST_MAX_WORKERS];
+    int started = 0;
+
+    for (int i = 0; nworkers > 1 && i < nworkers; i++) {
+        if (pthread_create(&workers[i], NULL, tree_worker, &t) != 0)
+            break;
+        started++;
+    }
+
+    /* One CPU, or no thread at all: hash the pieces on this one */
+    if (started == 0)
+        tree_worker(&t);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    pthread_mutex_destroy(&t.lock);
+
+    if (t.err) {
+        free(t.cvs);
+        return t.err;
+    }
+
+    struct blake3_hasher h;
+    blake3_init(&h);
+    for (size_t i = 0; i < t.npieces; i++)
+        blake3_push_subtree(&h, t.cvs[i], DIGEST_READ_SIZE);
+    free(t.cvs);
+
+    /* The tail, at least one byte, holds the root */
+    off_t off = (off_t)t.npieces * DIGEST_READ_SIZE;
+    for (;;) {
+        ssize_t got = pread(fd, buf, DIGEST_READ_SIZE, off);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        if (got == 0)
+            break;
+        blake3_update(&h, buf, (size_t)got);
+        off += got;
+    }
+
+    unsigned char digest[BLAKE3_OUT_LEN];
+    blake3_final(&h, digest);
+    hex_encode(digest, BLAKE3_OUT_LEN, out);
+    *bytes = off;
+    return 0;
+}
+
+int digest_file(enum digest_alg alg, const char *path, char out[65])
+{
+    const char *name = digest_name(alg);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "%s: cannot open %s\n", name, path);
+        return 1;
+    }
+
+    /*
+     * A whole block is an mmap and a round of page faults per call; a
+     * small file only needs its size.  Batches keep one per thread.
+     */
+    struct stat st;
+    size_t bufsize = DIGEST_READ_SIZE;
+    int have_size = fstat(fd, &st) == 0;
+    if (have_size && st.st_size < DIGEST_READ_SIZE)
+        bufsize = ((size_t)st.st_size + 4096) & ~(size_t)4095;
+
+    struct digest_stream *s = NULL;
+    unsigned char *buf = read_buffer(bufsize);
+    long long bytes;
+    int err = 1;
+    int nworkers = online_cpus();
+
+    if (buf && alg == DIGEST_BLAKE3 && have_size &&
+            st.st_size > DIGEST_TREE_MIN) {
+        err = blake3_tree(fd, st.st_size, nworkers, buf, out, &bytes);
+    } else if (!buf || !(s = stream_alloc(alg))) {
+        fprintf(stderr, "%s: out of memory\n", name);
+        goto out;
+    } else {
+        err = hash_fd(s, fd, buf, bufsize, out, &bytes);
+    }
+
+    if (err < 0)
+        fprintf(stderr, "%s: digest failed on %s\n", name, path);
+    else if (err)
+        fprintf(stderr, "%s: read error on %s: %s\n",
+                name, path, strerror(err));
+
+out:
+    digest_stream_free(s);
+    free(buf);
+    close(fd);
+    return err ? 1 : 0;
+}
+
+/* =========================================================================
+ * Batch digest
+ * ========================================================================= */
+
+struct batch {
+    enum digest_alg     alg;
+    int                 dirfd;
+    int                 oflags;
+    struct digest_job  *jobs;
+    size_t              count;
+    size_t              next;
+    pthread_mutex_t     lock;
+};
+
+static void *batch_worker(void *arg)
+{
+    struct batch         *b   = arg;
+    struct digest_stream *s   = stream_alloc(b->alg);
+    unsigned char        *buf = read_buffer(DIGEST_READ_SIZE);
+
+    for (;;) {
+        pthread_mutex_lock(&b->lock);
+        size_t i = b->next < b->count ? b->next++ : (size_t)-1;
+        pthread_mutex_unlock(&b->lock);
+
+        if (i == (size_t)-1)
+            break;
+
+        struct digest_job *job = &b->jobs[i];
+        job->bytes = 0;
+
+        if (!s || !buf) {
+            job->err = ENOMEM;
+            continue;
+        }
+
+        int fd;
+        if (b->dirfd == DIGEST_AT_ROOT) {
+            const char *leaf;
+            int dfd = root_at(job->path, 0, &leaf);
+            fd = dfd < 0 ? -1
+                         : openat(dfd, leaf, O_RDONLY | O_CLOEXEC | b->oflags);
+            int saved = errno;
+            root_at_done(dfd);
+            errno = saved;
+        } else {
+            fd = openat(b->dirfd, job->path,
+                        O_RDONLY | O_CLOEXEC | b->oflags);
+        }
+        if (fd < 0) {
+            job->err = errno;
+            continue;
+        }
+
+        int err = hash_fd(s, fd, buf, DIGEST_READ_SIZE, job->hex,
+                          &job->bytes);
+        job->err = err < 0 ? EIO : err;
+        close(fd);
+    }
+
+    digest_stream_free(s);
+    free(buf);
+    return NULL;
+}
+
+static int batch_workers(size_t jobs)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        cpus = 1;
+    cpus *= 2;
+    if (cpus > DIGEST_MAX_WORKERS)
+        cpus = DIGEST_MAX_WORKERS;
+    if ((size_t)cpus > jobs)
+        cpus = (long)jobs;
+    return (int)cpus;
+}
+
+void digest_batch(enum digest_alg alg, int dirfd, int oflags,
+                  struct digest_job *jobs, size_t count)
+{
+    struct batch b = {
+        .alg    = alg,
+        .dirfd  = dirfd,
+        .oflags = oflags,
+        .jobs   = jobs,
+        .count  = count,
+    };
+
+    pthread_mutex_init(&b.lock, NULL);
+
+    int nworkers = count > 1 ? batch_workers(count) : 0;
+    pthread_t workers[DIGEST_MAX_WORKERS];
+    int started = 0;
+
+    for (int i = 0; i < nworkers; i++) {
+        if (pthread_create(&workers[i], NULL, batch_worker, &b) != 0)
+            break;
+        started++;
+    }
+
+    /* One file, or no thread at all: hash on this one */
+    if (started == 0)
+        batch_worker(&b);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    pthread_mutex_destroy(&b.lock);
+}
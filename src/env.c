@@ -18,8 +18,16 @@
  *   diagnostic is printed to stderr and the process exits — the same
  *   behaviour as before, but with a clear message rather than a
  *   confusing "logging unavailable" error.
+ *
+ * With --root the hierarchy is created inside the root (root.h); the
+ * host's cache directory is still ensured, since the package cache is
+ * shared by every root.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include "root.h"
+
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
@@ -33,12 +41,21 @@
 #define FLAPPY_DB_DIR    "/var/lib/flappy"
 #define FLAPPY_LOG_PATH  "/var/log/flappy.log"
 
-static void ensure_dir(const char *path) {
-    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+static void ensure_dir_at(int dfd, const char *path) {
+    const char *leaf = path;
+    if (dfd != AT_FDCWD)
+        dfd = root_at(path, 0, &leaf);
+    if (dfd == -1 || (mkdirat(dfd, leaf, 0755) == -1 && errno != EEXIST)) {
         fprintf(stderr, "flappy: cannot create %s: %s\n",
                 path, strerror(errno));
         exit(1);
     }
+    if (dfd != AT_FDCWD)
+        root_at_done(dfd);
+}
+
+static void ensure_dir(const char *path) {
+    ensure_dir_at(root_fd(), path);
 }
 
 /*
@@ -52,7 +69,14 @@ static void ensure_log_file(void) {
     /* O_CREAT | O_EXCL succeeds only if the file does not exist.
      * If it already exists, open with O_RDONLY just to confirm
      * accessibility — log_init will open it in append mode. */
-    int fd = open(FLAPPY_LOG_PATH, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    const char *leaf;
+    int dfd = root_at(FLAPPY_LOG_PATH, 0, &leaf);
+    int fd  = dfd < 0 ? -1
+                      : openat(dfd, leaf, O_WRONLY | O_CREAT | O_APPEND |
+                                          O_NOFOLLOW | O_CLOEXEC, 0600);
+    int err = errno;
+    root_at_done(dfd);
+    errno = err;
     if (fd < 0) {
         fprintf(stderr,
                 "flappy: cannot create log file %s: %s\n"
@@ -60,21 +84,27 @@ static void ensure_log_file(void) {
                 FLAPPY_LOG_PATH, strerror(errno));
         exit(1);
     }
-    close(fd);
 
     /* Ensure correct ownership and mode even if file pre-existed
      * with wrong permissions (e.g. created by a non-root test run). */
     if (geteuid() == 0) {
-        if (chown(FLAPPY_LOG_PATH, 0, 0) != 0)
+        if (fchown(fd, 0, 0) != 0)
             fprintf(stderr, "flappy: warning: cannot set ownership on %s: %s\n",
                     FLAPPY_LOG_PATH, strerror(errno));
-        if (chmod(FLAPPY_LOG_PATH, 0600) != 0)
+        if (fchmod(fd, 0600) != 0)
             fprintf(stderr, "flappy: warning: cannot set mode on %s: %s\n",
                     FLAPPY_LOG_PATH, strerror(errno));
     }
+    close(fd);
 }
 
 void flappy_env_init(void) {
+    if (root_is_alt()) {
+        ensure_dir_at(AT_FDCWD, "/var/cache");
+        ensure_dir_at(AT_FDCWD, FLAPPY_CACHE_DIR);
+        ensure_dir("/var");
+    }
+
     ensure_dir("/var/cache");
     ensure_dir("/var/lib");
     ensure_dir("/var/log");
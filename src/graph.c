@@ -17,6 +17,7 @@
 #include "graph.h"
 #include "flappy.h"
 #include "db_guard.h"
+#include "version.h"
 
 #include <sqlite3.h>
 #include <stdio.h>
@@ -34,6 +35,24 @@ static void normalize_lower(char *s)
         s[i] = (char)tolower((unsigned char)s[i]);
 }
 
+/*
+ * bind_version_key
+ *
+ * Binds the binary sort key of `version` (see version_key) to
+ * parameter `idx`, or NULL if the version string is invalid — the
+ * same thing the v3 migration stores for such rows.
+ */
+static void bind_version_key(sqlite3_stmt *st, int idx, const char *version)
+{
+    unsigned char key[VERSION_KEY_MAX];
+    size_t len;
+
+    if (version_key(version, key, &len) == 0)
+        sqlite3_bind_blob(st, idx, key, (int)len, SQLITE_TRANSIENT);
+    else
+        sqlite3_bind_null(st, idx);
+}
+
 /* =========================================================================
  * Transaction Helpers (used only by read-query functions)
  *
@@ -266,7 +285,8 @@ int graph_add_package(
     sqlite3_stmt *st = NULL;
     int rc = sqlite3_prepare_v2(
         db,
-        "INSERT INTO packages(name, version, explicit) VALUES(?, ?, ?);",
+        "INSERT INTO packages(name, version, explicit, version_key) "
+        "VALUES(?, ?, ?, ?);",
         -1, &st, NULL
     );
     if (rc != SQLITE_OK)
@@ -275,6 +295,7 @@ int graph_add_package(
     sqlite3_bind_text(st, 1, canon,   -1, SQLITE_STATIC);
     sqlite3_bind_text(st, 2, version, -1, SQLITE_STATIC);
     sqlite3_bind_int (st, 3, explicit_flag);
+    bind_version_key(st, 4, version);
 
     rc = sqlite3_step(st);
     sqlite3_finalize(st);
@@ -346,6 +367,167 @@ int graph_add_package(
     return 0;
 }
 
+/* =========================================================================
+ * graph_upgrade_package
+ *
+ * CALLER MUST hold an open BEGIN IMMEDIATE transaction (same contract as
+ * graph_add_package).
+ *
+ * The package row is updated in place so its id — and therefore every
+ * reverse dependency edge and every files row pointing at it — survives
+ * the upgrade.  Only the package's own outgoing edges are replaced.
+ * ========================================================================= */
+
+int graph_upgrade_package(
+    const char *name,
+    const char *version,
+    const char **depends,
+    size_t depends_count)
+{
+    sqlite3 *db = db_handle();
+    if (!db)
+        return 1;
+
+    char *canon = strdup(name);
+    if (!canon)
+        return 1;
+    normalize_lower(canon);
+
+    /* 1. Package must already exist */
+    sqlite3_int64 pkg_id = get_package_id(db, canon);
+    if (pkg_id < 0) {
+        fprintf(stderr, "upgrade: package '%s' is not installed\n", name);
+        free(canon);
+        return 1;
+    }
+
+    /* 2. Resolve new dependency ids (must be installed, no self-dep) */
+    sqlite3_int64 *dep_ids = NULL;
+    if (depends_count > 0) {
+        dep_ids = calloc(depends_count, sizeof(sqlite3_int64));
+        if (!dep_ids) {
+            free(canon);
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < depends_count; i++) {
+        char *dep = strdup(depends[i]);
+        if (!dep) {
+            free(dep_ids);
+            free(canon);
+            return 1;
+        }
+        normalize_lower(dep);
+
+        if (strcmp(dep, canon) == 0) {
+            fprintf(stderr,
+                    "upgrade: self-dependency not allowed (%s)\n", name);
+            free(dep);
+            free(dep_ids);
+            free(canon);
+            return 1;
+        }
+
+        dep_ids[i] = get_package_id(db, dep);
+        if (dep_ids[i] < 0) {
+            fprintf(stderr,
+                    "upgrade: dependency '%s' is not installed\n", dep);
+            free(dep);
+            free(dep_ids);
+            free(canon);
+            return 1;
+        }
+        free(dep);
+    }
+
+    /* 3. Update version (and its sort key) in place */
+    sqlite3_stmt *st = NULL;
+    int rc = sqlite3_prepare_v2(
+        db,
+        "UPDATE packages SET version = ?, version_key = ? WHERE id = ?;",
+        -1, &st, NULL
+    );
+    if (rc != SQLITE_OK)
+        db_die(db, rc, "upgrade package prepare");
+
+    sqlite3_bind_text (st, 1, version, -1, SQLITE_STATIC);
+    bind_version_key(st, 2, version);
+    sqlite3_bind_int64(st, 3, pkg_id);
+
+    rc = sqlite3_step(st);
+    sqlite3_finalize(st);
+
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "upgrade: failed to update package record\n");
+        free(dep_ids);
+        free(canon);
+        return 1;
+    }
+
+    /* 4. Replace outgoing dependency edges */
+    rc = sqlite3_prepare_v2(
+        db,
+        "DELETE FROM dependencies WHERE package_id = ?;",
+        -1, &st, NULL
+    );
+    if (rc != SQLITE_OK)
+        db_die(db, rc, "upgrade edges delete prepare");
+
+    sqlite3_bind_int64(st, 1, pkg_id);
+    rc = sqlite3_step(st);
+    sqlite3_finalize(st);
+
+    if (rc != SQLITE_DONE) {
+        free(dep_ids);
+        free(canon);
+        return 1;
+    }
+
+    rc = sqlite3_prepare_v2(
+        db,
+        "INSERT OR IGNORE INTO dependencies(package_id, depends_on) "
+        "VALUES(?, ?);",
+        -1, &st, NULL
+    );
+    if (rc != SQLITE_OK)
+        db_die(db, rc, "upgrade edges insert prepare");
+
+    for (size_t i = 0; i < depends_count; i++) {
+        sqlite3_reset(st);
+        sqlite3_bind_int64(st, 1, pkg_id);
+        sqlite3_bind_int64(st, 2, dep_ids[i]);
+
+        if (sqlite3_step(st) != SQLITE_DONE) {
+            sqlite3_finalize(st);
+            free(dep_ids);
+            free(canon);
+            return 1;
+        }
+    }
+    sqlite3_finalize(st);
+
+    /* 5. Cycle detection — the new edges must not lead back to pkg_id */
+    for (size_t i = 0; i < depends_count; i++) {
+        VisitedSet visited = {0};
+
+        if (dfs_has_cycle(db, dep_ids[i], pkg_id, &visited)) {
+            fprintf(stderr,
+                    "upgrade: dependency cycle detected involving '%s'\n",
+                    name);
+            free(dep_ids);
+            free(canon);
+            return 1;
+        }
+    }
+
+    free(dep_ids);
+    free(canon);
+
+    log_info("graph: upgraded package %s to %s", name, version);
+    return 0;
+}
+
 /* =========================================================================
  * graph_depends
  * ========================================================================= */
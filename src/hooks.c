@@ -15,12 +15,18 @@
  *
  * This is a deliberate departure from PHILOSOPHY.md's "no post-install
  * scripts" position, made explicitly by the project maintainer.
+ *
+ * With --root, hook files live inside the root and the script runs
+ * chroot()ed into it, so a package's hooks act on the image being
+ * built and never on the host.  A root without bash yet (early in a
+ * bootstrap) skips hooks with a warning, as pacman does.
  */
 
 #define _POSIX_C_SOURCE 200809L
 
 #include "hooks.h"
 #include "flappy.h"
+#include "root.h"
 
 #include <archive.h>
 #include <archive_entry.h>
@@ -43,11 +49,24 @@ void hook_path(const char *pkgname, char *out, size_t outsz)
     snprintf(out, outsz, "%s/%s.install", FLAPPY_HOOKS_DIR, pkgname);
 }
 
+/* Is `abs` inside the root accessible for `mode`, not followed if a link? */
+static int in_root(const char *abs, int mode)
+{
+    const char *leaf;
+    int dfd = root_at(abs, 0, &leaf);
+    if (dfd < 0)
+        return 0;
+    int ok = faccessat(dfd, leaf, mode, AT_SYMLINK_NOFOLLOW) == 0;
+    root_at_done(dfd);
+    return ok;
+}
+
 /* =========================================================================
  * run_hook
  *
  * Sources the script, checks whether the function is defined with
- * `declare -f`, and calls it only if so.  Missing functions are not
+ * `type -t` (no /dev/null needed: a fresh root may not have /dev
+ * yet), and calls it only if so.  Missing functions are not
  * errors — consistent with pacman behaviour.
  *
  * Arguments are passed via environment variables so that version strings
@@ -62,20 +81,31 @@ int run_hook(const char *script_path,
     if (!script_path || !function)
         return 0;
 
-    struct stat st;
-    if (stat(script_path, &st) != 0)
+    if (!in_root(script_path, F_OK))
         return 0;   /* no hook file — not an error */
 
+    if (root_is_alt() &&
+        !in_root("/usr/bin/bash", X_OK) && !in_root("/bin/bash", X_OK)) {
+        fprintf(stderr, "[WARN] hook %s() skipped: no bash in %s\n",
+                function, root_dir());
+        log_error("hook %s() in %s skipped: no bash in root",
+                  function, script_path);
+        return 0;
+    }
+
     char cmd[1024];
     snprintf(cmd, sizeof(cmd),
+        "%s"
         "bash -c '"
         "source \"$FLAPPY_HOOK_SCRIPT\"; "
-        "if declare -f \"$FLAPPY_HOOK_FUNC\" > /dev/null 2>&1; then "
+        "if [ \"$(type -t \"$FLAPPY_HOOK_FUNC\")\" = function ]; then "
         "  \"$FLAPPY_HOOK_FUNC\" "
         "  ${FLAPPY_HOOK_ARG1:+\"$FLAPPY_HOOK_ARG1\"} "
         "  ${FLAPPY_HOOK_ARG2:+\"$FLAPPY_HOOK_ARG2\"}; "
-        "fi'");
+        "fi'",
+        root_is_alt() ? "chroot \"$FLAPPY_HOOK_ROOT\" " : "");
 
+    setenv("FLAPPY_HOOK_ROOT",   root_dir(),  1);
     setenv("FLAPPY_HOOK_SCRIPT", script_path, 1);
     setenv("FLAPPY_HOOK_FUNC",   function,    1);
 
@@ -87,6 +117,7 @@ int run_hook(const char *script_path,
 
     int rc = system(cmd);
 
+    unsetenv("FLAPPY_HOOK_ROOT");
     unsetenv("FLAPPY_HOOK_SCRIPT");
     unsetenv("FLAPPY_HOOK_FUNC");
     unsetenv("FLAPPY_HOOK_ARG1");
@@ -123,9 +154,14 @@ int run_hook(const char *script_path,
 
 int hook_install_from_pkg(const char *pkgname, const char *pkgfile)
 {
-    if (mkdir(FLAPPY_HOOKS_DIR, 0700) == -1 && errno != EEXIST) {
+    const char *leaf;
+    int dfd = root_at(FLAPPY_HOOKS_DIR, 0, &leaf);
+    int rc  = dfd < 0 ? -1 : mkdirat(dfd, leaf, 0700);
+    int err = errno;
+    root_at_done(dfd);
+    if (rc == -1 && err != EEXIST) {
         fprintf(stderr, "hook: cannot create %s: %s\n",
-                FLAPPY_HOOKS_DIR, strerror(errno));
+                FLAPPY_HOOKS_DIR, strerror(err));
         return 1;
     }
 
@@ -168,7 +204,12 @@ int hook_install_from_pkg(const char *pkgname, const char *pkgfile)
         char out_path[256];
         hook_path(pkgname, out_path, sizeof(out_path));
 
-        int fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0700);
+        int hdfd = root_at(out_path, 0, &leaf);
+        int fd = hdfd < 0 ? -1 :
+                 openat(hdfd, leaf,
+                        O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                        0700);
+        root_at_done(hdfd);
         if (fd < 0) {
             fprintf(stderr, "hook: cannot create %s: %s\n",
                     out_path, strerror(errno));
@@ -191,7 +232,7 @@ int hook_install_from_pkg(const char *pkgname, const char *pkgfile)
 
         if (write_err || n < 0) {
             fprintf(stderr, "hook: write error for %s\n", out_path);
-            unlink(out_path);
+            root_unlink(out_path);
             archive_read_free(a);
             return 1;
         }
@@ -214,7 +255,7 @@ void hook_remove(const char *pkgname)
     char path[256];
     hook_path(pkgname, path, sizeof(path));
 
-    if (unlink(path) == 0)
+    if (root_unlink(path) == 0)
         log_info("hook: removed %s", path);
     /* ENOENT is fine — package had no hook */
 }
\ No newline at end of file
@@ -34,6 +34,7 @@
  */
 
 #include "install.h"
+#include "repo.h"
 #include "flappy.h"
 #include "ui.h"
 
@@ -41,27 +42,15 @@
 #include <stdlib.h>
 #include <string.h>
 
-int install_guard(void);
-int install_lookup(const char *pkg, char *filename, char *checksum);
-int install_download(const char *filename, char *local_path,
-                     const char *expected_checksum);
-int install_verify(const char *path, const char *checksum);
-int install_conflict_staged(const char *pkgname, const char *staging_dir);
-int install_extract(const char *pkgfile, char *staging_dir);
-int install_commit(const char *pkgname, const char *pkgfile,
-                   const char *staging_dir);
-
 /* Forward declaration for staging cleanup on abort */
 static void abort_cleanup(const char *staging_dir);
 
-int install_package(const char *pkgname)
+int install_package(const char *pkgname, const char *version)
 {
     char filename[256];
     char checksum[128];
+    char base_url[REPO_URL_MAX];
     char pkgpath[512];
-    char staging[512];
-
-    staging[0] = '\0';
 
     ui_step("resolving package...");
 
@@ -70,14 +59,25 @@ int install_package(const char *pkgname)
         return 1;
     }
 
-    if (install_lookup(pkgname, filename, checksum)) {
+    if (install_lookup_version(pkgname, version,
+                               filename, checksum, base_url)) {
         ui_error("package not found in repository: %s", pkgname);
         return 1;
     }
 
-    if (install_download(filename, pkgpath, checksum))
+    if (install_download(filename, base_url, pkgpath, checksum))
         return 1;
 
+    return install_package_file(pkgname, pkgpath, checksum);
+}
+
+int install_package_file(const char *pkgname, const char *pkgpath,
+                         const char *checksum)
+{
+    char staging[512];
+
+    staging[0] = '\0';
+
     ui_step("verifying package integrity...");
     if (install_verify(pkgpath, checksum)) {
         ui_error("package integrity verification failed");
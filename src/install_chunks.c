@@ -0,0 +1,365 @@
+/*
+ * install_chunks.c - Chunked package transport
+ *
+ * Related packages share large identical regions — locale data,
+ * firmware blobs, documentation — across versions and variants.  A
+ * repository may cut each archive into content-defined chunks and
+ * publish, beside the archive:
+ *
+ *   packages/<index file>       the chunk index of the archive
+ *   packages/chunks/<sha256>    every chunk, named by its SHA256
+ *
+ * listed in an optional repo.db table, carried through the merge
+ * (repo_update.c) for the packages each repository provides:
+ *
+ *   chunk_indexes(package, filename, index_filename, checksum)
+ *
+ *   filename        the archive (packages.filename)
+ *   index_filename  its chunk index, under packages/
+ *   checksum        SHA256 of the index file
+ *
+ * The index is text, one chunk per line in archive order:
+ *
+ *   <sha256> <size>
+ *
+ * The client keeps the chunks it has fetched in a chunk store under
+ * the package cache (FLAPPY_PKG_CACHE_DIR/chunks, the same layout as
+ * the server), fetches only the chunks it lacks in one
+ * install_download_batch, and concatenates them into the archive.
+ * Each chunk is verified by its name as it is downloaded or reused;
+ * the assembled archive is hashed while it is written and must match
+ * the package checksum.
+ *
+ * Where the chunk boundaries fall is the repository's choice; the
+ * client only follows the index.  Boundaries picked by content (a
+ * rolling hash) keep unchanged regions as identical chunks across
+ * builds.  As with deltas, that holds for the compressed archive only
+ * when it is built with `zstd --rsyncable`.
+ *
+ * UX contract:
+ *   fetching N of M chunks for <file>
+ *   [OK] assembled <file> from chunks (X KiB downloaded)
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "flappy.h"
+#include "install.h"
+#include "repo.h"
+#include "digest.h"
+#include "ui.h"
+
+#include <sqlite3.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHUNK_SUBDIR    "chunks"
+
+#define CHUNK_SIZE_MAX  (16LL * 1024 * 1024)
+#define CHUNK_NAME_MAX  (sizeof(CHUNK_SUBDIR) + 65)
+
+struct chunk {
+    char      name[CHUNK_NAME_MAX];     /* "chunks/<sha256>" */
+    long long size;
+};
+
+static int is_sha256(const char *s)
+{
+    size_t n = strspn(s, "0123456789abcdef");
+    return n == 64 && s[64] == '\0';
+}
+
+/*
+ * index_lookup
+ *
+ * Fills the chunk index file name and checksum of archive `filename`.
+ * Returns 0 if the repository publishes one.
+ */
+static int index_lookup(const char *filename, char *index_name,
+                        char *index_sum)
+{
+    sqlite3 *db = NULL;
+    if (sqlite3_open_v2(FLAPPY_REPO_DB_PATH, &db,
+                        SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        sqlite3_close(db);
+        return 1;
+    }
+
+    /* No chunk_indexes table: the repository publishes none */
+    sqlite3_stmt *st = NULL;
+    int rc = 1;
+
+    if (sqlite3_prepare_v2(db,
+            "SELECT index_filename, checksum FROM chunk_indexes "
+            "WHERE filename = ?;",
+            -1, &st, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(st, 1, filename, -1, SQLITE_STATIC);
+
+        if (sqlite3_step(st) == SQLITE_ROW) {
+            const char *idx = (const char *)sqlite3_column_text(st, 0);
+            const char *sum = (const char *)sqlite3_column_text(st, 1);
+
+            if (install_filename_ok(idx) && sum && is_sha256(sum)) {
+                snprintf(index_name, 256, "%s", idx);
+                snprintf(index_sum, 65, "%s", sum);
+                rc = 0;
+            }
+        }
+    }
+
+    sqlite3_finalize(st);
+    sqlite3_close(db);
+    return rc;
+}
+
+/*
+ * parse_index
+ *
+ * Reads the chunk list of an index file.  Returns 0 on success; a
+ * malformed index fails as a whole.
+ */
+static int parse_index(const char *path, struct chunk **out, size_t *count)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 1;
+
+    struct chunk *chunks = NULL;
+    size_t n = 0, cap = 0;
+    char line[256];
+    int rc = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        char sha[65];
+        long long size;
+        char extra;
+
+        if (line[0] == '\n')
+            continue;
+
+        if (sscanf(line, "%64s %lld %c", sha, &size, &extra) != 2 ||
+            !is_sha256(sha) || size <= 0 || size > CHUNK_SIZE_MAX) {
+            rc = 1;
+            break;
+        }
+
+        if (n == cap) {
+            size_t newcap = cap ? cap * 2 : 256;
+            struct chunk *tmp = realloc(chunks, newcap * sizeof(*tmp));
+            if (!tmp) {
+                rc = 1;
+                break;
+            }
+            chunks = tmp;
+            cap    = newcap;
+        }
+
+        snprintf(chunks[n].name, sizeof(chunks[n].name),
+                 CHUNK_SUBDIR "/%s", sha);
+        chunks[n].size = size;
+        n++;
+    }
+
+    fclose(f);
+
+    if (rc != 0 || n == 0) {
+        free(chunks);
+        return 1;
+    }
+
+    *out   = chunks;
+    *count = n;
+    return 0;
+}
+
+static int cmp_chunk(const void *a, const void *b)
+{
+    return strcmp(((const struct chunk *)a)->name,
+                  ((const struct chunk *)b)->name);
+}
+
+/*
+ * fetch_chunks
+ *
+ * Brings every distinct chunk of the index into the store in one
+ * batch; chunks already stored are verified and reused by the batch
+ * itself.  *fetched is the byte count of the chunks that were not
+ * stored yet.  Returns 0 when all are in place.
+ */
+static int fetch_chunks(const struct chunk *chunks, size_t n,
+                        const char *base_url, const char *filename,
+                        long long *fetched)
+{
+    struct chunk *uniq = malloc(n * sizeof(*uniq));
+    if (!uniq)
+        return 1;
+
+    memcpy(uniq, chunks, n * sizeof(*uniq));
+    qsort(uniq, n, sizeof(*uniq), cmp_chunk);
+
+    size_t nuniq = 0;
+    for (size_t i = 0; i < n; i++)
+        if (nuniq == 0 || strcmp(uniq[nuniq - 1].name, uniq[i].name) != 0)
+            uniq[nuniq++] = uniq[i];
+
+    struct download_req *reqs = calloc(nuniq, sizeof(*reqs));
+    if (!reqs) {
+        free(uniq);
+        return 1;
+    }
+
+    size_t missing = 0;
+    *fetched = 0;
+
+    for (size_t i = 0; i < nuniq; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s",
+                 FLAPPY_PKG_CACHE_DIR, uniq[i].name);
+        if (access(path, F_OK) != 0) {
+            missing++;
+            *fetched += uniq[i].size;
+        }
+
+        reqs[i].filename = uniq[i].name;
+        reqs[i].checksum = uniq[i].name + sizeof(CHUNK_SUBDIR);
+        reqs[i].base_url = base_url;
+        reqs[i].quiet    = 1;
+    }
+
+    ui_step("fetching %zu of %zu chunks for %s", missing, nuniq, filename);
+
+    int rc = install_download_batch(reqs, nuniq, NULL, NULL);
+
+    free(reqs);
+    free(uniq);
+    return rc;
+}
+
+/*
+ * assemble
+ *
+ * Concatenates the stored chunks into `local_path`, hashing as it
+ * writes, and publishes the file only if the hash is `checksum`.
+ */
+static int assemble(const struct chunk *chunks, size_t n,
+                    const char *checksum, const char *local_path)
+{
+    char part[INSTALL_PART_PATH_MAX];
+    install_part_path(part, local_path);
+
+    enum digest_alg alg;
+    const char *expected;
+    if (digest_parse(checksum, &alg, &expected) != 0) {
+        log_error("chunks: unsupported checksum %s", checksum);
+        return 1;
+    }
+
+    FILE *out = fopen(part, "wb");
+    struct digest_stream *hash = digest_stream_new(alg);
+    char *buf = malloc(65536);
+    int rc = (out && hash && buf) ? 0 : 1;
+
+    for (size_t i = 0; i < n && rc == 0; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s",
+                 FLAPPY_PKG_CACHE_DIR, chunks[i].name);
+
+        FILE *in = fopen(path, "rb");
+        if (!in) {
+            rc = 1;
+            break;
+        }
+
+        long long total = 0;
+        size_t got;
+        while ((got = fread(buf, 1, 65536, in)) > 0) {
+            total += (long long)got;
+            if (fwrite(buf, 1, got, out) != got ||
+                digest_stream_update(hash, buf, got) != 0) {
+                rc = 1;
+                break;
+            }
+        }
+
+        if (ferror(in) || total != chunks[i].size)
+            rc = 1;
+        fclose(in);
+    }
+
+    char actual[65];
+    if (rc == 0 && digest_stream_final(hash, actual) != 0)
+        rc = 1;
+    if (rc == 0 && strcmp(actual, expected) != 0) {
+        log_error("chunks: %s assembled with checksum %s, expected %s",
+                  local_path, actual, checksum);
+        rc = 1;
+    }
+
+    if (out && fclose(out) != 0)
+        rc = 1;
+    digest_stream_free(hash);
+    free(buf);
+
+    if (rc == 0 && rename(part, local_path) != 0)
+        rc = 1;
+    if (rc != 0)
+        unlink(part);
+    return rc;
+}
+
+int install_chunks_fetch(struct download_req *req)
+{
+    char index_name[256], index_sum[65];
+
+    if (req->quiet || index_lookup(req->filename, index_name, index_sum))
+        return 1;
+
+    char store[sizeof(FLAPPY_PKG_CACHE_DIR "/" CHUNK_SUBDIR)];
+    snprintf(store, sizeof(store), "%s/%s",
+             FLAPPY_PKG_CACHE_DIR, CHUNK_SUBDIR);
+    if (mkdir(store, 0755) != 0 && errno != EEXIST) {
+        log_error("chunks: cannot create %s: %s", store, strerror(errno));
+        return 1;
+    }
+
+    /* The index itself: a small, verified, cached file */
+    struct download_req index = {
+        .filename = index_name,
+        .checksum = index_sum,
+        .base_url = req->base_url,
+        .quiet    = 1,
+    };
+
+    struct chunk *chunks = NULL;
+    size_t n = 0;
+    long long fetched = 0;
+
+    if (install_download_batch(&index, 1, NULL, NULL) != 0 ||
+        parse_index(index.local_path, &chunks, &n) != 0) {
+        ui_warn("chunk index of %s unavailable — downloading it whole",
+                req->filename);
+        return 1;
+    }
+
+    int rc = fetch_chunks(chunks, n, req->base_url, req->filename, &fetched);
+    if (rc == 0)
+        rc = assemble(chunks, n, req->checksum, req->local_path);
+    free(chunks);
+
+    if (rc != 0) {
+        ui_warn("cannot assemble %s from chunks — downloading it whole",
+                req->filename);
+        return 1;
+    }
+
+    ui_ok("assembled %s from chunks (%lld KiB downloaded)",
+          req->filename, (fetched + 1023) / 1024);
+    log_info("chunks: assembled %s, %lld bytes fetched",
+             req->local_path, fetched);
+    return 0;
+}
@@ -28,8 +28,53 @@
  *   walk_staging now collects both regular files and symlinks.
  *   The copy step dispatches on lstat type: regular files go through
  *   copy_file (open/read/write), symlinks go through copy_symlink
- *   (readlink/symlink).  Both share ensure_parent_dirs for parent
- *   directory creation.
+ *   (readlink/symlink).  Both create missing parent directories
+ *   through root_at (ROOT_AT_MKDIR).
+ *
+ * UPGRADE COMMIT:
+ *
+ *   install_commit_upgrade replaces an installed package in place.
+ *   The order is inverted relative to a fresh install so that the
+ *   old version stays intact until the DB has committed:
+ *
+ *     1. every staged entry is diffed against the package's files
+ *        rows: one whose size, mode and sha256 match its row, and
+ *        which is still on disk with that type and size, is unchanged
+ *        and left alone
+ *     2. the other paths are journaled in upgrade_swaps, and each
+ *        entry is written next to its destination as <dst>.flappy-new
+ *        (nothing visible changes yet)
+ *     3. one BEGIN IMMEDIATE transaction updates the package row and
+ *        dependency edges (graph_upgrade_package), applies the diff to
+ *        the files rows (UPDATE changed, INSERT new, DELETE vanished —
+ *        unchanged rows are not touched), and swaps each .flappy-new
+ *        in: the destination is kept as <dst>.flappy-old, then
+ *        rename()d over, which is atomic per path.  COMMIT follows only
+ *        once every swap has succeeded.
+ *     4. paths owned by the old version but not the new one are
+ *        unlinked (files under /etc are kept, as remove does)
+ *
+ *   A failure before COMMIT rolls the transaction back, moves every
+ *   .flappy-old back, unlinks the .flappy-new files and leaves the old
+ *   version installed and registered.  A crash leaves the journal,
+ *   from which install_upgrade_recover (run by db_open_or_die) undoes
+ *   or finishes the swaps.  Rows with no fingerprint (registered
+ *   before schema v4) never compare equal, so the first upgrade
+ *   rewrites those files and fills their rows in.
+ *
+ * REGISTRATION:
+ *
+ *   install_register (constraints, package row, dependency edges, file
+ *   rows) is the DB half of a commit.  install_commit wraps it in its
+ *   own transaction; `install --bootstrap` calls it for every package
+ *   inside one transaction after writing the files itself.
+ *
+ * ALTERNATE ROOT:
+ *
+ *   Destination paths are canonical ("/usr/bin/x") and every write,
+ *   rename and unlink on them goes through root_at() (root.h), which
+ *   keeps them inside the root.  Staging paths are host paths and stay
+ *   as they are.
  *
  * Invariant: a failed install leaves the system unchanged.
  */
@@ -38,9 +83,12 @@
 
 #include "flappy.h"
 #include "graph.h"
+#include "install.h"
 #include "install_constraints.h"
 #include "pkg_meta.h"
 #include "db_guard.h"
+#include "root.h"
+#include "digest.h"
 
 #include <sqlite3.h>
 
@@ -55,43 +103,6 @@
 #include <fcntl.h>
 #include <limits.h>
 
-/* =========================================================================
- * Parent directory creation (shared by copy_file and copy_symlink)
- * ========================================================================= */
-
-/*
- * ensure_parent_dirs
- *
- * Creates every directory component of `dst`'s parent path.
- * Returns 0 on success, -1 on failure.
- */
-static int ensure_parent_dirs(const char *dst)
-{
-    char parent[PATH_MAX];
-    strncpy(parent, dst, sizeof(parent) - 1);
-    parent[sizeof(parent) - 1] = '\0';
-
-    char *slash = strrchr(parent, '/');
-    if (!slash || slash == parent)
-        return 0; /* root or no parent component */
-
-    *slash = '\0';
-
-    for (char *p = parent + 1; *p; p++) {
-        if (*p == '/') {
-            *p = '\0';
-            if (mkdir(parent, 0755) == -1 && errno != EEXIST)
-                return -1;
-            *p = '/';
-        }
-    }
-
-    if (mkdir(parent, 0755) == -1 && errno != EEXIST)
-        return -1;
-
-    return 0;
-}
-
 /* =========================================================================
  * File copy helpers
  * ========================================================================= */
@@ -101,13 +112,11 @@ static int ensure_parent_dirs(const char *dst)
  *
  * Copies a regular file from src to dst.
  * Creates parent directories as needed.
- * Preserves permissions from src.
+ * Preserves permissions from src.  A symlink at dst is replaced, not
+ * written through.
  */
 static int copy_file(const char *src, const char *dst)
 {
-    if (ensure_parent_dirs(dst) != 0)
-        return -1;
-
     /* Get source permissions */
     struct stat st;
     if (stat(src, &st) != 0)
@@ -117,8 +126,19 @@ static int copy_file(const char *src, const char *dst)
     if (fdin < 0)
         return -1;
 
-    int fdout = open(dst, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777);
+    const char *leaf;
+    int dfd = root_at(dst, ROOT_AT_MKDIR, &leaf);
+    if (dfd < 0) {
+        close(fdin);
+        return -1;
+    }
+
+    int oflags = O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC;
+    int fdout = openat(dfd, leaf, oflags, st.st_mode & 0777);
+    if (fdout < 0 && errno == ELOOP && unlinkat(dfd, leaf, 0) == 0)
+        fdout = openat(dfd, leaf, oflags, st.st_mode & 0777);
     if (fdout < 0) {
+        root_at_done(dfd);
         close(fdin);
         return -1;
     }
@@ -141,7 +161,8 @@ static int copy_file(const char *src, const char *dst)
     close(fdout);
 
     if (err)
-        unlink(dst);
+        unlinkat(dfd, leaf, 0);
+    root_at_done(dfd);
 
     return err ? -1 : 0;
 }
@@ -165,17 +186,21 @@ static int copy_symlink(const char *src, const char *dst)
         return -1;
     target[len] = '\0';
 
-    if (ensure_parent_dirs(dst) != 0)
+    const char *leaf;
+    int dfd = root_at(dst, ROOT_AT_MKDIR, &leaf);
+    if (dfd < 0)
         return -1;
 
     /* Remove any existing entry at dst before creating the new symlink */
-    if (unlink(dst) != 0 && errno != ENOENT)
-        return -1;
-
-    if (symlink(target, dst) != 0)
-        return -1;
-
-    return 0;
+    int rc = 0;
+    if ((unlinkat(dfd, leaf, 0) != 0 && errno != ENOENT) ||
+            symlinkat(target, dfd, leaf) != 0)
+        rc = -1;
+
+    int saved = errno;
+    root_at_done(dfd);
+    errno = saved;
+    return rc;
 }
 
 /* =========================================================================
@@ -291,32 +316,172 @@ static int walk_staging(const char *staging_dir,
     return err;
 }
 
+/*
+ * fingerprint_staged
+ *
+ * Builds the install_file for every staged path: size, mode and
+ * sha256 of a regular file's content, or of a symlink's target string
+ * (kept in link_target).  Regular files are hashed together with
+ * digest_batch once every path is stat'ed.  The paths are borrowed
+ * from `staged`; release with staged_files_free.
+ */
+static void staged_files_free(struct install_file *files, size_t count)
+{
+    if (!files)
+        return;
+    for (size_t i = 0; i < count; i++)
+        free(files[i].link_target);
+    free(files);
+}
+
+static int hash_staged(const char *staging_dir, struct install_file *files,
+                       size_t count)
+{
+    size_t njobs = 0;
+    for (size_t i = 0; i < count; i++)
+        if (!files[i].link_target)
+            njobs++;
+
+    struct digest_job *jobs = calloc(njobs ? njobs : 1, sizeof(*jobs));
+    int dirfd = open(staging_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int rc = 0;
+
+    if (!jobs || dirfd < 0) {
+        fprintf(stderr, "commit: cannot open staging dir %s: %s\n",
+                staging_dir, strerror(jobs ? errno : ENOMEM));
+        rc = 1;
+        goto out;
+    }
+
+    for (size_t i = 0, j = 0; i < count; i++)
+        if (!files[i].link_target)
+            jobs[j++].path = files[i].path;
+
+    digest_batch(DIGEST_SHA256, dirfd, O_NOFOLLOW, jobs, njobs);
+
+    for (size_t i = 0, j = 0; i < count; i++) {
+        if (files[i].link_target)
+            continue;
+
+        const struct digest_job *job = &jobs[j++];
+        if (job->err) {
+            fprintf(stderr, "commit: cannot hash staged file %s/%s: %s\n",
+                    staging_dir, job->path, strerror(job->err));
+            rc = 1;
+            break;
+        }
+        memcpy(files[i].sha256, job->hex, sizeof(files[i].sha256));
+    }
+
+out:
+    if (dirfd >= 0)
+        close(dirfd);
+    free(jobs);
+    return rc;
+}
+
+static struct install_file *fingerprint_staged(const char *staging_dir,
+                                               const PathList *staged)
+{
+    struct install_file *files = calloc(staged->count ? staged->count : 1,
+                                        sizeof(*files));
+    if (!files)
+        return NULL;
+
+    for (size_t i = 0; i < staged->count; i++) {
+        struct install_file *f = &files[i];
+        char src[PATH_MAX];
+        struct stat st;
+
+        f->path = staged->paths[i];
+        snprintf(src, sizeof(src), "%s/%s", staging_dir, f->path);
+
+        if (lstat(src, &st) != 0) {
+            fprintf(stderr, "commit: cannot stat staged file %s: %s\n",
+                    src, strerror(errno));
+            staged_files_free(files, i);
+            return NULL;
+        }
+
+        if (S_ISLNK(st.st_mode)) {
+            char target[PATH_MAX];
+            ssize_t len = readlink(src, target, sizeof(target));
+            struct digest_stream *hash = digest_stream_new(DIGEST_SHA256);
+
+            if (len < 0 || !hash ||
+                digest_stream_update(hash, target, (size_t)len) ||
+                digest_stream_final(hash, f->sha256)) {
+                fprintf(stderr, "commit: cannot read link %s\n", src);
+                digest_stream_free(hash);
+                staged_files_free(files, i);
+                return NULL;
+            }
+            digest_stream_free(hash);
+            if (!(f->link_target = strndup(target, (size_t)len))) {
+                staged_files_free(files, i);
+                return NULL;
+            }
+            f->size = len;
+            f->mode = S_IFLNK | 0777;
+        } else {
+            f->size = (long long)st.st_size;
+            f->mode = (unsigned)(st.st_mode & (S_IFMT | 07777));
+        }
+    }
+
+    if (hash_staged(staging_dir, files, staged->count) != 0) {
+        staged_files_free(files, staged->count);
+        return NULL;
+    }
+
+    return files;
+}
+
 /* =========================================================================
  * DB file registration
  * ========================================================================= */
 
+/* size, mode, sha256, link_target of `f`, bound from parameter `col` on */
+static void bind_fingerprint(sqlite3_stmt *st, int col,
+                             const struct install_file *f)
+{
+    sqlite3_bind_int64(st, col,     f->size);
+    sqlite3_bind_int64(st, col + 1, f->mode);
+    if (f->sha256[0])
+        sqlite3_bind_text(st, col + 2, f->sha256, -1, SQLITE_STATIC);
+    else
+        sqlite3_bind_null(st, col + 2);
+    if (f->link_target)
+        sqlite3_bind_text(st, col + 3, f->link_target, -1, SQLITE_STATIC);
+    else
+        sqlite3_bind_null(st, col + 3);
+}
+
 static int register_files(sqlite3 *db,
                            sqlite3_int64 pkg_id,
-                           const PathList *pl)
+                           const struct install_file *files, size_t count)
 {
     sqlite3_stmt *st = NULL;
     int rc = sqlite3_prepare_v2(
         db,
-        "INSERT INTO files(path, package_id) VALUES(?, ?);",
+        "INSERT INTO files(path, package_id, size, mode, sha256, "
+        "                  link_target) "
+        "VALUES(?, ?, ?, ?, ?, ?);",
         -1, &st, NULL
     );
     if (rc != SQLITE_OK)
         db_die(db, rc, "register_files prepare");
 
-    for (size_t i = 0; i < pl->count; i++) {
+    for (size_t i = 0; i < count; i++) {
         sqlite3_reset(st);
         sqlite3_clear_bindings(st);
 
         char canonical[PATH_MAX];
-        snprintf(canonical, sizeof(canonical), "/%s", pl->paths[i]);
+        snprintf(canonical, sizeof(canonical), "/%s", files[i].path);
 
         sqlite3_bind_text (st, 1, canonical, -1, SQLITE_TRANSIENT);
         sqlite3_bind_int64(st, 2, pkg_id);
+        bind_fingerprint(st, 3, &files[i]);
 
         rc = sqlite3_step(st);
         if (rc != SQLITE_DONE) {
@@ -336,7 +501,7 @@ static int register_files(sqlite3 *db,
 static void rollback_files(const char * const *paths, size_t count)
 {
     for (size_t i = 0; i < count; i++) {
-        if (unlink(paths[i]) != 0 && errno != ENOENT)
+        if (root_unlink(paths[i]) != 0 && errno != ENOENT)
             log_error("rollback: failed to remove %s: %s",
                       paths[i], strerror(errno));
     }
@@ -356,6 +521,69 @@ static void remove_staging(const char *staging_dir)
     (void)system(cmd);
 }
 
+/* =========================================================================
+ * Package registration
+ * ========================================================================= */
+
+long long install_register(const struct flappy_pkg *meta,
+                           const struct install_file *files, size_t count)
+{
+    sqlite3 *db = db_handle();
+    if (!db)
+        return -1;
+
+    /* Version constraints against what is installed so far */
+    if (install_check_constraints(meta))
+        return -1;
+
+    /* Plain name array for graph_add_package */
+    const char **dep_names = NULL;
+    if (meta->depends_count > 0) {
+        dep_names = malloc(meta->depends_count * sizeof(char *));
+        if (!dep_names)
+            return -1;
+        for (size_t i = 0; i < meta->depends_count; i++)
+            dep_names[i] = meta->depends[i].name;
+    }
+
+    /* Package + dependency rows */
+    int rc = graph_add_package(
+        meta->name,
+        meta->version,
+        1,
+        dep_names,
+        meta->depends_count
+    );
+    free(dep_names);
+
+    if (rc != 0)
+        return -1;
+
+    /* The new package rowid, for file registration */
+    sqlite3_int64 pkg_id = -1;
+    {
+        sqlite3_stmt *st = NULL;
+        sqlite3_prepare_v2(db,
+            "SELECT id FROM packages WHERE name = ?;",
+            -1, &st, NULL);
+        sqlite3_bind_text(st, 1, meta->name, -1, SQLITE_STATIC);
+        if (sqlite3_step(st) == SQLITE_ROW)
+            pkg_id = sqlite3_column_int64(st, 0);
+        sqlite3_finalize(st);
+    }
+
+    if (pkg_id < 0)
+        return -1;
+
+    /* File paths (regular files and symlinks) */
+    if (register_files(db, pkg_id, files, count) != 0) {
+        fprintf(stderr, "commit: failed to register files in DB\n");
+        return -1;
+    }
+
+    return pkg_id;
+}
+
 /* =========================================================================
  * Public entry
  * ========================================================================= */
@@ -399,76 +627,31 @@ int install_commit(const char *pkgname,
         return 1;
     }
 
-    /*
-     * 3a. Check version constraints before touching the DB.
-     */
-    if (install_check_constraints(meta)) {
+    struct install_file *files = fingerprint_staged(staging_dir, &staged);
+    if (!files) {
+        fprintf(stderr, "commit: failed to fingerprint staged files\n");
         pkg_meta_free(meta);
         pathlist_free(&staged);
         return 1;
     }
 
     /*
-     * 3b. Build plain name array for graph_add_package.
-     */
-    const char **dep_names = NULL;
-    if (meta->depends_count > 0) {
-        dep_names = malloc(meta->depends_count * sizeof(char *));
-        if (!dep_names) {
-            pkg_meta_free(meta);
-            pathlist_free(&staged);
-            return 1;
-        }
-        for (size_t i = 0; i < meta->depends_count; i++)
-            dep_names[i] = meta->depends[i].name;
-    }
-
-    /*
-     * 4. Open the single transaction that covers package row,
+     * 3. Open the single transaction that covers package row,
      *    dependency edges, and file registration.
      */
     if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) {
         fprintf(stderr, "commit: could not begin transaction\n");
-        free(dep_names);
+        staged_files_free(files, staged.count);
         pkg_meta_free(meta);
         pathlist_free(&staged);
         return 1;
     }
 
     /*
-     * 4a. Insert package + dependency rows.
+     * 4. Version constraints, package + dependency rows, file rows.
      */
-    int rc = graph_add_package(
-        meta->name,
-        meta->version,
-        1,
-        dep_names,
-        meta->depends_count
-    );
-    free(dep_names);
-
-    if (rc != 0) {
-        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
-        pkg_meta_free(meta);
-        pathlist_free(&staged);
-        return 1;
-    }
-
-    /*
-     * 4b. Retrieve the new package rowid for file registration.
-     */
-    sqlite3_int64 pkg_id = -1;
-    {
-        sqlite3_stmt *st = NULL;
-        sqlite3_prepare_v2(db,
-            "SELECT id FROM packages WHERE name = ?;",
-            -1, &st, NULL);
-        sqlite3_bind_text(st, 1, meta->name, -1, SQLITE_STATIC);
-        if (sqlite3_step(st) == SQLITE_ROW)
-            pkg_id = sqlite3_column_int64(st, 0);
-        sqlite3_finalize(st);
-    }
-
+    sqlite3_int64 pkg_id = install_register(meta, files, staged.count);
+    staged_files_free(files, staged.count);
     if (pkg_id < 0) {
         sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
         pkg_meta_free(meta);
@@ -476,17 +659,6 @@ int install_commit(const char *pkgname,
         return 1;
     }
 
-    /*
-     * 4c. Register file paths (regular files and symlinks).
-     */
-    if (register_files(db, pkg_id, &staged) != 0) {
-        fprintf(stderr, "commit: failed to register files in DB\n");
-        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
-        pkg_meta_free(meta);
-        pathlist_free(&staged);
-        return 1;
-    }
-
     /*
      * 4d. COMMIT.
      */
@@ -605,4 +777,741 @@ int install_commit(const char *pkgname,
     remove_staging(staging_dir);
 
     return 0;
-}
\ No newline at end of file
+}
+
+/* =========================================================================
+ * Upgrade commit
+ * ========================================================================= */
+
+#define UPGRADE_SUFFIX ".flappy-new"
+
+/* What the upgrade does with one staged entry */
+enum file_change {
+    FILE_UNCHANGED,
+    FILE_CHANGED,
+    FILE_NEW,
+};
+
+static int cmp_file_path(const void *a, const void *b)
+{
+    return strcmp(((const struct install_file *)a)->path,
+                  ((const struct install_file *)b)->path);
+}
+
+/*
+ * collect_owned
+ *
+ * Loads the files rows of pkg_id with their fingerprints, sorted by
+ * path.  Paths come back root-relative, like staged ones; a row with
+ * no fingerprint loads with sha256 "" and never compares equal.
+ */
+static int collect_owned(sqlite3 *db, sqlite3_int64 pkg_id,
+                         struct install_file **out, size_t *count)
+{
+    sqlite3_stmt *st = NULL;
+    int rc = sqlite3_prepare_v2(db,
+        "SELECT path, size, mode, sha256 FROM files "
+        "WHERE package_id = ? ORDER BY path COLLATE BINARY;",
+        -1, &st, NULL);
+    if (rc != SQLITE_OK)
+        db_die(db, rc, "upgrade owned prepare");
+
+    sqlite3_bind_int64(st, 1, pkg_id);
+
+    struct install_file *files = NULL;
+    size_t n = 0, cap = 0;
+
+    while ((rc = sqlite3_step(st)) == SQLITE_ROW) {
+        const char *p   = (const char *)sqlite3_column_text(st, 0);
+        const char *sha = (const char *)sqlite3_column_text(st, 3);
+
+        if (!p)
+            continue;
+
+        if (n == cap) {
+            size_t newcap = cap ? cap * 2 : 64;
+            struct install_file *tmp = realloc(files,
+                                               newcap * sizeof(*tmp));
+            if (!tmp)
+                break;
+            files = tmp;
+            cap   = newcap;
+        }
+
+        struct install_file *f = &files[n];
+        memset(f, 0, sizeof(*f));
+        if (!(f->path = strdup(root_rel(p))))
+            break;
+        n++;
+
+        f->size = sqlite3_column_type(st, 1) == SQLITE_NULL
+                  ? -1 : sqlite3_column_int64(st, 1);
+        f->mode = (unsigned)sqlite3_column_int64(st, 2);
+        if (sha && strlen(sha) == 64)
+            memcpy(f->sha256, sha, 65);
+    }
+
+    sqlite3_finalize(st);
+
+    if (rc != SQLITE_DONE) {
+        install_files_free(files, n);
+        return -1;
+    }
+
+    *out   = files;
+    *count = n;
+    return 0;
+}
+
+/*
+ * file_unchanged
+ *
+ * 1 if the staged entry `f` matches its row `old` by size, mode and
+ * sha256, and the installed path still has that type and size — a
+ * file deleted or truncated by hand is rewritten, not trusted.
+ */
+static int file_unchanged(const struct install_file *old,
+                          const struct install_file *f)
+{
+    if (!old->sha256[0] ||
+        old->size != f->size ||
+        old->mode != f->mode ||
+        strcmp(old->sha256, f->sha256) != 0)
+        return 0;
+
+    struct stat st;
+    const char *leaf;
+    int dfd = root_at(old->path, 0, &leaf);
+    if (dfd < 0)
+        return 0;
+    int rc = fstatat(dfd, leaf, &st, AT_SYMLINK_NOFOLLOW);
+    root_at_done(dfd);
+    if (rc != 0)
+        return 0;
+
+    return (st.st_mode & S_IFMT) == (f->mode & S_IFMT) &&
+           (long long)st.st_size == f->size;
+}
+
+/*
+ * apply_files_diff
+ *
+ * Brings pkg_id's files rows in line with the new version inside the
+ * caller's transaction: UPDATE the fingerprint of changed entries,
+ * INSERT new ones, DELETE rows of owned paths no longer shipped.
+ * Unchanged rows are left as they are.  A new entry still registered
+ * to another package takes that row over: the conflict check allowed
+ * it only for a package of the same upgrade set whose new version no
+ * longer ships the path (install_conflict_staged_set).
+ */
+static int apply_files_diff(sqlite3 *db, sqlite3_int64 pkg_id,
+                            const struct install_file *files,
+                            const unsigned char *change, size_t count,
+                            const struct install_file *owned,
+                            const unsigned char *shipped, size_t nowned)
+{
+    sqlite3_stmt *upd = NULL, *ins = NULL, *del = NULL, *take = NULL;
+    int rc = 0;
+
+    if (sqlite3_prepare_v2(db,
+            "UPDATE files SET size = ?, mode = ?, sha256 = ?, "
+            "                 link_target = ? "
+            "WHERE path = ? AND package_id = ?;",
+            -1, &upd, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db,
+            "INSERT INTO files(size, mode, sha256, link_target, path, "
+            "                  package_id) "
+            "VALUES(?, ?, ?, ?, ?, ?);",
+            -1, &ins, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db,
+            "DELETE FROM files WHERE path = ? AND package_id = ?;",
+            -1, &del, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db,
+            "DELETE FROM files WHERE path = ? AND package_id != ?;",
+            -1, &take, NULL) != SQLITE_OK)
+        db_die(db, sqlite3_errcode(db), "upgrade files diff prepare");
+
+    for (size_t i = 0; i < count && !rc; i++) {
+        if (change[i] == FILE_UNCHANGED)
+            continue;
+
+        sqlite3_stmt *st = change[i] == FILE_NEW ? ins : upd;
+        char canonical[PATH_MAX];
+        snprintf(canonical, sizeof(canonical), "/%s", files[i].path);
+
+        if (change[i] == FILE_NEW) {
+            sqlite3_reset(take);
+            sqlite3_bind_text (take, 1, canonical, -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int64(take, 2, pkg_id);
+            if (sqlite3_step(take) != SQLITE_DONE) {
+                rc = 1;
+                break;
+            }
+        }
+
+        sqlite3_reset(st);
+        bind_fingerprint(st, 1, &files[i]);
+        sqlite3_bind_text (st, 5, canonical, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(st, 6, pkg_id);
+        if (sqlite3_step(st) != SQLITE_DONE)
+            rc = 1;
+    }
+
+    for (size_t i = 0; i < nowned && !rc; i++) {
+        if (shipped[i])
+            continue;
+
+        char canonical[PATH_MAX];
+        snprintf(canonical, sizeof(canonical), "/%s", owned[i].path);
+
+        sqlite3_reset(del);
+        sqlite3_bind_text (del, 1, canonical, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(del, 2, pkg_id);
+        if (sqlite3_step(del) != SQLITE_DONE)
+            rc = 1;
+    }
+
+    sqlite3_finalize(upd);
+    sqlite3_finalize(ins);
+    sqlite3_finalize(del);
+    sqlite3_finalize(take);
+    return rc;
+}
+
+/*
+ * Swap journal
+ *
+ * upgrade_swaps holds one row per path an upgrade replaces, written
+ * before the first <path>.flappy-new and deleted once every path is
+ * final, so a crash at any point leaves enough behind for
+ * install_upgrade_recover to undo or finish the swap:
+ *
+ *   SWAP_WRITING    .flappy-new files are being written; nothing on
+ *                   disk has changed yet
+ *   SWAP_WRITTEN    every .flappy-new is complete and the swaps may
+ *                   have begun: each destination is hard-linked to
+ *                   <path>.flappy-old, then the .flappy-new renamed
+ *                   over it
+ *   SWAP_COMMITTED  set in the transaction that registers the new
+ *                   version; the .flappy-old links are stale
+ *
+ * An upgrade holds a write lock on UPGRADE_LOCK_PATH while it has
+ * rows, and recovery only runs when it can take that lock, so it never
+ * undoes the swaps of an upgrade that is still running.
+ */
+enum swap_stage {
+    SWAP_WRITING,
+    SWAP_WRITTEN,
+    SWAP_COMMITTED,
+};
+
+#define BACKUP_SUFFIX ".flappy-old"
+#define UPGRADE_LOCK_PATH FLAPPY_DB_DIR "/upgrade.lock"
+
+/* fcntl write lock on UPGRADE_LOCK_PATH, or -1 (errno) */
+static int swaps_lock(int wait)
+{
+    const char *leaf;
+    int dfd = root_at(UPGRADE_LOCK_PATH, 0, &leaf);
+    if (dfd < 0)
+        return -1;
+    int fd = openat(dfd, leaf, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC,
+                    0600);
+    root_at_done(dfd);
+    if (fd < 0)
+        return -1;
+
+    struct flock fl = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+    while (fcntl(fd, wait ? F_SETLKW : F_SETLK, &fl) != 0) {
+        if (errno == EINTR)
+            continue;
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+static int swaps_record(sqlite3 *db, const char *pkgname,
+                        char **paths, size_t count)
+{
+    sqlite3_stmt *st = NULL;
+
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK)
+        return 1;
+    if (sqlite3_prepare_v2(db,
+            "INSERT INTO upgrade_swaps(path, package, stage) "
+            "VALUES(?, ?, 0);",
+            -1, &st, NULL) != SQLITE_OK)
+        db_die(db, sqlite3_errcode(db), "upgrade swaps prepare");
+
+    int rc = 0;
+    for (size_t i = 0; i < count && !rc; i++) {
+        sqlite3_reset(st);
+        sqlite3_bind_text(st, 1, paths[i], -1, SQLITE_STATIC);
+        sqlite3_bind_text(st, 2, pkgname, -1, SQLITE_STATIC);
+        if (sqlite3_step(st) != SQLITE_DONE)
+            rc = 1;
+    }
+    sqlite3_finalize(st);
+
+    if (rc || sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        return 1;
+    }
+    return 0;
+}
+
+/* Moves pkgname's rows to `stage`, or deletes them with stage -1 */
+static int swaps_stage(sqlite3 *db, const char *pkgname, int stage)
+{
+    sqlite3_stmt *st = NULL;
+    const char *sql = stage < 0
+        ? "DELETE FROM upgrade_swaps WHERE package = ?1;"
+        : "UPDATE upgrade_swaps SET stage = ?2 WHERE package = ?1;";
+
+    if (sqlite3_prepare_v2(db, sql, -1, &st, NULL) != SQLITE_OK)
+        db_die(db, sqlite3_errcode(db), "upgrade swaps prepare");
+    sqlite3_bind_text(st, 1, pkgname, -1, SQLITE_STATIC);
+    if (stage >= 0)
+        sqlite3_bind_int(st, 2, stage);
+
+    int rc = sqlite3_step(st) == SQLITE_DONE ? 0 : 1;
+    sqlite3_finalize(st);
+    return rc;
+}
+
+/*
+ * swap_name
+ *
+ * Opens the directory of `dst` inside the root; *leaf is its name
+ * there and `side` that name with `suffix`.
+ */
+static int swap_name(const char *dst, const char *suffix, const char **leaf,
+                     char *side, size_t sidesz)
+{
+    int dfd = root_at(dst, 0, leaf);
+    if (dfd < 0)
+        return -1;
+
+    int n = snprintf(side, sidesz, "%s%s", *leaf, suffix);
+    if (n < 0 || (size_t)n >= sidesz) {
+        root_at_done(dfd);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return dfd;
+}
+
+/*
+ * swap_in
+ *
+ * Keeps the current entry at `dst` (if any) as dst.flappy-old and
+ * renames dst.flappy-new over it.
+ */
+static int swap_in(const char *dst)
+{
+    const char *leaf;
+    char newname[PATH_MAX], oldname[PATH_MAX];
+    int dfd = swap_name(dst, UPGRADE_SUFFIX, &leaf, newname, sizeof(newname));
+    if (dfd < 0)
+        return -1;
+    snprintf(oldname, sizeof(oldname), "%s" BACKUP_SUFFIX, leaf);
+
+    int rc = 0;
+    if (unlinkat(dfd, oldname, 0) != 0 && errno != ENOENT)
+        rc = -1;
+    else if (linkat(dfd, leaf, dfd, oldname, 0) != 0 && errno != ENOENT)
+        rc = -1;
+    else if (renameat(dfd, newname, dfd, leaf) != 0)
+        rc = -1;
+
+    int saved = errno;
+    root_at_done(dfd);
+    errno = saved;
+    return rc;
+}
+
+/*
+ * swap_undo
+ *
+ * Puts `dst` back as it was before its swap, whether or not the swap
+ * happened: a leftover .flappy-new means it did not, a .flappy-old is
+ * the old entry.  With neither, the swap installed a path that did not
+ * exist, which is removed unless `owned` says the old version has it
+ * (then the swap had already been undone).
+ */
+static void swap_undo(const char *dst, int owned)
+{
+    const char *leaf;
+    char newname[PATH_MAX], oldname[PATH_MAX];
+    int dfd = swap_name(dst, UPGRADE_SUFFIX, &leaf, newname, sizeof(newname));
+    if (dfd < 0)
+        return;
+    snprintf(oldname, sizeof(oldname), "%s" BACKUP_SUFFIX, leaf);
+
+    int had_new = unlinkat(dfd, newname, 0) == 0;
+    if (renameat(dfd, oldname, dfd, leaf) != 0) {
+        if (errno != ENOENT)
+            log_error("upgrade: cannot restore %s: %s", dst, strerror(errno));
+        else if (!had_new && !owned &&
+                 unlinkat(dfd, leaf, 0) != 0 && errno != ENOENT)
+            log_error("upgrade: cannot remove %s: %s", dst, strerror(errno));
+    }
+    root_at_done(dfd);
+}
+
+/* Drops what a finished swap left beside `dst` */
+static void swap_done(const char *dst)
+{
+    const char *leaf;
+    char oldname[PATH_MAX];
+    int dfd = swap_name(dst, BACKUP_SUFFIX, &leaf, oldname, sizeof(oldname));
+    if (dfd < 0)
+        return;
+    if (unlinkat(dfd, oldname, 0) != 0 && errno != ENOENT)
+        log_error("upgrade: cannot remove %s" BACKUP_SUFFIX ": %s",
+                  dst, strerror(errno));
+    root_at_done(dfd);
+}
+
+int install_upgrade_recover(void)
+{
+    sqlite3 *db = db_handle();
+    if (!db)
+        return -1;
+
+    sqlite3_stmt *st = NULL;
+    int any = 0;
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM upgrade_swaps LIMIT 1;",
+                           -1, &st, NULL) == SQLITE_OK)
+        any = sqlite3_step(st) == SQLITE_ROW;
+    sqlite3_finalize(st);
+    st = NULL;
+    if (!any)
+        return 0;
+
+    /* Busy: an upgrade is running.  Unwritable: not root. */
+    int lock = swaps_lock(0);
+    if (lock < 0)
+        return 0;
+
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) {
+        close(lock);
+        return -1;
+    }
+    if (sqlite3_prepare_v2(db,
+            "SELECT s.path, s.package, s.stage, "
+            "       EXISTS(SELECT 1 FROM files f WHERE f.path = s.path) "
+            "FROM upgrade_swaps s ORDER BY s.package;",
+            -1, &st, NULL) != SQLITE_OK)
+        db_die(db, sqlite3_errcode(db), "upgrade recover prepare");
+
+    int n = 0;
+    char last[256] = "";
+
+    while (sqlite3_step(st) == SQLITE_ROW) {
+        const char *path = (const char *)sqlite3_column_text(st, 0);
+        const char *pkg  = (const char *)sqlite3_column_text(st, 1);
+        int stage        = sqlite3_column_int(st, 2);
+        int owned        = sqlite3_column_int(st, 3);
+
+        if (!path || !pkg)
+            continue;
+
+        if (strcmp(pkg, last) != 0) {
+            const char *what = stage == SWAP_COMMITTED ? "finishing"
+                                                       : "undoing";
+            fprintf(stderr, "commit: %s interrupted upgrade of %s\n",
+                    what, pkg);
+            log_info("upgrade: %s interrupted upgrade of %s", what, pkg);
+            snprintf(last, sizeof(last), "%s", pkg);
+        }
+
+        if (stage == SWAP_COMMITTED) {
+            swap_done(path);
+        } else if (stage == SWAP_WRITTEN) {
+            swap_undo(path, owned);
+        } else {
+            char tmp[PATH_MAX];
+            snprintf(tmp, sizeof(tmp), "%s" UPGRADE_SUFFIX, path);
+            if (root_unlink(tmp) != 0 && errno != ENOENT)
+                log_error("upgrade: failed to remove %s: %s",
+                          tmp, strerror(errno));
+        }
+        n++;
+    }
+    sqlite3_finalize(st);
+
+    int rc = n;
+    if (sqlite3_exec(db, "DELETE FROM upgrade_swaps; COMMIT;",
+                     NULL, NULL, NULL) != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        rc = -1;
+    }
+    close(lock);
+    return rc;
+}
+
+int install_commit_upgrade(const char *pkgname,
+                           const char *pkgfile,
+                           const char *staging_dir)
+{
+    struct flappy_pkg *meta = pkg_read_from_file(pkgfile);
+    if (!meta) {
+        fprintf(stderr, "commit: cannot read package metadata from %s\n",
+                pkgfile);
+        return 1;
+    }
+
+    if (strcmp(meta->name, pkgname) != 0) {
+        fprintf(stderr,
+                "commit: package name mismatch: expected '%s' got '%s'\n",
+                pkgname, meta->name);
+        pkg_meta_free(meta);
+        return 1;
+    }
+
+    sqlite3 *db = db_handle();
+    if (!db) {
+        pkg_meta_free(meta);
+        return 1;
+    }
+
+    sqlite3_int64 pkg_id = -1;
+    {
+        sqlite3_stmt *st = NULL;
+        sqlite3_prepare_v2(db,
+            "SELECT id FROM packages WHERE name = ?;",
+            -1, &st, NULL);
+        sqlite3_bind_text(st, 1, meta->name, -1, SQLITE_STATIC);
+        if (sqlite3_step(st) == SQLITE_ROW)
+            pkg_id = sqlite3_column_int64(st, 0);
+        sqlite3_finalize(st);
+    }
+
+    if (pkg_id < 0) {
+        fprintf(stderr, "commit: '%s' is not installed\n", pkgname);
+        pkg_meta_free(meta);
+        return 1;
+    }
+
+    PathList             staged  = {0};
+    struct install_file *files   = NULL;
+    struct install_file *owned   = NULL;
+    size_t               nowned  = 0;
+    unsigned char       *change  = NULL;   /* per staged entry */
+    unsigned char       *shipped = NULL;   /* per owned row */
+    char               **pending = NULL;   /* destinations to swap */
+    size_t              *pending_of = NULL;/* staged index of each */
+    size_t               pending_count = 0;
+    int                  journaled = 0;
+    int                  lock = -1;
+    const char         **dep_names = NULL;
+    int                  rc = 1;
+
+    if (walk_staging(staging_dir, "", &staged) != 0 ||
+            collect_owned(db, pkg_id, &owned, &nowned) != 0) {
+        fprintf(stderr, "commit: failed to collect file lists\n");
+        goto out;
+    }
+
+    if (install_check_constraints(meta))
+        goto out;
+
+    files      = fingerprint_staged(staging_dir, &staged);
+    change     = calloc(staged.count ? staged.count : 1, 1);
+    shipped    = calloc(nowned ? nowned : 1, 1);
+    pending    = calloc(staged.count ? staged.count : 1, sizeof(char *));
+    pending_of = calloc(staged.count ? staged.count : 1, sizeof(size_t));
+    if (!files || !change || !shipped || !pending || !pending_of) {
+        fprintf(stderr, "commit: failed to fingerprint staged files\n");
+        goto out;
+    }
+
+    /*
+     * 1. Diff against the files rows.
+     */
+    size_t unchanged = 0;
+    int failed = 0;
+
+    for (size_t i = 0; i < staged.count; i++) {
+        const struct install_file *old =
+            bsearch(&files[i], owned, nowned, sizeof(*owned), cmp_file_path);
+
+        if (old) {
+            shipped[old - owned] = 1;
+            if (file_unchanged(old, &files[i])) {
+                change[i] = FILE_UNCHANGED;
+                unchanged++;
+                continue;
+            }
+            change[i] = FILE_CHANGED;
+        } else {
+            change[i] = FILE_NEW;
+        }
+
+        char dst[PATH_MAX];
+        int n = snprintf(dst, sizeof(dst), "/%s", staged.paths[i]);
+        if (n < 0 || (size_t)n + sizeof(UPGRADE_SUFFIX) > sizeof(dst)) {
+            fprintf(stderr, "commit: path too long: /%s\n", staged.paths[i]);
+            goto out;
+        }
+        if (!(pending[pending_count] = strdup(dst)))
+            goto out;
+        pending_of[pending_count++] = i;
+    }
+
+    /*
+     * 2. Journal the swaps, then write every changed or new entry
+     *    beside its destination.
+     */
+    if ((lock = swaps_lock(1)) < 0) {
+        fprintf(stderr, "commit: cannot lock %s: %s\n",
+                UPGRADE_LOCK_PATH, strerror(errno));
+        goto out;
+    }
+    if (swaps_record(db, meta->name, pending, pending_count) != 0) {
+        fprintf(stderr, "commit: cannot record pending swaps: %s\n",
+                sqlite3_errmsg(db));
+        goto out;
+    }
+    journaled = 1;
+
+    for (size_t p = 0; p < pending_count; p++) {
+        size_t i = pending_of[p];
+        char src[PATH_MAX], tmp[PATH_MAX];
+
+        snprintf(src, sizeof(src), "%s/%s", staging_dir, staged.paths[i]);
+        snprintf(tmp, sizeof(tmp), "%s" UPGRADE_SUFFIX, pending[p]);
+
+        int cp_rc = S_ISLNK(files[i].mode) ? copy_symlink(src, tmp)
+                                           : copy_file(src, tmp);
+        if (cp_rc != 0) {
+            fprintf(stderr, "commit: failed to write %s: %s\n",
+                    tmp, strerror(errno));
+            goto out;
+        }
+    }
+
+    if (swaps_stage(db, meta->name, SWAP_WRITTEN) != 0) {
+        fprintf(stderr, "commit: cannot record pending swaps: %s\n",
+                sqlite3_errmsg(db));
+        goto out;
+    }
+
+    /*
+     * 3. In one transaction: update the package row and dependency
+     *    edges, apply the diff to the files rows, and swap each
+     *    written entry into place.  rename() replaces the old file
+     *    atomically; a reader sees either the old or the new content.
+     *    COMMIT only once every swap has succeeded.
+     */
+    if (meta->depends_count > 0) {
+        dep_names = malloc(meta->depends_count * sizeof(char *));
+        if (!dep_names)
+            goto out;
+        for (size_t i = 0; i < meta->depends_count; i++)
+            dep_names[i] = meta->depends[i].name;
+    }
+
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "commit: could not begin transaction\n");
+        goto out;
+    }
+
+    if (graph_upgrade_package(meta->name, meta->version, dep_names,
+                              meta->depends_count) != 0)
+        failed = 1;
+
+    if (!failed && apply_files_diff(db, pkg_id, files, change, staged.count,
+                                    owned, shipped, nowned) != 0) {
+        fprintf(stderr, "commit: failed to register files in DB\n");
+        failed = 1;
+    }
+
+    if (!failed && swaps_stage(db, meta->name, SWAP_COMMITTED) != 0) {
+        fprintf(stderr, "commit: cannot record pending swaps\n");
+        failed = 1;
+    }
+
+    for (size_t p = 0; p < pending_count && !failed; p++) {
+        if (swap_in(pending[p]) != 0) {
+            fprintf(stderr, "commit: cannot replace %s: %s\n",
+                    pending[p], strerror(errno));
+            log_error("upgrade: cannot replace %s: %s",
+                      pending[p], strerror(errno));
+            failed = 1;
+        }
+    }
+
+    if (!failed &&
+            sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "commit: transaction commit failed\n");
+        failed = 1;
+    }
+
+    if (failed) {
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        goto out;
+    }
+
+    for (size_t p = 0; p < pending_count; p++)
+        swap_done(pending[p]);
+    journaled = 0;
+    if (swaps_stage(db, meta->name, -1) != 0)
+        log_error("upgrade: cannot clear pending swaps of %s: %s",
+                  meta->name, sqlite3_errmsg(db));
+
+    /*
+     * 4. Remove paths the new version no longer ships.
+     */
+    size_t removed = 0;
+
+    for (size_t i = 0; i < nowned; i++) {
+        if (shipped[i])
+            continue;
+        removed++;
+        if (strncmp(owned[i].path, "etc/", 4) == 0) {
+            log_info("upgrade: kept unowned config /%s", owned[i].path);
+            continue;
+        }
+        if (root_unlink(owned[i].path) != 0 && errno != ENOENT)
+            log_error("upgrade: failed to remove /%s: %s",
+                      owned[i].path, strerror(errno));
+    }
+
+    log_info("upgrade: committed %s %s (%zu files: %zu written, "
+             "%zu unchanged, %zu removed)",
+             meta->name, meta->version, staged.count,
+             staged.count - unchanged, unchanged, removed);
+
+    remove_staging(staging_dir);
+    rc = 0;
+
+out:
+    if (journaled) {
+        /* Nothing committed: put every destination back as it was */
+        for (size_t p = 0; p < pending_count; p++)
+            swap_undo(pending[p],
+                      change[pending_of[p]] == FILE_CHANGED);
+        if (swaps_stage(db, meta->name, -1) != 0)
+            log_error("upgrade: cannot clear pending swaps of %s: %s",
+                      meta->name, sqlite3_errmsg(db));
+    }
+    if (lock >= 0)
+        close(lock);
+    for (size_t p = 0; p < pending_count; p++)
+        free(pending[p]);
+    free(pending);
+    free(pending_of);
+    free(dep_names);
+    free(change);
+    free(shipped);
+    staged_files_free(files, staged.count);
+    install_files_free(owned, nowned);
+    pathlist_free(&staged);
+    pkg_meta_free(meta);
+    return rc;
+}
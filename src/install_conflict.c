@@ -19,6 +19,12 @@
  * Atomicity is preserved: nothing has been written to the real
  * filesystem yet (staging is separate), so an abort here is clean.
  *
+ * install_conflict_staged_set is the same check for one package of an
+ * upgrade set, which may take over a path from another package of the
+ * set whose new version no longer ships it.  install_conflict_within
+ * checks the staged packages of a set against each other, for paths
+ * no installed package owns yet.
+ *
  * Returns:
  *   0  no conflicts
  *   1  conflict detected or error
@@ -28,6 +34,7 @@
 
 #include "flappy.h"
 #include "db_guard.h"
+#include "install.h"
 
 #include <sqlite3.h>
 
@@ -137,7 +144,101 @@ static int walk_staged(const char *staging_dir,
  * Public entry
  * ========================================================================= */
 
+/* Does `owner`, if it is upgraded with the set, stop shipping `path`? */
+static int released(const char *owner, const char *path,
+                    const struct staged_pkg *set, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(set[i].name, owner) != 0)
+            continue;
+
+        char staged[PATH_MAX];
+        struct stat st;
+        int n = snprintf(staged, sizeof(staged), "%s%s",
+                         set[i].staging_dir, path);
+        return n > 0 && n < (int)sizeof(staged) &&
+               lstat(staged, &st) != 0 && errno == ENOENT;
+    }
+    return 0;
+}
+
+/* One staged path of install_conflict_within and its package */
+struct staged_path {
+    const char *path;
+    size_t      pkg;
+};
+
+static int staged_path_cmp(const void *a, const void *b)
+{
+    const struct staged_path *x = a, *y = b;
+    int c = strcmp(x->path, y->path);
+    if (c == 0)
+        c = (x->pkg > y->pkg) - (x->pkg < y->pkg);
+    return c;
+}
+
+int install_conflict_within(const struct staged_pkg *set, size_t count)
+{
+    PathList *pl = calloc(count ? count : 1, sizeof(*pl));
+    if (!pl) {
+        fprintf(stderr, "conflict: out of memory\n");
+        return 1;
+    }
+
+    int rc = 0;
+    size_t total = 0;
+    for (size_t i = 0; i < count && !rc; i++) {
+        if (walk_staged(set[i].staging_dir, "", &pl[i]) != 0) {
+            fprintf(stderr, "conflict: failed to walk staging directory\n");
+            rc = 1;
+        }
+        total += pl[i].count;
+    }
+
+    /* every staged path of the set, sorted: a shared one is adjacent */
+    struct staged_path *all = NULL;
+    if (!rc && total > 0) {
+        all = malloc(total * sizeof(*all));
+        if (!all) {
+            fprintf(stderr, "conflict: out of memory\n");
+            rc = 1;
+        }
+    }
+
+    if (!rc && all) {
+        size_t k = 0;
+        for (size_t i = 0; i < count; i++)
+            for (size_t j = 0; j < pl[i].count; j++) {
+                all[k].path = pl[i].paths[j];
+                all[k].pkg  = i;
+                k++;
+            }
+        qsort(all, total, sizeof(*all), staged_path_cmp);
+
+        for (size_t k = 1; k < total; k++) {
+            if (strcmp(all[k - 1].path, all[k].path) != 0)
+                continue;
+            fprintf(stderr, "conflict: %s is shipped by both %s and %s\n",
+                    all[k].path, set[all[k - 1].pkg].name,
+                    set[all[k].pkg].name);
+            rc = 1;
+        }
+    }
+
+    free(all);
+    for (size_t i = 0; i < count; i++)
+        pathlist_free(&pl[i]);
+    free(pl);
+    return rc;
+}
+
 int install_conflict_staged(const char *pkgname, const char *staging_dir)
+{
+    return install_conflict_staged_set(pkgname, staging_dir, NULL, 0);
+}
+
+int install_conflict_staged_set(const char *pkgname, const char *staging_dir,
+                                const struct staged_pkg *set, size_t count)
 {
     PathList pl = {0};
 
@@ -180,11 +281,13 @@ int install_conflict_staged(const char *pkgname, const char *staging_dir)
         sqlite3_bind_text(st, 2, pkgname,     -1, SQLITE_STATIC);
 
         if (sqlite3_step(st) == SQLITE_ROW) {
-            const unsigned char *owner = sqlite3_column_text(st, 0);
+            const char *owner = (const char *)sqlite3_column_text(st, 0);
+            if (owner && released(owner, pl.paths[i], set, count))
+                continue;
             fprintf(stderr,
                     "conflict: %s is already owned by %s\n",
                     pl.paths[i],
-                    owner ? (const char *)owner : "unknown");
+                    owner ? owner : "unknown");
             conflict = 1;
         }
     }
@@ -5,7 +5,9 @@
  *
  * For each declared dependency with a version constraint,
  * looks up the installed version and verifies it satisfies
- * the constraint.
+ * the constraint.  The installed side is compared through its stored
+ * packages.version_key against the constraint the parser compiled
+ * into dep_entry, so no version string is parsed here.
  *
  * Returns:
  *   0  all constraints satisfied
@@ -24,6 +26,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 static const char *op_str(dep_op_t op)
 {
@@ -38,31 +41,48 @@ static const char *op_str(dep_op_t op)
 }
 
 /*
- * get_installed_version
+ * installed_version
  *
- * Returns the installed version of `name`, or NULL if not installed.
- * Caller must free the returned string.
+ * Looks up `name` in the installed DB.  Returns 1 if installed, with
+ * the version string copied into `version` and its sort key into
+ * `key` / *keylen (*keylen is set to SIZE_MAX when the stored key is
+ * NULL, i.e. the installed version is invalid).  Returns 0 if not
+ * installed.
  */
-static char *get_installed_version(sqlite3 *db, const char *name)
+static int installed_version(sqlite3 *db, const char *name,
+                             char *version, size_t vsize,
+                             unsigned char *key, size_t *keylen)
 {
     sqlite3_stmt *st = NULL;
 
     int rc = sqlite3_prepare_v2(db,
-        "SELECT version FROM packages WHERE name = ?;",
+        "SELECT version, version_key FROM packages WHERE name = ?;",
         -1, &st, NULL);
     if (rc != SQLITE_OK)
-        return NULL;
+        return 0;
 
     sqlite3_bind_text(st, 1, name, -1, SQLITE_STATIC);
 
-    char *version = NULL;
+    int found = 0;
     if (sqlite3_step(st) == SQLITE_ROW) {
         const char *v = (const char *)sqlite3_column_text(st, 0);
-        if (v) version = strdup(v);
+        snprintf(version, vsize, "%s", v ? v : "");
+
+        const void *k = sqlite3_column_blob(st, 1);
+        int n = sqlite3_column_bytes(st, 1);
+        if (sqlite3_column_type(st, 1) == SQLITE_BLOB &&
+            n <= VERSION_KEY_MAX) {
+            if (n > 0)
+                memcpy(key, k, (size_t)n);
+            *keylen = (size_t)n;
+        } else {
+            *keylen = SIZE_MAX;
+        }
+        found = 1;
     }
 
     sqlite3_finalize(st);
-    return version;
+    return found;
 }
 
 int install_check_constraints(const struct flappy_pkg *pkg)
@@ -79,14 +99,18 @@ int install_check_constraints(const struct flappy_pkg *pkg)
         if (dep->op == DEP_OP_NONE)
             continue;
 
-        char *installed = get_installed_version(db, dep->name);
+        char installed[64];
+        unsigned char ikey[VERSION_KEY_MAX];
+        size_t ilen;
 
-        if (!installed) {
+        if (!installed_version(db, dep->name, installed, sizeof(installed),
+                               ikey, &ilen)) {
             /* Not installed at all — graph_add_package will catch this */
             continue;
         }
 
-        if (!version_satisfies(installed, dep->op, dep->version)) {
+        if (!version_constraint_test(&dep->constraint,
+                                     ilen == SIZE_MAX ? NULL : ikey, ilen)) {
             ui_error("dependency constraint not satisfied: %s %s %s (installed: %s)",
                      dep->name, op_str(dep->op), dep->version, installed);
             log_error("constraint failed: %s requires %s %s %s, installed %s",
@@ -94,9 +118,7 @@ int install_check_constraints(const struct flappy_pkg *pkg)
                       op_str(dep->op), dep->version, installed);
             failed = 1;
         }
-
-        free(installed);
     }
 
     return failed;
-}
\ No newline at end of file
+}
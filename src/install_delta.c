@@ -0,0 +1,235 @@
+/*
+ * install_delta.c - Binary delta packages for upgrades
+ *
+ * A repository may publish, next to a package archive, deltas that
+ * turn an older archive of the same package into it.  A delta is a
+ * zstd frame compressed with the old archive as prefix
+ * (`zstd --patch-from=<old> <new> -o <delta>`), so the client
+ * rebuilds the new archive byte for byte by decompressing the delta
+ * with the cached old archive as the same prefix.
+ *
+ * repo.db lists them in an optional table, carried through the merge
+ * (repo_update.c) for the packages each repository provides:
+ *
+ *   deltas(package, from_filename, to_filename, filename, checksum)
+ *
+ *   from_filename  archive the delta applies to (looked up in the cache)
+ *   to_filename    archive it rebuilds (packages.filename)
+ *   filename       the delta file, under packages/ like an archive
+ *   checksum       SHA256 of the delta file
+ *
+ * The rebuilt archive is verified with install_verify against the
+ * package checksum, exactly like a downloaded one, so a stale or
+ * corrupt base archive is caught there; the caller then downloads the
+ * full archive instead.  The base itself is not hashed first.
+ *
+ * Deltas are taken over the compressed archives.  They stay small
+ * only when unchanged content compresses to unchanged bytes, i.e.
+ * archives built with `zstd --rsyncable`.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "flappy.h"
+#include "install.h"
+#include "repo.h"
+
+#include <sqlite3.h>
+#include <zstd.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * --patch-from raises the frame window to cover the whole base; accept
+ * up to ZSTD_WINDOWLOG_MAX_64 (2 GiB) instead of the 128 MiB default.
+ */
+#define DELTA_WINDOW_LOG_MAX 31
+
+int install_delta_find(const char *pkg, const char *filename,
+                       struct delta_info *out)
+{
+    char path[512];
+    int n = snprintf(path, sizeof(path), "%s/%s",
+                     FLAPPY_PKG_CACHE_DIR, filename);
+
+    /* The archive itself is already cached: nothing to rebuild */
+    if (n < 0 || n >= (int)sizeof(path) || access(path, F_OK) == 0)
+        return 1;
+
+    sqlite3 *db = NULL;
+    if (sqlite3_open_v2(FLAPPY_REPO_DB_PATH, &db,
+                        SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        sqlite3_close(db);
+        return 1;
+    }
+
+    /* No deltas table: the repository publishes none */
+    sqlite3_stmt *st = NULL;
+    if (sqlite3_prepare_v2(db,
+            "SELECT from_filename, filename, checksum FROM deltas "
+            "WHERE package = ? AND to_filename = ?;",
+            -1, &st, NULL) != SQLITE_OK) {
+        sqlite3_close(db);
+        return 1;
+    }
+
+    sqlite3_bind_text(st, 1, pkg, -1, SQLITE_STATIC);
+    sqlite3_bind_text(st, 2, filename, -1, SQLITE_STATIC);
+
+    int rc = 1;
+    while (rc != 0 && sqlite3_step(st) == SQLITE_ROW) {
+        const char *from  = (const char *)sqlite3_column_text(st, 0);
+        const char *delta = (const char *)sqlite3_column_text(st, 1);
+        const char *sum   = (const char *)sqlite3_column_text(st, 2);
+
+        if (!install_filename_ok(from) || !install_filename_ok(delta) ||
+            !sum)
+            continue;
+
+        n = snprintf(out->base_path, sizeof(out->base_path), "%s/%s",
+                     FLAPPY_PKG_CACHE_DIR, from);
+        if (n < 0 || n >= (int)sizeof(out->base_path) ||
+            access(out->base_path, R_OK) != 0)
+            continue;
+
+        snprintf(out->filename, sizeof(out->filename), "%s", delta);
+        snprintf(out->checksum, sizeof(out->checksum), "%s", sum);
+        rc = 0;
+    }
+
+    sqlite3_finalize(st);
+    sqlite3_close(db);
+
+    if (rc == 0)
+        log_info("delta: %s from %s via %s",
+                 filename, out->base_path, out->filename);
+    return rc;
+}
+
+/*
+ * patch_from
+ *
+ * Decompresses the delta at `delta_path` into `out`, with `base`
+ * (size `base_len`) as the frame prefix.  Returns 0 on success.
+ */
+static int patch_from(const void *base, size_t base_len,
+                      const char *delta_path, FILE *out)
+{
+    FILE *in = fopen(delta_path, "rb");
+    if (!in)
+        return 1;
+
+    ZSTD_DCtx *dctx   = ZSTD_createDCtx();
+    size_t     in_cap  = ZSTD_DStreamInSize();
+    size_t     out_cap = ZSTD_DStreamOutSize();
+    void      *ibuf    = malloc(in_cap);
+    void      *obuf    = malloc(out_cap);
+    int        rc      = 1;
+
+    if (!dctx || !ibuf || !obuf ||
+        ZSTD_isError(ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax,
+                                            DELTA_WINDOW_LOG_MAX)) ||
+        ZSTD_isError(ZSTD_DCtx_refPrefix(dctx, base, base_len)))
+        goto out;
+
+    size_t ret  = 1;            /* 0 once the frame is complete */
+    size_t got;
+
+    while ((got = fread(ibuf, 1, in_cap, in)) > 0) {
+        ZSTD_inBuffer input = { ibuf, got, 0 };
+
+        /* One frame only: the prefix does not carry over to a second */
+        if (ret == 0)
+            goto out;
+
+        while (input.pos < input.size) {
+            ZSTD_outBuffer output = { obuf, out_cap, 0 };
+            ret = ZSTD_decompressStream(dctx, &output, &input);
+            if (ZSTD_isError(ret)) {
+                log_error("delta: %s: %s", delta_path,
+                          ZSTD_getErrorName(ret));
+                goto out;
+            }
+            if (fwrite(obuf, 1, output.pos, out) != output.pos)
+                goto out;
+            if (ret == 0 && input.pos < input.size)
+                goto out;
+        }
+    }
+
+    rc = (ferror(in) || ret != 0) ? 1 : 0;
+
+out:
+    free(ibuf);
+    free(obuf);
+    ZSTD_freeDCtx(dctx);
+    fclose(in);
+    return rc;
+}
+
+int install_delta_apply(const struct delta_info *delta,
+                        const char *delta_path,
+                        const char *filename, const char *checksum,
+                        char *local_path)
+{
+    int n = snprintf(local_path, 512, "%s/%s",
+                     FLAPPY_PKG_CACHE_DIR, filename);
+    if (n < 0 || n >= 512)
+        return 1;
+
+    char part[INSTALL_PART_PATH_MAX];
+    install_part_path(part, local_path);
+
+    int fd = open(delta->base_path, O_RDONLY);
+    if (fd < 0) {
+        log_error("delta: cannot open %s: %s",
+                  delta->base_path, strerror(errno));
+        return 1;
+    }
+
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED) {
+        log_error("delta: cannot map %s", delta->base_path);
+        return 1;
+    }
+
+    int rc = 1;
+    FILE *out = fopen(part, "wb");
+    if (out) {
+        rc = patch_from(base, (size_t)st.st_size, delta_path, out);
+        if (fclose(out) != 0)
+            rc = 1;
+    }
+    munmap(base, (size_t)st.st_size);
+
+    /* The delta is single use; the rebuilt archive replaces it */
+    unlink(delta_path);
+
+    if (rc == 0 && install_verify(part, checksum) != 0)
+        rc = 1;
+
+    if (rc == 0 && rename(part, local_path) != 0)
+        rc = 1;
+
+    if (rc != 0) {
+        unlink(part);
+        log_error("delta: cannot rebuild %s from %s",
+                  filename, delta->base_path);
+        return 1;
+    }
+
+    log_info("delta: rebuilt %s from %s", filename, delta->base_path);
+    return 0;
+}
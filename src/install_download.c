@@ -11,85 +11,82 @@
  * "checksum mismatch" — giving the operator no indication that
  * the fix is `flappy clean --all`.
  *
- * The cache hit path now computes the SHA256 of the cached file
+ * The cache hit path now computes the digest of the cached file
  * and compares it against the expected checksum from repo.db
  * before deciding to skip the download.  On mismatch the cached
  * file is deleted and a fresh download is performed.  The
  * operator sees a clear diagnostic rather than a cryptic failure
  * one step later.
+ *
+ * SEGMENTED DOWNLOADS:
+ *
+ * One TCP stream is bound by per-connection throughput (window size,
+ * server-side shaping), which makes multi-GB packages (toolchains,
+ * firmware) far slower than the link.  A package of at least
+ * DOWNLOAD_SEGMENT_THRESHOLD bytes on a server that advertises
+ * "Accept-Ranges: bytes" is fetched as up to DOWNLOAD_SEGMENTS_MAX
+ * concurrent Range requests, each pwrite()ing its slice into a cache
+ * file preallocated to the full size.  A segment that fails is resumed
+ * from its last byte; the assembled file is verified as a whole by
+ * install_verify like any other download.
+ *
+ * CHUNKED ARCHIVES:
+ *
+ * On a cache miss, an archive the repository also publishes as a
+ * chunk index is handed to install_chunks_fetch first, which fills the
+ * cache from the local chunk store plus the chunks it lacks; only if
+ * that fails is the archive downloaded whole.  The chunk fetches are
+ * themselves batch requests marked `quiet`.
  */
 
 #define _POSIX_C_SOURCE 200809L
 
 #include "flappy.h"
+#include "install.h"
+#include "mirror.h"
+#include "netsched.h"
 #include "repo.h"
-#include "sha256.h"
+#include "digest.h"
 #include "ui.h"
 
 #include <curl/curl.h>
-#include <sqlite3.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
-#define CACHE_DIR "/var/cache/flappy/packages"
+#define DOWNLOAD_SEGMENT_THRESHOLD (64LL * 1024 * 1024)
+#define DOWNLOAD_SEGMENT_MIN       (16LL * 1024 * 1024)
+#define DOWNLOAD_SEGMENTS_MAX      8
+#define DOWNLOAD_SEGMENT_RETRIES   2
 
-static size_t write_data(void *ptr, size_t size, size_t nmemb, FILE *stream)
+static size_t write_data(char *ptr, size_t size, size_t nmemb, void *arg)
 {
-    return fwrite(ptr, size, nmemb, stream);
+    return fwrite(ptr, size, nmemb, (FILE *)arg);
 }
 
 static int ensure_cache_dir(void)
 {
-    if (mkdir(CACHE_DIR, 0755) == -1 && errno != EEXIST) {
+    if (mkdir(FLAPPY_PKG_CACHE_DIR, 0755) == -1 && errno != EEXIST) {
         ui_error("cannot create cache dir: %s", strerror(errno));
         return 1;
     }
     return 0;
 }
 
-static void read_base_url(char *out, size_t out_size)
-{
-    sqlite3 *db = NULL;
-    sqlite3_stmt *st = NULL;
-
-    strncpy(out, FLAPPY_DEFAULT_REPO_URL, out_size - 1);
-    out[out_size - 1] = '\0';
-
-    if (sqlite3_open_v2(FLAPPY_REPO_DB_PATH, &db,
-                        SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
-        return;
-
-    if (sqlite3_prepare_v2(db,
-            "SELECT value FROM meta WHERE key = 'base_url';",
-            -1, &st, NULL) != SQLITE_OK) {
-        sqlite3_close(db);
-        return;
-    }
-
-    if (sqlite3_step(st) == SQLITE_ROW) {
-        const char *url = (const char *)sqlite3_column_text(st, 0);
-        if (url && *url) {
-            strncpy(out, url, out_size - 1);
-            out[out_size - 1] = '\0';
-        }
-    }
-
-    sqlite3_finalize(st);
-    sqlite3_close(db);
-}
-
 /*
  * do_download
  *
- * Downloads `url` into the file at `local_path`, showing a progress
- * bar on TTY.  Returns 0 on success, 1 on failure.
+ * Downloads `url` (a file on `mirror`) into the file at `local_path`,
+ * showing a progress bar on TTY.  Returns 0 on success, 1 on failure.
  */
-static int do_download(const char *url, const char *local_path,
-                       const char *filename)
+static int do_download(const char *url, const char *mirror,
+                       const char *local_path, const char *filename)
 {
     FILE *f = fopen(local_path, "wb");
     if (!f) {
@@ -107,10 +104,12 @@ static int do_download(const char *url, const char *local_path,
     }
 
     curl_easy_setopt(curl, CURLOPT_URL,            url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,  write_data);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA,      f);
     curl_easy_setopt(curl, CURLOPT_FAILONERROR,    1L);
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    mirror_curl_setopts(curl);
+
+    struct netsched_xfer sx = {0};
+    netsched_begin(&sx, curl, url, write_data, f, 1);
 
     if (ui_is_tty()) {
         curl_easy_setopt(curl, CURLOPT_NOPROGRESS,       0L);
@@ -121,6 +120,8 @@ static int do_download(const char *url, const char *local_path,
     }
 
     CURLcode res = curl_easy_perform(curl);
+    netsched_end(&sx);
+    mirror_record(mirror, curl, res);
     curl_easy_cleanup(curl);
     fclose(f);
 
@@ -128,73 +129,760 @@ static int do_download(const char *url, const char *local_path,
         fprintf(stderr, "\n");
         ui_error("failed to download %s: %s", filename,
                  curl_easy_strerror(res));
+        unlink(local_path);
         return 1;
     }
 
     ui_progress_finish();
-    log_info("download: cached %s", local_path);
     return 0;
 }
 
-int install_download(const char *filename, char *local_path,
-                     const char *expected_checksum)
+/* =========================================================================
+ * Segmented download
+ * ========================================================================= */
+
+static size_t header_ranges(char *buf, size_t size, size_t nitems, void *arg)
 {
-    if (ensure_cache_dir())
+    size_t len = size * nitems;
+    static const char key[] = "accept-ranges:";
+
+    if (len > sizeof(key) - 1 &&
+        strncasecmp(buf, key, sizeof(key) - 1) == 0) {
+        const char *v = buf + sizeof(key) - 1;
+        while (*v == ' ' || *v == '\t')
+            v++;
+        if (strncasecmp(v, "bytes", 5) == 0)
+            *(int *)arg = 1;
+    }
+    return len;
+}
+
+/*
+ * remote_size
+ *
+ * HEAD `url`.  Returns its Content-Length if the server accepts byte
+ * ranges, -1 otherwise (unknown size, no ranges, or any error — the
+ * caller then downloads in one stream, which reports the real error).
+ */
+static curl_off_t remote_size(const char *url)
+{
+    CURL *curl = curl_easy_init();
+    if (!curl)
+        return -1;
+
+    int ranges = 0;
+    curl_easy_setopt(curl, CURLOPT_URL,            url);
+    curl_easy_setopt(curl, CURLOPT_NOBODY,         1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR,    1L);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_ranges);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA,     &ranges);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS,     MIRROR_PROBE_TIMEOUT_MS);
+    mirror_curl_setopts(curl);
+
+    curl_off_t size = -1;
+    if (curl_easy_perform(curl) != CURLE_OK ||
+        curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                          &size) != CURLE_OK ||
+        !ranges)
+        size = -1;
+
+    curl_easy_cleanup(curl);
+    return size;
+}
+
+struct segment {
+    int         fd;
+    curl_off_t  begin;      /* first byte of the slice */
+    curl_off_t  pos;        /* next byte to write */
+    curl_off_t  end;        /* last byte, inclusive */
+    CURL       *curl;
+    struct netsched_xfer sched;
+};
+
+static size_t segment_write(char *ptr, size_t size, size_t nmemb, void *arg)
+{
+    struct segment *sg = arg;
+    size_t len = size * nmemb;
+
+    /* a server that ignores Range sends more than was asked for */
+    if ((curl_off_t)len > sg->end + 1 - sg->pos)
+        return 0;
+
+    size_t done = 0;
+    while (done < len) {
+        ssize_t w = pwrite(sg->fd, ptr + done, len - done,
+                           (off_t)(sg->pos + (curl_off_t)done));
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        done += (size_t)w;
+    }
+
+    sg->pos += (curl_off_t)len;
+    return len;
+}
+
+static int segment_start(CURLM *multi, struct segment *sg, const char *url)
+{
+    char range[64];
+    snprintf(range, sizeof(range), "%lld-%lld",
+             (long long)sg->pos, (long long)sg->end);
+
+    sg->curl = curl_easy_init();
+    if (!sg->curl)
+        return 1;
+
+    curl_easy_setopt(sg->curl, CURLOPT_URL,            url);
+    curl_easy_setopt(sg->curl, CURLOPT_RANGE,          range);
+    curl_easy_setopt(sg->curl, CURLOPT_FAILONERROR,    1L);
+    curl_easy_setopt(sg->curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(sg->curl, CURLOPT_NOPROGRESS,     1L);
+    curl_easy_setopt(sg->curl, CURLOPT_PRIVATE,        sg);
+    mirror_curl_setopts(sg->curl);
+
+    /* nseg never exceeds netsched_slots: a slot frees up eventually */
+    netsched_begin(&sg->sched, sg->curl, url, segment_write, sg, 1);
+
+    curl_multi_add_handle(multi, sg->curl);
+    return 0;
+}
+
+/*
+ * do_download_segmented
+ *
+ * Same contract as do_download, for a file of `size` bytes on a server
+ * that accepts byte ranges.
+ */
+static int do_download_segmented(const char *url, const char *mirror,
+                                 const char *local_path,
+                                 const char *filename, curl_off_t size)
+{
+    int fd = open(local_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+    if (fd < 0) {
+        ui_error("cannot open cache file: %s", strerror(errno));
+        return 1;
+    }
+
+    /* reserve the whole file up front: no ENOSPC halfway, less
+     * fragmentation from out-of-order writes */
+    int err = posix_fallocate(fd, 0, (off_t)size);
+    if (err == EINVAL || err == EOPNOTSUPP)
+        err = ftruncate(fd, (off_t)size) == 0 ? 0 : errno;
+    if (err) {
+        ui_error("cannot allocate %s: %s", local_path, strerror(err));
+        close(fd);
+        unlink(local_path);
+        return 1;
+    }
+
+    CURLM *multi = curl_multi_init();
+    if (!multi) {
+        ui_error("curl init failed");
+        close(fd);
+        unlink(local_path);
+        return 1;
+    }
+
+    int nseg = (int)(size / DOWNLOAD_SEGMENT_MIN);
+    if (nseg < 2)
+        nseg = 2;
+    if (nseg > DOWNLOAD_SEGMENTS_MAX)
+        nseg = DOWNLOAD_SEGMENTS_MAX;
+    if (nseg > netsched_slots(url))
+        nseg = netsched_slots(url);
+
+    struct segment segs[DOWNLOAD_SEGMENTS_MAX];
+    curl_off_t chunk = size / nseg;
+    for (int i = 0; i < nseg; i++) {
+        segs[i].fd    = fd;
+        segs[i].begin = chunk * i;
+        segs[i].pos   = segs[i].begin;
+        segs[i].end   = i == nseg - 1 ? size - 1 : chunk * (i + 1) - 1;
+        segs[i].curl  = NULL;
+        memset(&segs[i].sched, 0, sizeof(segs[i].sched));
+    }
+
+    ui_progress_init(filename);
+    log_info("download: %s in %d segments", filename, nseg);
+
+    int failed = 0;
+
+    for (int attempt = 0; attempt <= DOWNLOAD_SEGMENT_RETRIES; attempt++) {
+        int active = 0;
+        failed = 0;
+
+        for (int i = 0; i < nseg; i++) {
+            if (segs[i].pos > segs[i].end)
+                continue;
+            if (segment_start(multi, &segs[i], url) != 0) {
+                failed = 1;
+                break;
+            }
+            active++;
+        }
+        if (failed || active == 0)
+            break;
+
+        while (active > 0) {
+            int running = 0;
+            CURLMcode mc = curl_multi_perform(multi, &running);
+            if (mc == CURLM_OK)
+                mc = curl_multi_poll(multi, NULL, 0, 1000, NULL);
+            if (mc != CURLM_OK) {
+                failed = 1;
+                break;
+            }
+
+            curl_off_t got = 0;
+            for (int i = 0; i < nseg; i++)
+                got += segs[i].pos - segs[i].begin;
+            ui_progress((double)got, (double)size);
+
+            CURLMsg *msg;
+            int left;
+            while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+                if (msg->msg != CURLMSG_DONE)
+                    continue;
+
+                struct segment *sg = NULL;
+                long code = 0;
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+                                  (char **)&sg);
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE,
+                                  &code);
+                CURLcode res = msg->data.result;
+
+                netsched_end(&sg->sched);
+                mirror_record(mirror, sg->curl, res);
+                curl_multi_remove_handle(multi, sg->curl);
+                curl_easy_cleanup(sg->curl);
+                sg->curl = NULL;
+                active--;
+
+                if (res == CURLE_OK && code != 206) {
+                    log_error("download: %s ignored Range (HTTP %ld)",
+                              mirror, code);
+                    failed = 1;
+                } else if (res != CURLE_OK || sg->pos <= sg->end) {
+                    log_error("download: segment %lld-%lld of %s: %s",
+                              (long long)sg->begin, (long long)sg->end,
+                              filename, curl_easy_strerror(res));
+                    failed = 1;
+                }
+            }
+        }
+
+        /* a failed loop leaves handles behind */
+        for (int i = 0; i < nseg; i++) {
+            if (!segs[i].curl)
+                continue;
+            netsched_end(&segs[i].sched);
+            curl_multi_remove_handle(multi, segs[i].curl);
+            curl_easy_cleanup(segs[i].curl);
+            segs[i].curl = NULL;
+        }
+
+        if (!failed)
+            break;
+    }
+
+    curl_multi_cleanup(multi);
+
+    int incomplete = failed;
+    for (int i = 0; i < nseg; i++)
+        incomplete |= segs[i].pos <= segs[i].end;
+
+    if (close(fd) != 0 && !incomplete) {
+        ui_error("cannot write %s: %s", local_path, strerror(errno));
+        incomplete = 1;
+    }
+
+    if (incomplete) {
+        fprintf(stderr, "\n");
+        ui_error("failed to download %s", filename);
+        unlink(local_path);
         return 1;
+    }
+
+    ui_progress_finish();
+    return 0;
+}
+
+int install_filename_ok(const char *name)
+{
+    return name && *name && !strchr(name, '/') &&
+           strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
 
-    int n = snprintf(local_path, 512, "%s/%s", CACHE_DIR, filename);
+/*
+ * cache_path
+ *
+ * Fills the cache path of `filename`.  local_path must be at least
+ * 512 bytes.  Returns 0 on success.
+ */
+static int cache_path(const char *filename, char *local_path)
+{
+    int n = snprintf(local_path, 512, "%s/%s", FLAPPY_PKG_CACHE_DIR, filename);
     if (n < 0 || n >= 512) {
         ui_error("local path too long");
         return 1;
     }
+    return 0;
+}
 
-    char base_url[512];
-    read_base_url(base_url, sizeof(base_url));
+/*
+ * install_part_path / part_publish
+ *
+ * Transfers write to install_part_path and are renamed into place
+ * once complete, so cache_lookup never sees a partial file.
+ */
+void install_part_path(char *out, const char *local_path)
+{
+    snprintf(out, INSTALL_PART_PATH_MAX, "%s.%ld.part", local_path,
+             (long)getpid());
+}
+
+static int part_publish(const char *part, const char *local_path,
+                        int quiet)
+{
+    if (rename(part, local_path) != 0) {
+        ui_error("cannot move %s into the cache: %s",
+                 local_path, strerror(errno));
+        unlink(part);
+        return 1;
+    }
+    if (!quiet)
+        log_info("download: cached %s", local_path);
+    return 0;
+}
 
-    size_t blen = strlen(base_url);
-    if (blen > 0 && base_url[blen - 1] == '/')
-        base_url[blen - 1] = '\0';
+/* URL of `filename` on `mirror`.  Returns 0 on success. */
+static int package_url(const char *mirror, const char *filename,
+                       char *url, size_t url_size)
+{
+    size_t blen = strlen(mirror);
+    while (blen > 0 && mirror[blen - 1] == '/')
+        blen--;
 
-    char url[1024];
-    n = snprintf(url, sizeof(url), "%s/packages/%s", base_url, filename);
-    if (n < 0 || n >= (int)sizeof(url)) {
+    int n = snprintf(url, url_size, "%.*s/packages/%s",
+                     (int)blen, mirror, filename);
+    if (n < 0 || n >= (int)url_size) {
         ui_error("URL too long");
         return 1;
     }
+    return 0;
+}
 
-    /* ---------------------------------------------------------------
-     * Cache hit check.
-     *
-     * A cached file is only reused if its SHA256 matches the expected
-     * checksum from repo.db.  On mismatch we delete the stale file,
-     * log a clear diagnostic, and fall through to a fresh download.
-     *
-     * This prevents a silent "checksum mismatch" failure one step
-     * later when the repository has been updated but the local cache
-     * still holds an old build under the same filename.
-     * --------------------------------------------------------------- */
+/*
+ * Ranked mirrors of the repository at `base_url` (as returned by
+ * install_lookup; NULL or "" means FLAPPY_DEFAULT_REPO_URL).
+ */
+static void package_mirrors(const char *base_url, struct mirror_list *out)
+{
+    mirror_list_for(base_url && *base_url ? base_url
+                                          : FLAPPY_DEFAULT_REPO_URL, out);
+}
+
+/*
+ * cache_lookup
+ *
+ * A cached file is only reused if its digest matches the expected
+ * checksum from repo.db, SHA256 or BLAKE3 as published.  On
+ * mismatch we delete the stale file, log a clear diagnostic, and let
+ * the caller fall through to a fresh download.
+ *
+ * This prevents a silent "checksum mismatch" failure one step
+ * later when the repository has been updated but the local cache
+ * still holds an old build under the same filename.
+ *
+ * Returns 1 on a valid hit, 0 on a miss, -1 on error.
+ */
+static int cache_lookup(const char *local_path, const char *filename,
+                        const char *expected_checksum, int quiet)
+{
     struct stat cache_st;
-    if (stat(local_path, &cache_st) == 0 && cache_st.st_size > 0) {
+    if (stat(local_path, &cache_st) != 0 || cache_st.st_size == 0)
+        return 0;
 
-        char cached_hash[65];
-        if (sha256_file(local_path, cached_hash) == 0 &&
-                strcmp(cached_hash, expected_checksum) == 0) {
+    enum digest_alg alg;
+    const char *expected;
+    char cached_hash[65];
+    if (digest_parse(expected_checksum, &alg, &expected) == 0 &&
+            digest_file(alg, local_path, cached_hash) == 0 &&
+            strcmp(cached_hash, expected) == 0) {
+        if (!quiet) {
             ui_ok("using cached %s", filename);
             log_info("download: using cached %s", local_path);
-            return 0;
         }
+        return 1;
+    }
+
+    /* Stale or corrupt cache entry */
+    log_info("download: cached %s failed checksum — re-downloading",
+             local_path);
+    ui_warn("cached file is stale or corrupt — re-downloading %s",
+            filename);
+    if (unlink(local_path) != 0 && errno != ENOENT) {
+        ui_error("cannot remove stale cache entry %s: %s",
+                 local_path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int install_download(const char *filename, const char *base_url,
+                     char *local_path,
+                     const char *expected_checksum)
+{
+    if (ensure_cache_dir())
+        return 1;
+
+    if (cache_path(filename, local_path))
+        return 1;
+
+    int hit = cache_lookup(local_path, filename, expected_checksum, 0);
+    if (hit < 0)
+        return 1;
+    if (hit)
+        return 0;
+
+    struct download_req chunked = {
+        .filename = filename,
+        .checksum = expected_checksum,
+        .base_url = base_url,
+    };
+    snprintf(chunked.local_path, sizeof(chunked.local_path), "%s",
+             local_path);
+    if (install_chunks_fetch(&chunked) == 0)
+        return 0;
+
+    struct mirror_list mirrors;
+    package_mirrors(base_url, &mirrors);
+
+    char part[INSTALL_PART_PATH_MAX];
+    install_part_path(part, local_path);
+
+    int rc = 1;
+    for (size_t i = 0; i < mirrors.count && rc != 0; i++) {
+        char url[1024];
+        if (package_url(mirrors.url[i], filename, url, sizeof(url)))
+            break;
+        if (i > 0)
+            ui_warn("retrying from mirror %s", mirrors.url[i]);
+
+        curl_off_t size = remote_size(url);
+        if (size >= DOWNLOAD_SEGMENT_THRESHOLD)
+            rc = do_download_segmented(url, mirrors.url[i], part,
+                                       filename, size);
+        else
+            rc = do_download(url, mirrors.url[i], part, filename);
+    }
 
-        /* Stale or corrupt cache entry */
-        log_info("download: cached %s failed checksum — re-downloading",
-                 local_path);
-        ui_warn("cached file is stale or corrupt — re-downloading %s",
-                filename);
-        if (unlink(local_path) != 0 && errno != ENOENT) {
-            ui_error("cannot remove stale cache entry %s: %s",
-                     local_path, strerror(errno));
-            return 1;
+    if (rc == 0)
+        rc = part_publish(part, local_path, 0);
+
+    mirror_state_save();
+    return rc;
+}
+
+/* =========================================================================
+ * Batch download
+ *
+ * Fetches several packages concurrently through one curl multi handle.
+ * No progress bar (bars cannot be interleaved); one line per completed
+ * file instead.  `done` is invoked from the calling thread as soon as
+ * each request finishes — cache hits first, then transfers in
+ * completion order — so the caller can start verifying and extracting
+ * while the remaining transfers are still running.
+ *
+ * Cache hits and chunked archives are settled before any transfer
+ * starts, so a nested batch (install_chunks_fetch) never waits for
+ * connection slots held by its parent.  Transfers then start in
+ * request order as netsched admits them.  netsched's connection limits
+ * are the only ones: the multi handle has no cap of its own, so every
+ * handle added to it is transferring and counts towards the rate
+ * shares.
+ * ========================================================================= */
+
+struct batch_xfer {
+    struct download_req *req;
+    FILE                *fp;
+    CURL                *curl;
+    struct netsched_xfer sched;
+    struct mirror_list   mirrors;
+    size_t               next;       /* next mirror to try */
+    char                 part[INSTALL_PART_PATH_MAX];
+};
+
+struct batch {
+    CURLM              *multi;
+    struct batch_xfer **pending;     /* transfers in start order */
+    size_t              npending;
+    size_t              next;        /* first not yet started */
+    int                 active;
+    int                 failures;
+    download_done_fn    done;
+    void               *ctx;
+};
+
+static void batch_finish(struct download_req *req, int status,
+                         download_done_fn done, void *ctx)
+{
+    req->status = status;
+    if (done)
+        done(req, ctx);
+}
+
+/*
+ * batch_start
+ *
+ * Starts `x` on its next mirror.  With `wait`, blocks for a connection
+ * slot.  Returns 0 if a transfer was added, 1 if there is no mirror
+ * left or it could not be started, -1 if no slot is free yet.
+ */
+static int batch_start(CURLM *multi, struct batch_xfer *x, int wait)
+{
+    struct download_req *req = x->req;
+    char url[1024];
+
+    if (x->next >= x->mirrors.count ||
+        package_url(x->mirrors.url[x->next], req->filename,
+                    url, sizeof(url)))
+        return 1;
+
+    CURL *curl = curl_easy_init();
+    if (!curl) {
+        ui_error("cannot start download of %s", req->filename);
+        return 1;
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL,            url);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR,    1L);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS,     1L);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE,        x);
+    mirror_curl_setopts(curl);
+
+    /* the part file is only created once the transfer is admitted */
+    if (netsched_begin(&x->sched, curl, url, write_data, NULL, wait) != 0) {
+        curl_easy_cleanup(curl);
+        return -1;
+    }
+
+    install_part_path(x->part, req->local_path);
+    FILE *f = fopen(x->part, "wb");
+    if (!f) {
+        ui_error("cannot start download of %s", req->filename);
+        netsched_end(&x->sched);
+        curl_easy_cleanup(curl);
+        return 1;
+    }
+    x->sched.arg = f;
+
+    x->fp   = f;
+    x->curl = curl;
+    x->next++;
+
+    curl_multi_add_handle(multi, curl);
+    return 0;
+}
+
+/*
+ * batch_admit
+ *
+ * Starts pending transfers in order until netsched has no slot left.
+ * With nothing running it waits for one, so the loop always advances.
+ */
+static void batch_admit(struct batch *b)
+{
+    while (b->next < b->npending) {
+        struct batch_xfer *x = b->pending[b->next];
+        int rc = batch_start(b->multi, x, b->active == 0);
+        if (rc < 0)
+            break;
+
+        b->next++;
+        if (rc > 0) {
+            batch_finish(x->req, 1, b->done, b->ctx);
+            b->failures++;
+            continue;
+        }
+
+        if (!x->req->quiet)
+            ui_step("downloading %s", x->req->filename);
+        b->active++;
+    }
+}
+
+/* A finished transfer of `x`, whatever its outcome */
+static void batch_complete(struct batch *b, struct batch_xfer *x,
+                           CURLcode res)
+{
+    netsched_end(&x->sched);
+    mirror_record(x->mirrors.url[x->next - 1], x->curl, res);
+    curl_multi_remove_handle(b->multi, x->curl);
+    curl_easy_cleanup(x->curl);
+    x->curl = NULL;
+    fclose(x->fp);
+    x->fp = NULL;
+
+    if (res != CURLE_OK) {
+        ui_error("failed to download %s: %s", x->req->filename,
+                 curl_easy_strerror(res));
+        unlink(x->part);
+
+        /* the slot just released is ours to reuse */
+        if (x->next < x->mirrors.count) {
+            ui_warn("retrying %s from mirror %s", x->req->filename,
+                    x->mirrors.url[x->next]);
+            if (batch_start(b->multi, x, 1) == 0)
+                return;
         }
+
+        b->active--;
+        batch_finish(x->req, 1, b->done, b->ctx);
+        b->failures++;
+        return;
+    }
+
+    b->active--;
+    if (part_publish(x->part, x->req->local_path, x->req->quiet)) {
+        batch_finish(x->req, 1, b->done, b->ctx);
+        b->failures++;
+        return;
+    }
+    if (!x->req->quiet)
+        ui_ok("downloaded %s", x->req->filename);
+    batch_finish(x->req, 0, b->done, b->ctx);
+}
+
+int install_download_batch(struct download_req *reqs, size_t n,
+                           download_done_fn done, void *ctx)
+{
+    if (ensure_cache_dir()) {
+        for (size_t i = 0; i < n; i++)
+            batch_finish(&reqs[i], 1, done, ctx);
+        return 1;
     }
 
-    return do_download(url, local_path, filename);
-}
\ No newline at end of file
+    struct batch b = {
+        .multi = curl_multi_init(),
+        .done  = done,
+        .ctx   = ctx,
+    };
+    if (!b.multi) {
+        ui_error("curl init failed");
+        for (size_t i = 0; i < n; i++)
+            batch_finish(&reqs[i], 1, done, ctx);
+        return 1;
+    }
+
+    struct batch_xfer *xfers = calloc(n ? n : 1, sizeof(*xfers));
+    b.pending = calloc(n ? n : 1, sizeof(*b.pending));
+    if (!xfers || !b.pending) {
+        free(xfers);
+        free(b.pending);
+        curl_multi_cleanup(b.multi);
+        for (size_t i = 0; i < n; i++)
+            batch_finish(&reqs[i], 1, done, ctx);
+        return 1;
+    }
+
+    struct batch_xfer *prev = NULL;
+
+    for (size_t i = 0; i < n; i++) {
+        struct download_req *req = &reqs[i];
+        struct batch_xfer   *x   = &xfers[i];
+
+        x->req = req;
+
+        if (cache_path(req->filename, req->local_path)) {
+            batch_finish(req, 1, done, ctx);
+            b.failures++;
+            continue;
+        }
+
+        int hit = cache_lookup(req->local_path, req->filename,
+                               req->checksum, req->quiet);
+        if (hit != 0) {
+            batch_finish(req, hit < 0, done, ctx);
+            b.failures += hit < 0;
+            continue;
+        }
+
+        if (install_chunks_fetch(req) == 0) {
+            batch_finish(req, 0, done, ctx);
+            continue;
+        }
+
+        /* requests from one repository share its ranked list */
+        if (prev && strcmp(req->base_url ? req->base_url : "",
+                           prev->req->base_url ? prev->req->base_url
+                                               : "") == 0)
+            x->mirrors = prev->mirrors;
+        else
+            package_mirrors(req->base_url, &x->mirrors);
+
+        b.pending[b.npending++] = x;
+        prev = x;
+    }
+
+    batch_admit(&b);
+
+    /*
+     * Completions are collected before polling: a finished transfer
+     * frees a slot, and waiting on the poll first would leave it idle
+     * for the whole timeout when nothing else is running.
+     */
+    while (b.active > 0) {
+        int running = 0;
+        CURLMcode mc = curl_multi_perform(b.multi, &running);
+
+        CURLMsg *msg;
+        int left;
+        while (mc == CURLM_OK &&
+               (msg = curl_multi_info_read(b.multi, &left)) != NULL) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            struct batch_xfer *x = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&x);
+            batch_complete(&b, x, msg->data.result);
+        }
+
+        batch_admit(&b);
+
+        if (mc == CURLM_OK && running > 0)
+            mc = curl_multi_poll(b.multi, NULL, 0, 1000, NULL);
+        if (mc != CURLM_OK) {
+            ui_error("download loop failed: %s", curl_multi_strerror(mc));
+            break;
+        }
+    }
+
+    /* Only reached with transfers left over if the multi loop broke */
+    for (size_t i = 0; i < b.npending; i++) {
+        struct batch_xfer *x = b.pending[i];
+        if (x->curl) {
+            netsched_end(&x->sched);
+            curl_multi_remove_handle(b.multi, x->curl);
+            curl_easy_cleanup(x->curl);
+            fclose(x->fp);
+            unlink(x->part);
+        } else if (i < b.next) {
+            continue;
+        }
+        batch_finish(x->req, 1, done, ctx);
+        b.failures++;
+    }
+
+    free(b.pending);
+    free(xfers);
+    curl_multi_cleanup(b.multi);
+    mirror_state_save();
+    return b.failures ? 1 : 0;
+}
@@ -6,6 +6,8 @@
  *   - Validate every archive entry path before writing
  *   - Reject absolute paths, path traversal, and forbidden roots
  *   - Extract files and populate staging_dir (out param)
+ *   - install_extract_direct: the same checks, written straight into
+ *     the root with no staging (`install --bootstrap`)
  *
  * Forbidden install roots:
  *   /proc  /dev  /sys  /home  /root
@@ -19,6 +21,9 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include "flappy.h"
+#include "install.h"
+#include "root.h"
+#include "digest.h"
 
 #include <archive.h>
 #include <archive_entry.h>
@@ -56,6 +61,8 @@ static int is_metadata_entry(const char *path)
             strcmp(path, ".PKGINFO")   == 0 ||
             strcmp(path, "./.FILES")   == 0 ||
             strcmp(path, ".FILES")     == 0 ||
+            strcmp(path, "./.INSTALL") == 0 ||
+            strcmp(path, ".INSTALL")   == 0 ||
             strcmp(path, "./")         == 0 ||
             strcmp(path, ".")          == 0);
 }
@@ -150,35 +157,48 @@ static int mkdir_p(const char *path, mode_t mode)
 }
 
 /* =========================================================================
- * Public entry
+ * Extraction loop (shared by install_extract and install_extract_direct)
  * ========================================================================= */
 
-int install_extract(const char *pkgfile,
-                    char *staging_dir)
-{
-    /* Create STAGING_BASE if needed */
-    if (mkdir_p(STAGING_BASE, 0755) != 0) {
-        fprintf(stderr, "extract: cannot create staging base: %s\n",
-                strerror(errno));
-        return 1;
-    }
-
-    /* Build unique staging path: STAGING_BASE/<basename>.stage */
-    const char *base = strrchr(pkgfile, '/');
-    base = base ? base + 1 : pkgfile;
+struct file_list {
+    struct install_file *files;
+    size_t               count;
+    size_t               cap;
+};
 
-    int n = snprintf(staging_dir, 512, "%s/%s.stage", STAGING_BASE, base);
-    if (n < 0 || n >= 512) {
-        fprintf(stderr, "extract: staging path too long\n");
-        return 1;
+static struct install_file *file_list_add(struct file_list *fl,
+                                          const char *path)
+{
+    if (fl->count == fl->cap) {
+        size_t cap = fl->cap ? fl->cap * 2 : 64;
+        struct install_file *tmp = realloc(fl->files, cap * sizeof(*tmp));
+        if (!tmp)
+            return NULL;
+        fl->files = tmp;
+        fl->cap   = cap;
     }
 
-    if (mkdir_p(staging_dir, 0755) != 0) {
-        fprintf(stderr, "extract: cannot create staging dir %s: %s\n",
-                staging_dir, strerror(errno));
-        return 1;
-    }
+    struct install_file *f = &fl->files[fl->count];
+    memset(f, 0, sizeof(*f));
+    if (!(f->path = strdup(path)))
+        return NULL;
+    fl->count++;
+    return f;
+}
 
+/*
+ * extract_archive
+ *
+ * Writes every safe entry of `pkgfile` to "<dest_dir>/<path>"
+ * (dest_dir "" for the host root).  With `files` set, only
+ * directories, regular files and symlinks are written and every file
+ * and symlink is collected under its package path (no dest_dir) with
+ * its fingerprint (struct install_file), hashed from the data blocks
+ * as they pass.
+ */
+static int extract_archive(const char *pkgfile, const char *dest_dir,
+                           int flags, struct file_list *files)
+{
     /* Open archive */
     struct archive *a = archive_read_new();
     if (!a)
@@ -201,10 +221,7 @@ int install_extract(const char *pkgfile,
         return 1;
     }
 
-    archive_write_disk_set_options(disk,
-        ARCHIVE_EXTRACT_TIME |
-        ARCHIVE_EXTRACT_PERM |
-        ARCHIVE_EXTRACT_OWNER);
+    archive_write_disk_set_options(disk, flags);
 
     struct archive_entry *entry;
     int rc = 0;
@@ -242,10 +259,9 @@ int install_extract(const char *pkgfile,
             break;
         }
 
-        /* Rewrite path into staging dir */
+        /* Rewrite path into the destination */
         char dest[PATH_MAX];
-        int written = snprintf(dest, sizeof(dest), "%s/%s",
-                               staging_dir, path);
+        int written = snprintf(dest, sizeof(dest), "%s/%s", dest_dir, path);
 
         if (written < 0 || written >= (int)sizeof(dest)) {
             fprintf(stderr, "extract: destination path too long\n");
@@ -253,6 +269,61 @@ int install_extract(const char *pkgfile,
             break;
         }
 
+        /* Same selection as install_commit's staging walk */
+        struct install_file *file = NULL;
+
+        if (files) {
+            mode_t type = archive_entry_filetype(entry);
+            if (type != AE_IFDIR && type != AE_IFREG && type != AE_IFLNK) {
+                archive_read_data_skip(a);
+                continue;
+            }
+            if (type != AE_IFDIR) {
+                file = file_list_add(files, path);
+                if (!file) {
+                    fprintf(stderr, "extract: out of memory\n");
+                    rc = 1;
+                    break;
+                }
+            }
+            if (type == AE_IFLNK) {
+                const char *target = archive_entry_symlink(entry);
+                target = target ? target : "";
+
+                struct digest_stream *hash = digest_stream_new(DIGEST_SHA256);
+                if (!hash ||
+                    digest_stream_update(hash, target, strlen(target)) ||
+                    digest_stream_final(hash, file->sha256))
+                    file->sha256[0] = '\0';
+                digest_stream_free(hash);
+
+                file->size = (long long)strlen(target);
+                file->mode = AE_IFLNK | 0777;       /* as lstat reports */
+                if (!(file->link_target = strdup(target))) {
+                    fprintf(stderr, "extract: out of memory\n");
+                    rc = 1;
+                    break;
+                }
+            } else if (type == AE_IFREG) {
+                file->size = (long long)archive_entry_size(entry);
+                file->mode = AE_IFREG | archive_entry_perm(entry);
+            }
+        }
+
+        /*
+         * NO_OVERWRITE makes libarchive skip an existing file quietly
+         * (empty files and symlinks without any error at all); refuse
+         * it here instead.
+         */
+        struct stat st;
+        if ((flags & ARCHIVE_EXTRACT_NO_OVERWRITE) &&
+            archive_entry_filetype(entry) != AE_IFDIR &&
+            lstat(dest, &st) == 0) {
+            fprintf(stderr, "extract: %s already exists\n", dest);
+            rc = 1;
+            break;
+        }
+
         archive_entry_set_pathname(entry, dest);
 
         /* Write header (creates parent directories as needed) */
@@ -263,10 +334,14 @@ int install_extract(const char *pkgfile,
             break;
         }
 
-        /* Copy file data */
+        /* Copy file data, hashing a collected regular file on the way */
         const void *block;
         size_t      block_size;
         la_int64_t  offset;
+        la_int64_t  hashed = 0;
+        struct digest_stream *hash =
+            file && (file->mode & AE_IFMT) == AE_IFREG
+            ? digest_stream_new(DIGEST_SHA256) : NULL; /* NULL: unknown */
 
         for (;;) {
             int r = archive_read_data_block(a, &block, &block_size, &offset);
@@ -285,8 +360,21 @@ int install_extract(const char *pkgfile,
                 rc = 1;
                 break;
             }
+
+            /* A sparse entry leaves holes: fall back to "unknown" */
+            if (hash && (offset != hashed ||
+                         digest_stream_update(hash, block, block_size))) {
+                digest_stream_free(hash);
+                hash = NULL;
+            }
+            hashed = offset + (la_int64_t)block_size;
         }
 
+        if (hash && !rc && (hashed != file->size ||
+                            digest_stream_final(hash, file->sha256) != 0))
+            file->sha256[0] = '\0';
+        digest_stream_free(hash);
+
         if (rc)
             break;
 
@@ -296,9 +384,95 @@ int install_extract(const char *pkgfile,
     archive_read_free(a);
     archive_write_free(disk);
 
-    if (rc)
+    return rc;
+}
+
+/* =========================================================================
+ * Public entry
+ * ========================================================================= */
+
+int install_extract(const char *pkgfile,
+                    char *staging_dir)
+{
+    /* Staging lives inside the root: concurrent roots never share it */
+    char staging_base[PATH_MAX];
+    if (root_path(staging_base, sizeof(staging_base), STAGING_BASE) != 0) {
+        fprintf(stderr, "extract: staging path too long\n");
+        return 1;
+    }
+
+    /* Create STAGING_BASE if needed */
+    if (mkdir_p(staging_base, 0755) != 0) {
+        fprintf(stderr, "extract: cannot create staging base: %s\n",
+                strerror(errno));
+        return 1;
+    }
+
+    /* Build unique staging path: STAGING_BASE/<basename>.stage */
+    const char *base = strrchr(pkgfile, '/');
+    base = base ? base + 1 : pkgfile;
+
+    int n = snprintf(staging_dir, 512, "%s/%s.stage", staging_base, base);
+    if (n < 0 || n >= 512) {
+        fprintf(stderr, "extract: staging path too long\n");
+        return 1;
+    }
+
+    if (mkdir_p(staging_dir, 0755) != 0) {
+        fprintf(stderr, "extract: cannot create staging dir %s: %s\n",
+                staging_dir, strerror(errno));
+        return 1;
+    }
+
+    if (extract_archive(pkgfile, staging_dir,
+                        ARCHIVE_EXTRACT_TIME |
+                        ARCHIVE_EXTRACT_PERM |
+                        ARCHIVE_EXTRACT_OWNER, NULL) != 0)
         return 1;
 
     log_info("extract: staged to %s", staging_dir);
     return 0;
-}
\ No newline at end of file
+}
+
+int install_extract_direct(const char *pkgfile,
+                           struct install_file **out, size_t *count)
+{
+    struct file_list files = {0};
+
+    *out   = NULL;
+    *count = 0;
+
+    /*
+     * Entries are written under the root's canonical path (root_set
+     * resolved it, so no component of that prefix is a symlink); the
+     * SECURE_* checks then reject a symlink or ".." anywhere inside
+     * the root.  The working directory is left alone: the unpack
+     * workers share it with the rest of the process.
+     */
+    int rc = extract_archive(pkgfile, root_is_alt() ? root_dir() : "",
+                             ARCHIVE_EXTRACT_TIME |
+                             ARCHIVE_EXTRACT_PERM |
+                             ARCHIVE_EXTRACT_OWNER |
+                             ARCHIVE_EXTRACT_NO_OVERWRITE |
+                             ARCHIVE_EXTRACT_SECURE_SYMLINKS |
+                             ARCHIVE_EXTRACT_SECURE_NODOTDOT, &files);
+    if (rc != 0) {
+        install_files_free(files.files, files.count);
+        return 1;
+    }
+
+    log_info("extract: %s written to %s (%zu files)",
+             pkgfile, root_dir(), files.count);
+    *out   = files.files;
+    *count = files.count;
+    return 0;
+}
+
+void install_files_free(struct install_file *files, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        free(files[i].path);
+        free(files[i].link_target);
+    }
+    free(files);
+}
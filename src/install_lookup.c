@@ -1,24 +1,142 @@
 /*
  * install_lookup.c - Query repo database for package metadata
  *
- * Looks up filename and checksum from repo.db.
- * Table is "packages" (not "repo_packages").
+ * Looks up filename, checksum and the owning repository's base URL
+ * from repo.db.  Table is "packages" (not "repo_packages").  In a
+ * merged repo.db (see repo_update) the URL comes from the `repos`
+ * row named by packages.repo; a single-repository repo.db only has
+ * meta base_url.
+ * A package with a BLAKE3 in repo.db (packages.blake3) gets
+ * "blake3:<hex>" as its checksum instead of the SHA256 (see digest.h).
+ * Unknown names get "did you mean" suggestions from the trigram index.
+ *
+ * install_lookup_version asks for one version by its version_key, so a
+ * caller that planned a version (upgrade, the resolver) fetches
+ * exactly that archive; install_lookup takes the newest.
+ *
+ * Fast path: the mmap'd repo index (repo_index.h), which returns the
+ * newest version's row.  repo.db is only opened when the index is
+ * missing or stale; a name may have several versions there too, so
+ * the fallback orders by version_key the same way (version_key() of
+ * the string for a repo.db indexed by an older flappy).
  */
 
 #include "flappy.h"
+#include "install.h"
+#include "repo.h"
+#include "repo_index.h"
+#include "trigram.h"
+#include "version.h"
 
 #include <sqlite3.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
 #define REPO_DB "/var/lib/flappy/repo.db"
 
+/*
+ * lookup_index
+ *
+ * The row of `version` (by version_key), or the newest when it is
+ * NULL.  Returns 0 found, 1 not found, -1 if the index is unavailable.
+ */
+static int lookup_index(const char *pkg, const char *version,
+                        const unsigned char *want, size_t want_len,
+                        char *filename, char *checksum, char *base_url)
+{
+    struct repo_index *idx = repo_index_open();
+    if (!idx)
+        return -1;
+
+    uint32_t id;
+    size_t nv = 0;
+    if (repo_index_find(idx, pkg, &id))
+        nv = repo_index_versions(idx, id);
+
+    struct repo_index_pkg p;
+    size_t k = 0;
+    for (; k < nv; k++) {
+        repo_index_version(idx, id, k, &p);
+        if (!version || (p.vkey && version_key_cmp(p.vkey, p.vkey_len,
+                                                   want, want_len) == 0))
+            break;
+    }
+    if (k == nv) {
+        repo_index_close(idx);
+        return 1;
+    }
+
+    int rc = 0;
+    if (!*p.filename || !*p.checksum) {
+        fprintf(stderr, "lookup: null filename or checksum for %s\n", pkg);
+        rc = -2;
+    } else {
+        snprintf(filename, 256, "%s", p.filename);
+        snprintf(checksum, 128, "%s", p.checksum);
+        snprintf(base_url, REPO_URL_MAX, "%s", p.base_url ? p.base_url : "");
+    }
+
+    repo_index_close(idx);
+    return rc;
+}
+
+/* Prepares `fmt` with the version key expression `key` filled in */
+static int prepare_keyed(sqlite3 *db, const char *fmt, const char *key,
+                         sqlite3_stmt **st)
+{
+    char sql[640];
+    snprintf(sql, sizeof(sql), fmt, key, key);
+    return sqlite3_prepare_v2(db, sql, -1, st, NULL);
+}
+
+/* "package not found" for a name, or for one version of it */
+static void not_found(const char *pkg, const char *version)
+{
+    if (version) {
+        fprintf(stderr, "package not found in repo: %s %s\n", pkg, version);
+        return;
+    }
+    fprintf(stderr, "package not found in repo: %s\n", pkg);
+    trigram_did_you_mean(pkg);
+}
+
 int install_lookup(const char *pkg,
                    char *filename,
-                   char *checksum)
+                   char *checksum,
+                   char *base_url)
+{
+    return install_lookup_version(pkg, NULL, filename, checksum, base_url);
+}
+
+int install_lookup_version(const char *pkg,
+                           const char *version,
+                           char *filename,
+                           char *checksum,
+                           char *base_url)
 {
+    unsigned char want[VERSION_KEY_MAX];
+    size_t want_len = 0;
+    if (version && version_key(version, want, &want_len) != 0) {
+        not_found(pkg, version);
+        return 1;
+    }
+
+    int irc = lookup_index(pkg, version, want, want_len,
+                           filename, checksum, base_url);
+    if (irc == 0) {
+        log_info("lookup: %s -> %s", pkg, filename);
+        return 0;
+    }
+    if (irc == 1) {
+        not_found(pkg, version);
+        return 1;
+    }
+    if (irc == -2)
+        return 1;
+
     sqlite3 *db;
-    sqlite3_stmt *st;
+    sqlite3_stmt *st = NULL;
 
     if (sqlite3_open_v2(REPO_DB, &db,
         SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
@@ -26,22 +144,57 @@ int install_lookup(const char *pkg,
         fprintf(stderr, "cannot open repo database\n");
         return 1;
     }
+    version_sql_register(db);
 
+    /* the planned version, or the newest as the index returns it */
+    const char *key =
+        sqlite3_prepare_v2(db, "SELECT version_key FROM packages LIMIT 0;",
+                           -1, &st, NULL) == SQLITE_OK
+        ? "version_key" : "version_key(version)";
+    sqlite3_finalize(st);
+    st = NULL;
+
+    const char *sql_blake3 =
+        "SELECT p.filename, "
+        "       CASE WHEN p.blake3 IS NOT NULL "
+        "            THEN 'blake3:' || p.blake3 ELSE p.checksum END, "
+        "       coalesce(r.base_url, "
+        "                (SELECT value FROM meta WHERE key = 'base_url')) "
+        "FROM packages AS p LEFT JOIN repos AS r ON r.name = p.repo "
+        "WHERE p.name = ?1 AND (?2 IS NULL OR %s = version_key(?2)) "
+        "ORDER BY %s DESC LIMIT 1;";
+
+    /* repo.db merged before BLAKE3 checksums */
     const char *sql =
-        "SELECT filename, checksum "
+        "SELECT p.filename, p.checksum, "
+        "       coalesce(r.base_url, "
+        "                (SELECT value FROM meta WHERE key = 'base_url')) "
+        "FROM packages AS p LEFT JOIN repos AS r ON r.name = p.repo "
+        "WHERE p.name = ?1 AND (?2 IS NULL OR %s = version_key(?2)) "
+        "ORDER BY %s DESC LIMIT 1;";
+
+    /* repo.db written before multi-repository support */
+    const char *sql_single =
+        "SELECT filename, checksum, "
+        "       (SELECT value FROM meta WHERE key = 'base_url') "
         "FROM packages "
-        "WHERE name = ?;";
+        "WHERE name = ?1 AND (?2 IS NULL OR %s = version_key(?2)) "
+        "ORDER BY %s DESC LIMIT 1;";
 
-    if (sqlite3_prepare_v2(db, sql, -1, &st, NULL) != SQLITE_OK) {
+    if (prepare_keyed(db, sql_blake3, key, &st) != SQLITE_OK &&
+        prepare_keyed(db, sql, key, &st) != SQLITE_OK &&
+        prepare_keyed(db, sql_single, key, &st) != SQLITE_OK) {
         fprintf(stderr, "lookup: prepare failed: %s\n", sqlite3_errmsg(db));
         sqlite3_close(db);
         return 1;
     }
 
     sqlite3_bind_text(st, 1, pkg, -1, SQLITE_STATIC);
+    if (version)
+        sqlite3_bind_text(st, 2, version, -1, SQLITE_STATIC);
 
     if (sqlite3_step(st) != SQLITE_ROW) {
-        fprintf(stderr, "package not found in repo: %s\n", pkg);
+        not_found(pkg, version);
         sqlite3_finalize(st);
         sqlite3_close(db);
         return 1;
@@ -60,6 +213,9 @@ int install_lookup(const char *pkg,
     strncpy(filename, f, 255);  filename[255] = '\0';
     strncpy(checksum, c, 127);  checksum[127] = '\0';
 
+    const char *u = (const char *)sqlite3_column_text(st, 2);
+    snprintf(base_url, REPO_URL_MAX, "%s", u ? u : "");
+
     sqlite3_finalize(st);
     sqlite3_close(db);
 
@@ -1,12 +1,12 @@
 /*
- * install_verify.c - Package integrity verification via SHA256
+ * install_verify.c - Package integrity verification via SHA256 or BLAKE3
  *
- * Delegates to sha256_file() in sha256.c (shared with repo_update.c).
- * The EVP implementation lives there; this file only handles the
+ * Delegates to digest_file() in digest.c (shared with repo_update.c).
+ * The digest implementations live there; this file only handles the
  * comparison and the caller-facing error messages.
  */
 
-#include "sha256.h"
+#include "digest.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -14,8 +14,9 @@
 /*
  * install_verify
  *
- * Computes SHA256 of the file at `path` and compares it against
- * the expected lowercase hex string in `checksum`.
+ * Computes the digest of the file at `path` and compares it against
+ * the expected checksum in `checksum`: lowercase hex SHA256, or
+ * "blake3:" and lowercase hex BLAKE3 (see digest.h).
  *
  * Returns:
  *   0  match
@@ -23,21 +24,29 @@
  */
 int install_verify(const char *path, const char *checksum)
 {
+    enum digest_alg alg;
+    const char *expected;
     char actual[65];
 
-    if (sha256_file(path, actual) != 0) {
-        /* sha256_file already printed the reason */
+    if (digest_parse(checksum, &alg, &expected) != 0) {
+        fprintf(stderr, "verify: unsupported checksum %s\n", checksum);
         return 1;
     }
 
-    if (strcmp(actual, checksum) != 0) {
+    if (digest_file(alg, path, actual) != 0) {
+        /* digest_file already printed the reason */
+        return 1;
+    }
+
+    if (strcmp(actual, expected) != 0) {
         fprintf(stderr,
                 "verify: checksum mismatch\n"
                 "  expected: %s\n"
-                "  actual:   %s\n",
-                checksum, actual);
+                "  actual:   %s%s\n",
+                checksum, alg == DIGEST_BLAKE3 ? DIGEST_BLAKE3_PREFIX : "",
+                actual);
         return 1;
     }
 
     return 0;
-}
\ No newline at end of file
+}
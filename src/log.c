@@ -1,9 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "flappy.h"
+#include "root.h"
 
 #include <stdarg.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 
 #define LOG_PATH "/var/log/flappy.log"
@@ -54,11 +58,13 @@ static void write_log(const char *level, const char *fmt, va_list ap)
  * Terminates if the log file cannot be opened.
  */
 void log_init(void) {
-    G_LOG_FP = fopen(LOG_PATH, "a");
+    char path[PATH_MAX];
+    if (root_path(path, sizeof(path), LOG_PATH) == 0)
+        G_LOG_FP = fopen(path, "a");
     if (!G_LOG_FP) {
         fprintf(stderr,
                 "Fatal: logging unavailable (%s): %s\n",
-                LOG_PATH, strerror(errno));
+                path, strerror(errno));
         exit(1);
     }
 }
@@ -13,6 +13,10 @@
  */
 int main(int argc, char **argv) {
 
+    /* Step 1: select the installation root (--root) */
+    if (cli_apply_root(argc, argv) != 0)
+        return 2;
+
     flappy_env_init();
 
     /* Step 2: Initialize logging */
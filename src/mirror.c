@@ -0,0 +1,340 @@
+/*
+ * mirror.c - Mirror ranking and failover (see mirror.h)
+ *
+ * STATE FILE (FLAPPY_MIRROR_STATE_PATH), one line per mirror:
+ *
+ *   <ttfb_ms> <connect_ms> <consecutive_fails> <last_fail_unix> <url>
+ *
+ * ttfb_ms / connect_ms are exponentially weighted moving averages
+ * (weight MIRROR_EWMA_WEIGHT for the newest sample); 0 = never
+ * measured.  Unparseable lines are dropped, so a damaged file costs
+ * the ranking, never the download.  It is written to a per-process
+ * temporary file and renamed into place.
+ *
+ * RANKING
+ *
+ *   1. healthy, measured      by ttfb_ms, fastest first
+ *   2. healthy, not measured  in configuration order
+ *   3. backing off            oldest failure first
+ *
+ * A mirror backs off for MIRROR_BACKOFF_BASE seconds after a failure,
+ * doubling per consecutive failure up to MIRROR_BACKOFF_MAX; one
+ * success clears it.  Backed-off mirrors stay in the list — when every
+ * mirror is failing, trying them all beats giving up.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mirror.h"
+#include "flappy.h"
+#include "repo.h"
+
+#include <curl/curl.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MIRROR_STATE_MAX    64
+#define MIRROR_EWMA_WEIGHT  0.3
+#define MIRROR_BACKOFF_BASE 60      /* seconds */
+#define MIRROR_BACKOFF_MAX  3600
+
+struct mirror_stat {
+    char      url[REPO_URL_MAX];
+    double    ttfb_ms;
+    double    connect_ms;
+    unsigned  fails;
+    long long last_fail;
+};
+
+static pthread_mutex_t    G_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static struct mirror_stat G_STATS[MIRROR_STATE_MAX];
+static size_t             G_NSTATS;
+static int                G_LOADED;
+static int                G_DIRTY;
+
+/* =========================================================================
+ * State (caller holds G_LOCK)
+ * ========================================================================= */
+
+static void state_load(void)
+{
+    if (G_LOADED)
+        return;
+    G_LOADED = 1;
+
+    FILE *f = fopen(FLAPPY_MIRROR_STATE_PATH, "r");
+    if (!f)
+        return;
+
+    char line[REPO_URL_MAX + 128];
+    while (G_NSTATS < MIRROR_STATE_MAX && fgets(line, sizeof(line), f)) {
+        struct mirror_stat s = {0};
+        if (sscanf(line, "%lf %lf %u %lld %511s",
+                   &s.ttfb_ms, &s.connect_ms, &s.fails, &s.last_fail,
+                   s.url) == 5 &&
+            s.ttfb_ms >= 0 && s.connect_ms >= 0)
+            G_STATS[G_NSTATS++] = s;
+    }
+
+    fclose(f);
+}
+
+static struct mirror_stat *state_find(const char *url, int add)
+{
+    state_load();
+
+    for (size_t i = 0; i < G_NSTATS; i++)
+        if (strcmp(G_STATS[i].url, url) == 0)
+            return &G_STATS[i];
+
+    if (!add || G_NSTATS == MIRROR_STATE_MAX || strchr(url, ' ') ||
+        strlen(url) >= REPO_URL_MAX)
+        return NULL;
+
+    struct mirror_stat *s = &G_STATS[G_NSTATS++];
+    memset(s, 0, sizeof(*s));
+    snprintf(s->url, sizeof(s->url), "%s", url);
+    return s;
+}
+
+static int backing_off(const struct mirror_stat *s, long long now)
+{
+    if (!s || s->fails == 0)
+        return 0;
+
+    long long wait = MIRROR_BACKOFF_BASE;
+    for (unsigned i = 1; i < s->fails && wait < MIRROR_BACKOFF_MAX; i++)
+        wait *= 2;
+    if (wait > MIRROR_BACKOFF_MAX)
+        wait = MIRROR_BACKOFF_MAX;
+
+    return now - s->last_fail < wait;
+}
+
+/* =========================================================================
+ * Ranking
+ * ========================================================================= */
+
+struct rank_key {
+    int       tier;        /* 1..3, see top of file */
+    double    value;       /* ttfb_ms, or last_fail for tier 3 */
+};
+
+static struct rank_key rank_of(const char *url, long long now)
+{
+    const struct mirror_stat *s = state_find(url, 0);
+
+    if (backing_off(s, now))
+        return (struct rank_key){ 3, (double)s->last_fail };
+    if (s && s->ttfb_ms > 0)
+        return (struct rank_key){ 1, s->ttfb_ms };
+    return (struct rank_key){ 2, 0 };
+}
+
+static int rank_before(struct rank_key a, struct rank_key b)
+{
+    if (a.tier != b.tier)
+        return a.tier < b.tier;
+    return a.value < b.value;
+}
+
+/* stable insertion sort; ties keep configuration order */
+static void rank_list(struct mirror_list *list)
+{
+    long long now = (long long)time(NULL);
+    struct rank_key keys[REPO_MIRROR_MAX];
+
+    pthread_mutex_lock(&G_LOCK);
+    for (size_t i = 0; i < list->count; i++)
+        keys[i] = rank_of(list->url[i], now);
+    pthread_mutex_unlock(&G_LOCK);
+
+    for (size_t i = 1; i < list->count; i++) {
+        struct rank_key k = keys[i];
+        char url[REPO_URL_MAX];
+        memcpy(url, list->url[i], REPO_URL_MAX);
+
+        size_t j = i;
+        while (j > 0 && rank_before(k, keys[j - 1])) {
+            keys[j] = keys[j - 1];
+            memcpy(list->url[j], list->url[j - 1], REPO_URL_MAX);
+            j--;
+        }
+        keys[j] = k;
+        memcpy(list->url[j], url, REPO_URL_MAX);
+    }
+}
+
+void mirror_list_from(const struct repo_source *src, struct mirror_list *out)
+{
+    out->count = src->nmirrors;
+    for (size_t i = 0; i < src->nmirrors; i++)
+        memcpy(out->url[i], src->mirrors[i], REPO_URL_MAX);
+    rank_list(out);
+}
+
+void mirror_list_for(const char *base_url, struct mirror_list *out)
+{
+    out->count = 1;
+    snprintf(out->url[0], REPO_URL_MAX, "%s", base_url);
+
+    struct repo_config *cfg = malloc(sizeof(*cfg));
+    if (!cfg)
+        return;
+
+    if (repo_config_load(cfg) == 0) {
+        const struct repo_source *src = repo_config_find(cfg, base_url);
+        if (src)
+            mirror_list_from(src, out);
+    }
+
+    free(cfg);
+}
+
+/* =========================================================================
+ * Measurement
+ * ========================================================================= */
+
+void mirror_curl_setopts(CURL *curl)
+{
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT,  MIRROR_CONNECT_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, MIRROR_LOW_SPEED_LIMIT);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME,  MIRROR_LOW_SPEED_TIME);
+}
+
+void mirror_record(const char *mirror, CURL *curl, CURLcode res)
+{
+    long code = 0;
+    curl_off_t connect_us = 0, ttfb_us = 0;
+
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE,        &code);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T,       &connect_us);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &ttfb_us);
+
+    int up = res == CURLE_OK ||
+             (res == CURLE_HTTP_RETURNED_ERROR && code >= 400 && code < 500);
+
+    pthread_mutex_lock(&G_LOCK);
+
+    struct mirror_stat *s = state_find(mirror, 1);
+    if (s) {
+        if (up) {
+            if (ttfb_us > 0) {
+                double t = (double)ttfb_us / 1000.0;
+                double c = (double)connect_us / 1000.0;
+                s->ttfb_ms = s->ttfb_ms > 0
+                    ? s->ttfb_ms + MIRROR_EWMA_WEIGHT * (t - s->ttfb_ms)
+                    : t;
+                s->connect_ms = s->connect_ms > 0
+                    ? s->connect_ms + MIRROR_EWMA_WEIGHT * (c - s->connect_ms)
+                    : c;
+            }
+            s->fails = 0;
+        } else {
+            s->fails++;
+            s->last_fail = (long long)time(NULL);
+        }
+        G_DIRTY = 1;
+    }
+
+    pthread_mutex_unlock(&G_LOCK);
+
+    if (!up)
+        log_error("mirror: %s failed: %s", mirror, curl_easy_strerror(res));
+}
+
+void mirror_probe(struct mirror_list *list)
+{
+    if (list->count < 2)
+        return;
+
+    CURLM *multi = curl_multi_init();
+    if (!multi)
+        return;
+
+    CURL *easy[REPO_MIRROR_MAX] = {0};
+
+    for (size_t i = 0; i < list->count; i++) {
+        char url[REPO_URL_MAX + 32];
+        snprintf(url, sizeof(url), "%s/repo.db.sha256", list->url[i]);
+
+        easy[i] = curl_easy_init();
+        if (!easy[i])
+            continue;
+
+        curl_easy_setopt(easy[i], CURLOPT_URL,               url);
+        curl_easy_setopt(easy[i], CURLOPT_NOBODY,            1L);
+        curl_easy_setopt(easy[i], CURLOPT_FAILONERROR,       1L);
+        curl_easy_setopt(easy[i], CURLOPT_FOLLOWLOCATION,    1L);
+        curl_easy_setopt(easy[i], CURLOPT_TIMEOUT_MS,
+                         MIRROR_PROBE_TIMEOUT_MS);
+        curl_easy_setopt(easy[i], CURLOPT_PRIVATE,           list->url[i]);
+        curl_multi_add_handle(multi, easy[i]);
+    }
+
+    int running = 1;
+    while (running) {
+        if (curl_multi_perform(multi, &running) != CURLM_OK ||
+            (running && curl_multi_poll(multi, NULL, 0, 1000, NULL)
+                        != CURLM_OK))
+            break;
+    }
+
+    CURLMsg *msg;
+    int left;
+    while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+        char *mirror = NULL;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &mirror);
+        mirror_record(mirror, msg->easy_handle, msg->data.result);
+    }
+
+    for (size_t i = 0; i < list->count; i++) {
+        if (!easy[i])
+            continue;
+        curl_multi_remove_handle(multi, easy[i]);
+        curl_easy_cleanup(easy[i]);
+    }
+    curl_multi_cleanup(multi);
+
+    rank_list(list);
+}
+
+void mirror_state_save(void)
+{
+    pthread_mutex_lock(&G_LOCK);
+
+    if (!G_DIRTY) {
+        pthread_mutex_unlock(&G_LOCK);
+        return;
+    }
+
+    /* per process: every --root shares the file, last rename wins */
+    char tmp[sizeof(FLAPPY_MIRROR_STATE_PATH) + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", FLAPPY_MIRROR_STATE_PATH,
+             (long)getpid());
+    FILE *f = fopen(tmp, "w");
+    int failed = !f;
+
+    for (size_t i = 0; f && i < G_NSTATS; i++)
+        failed |= fprintf(f, "%.1f %.1f %u %lld %s\n",
+                          G_STATS[i].ttfb_ms, G_STATS[i].connect_ms,
+                          G_STATS[i].fails, G_STATS[i].last_fail,
+                          G_STATS[i].url) < 0;
+
+    if (f)
+        failed |= fclose(f) != 0;
+
+    if (!failed && rename(tmp, FLAPPY_MIRROR_STATE_PATH) == 0)
+        G_DIRTY = 0;
+    else
+        unlink(tmp);
+
+    pthread_mutex_unlock(&G_LOCK);
+}
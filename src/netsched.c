@@ -0,0 +1,555 @@
+/*
+ * netsched.c - Download scheduler (see netsched.h)
+ *
+ * One mutex guards the configuration and the connection counts.
+ * Admission waits on a condition variable that every netsched_end
+ * broadcasts.
+ *
+ * Bandwidth is never enforced by blocking: several transfers share one
+ * thread in a curl multi handle, and a sleep in one write callback
+ * would stall all of them.  Instead every admitted transfer gets a
+ * share of the rates as its CURLOPT_MAX_RECV_SPEED_LARGE.  curl then
+ * holds off reading that socket on a timer of its own, TCP flow
+ * control passes that back to the sender, and the other transfers
+ * keep running.
+ *
+ * A host's rate is split equally between its transfers.  The process
+ * rate is water-filled: a host whose own rate holds its transfers
+ * below an equal part keeps only what that rate allows, and the rest
+ * is split equally between the other transfers (fair_level).  Below
+ * that, shares stay equal; bandwidth a slow server leaves unused is
+ * not handed on.
+ *
+ * Shares change as transfers come and go and as a background process
+ * starts or stops yielding.  The write trampoline recomputes its own
+ * share after each write and updates the option when it moved, so the
+ * handle is only ever touched from the thread performing it.
+ *
+ * Configuration is loaded on first use, so commands that never
+ * download never read it.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "netsched.h"
+#include "flappy.h"
+#include "mirror.h"
+#include "ui.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NETSCHED_HOSTS_MAX      64
+#define NETSCHED_HOST_NAME_MAX  256
+
+#define DEFAULT_MAX_CONNECTIONS  16
+#define DEFAULT_HOST_CONNECTIONS 8
+#define DEFAULT_YIELD_RATE       (64.0 * 1024)
+
+/* How often a background process looks for interactive ones */
+#define YIELD_CHECK_INTERVAL 1.0
+
+struct netsched_host {
+    char          name[NETSCHED_HOST_NAME_MAX];
+    int           max_conn;         /* 0 = host_connections */
+    double        rate;             /* 0 = no cap of its own */
+    int           active;
+};
+
+static struct {
+    pthread_mutex_t     lock;
+    pthread_cond_t      freed;
+    int                 loaded;
+
+    enum netsched_class cls;
+    double              rate_override;
+
+    int                 max_conn;
+    int                 host_conn;
+    double              rate;
+    double              background_rate;
+    double              yield_rate;
+
+    struct netsched_host hosts[NETSCHED_HOSTS_MAX];
+    size_t               nhosts;
+    struct netsched_host other;     /* hosts past NETSCHED_HOSTS_MAX */
+    int                  active;
+
+    int                 lock_fd;
+    int                 yielding;
+    struct timespec     checked;
+} ns = {
+    .lock    = PTHREAD_MUTEX_INITIALIZER,
+    .freed   = PTHREAD_COND_INITIALIZER,
+    .lock_fd = -1,
+};
+
+/* =========================================================================
+ * Configuration
+ * ========================================================================= */
+
+static char *trim(char *s)
+{
+    while (isspace((unsigned char)*s))
+        s++;
+    size_t n = strlen(s);
+    while (n > 0 && isspace((unsigned char)s[n - 1]))
+        s[--n] = '\0';
+    return s;
+}
+
+int netsched_parse_rate(const char *s, long long *out)
+{
+    char *end = NULL;
+    long long v = strtoll(s, &end, 10);
+    if (!s[0] || end == s || v < 1)
+        return 1;
+
+    int shift;
+    switch (*end) {
+    case '\0':          shift = 0;  break;
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    default:            return 1;
+    }
+    if (*end || v > (LLONG_MAX >> shift))
+        return 1;
+
+    *out = v << shift;
+    return 0;
+}
+
+/* A rate in the config file: like netsched_parse_rate, or "0" */
+static int conf_rate(const char *s, double *out)
+{
+    long long v;
+    if (strcmp(s, "0") == 0) {
+        *out = 0;
+        return 0;
+    }
+    if (netsched_parse_rate(s, &v))
+        return 1;
+    *out = (double)v;
+    return 0;
+}
+
+static int conf_count(const char *s, int *out)
+{
+    char *end = NULL;
+    long v = strtol(s, &end, 10);
+    if (!s[0] || *end || v < 1 || v > 1024)
+        return 1;
+    *out = (int)v;
+    return 0;
+}
+
+static void conf_defaults(void)
+{
+    ns.max_conn        = DEFAULT_MAX_CONNECTIONS;
+    ns.host_conn       = DEFAULT_HOST_CONNECTIONS;
+    ns.rate            = 0;
+    ns.background_rate = 0;
+    ns.yield_rate      = DEFAULT_YIELD_RATE;
+    ns.nhosts          = 0;
+}
+
+/*
+ * conf_load
+ *
+ * Reads NETSCHED_CONF_PATH.  Keys before the first [host] section are
+ * process-wide.  On any error the whole file is ignored.
+ */
+static void conf_load(void)
+{
+    conf_defaults();
+
+    FILE *f = fopen(NETSCHED_CONF_PATH, "r");
+    if (!f) {
+        if (errno != ENOENT)
+            ui_warn("cannot read %s: %s — using default download limits",
+                    NETSCHED_CONF_PATH, strerror(errno));
+        return;
+    }
+
+    char line[512];
+    int lineno = 0;
+    struct netsched_host *cur = NULL;
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *p = trim(line);
+
+        if (!*p || *p == '#' || *p == ';')
+            continue;
+
+        if (*p == '[') {
+            char *end = strchr(p, ']');
+            if (!end || end[1] != '\0')
+                goto bad;
+            *end = '\0';
+            char *name = trim(p + 1);
+            if (!*name || strlen(name) >= NETSCHED_HOST_NAME_MAX ||
+                strpbrk(name, "/:@ \t") || ns.nhosts == NETSCHED_HOSTS_MAX)
+                goto bad;
+
+            cur = &ns.hosts[ns.nhosts++];
+            memset(cur, 0, sizeof(*cur));
+            snprintf(cur->name, sizeof(cur->name), "%s", name);
+            continue;
+        }
+
+        char *eq = strchr(p, '=');
+        if (!eq)
+            goto bad;
+        *eq = '\0';
+        char *key = trim(p);
+        char *val = trim(eq + 1);
+
+        int bad = 1;
+        if (cur) {
+            if (strcmp(key, "connections") == 0)
+                bad = conf_count(val, &cur->max_conn);
+            else if (strcmp(key, "rate") == 0)
+                bad = conf_rate(val, &cur->rate);
+        } else {
+            if (strcmp(key, "max_connections") == 0)
+                bad = conf_count(val, &ns.max_conn);
+            else if (strcmp(key, "host_connections") == 0)
+                bad = conf_count(val, &ns.host_conn);
+            else if (strcmp(key, "rate") == 0)
+                bad = conf_rate(val, &ns.rate);
+            else if (strcmp(key, "background_rate") == 0)
+                bad = conf_rate(val, &ns.background_rate);
+            else if (strcmp(key, "background_yield_rate") == 0)
+                bad = conf_rate(val, &ns.yield_rate);
+        }
+        if (bad)
+            goto bad;
+    }
+
+    fclose(f);
+    return;
+
+bad:
+    ui_warn("%s:%d: syntax error — using default download limits",
+            NETSCHED_CONF_PATH, lineno);
+    fclose(f);
+    conf_defaults();
+}
+
+/*
+ * Interactive processes announce themselves with a shared lock held
+ * until exit; background processes only test for it.  Without write
+ * access to FLAPPY_DB_DIR (not root) there is nothing to announce to.
+ */
+static void priority_lock(void)
+{
+    ns.lock_fd = open(NETSCHED_LOCK_PATH, O_RDWR | O_CREAT | O_CLOEXEC,
+                      0644);
+    if (ns.lock_fd < 0 || ns.cls != NETSCHED_INTERACTIVE)
+        return;
+
+    struct flock fl = { .l_type = F_RDLCK, .l_whence = SEEK_SET };
+    if (fcntl(ns.lock_fd, F_SETLK, &fl) != 0)
+        log_info("netsched: cannot lock %s: %s",
+                 NETSCHED_LOCK_PATH, strerror(errno));
+}
+
+static void ensure_loaded(void)
+{
+    if (ns.loaded)
+        return;
+    ns.loaded = 1;
+    conf_load();
+    priority_lock();
+}
+
+/* =========================================================================
+ * Hosts
+ * ========================================================================= */
+
+/* Host part of `url`, without user info or port, lower case */
+static void url_host(const char *url, char *out, size_t outsz)
+{
+    const char *p = strstr(url, "://");
+    p = p ? p + 3 : url;
+
+    size_t len = strcspn(p, "/?#");
+    const char *at = memchr(p, '@', len);
+    if (at) {
+        len -= (size_t)(at + 1 - p);
+        p = at + 1;
+    }
+
+    /* [v6]:port keeps its brackets; host:port loses the port */
+    const char *colon = p[0] == '[' ? memchr(p, ']', len) : NULL;
+    if (colon)
+        len = (size_t)(colon + 1 - p);
+    else if ((colon = memchr(p, ':', len)) != NULL)
+        len = (size_t)(colon - p);
+
+    if (len >= outsz)
+        len = outsz - 1;
+    for (size_t i = 0; i < len; i++)
+        out[i] = (char)tolower((unsigned char)p[i]);
+    out[len] = '\0';
+}
+
+/* Called with ns.lock held */
+static struct netsched_host *host_for(const char *url)
+{
+    char name[NETSCHED_HOST_NAME_MAX];
+    url_host(url, name, sizeof(name));
+
+    for (size_t i = 0; i < ns.nhosts; i++)
+        if (strcasecmp(ns.hosts[i].name, name) == 0)
+            return &ns.hosts[i];
+
+    if (ns.nhosts == NETSCHED_HOSTS_MAX)
+        return &ns.other;
+
+    struct netsched_host *h = &ns.hosts[ns.nhosts++];
+    memset(h, 0, sizeof(*h));
+    snprintf(h->name, sizeof(h->name), "%s", name);
+    return h;
+}
+
+static int host_limit(const struct netsched_host *h)
+{
+    int n = h->max_conn ? h->max_conn : ns.host_conn;
+    return n < ns.max_conn ? n : ns.max_conn;
+}
+
+/* =========================================================================
+ * Bandwidth
+ * ========================================================================= */
+
+static double seconds_between(const struct timespec *a,
+                              const struct timespec *b)
+{
+    return (double)(b->tv_sec - a->tv_sec) +
+           (double)(b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+/* Called with ns.lock held */
+static int interactive_running(const struct timespec *now)
+{
+    if (ns.lock_fd < 0)
+        return 0;
+
+    if (ns.checked.tv_sec != 0 &&
+        seconds_between(&ns.checked, now) < YIELD_CHECK_INTERVAL)
+        return ns.yielding;
+    ns.checked = *now;
+
+    struct flock fl = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+    int busy = fcntl(ns.lock_fd, F_GETLK, &fl) == 0 &&
+               fl.l_type != F_UNLCK;
+
+    if (busy != ns.yielding)
+        log_info("netsched: %s", busy
+                 ? "interactive download running — yielding bandwidth"
+                 : "no interactive download — resuming");
+    ns.yielding = busy;
+    return busy;
+}
+
+/* Called with ns.lock held */
+static double process_rate(const struct timespec *now)
+{
+    if (ns.cls == NETSCHED_INTERACTIVE)
+        return ns.rate_override > 0 ? ns.rate_override : ns.rate;
+
+    double rate = ns.rate_override > 0 ? ns.rate_override
+                : ns.background_rate > 0 ? ns.background_rate
+                : ns.rate;
+
+    if (ns.yield_rate > 0 && interactive_running(now) &&
+        (rate <= 0 || rate > ns.yield_rate))
+        rate = ns.yield_rate;
+    return rate;
+}
+
+/* Called with ns.lock held */
+static int low_cap(const struct netsched_host *h)
+{
+    double floor = 2.0 * ns.max_conn * MIRROR_LOW_SPEED_LIMIT;
+    double rates[] = {
+        ns.rate_override, ns.rate, h->rate,
+        ns.cls == NETSCHED_BACKGROUND ? ns.background_rate : 0,
+        ns.cls == NETSCHED_BACKGROUND ? ns.yield_rate : 0,
+    };
+
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+        if (rates[i] > 0 && rates[i] < floor)
+            return 1;
+    return 0;
+}
+
+/*
+ * fair_level
+ *
+ * The part of the process `rate` (> 0) each transfer gets unless its
+ * host holds it lower.  Hosts whose rate keeps their transfers below
+ * the current level are settled at that rate, which raises the level
+ * for the rest; repeated until no host drops out.  Called with
+ * ns.lock held.
+ */
+static double fair_level(double rate)
+{
+    unsigned char settled[NETSCHED_HOSTS_MAX + 1] = {0};
+    double left = rate;
+    int    n    = ns.active;
+
+    for (int changed = 1; changed && n > 0; ) {
+        changed = 0;
+        double level = left / n;
+
+        for (size_t i = 0; i <= ns.nhosts; i++) {
+            const struct netsched_host *h =
+                i < ns.nhosts ? &ns.hosts[i] : &ns.other;
+            if (settled[i] || h->active == 0 || h->rate <= 0 ||
+                h->rate / h->active >= level)
+                continue;
+            settled[i] = 1;
+            left -= h->rate;
+            n    -= h->active;
+            changed = 1;
+        }
+    }
+
+    return n > 0 ? left / n : rate;
+}
+
+/*
+ * share
+ *
+ * The receive cap of one admitted transfer on `h`, in bytes per
+ * second: its equal part of the host rate, or its fair_level of the
+ * process rate, whichever is lower.  0 = no cap.  Called with ns.lock
+ * held.
+ */
+static curl_off_t share(const struct netsched_host *h,
+                        const struct timespec *now)
+{
+    double rate = process_rate(now);
+    double cap  = rate > 0 ? fair_level(rate) : 0;
+
+    if (h->rate > 0 && (cap <= 0 || h->rate / h->active < cap))
+        cap = h->rate / h->active;
+
+    if (cap <= 0)
+        return 0;
+    return cap < 1 ? 1 : (curl_off_t)cap;
+}
+
+/* Brings x's CURLOPT_MAX_RECV_SPEED_LARGE up to date with its share */
+static void apply_share(struct netsched_xfer *x)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&ns.lock);
+    curl_off_t cap = share(x->host, &now);
+    pthread_mutex_unlock(&ns.lock);
+
+    if (cap != x->cap) {
+        curl_easy_setopt(x->curl, CURLOPT_MAX_RECV_SPEED_LARGE, cap);
+        x->cap = cap;
+    }
+}
+
+static size_t xfer_write(char *ptr, size_t size, size_t nmemb, void *arg)
+{
+    struct netsched_xfer *x = arg;
+    size_t n = x->write(ptr, size, nmemb, x->arg);
+
+    if (n > 0)
+        apply_share(x);
+    return n;
+}
+
+/* =========================================================================
+ * Public API
+ * ========================================================================= */
+
+void netsched_set_class(enum netsched_class cls)
+{
+    pthread_mutex_lock(&ns.lock);
+    ns.cls = cls;
+    pthread_mutex_unlock(&ns.lock);
+}
+
+void netsched_set_rate(long long bytes_per_sec)
+{
+    pthread_mutex_lock(&ns.lock);
+    ns.rate_override = bytes_per_sec > 0 ? (double)bytes_per_sec : 0;
+    pthread_mutex_unlock(&ns.lock);
+}
+
+int netsched_begin(struct netsched_xfer *x, CURL *curl, const char *url,
+                   netsched_write_fn write, void *arg, int wait)
+{
+    pthread_mutex_lock(&ns.lock);
+    ensure_loaded();
+
+    struct netsched_host *h = host_for(url);
+    while (ns.active >= ns.max_conn || h->active >= host_limit(h)) {
+        if (!wait) {
+            pthread_mutex_unlock(&ns.lock);
+            return 1;
+        }
+        pthread_cond_wait(&ns.freed, &ns.lock);
+    }
+    ns.active++;
+    h->active++;
+    int relax = low_cap(h);
+    pthread_mutex_unlock(&ns.lock);
+
+    x->host  = h;
+    x->curl  = curl;
+    x->write = write;
+    x->arg   = arg;
+    x->cap   = -1;
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, xfer_write);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA,     x);
+    apply_share(x);
+
+    /* a low cap shared by many connections must not read as a stall */
+    if (relax)
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    return 0;
+}
+
+void netsched_end(struct netsched_xfer *x)
+{
+    if (!x->host)
+        return;
+
+    pthread_mutex_lock(&ns.lock);
+    ns.active--;
+    x->host->active--;
+    pthread_cond_broadcast(&ns.freed);
+    pthread_mutex_unlock(&ns.lock);
+
+    x->host = NULL;
+}
+
+int netsched_slots(const char *url)
+{
+    pthread_mutex_lock(&ns.lock);
+    ensure_loaded();
+    int n = host_limit(host_for(url));
+    pthread_mutex_unlock(&ns.lock);
+    return n;
+}
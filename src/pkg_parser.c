@@ -2,6 +2,7 @@
 
 #include "pkg_meta.h"
 #include "flappy.h"
+#include "version.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -123,6 +124,7 @@ static int append_dep(struct dep_entry **arr,
 
     if (*p == '\0') {
         /* No constraint */
+        version_constraint_compile(&e->constraint, DEP_OP_NONE, NULL);
         (*count)++;
         return 1;
     }
@@ -152,6 +154,10 @@ static int append_dep(struct dep_entry **arr,
         return 0;
     }
 
+    /* An invalid version is kept; the compiled constraint rejects all. */
+    if (version_constraint_compile(&e->constraint, e->op, e->version) != 0)
+        log_error("pkg_parser: invalid version in depend: %s", value);
+
     (*count)++;
     return 1;
 }
@@ -19,9 +19,11 @@
 
 #include "flappy.h"
 #include "db_guard.h"
+#include "root.h"
 #include "ui.h"
 
 #include <sqlite3.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -168,7 +170,7 @@ static int delete_files(const FileList *fl, int keep_configs)
         const char *path = fl->paths[i];
         if (keep_configs && strncmp(path, "/etc/", 5) == 0)
             continue;
-        if (unlink(path) != 0 && errno != ENOENT) {
+        if (root_unlink(path) != 0 && errno != ENOENT) {
             log_error("remove: failed to delete %s: %s",
                       path, strerror(errno));
             errors++;
@@ -0,0 +1,209 @@
+/*
+ * repo_config.c - Repository list (/etc/flappy/repos.conf)
+ *
+ * A deliberately small INI reader: [section] headers, `key = value`
+ * lines, '#' / ';' comments, blank lines.  Keys, per section:
+ *
+ *   url        the repository's canonical URL (required)
+ *   mirror     another server with the same content; may repeat
+ *   priority   higher wins a package name provided twice
+ *
+ * Unknown keys are rejected so a typo ("prority") does not silently
+ * change which repository wins.
+ *
+ * The file is optional.  Without it flappy behaves as it always has:
+ * one repository, "core", at FLAPPY_DEFAULT_REPO_URL.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "repo.h"
+#include "flappy.h"
+#include "ui.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char *trim(char *s)
+{
+    while (isspace((unsigned char)*s))
+        s++;
+    size_t n = strlen(s);
+    while (n > 0 && isspace((unsigned char)s[n - 1]))
+        s[--n] = '\0';
+    return s;
+}
+
+static int valid_name(const char *s)
+{
+    if (!*s || strlen(s) >= REPO_NAME_MAX)
+        return 0;
+    for (; *s; s++)
+        if (!(islower((unsigned char)*s) || isdigit((unsigned char)*s) ||
+              *s == '-' || *s == '_'))
+            return 0;
+    return 1;
+}
+
+static void set_default(struct repo_config *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    snprintf(cfg->repos[0].name, REPO_NAME_MAX, "core");
+    snprintf(cfg->repos[0].mirrors[0], REPO_URL_MAX, "%s",
+             FLAPPY_DEFAULT_REPO_URL);
+    cfg->repos[0].nmirrors = 1;
+    cfg->count = 1;
+}
+
+/* stable insertion sort, highest priority first */
+static void sort_by_priority(struct repo_config *cfg)
+{
+    for (size_t i = 1; i < cfg->count; i++) {
+        struct repo_source r = cfg->repos[i];
+        size_t j = i;
+        while (j > 0 && cfg->repos[j - 1].priority < r.priority) {
+            cfg->repos[j] = cfg->repos[j - 1];
+            j--;
+        }
+        cfg->repos[j] = r;
+    }
+}
+
+int repo_config_load(struct repo_config *cfg)
+{
+    FILE *f = fopen(FLAPPY_REPOS_CONF_PATH, "r");
+    if (!f) {
+        if (errno != ENOENT) {
+            ui_error("cannot read %s: %s",
+                     FLAPPY_REPOS_CONF_PATH, strerror(errno));
+            return 1;
+        }
+        set_default(cfg);
+        return 0;
+    }
+
+    memset(cfg, 0, sizeof(*cfg));
+
+    char line[1024];
+    int lineno = 0;
+    struct repo_source *cur = NULL;
+    int has_url[REPO_MAX] = {0};
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *p = trim(line);
+
+        if (!*p || *p == '#' || *p == ';')
+            continue;
+
+        if (*p == '[') {
+            char *end = strchr(p, ']');
+            if (!end || end[1] != '\0')
+                goto bad;
+            *end = '\0';
+            char *name = trim(p + 1);
+            if (!valid_name(name))
+                goto bad;
+
+            for (size_t i = 0; i < cfg->count; i++) {
+                if (strcmp(cfg->repos[i].name, name) == 0) {
+                    ui_error("%s:%d: duplicate repository [%s]",
+                             FLAPPY_REPOS_CONF_PATH, lineno, name);
+                    fclose(f);
+                    return 1;
+                }
+            }
+            if (cfg->count == REPO_MAX) {
+                ui_error("%s:%d: too many repositories (max %d)",
+                         FLAPPY_REPOS_CONF_PATH, lineno, REPO_MAX);
+                fclose(f);
+                return 1;
+            }
+
+            cur = &cfg->repos[cfg->count++];
+            snprintf(cur->name, REPO_NAME_MAX, "%s", name);
+            continue;
+        }
+
+        char *eq = strchr(p, '=');
+        if (!cur || !eq)
+            goto bad;
+        *eq = '\0';
+        char *key = trim(p);
+        char *val = trim(eq + 1);
+
+        if (strcmp(key, "url") == 0 || strcmp(key, "mirror") == 0) {
+            int is_url = (key[0] == 'u');
+            size_t n = strlen(val);
+            while (n > 0 && val[n - 1] == '/')
+                val[--n] = '\0';
+            if (!n || n >= REPO_URL_MAX ||
+                cur->nmirrors == REPO_MIRROR_MAX ||
+                (is_url && has_url[cur - cfg->repos]))
+                goto bad;
+
+            /* url always occupies slot 0 */
+            size_t at = cur->nmirrors;
+            if (is_url) {
+                memmove(cur->mirrors[1], cur->mirrors[0],
+                        cur->nmirrors * REPO_URL_MAX);
+                has_url[cur - cfg->repos] = 1;
+                at = 0;
+            }
+            snprintf(cur->mirrors[at], REPO_URL_MAX, "%s", val);
+            cur->nmirrors++;
+        } else if (strcmp(key, "priority") == 0) {
+            char *end = NULL;
+            long v = strtol(val, &end, 10);
+            if (!*val || *end || v < -1000000 || v > 1000000)
+                goto bad;
+            cur->priority = (int)v;
+        } else {
+            goto bad;
+        }
+    }
+
+    fclose(f);
+
+    if (cfg->count == 0) {
+        ui_error("%s: no repositories configured", FLAPPY_REPOS_CONF_PATH);
+        return 1;
+    }
+
+    for (size_t i = 0; i < cfg->count; i++) {
+        if (!has_url[i]) {
+            ui_error("%s: repository [%s] has no url",
+                     FLAPPY_REPOS_CONF_PATH, cfg->repos[i].name);
+            return 1;
+        }
+    }
+
+    sort_by_priority(cfg);
+    return 0;
+
+bad:
+    ui_error("%s:%d: syntax error", FLAPPY_REPOS_CONF_PATH, lineno);
+    fclose(f);
+    return 1;
+}
+
+static int url_eq(const char *a, const char *b)
+{
+    size_t la = strlen(a), lb = strlen(b);
+    while (la > 0 && a[la - 1] == '/') la--;
+    while (lb > 0 && b[lb - 1] == '/') lb--;
+    return la == lb && strncmp(a, b, la) == 0;
+}
+
+const struct repo_source *repo_config_find(const struct repo_config *cfg,
+                                           const char *url)
+{
+    for (size_t i = 0; i < cfg->count; i++)
+        for (size_t m = 0; m < cfg->repos[i].nmirrors; m++)
+            if (url_eq(cfg->repos[i].mirrors[m], url))
+                return &cfg->repos[i];
+    return NULL;
+}
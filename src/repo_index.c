@@ -0,0 +1,792 @@
+/*
+ * repo_index.c - Memory-mapped binary repository index
+ *
+ * FILE LAYOUT (native byte order, sections 8-byte aligned)
+ *
+ *   struct ridx_header
+ *   struct ridx_name   names[nnames]      BINARY order
+ *   struct ridx_entry  entries[nentries]  grouped by name, newest first
+ *   struct ridx_dep    deps[ndeps]        grouped by name
+ *   uint32_t           disp[nbuckets]     perfect-hash displacements
+ *   uint32_t           slots[nslots]      slot -> name id (or EMPTY)
+ *   char               pool[pool_bytes]   NUL-terminated strings and
+ *                                         raw version keys; offset 0
+ *                                         is the empty string
+ *
+ * PERFECT HASH (hash-and-displace, as in CHD)
+ *
+ *   h    = FNV-1a 64 of the name
+ *   b    = h % nbuckets                     (about 4 names per bucket)
+ *   slot = mix(h ^ disp[b] * φ) % nslots    (nslots = 1.25 × nnames)
+ *
+ * Buckets are placed largest first; each gets the smallest
+ * displacement that lands all its names on free slots.  A lookup is
+ * two hashes, two array reads and one string compare, touching the
+ * disp, slots, names and pool pages — a handful of page faults cold.
+ *
+ * Only structural bounds are checked at open (O(1)); per-record
+ * offsets are clamped at access, so a damaged file yields wrong but
+ * memory-safe answers until the SHA check retires it.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "repo_index.h"
+#include "flappy.h"
+#include "repo.h"
+
+#include <sqlite3.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RIDX_MAGIC      "FRIX"
+#define RIDX_VERSION    2
+#define RIDX_EMPTY      UINT32_MAX
+#define RIDX_MAX_DISP   (1u << 24)
+
+struct ridx_header {
+    char     magic[4];
+    uint32_t version;
+    char     repo_sha[64];
+    uint32_t nnames;
+    uint32_t nentries;
+    uint32_t ndeps;
+    uint32_t nbuckets;
+    uint32_t nslots;
+    uint32_t base_url_off;   /* 0 = none */
+    uint64_t names_at;
+    uint64_t entries_at;
+    uint64_t deps_at;
+    uint64_t disp_at;
+    uint64_t slots_at;
+    uint64_t pool_at;
+    uint64_t pool_bytes;
+};
+
+struct ridx_name {
+    uint32_t name_off;
+    uint32_t first_entry;
+    uint32_t entry_count;
+    uint32_t first_dep;
+    uint32_t dep_count;
+};
+
+struct ridx_entry {
+    uint32_t version_off;
+    uint32_t filename_off;
+    uint32_t checksum_off;
+    uint32_t vkey_off;
+    uint32_t vkey_len;       /* RIDX_EMPTY = invalid version */
+    uint32_t base_url_off;   /* owning repository; 0 = meta base_url */
+};
+
+struct ridx_dep {
+    uint32_t name_off;
+    uint32_t version_off;
+    uint32_t op;
+};
+
+struct repo_index {
+    void                      *map;
+    size_t                     map_size;
+    const struct ridx_header  *hdr;
+    const struct ridx_name    *names;
+    const struct ridx_entry   *entries;
+    const struct ridx_dep     *deps;
+    const uint32_t            *disp;
+    const uint32_t            *slots;
+    const char                *pool;
+};
+
+/* =========================================================================
+ * Hashing
+ * ========================================================================= */
+
+static uint64_t hash_name(const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint32_t slot_of(uint64_t h, uint32_t d, uint32_t nslots)
+{
+    return (uint32_t)(mix64(h ^ ((uint64_t)d * 0x9e3779b97f4a7c15ULL))
+                      % nslots);
+}
+
+/* =========================================================================
+ * Build: growable buffers
+ * ========================================================================= */
+
+struct buf {
+    char   *data;
+    size_t  len;
+    size_t  cap;
+};
+
+static int buf_reserve(struct buf *b, size_t extra)
+{
+    if (b->len + extra <= b->cap)
+        return 0;
+    size_t nc = b->cap ? b->cap : 4096;
+    while (nc < b->len + extra)
+        nc *= 2;
+    char *tmp = realloc(b->data, nc);
+    if (!tmp)
+        return 1;
+    b->data = tmp;
+    b->cap  = nc;
+    return 0;
+}
+
+static int buf_append(struct buf *b, const void *p, size_t n)
+{
+    if (buf_reserve(b, n))
+        return 1;
+    if (n)
+        memcpy(b->data + b->len, p, n);
+    b->len += n;
+    return 0;
+}
+
+/* appends a NUL-terminated string to the pool; "" and NULL map to 0 */
+static int pool_str(struct buf *pool, const char *s, uint32_t *off)
+{
+    if (!s || !*s) {
+        *off = 0;
+        return 0;
+    }
+    if (pool->len > UINT32_MAX - 1)
+        return 1;
+    *off = (uint32_t)pool->len;
+    return buf_append(pool, s, strlen(s) + 1);
+}
+
+static dep_op_t parse_op(const char *s)
+{
+    if (!s)                    return DEP_OP_NONE;
+    if (strcmp(s, ">=") == 0)  return DEP_OP_GE;
+    if (strcmp(s, "<=") == 0)  return DEP_OP_LE;
+    if (strcmp(s, ">")  == 0)  return DEP_OP_GT;
+    if (strcmp(s, "<")  == 0)  return DEP_OP_LT;
+    if (strcmp(s, "=")  == 0)  return DEP_OP_EQ;
+    return DEP_OP_NONE;
+}
+
+/* =========================================================================
+ * Build: perfect hash
+ * ========================================================================= */
+
+static int build_hash(const struct ridx_name *names, uint32_t nnames,
+                      const char *pool,
+                      uint32_t nbuckets, uint32_t nslots,
+                      uint32_t *disp, uint32_t *slots)
+{
+    uint64_t *hashes = malloc((nnames ? nnames : 1) * sizeof(*hashes));
+    uint32_t *start  = calloc((size_t)nbuckets + 1, sizeof(*start));
+    uint32_t *member = malloc((nnames ? nnames : 1) * sizeof(*member));
+    uint32_t *order  = malloc(nbuckets * sizeof(*order));
+    uint32_t *fill   = calloc(nbuckets, sizeof(*fill));
+    int failed = 0;
+
+    if (!hashes || !start || !member || !order || !fill) {
+        failed = 1;
+        goto out;
+    }
+
+    /* bucket members, counting sort */
+    for (uint32_t i = 0; i < nnames; i++) {
+        hashes[i] = hash_name(pool + names[i].name_off);
+        start[hashes[i] % nbuckets + 1]++;
+    }
+    for (uint32_t b = 0; b < nbuckets; b++)
+        start[b + 1] += start[b];
+    for (uint32_t i = 0; i < nnames; i++) {
+        uint32_t b = (uint32_t)(hashes[i] % nbuckets);
+        member[start[b] + fill[b]++] = i;
+    }
+
+    /* largest buckets first (simple counting sort by size) */
+    uint32_t maxsz = 0;
+    for (uint32_t b = 0; b < nbuckets; b++)
+        if (start[b + 1] - start[b] > maxsz)
+            maxsz = start[b + 1] - start[b];
+
+    uint32_t k = 0;
+    for (uint32_t sz = maxsz + 1; sz-- > 0; )
+        for (uint32_t b = 0; b < nbuckets; b++)
+            if (start[b + 1] - start[b] == sz)
+                order[k++] = b;
+
+    for (uint32_t s = 0; s < nslots; s++)
+        slots[s] = RIDX_EMPTY;
+
+    uint32_t cand[64];
+
+    for (uint32_t o = 0; o < nbuckets && !failed; o++) {
+        uint32_t b  = order[o];
+        uint32_t sz = start[b + 1] - start[b];
+        disp[b] = 0;
+        if (sz == 0)
+            continue;
+        if (sz > 64) {
+            failed = 1;
+            break;
+        }
+
+        uint32_t d;
+        for (d = 0; d < RIDX_MAX_DISP; d++) {
+            int ok = 1;
+            for (uint32_t j = 0; j < sz && ok; j++) {
+                cand[j] = slot_of(hashes[member[start[b] + j]], d, nslots);
+                if (slots[cand[j]] != RIDX_EMPTY)
+                    ok = 0;
+                for (uint32_t i = 0; i < j && ok; i++)
+                    if (cand[i] == cand[j])
+                        ok = 0;
+            }
+            if (ok)
+                break;
+        }
+
+        if (d == RIDX_MAX_DISP) {
+            failed = 1;
+            break;
+        }
+
+        disp[b] = d;
+        for (uint32_t j = 0; j < sz; j++)
+            slots[cand[j]] = member[start[b] + j];
+    }
+
+out:
+    free(hashes);
+    free(start);
+    free(member);
+    free(order);
+    free(fill);
+    return failed;
+}
+
+/* =========================================================================
+ * Build
+ * ========================================================================= */
+
+static int find_name_id(const struct ridx_name *names, uint32_t n,
+                        const char *pool, const char *name, uint32_t *id)
+{
+    uint32_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(pool + names[mid].name_off, name);
+        if (c == 0) {
+            *id = mid;
+            return 1;
+        }
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return 0;
+}
+
+static int write_section(FILE *f, const void *p, size_t n, uint64_t *at)
+{
+    static const char zero[8] = {0};
+
+    long pos = ftell(f);
+    if (pos < 0)
+        return 1;
+    size_t pad = (8 - (size_t)pos % 8) % 8;
+    if (pad && fwrite(zero, pad, 1, f) != 1)
+        return 1;
+
+    *at = (uint64_t)pos + pad;
+    return n && fwrite(p, n, 1, f) != 1;
+}
+
+/*
+ * Base URLs of the merged repositories (repos table, see repo_update),
+ * interned once in the pool.  A repo.db without the table has none and
+ * every entry falls back to meta base_url.
+ */
+struct repo_url {
+    char     name[REPO_NAME_MAX];
+    uint32_t off;
+};
+
+static size_t load_repo_urls(sqlite3 *repo, struct buf *pool,
+                             struct repo_url *out, int *failed)
+{
+    sqlite3_stmt *st = NULL;
+    size_t n = 0;
+
+    if (sqlite3_prepare_v2(repo, "SELECT name, base_url FROM repos;",
+                           -1, &st, NULL) != SQLITE_OK)
+        return 0;
+
+    while (n < REPO_MAX && sqlite3_step(st) == SQLITE_ROW) {
+        const char *name = (const char *)sqlite3_column_text(st, 0);
+        if (!name)
+            continue;
+        snprintf(out[n].name, REPO_NAME_MAX, "%s", name);
+        *failed |= pool_str(pool,
+            (const char *)sqlite3_column_text(st, 1), &out[n].off);
+        n++;
+    }
+
+    sqlite3_finalize(st);
+    return n;
+}
+
+static uint32_t repo_url_off(const struct repo_url *urls, size_t n,
+                             const char *name)
+{
+    for (size_t i = 0; name && i < n; i++)
+        if (strcmp(urls[i].name, name) == 0)
+            return urls[i].off;
+    return 0;
+}
+
+int repo_index_build(sqlite3 *repo, const char *repo_sha, const char *path)
+{
+    struct buf pool    = {0};
+    struct buf names   = {0};
+    struct buf entries = {0};
+    struct buf deps    = {0};
+    uint32_t  *disp    = NULL;
+    uint32_t  *slots   = NULL;
+    FILE      *f       = NULL;
+    int        failed  = 0;
+
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    /* offset 0 is the empty string */
+    if (buf_append(&pool, "", 1))
+        goto fail;
+
+    struct repo_url urls[REPO_MAX];
+    size_t nurls = load_repo_urls(repo, &pool, urls, &failed);
+    if (failed)
+        goto fail;
+
+    /* --- packages: one ridx_name per distinct name --- */
+    sqlite3_stmt *st = NULL;
+    int has_repo = (sqlite3_prepare_v2(repo,
+            "SELECT repo FROM packages LIMIT 0;",
+            -1, &st, NULL) == SQLITE_OK);
+    sqlite3_finalize(st);
+
+    /* The checksum as install_lookup reads it: BLAKE3 when published */
+    st = NULL;
+    int has_blake3 = (sqlite3_prepare_v2(repo,
+            "SELECT blake3 FROM packages LIMIT 0;",
+            -1, &st, NULL) == SQLITE_OK);
+    sqlite3_finalize(st);
+
+    char sql[512];
+    snprintf(sql, sizeof(sql),
+             "SELECT name, version, filename, %s, version_key, %s "
+             "FROM packages WHERE name IS NOT NULL "
+             "ORDER BY name COLLATE BINARY, version_key DESC;",
+             has_blake3 ? "CASE WHEN blake3 IS NOT NULL "
+                          "THEN 'blake3:' || blake3 ELSE checksum END"
+                        : "checksum",
+             has_repo ? "repo" : "NULL");
+
+    if (sqlite3_prepare_v2(repo, sql, -1, &st, NULL) != SQLITE_OK)
+        goto fail;
+
+    struct ridx_name *cur = NULL;
+    uint32_t nentries = 0;
+
+    while (!failed && sqlite3_step(st) == SQLITE_ROW) {
+        const char *name = (const char *)sqlite3_column_text(st, 0);
+
+        if (!cur || strcmp(pool.data + cur->name_off, name) != 0) {
+            struct ridx_name n = {0};
+            if (pool_str(&pool, name, &n.name_off) ||
+                buf_append(&names, &n, sizeof(n))) {
+                failed = 1;
+                break;
+            }
+            cur = (struct ridx_name *)(names.data + names.len) - 1;
+            cur->first_entry = nentries;
+        }
+
+        struct ridx_entry e = {0};
+        failed |= pool_str(&pool,
+            (const char *)sqlite3_column_text(st, 1), &e.version_off);
+        failed |= pool_str(&pool,
+            (const char *)sqlite3_column_text(st, 2), &e.filename_off);
+        failed |= pool_str(&pool,
+            (const char *)sqlite3_column_text(st, 3), &e.checksum_off);
+
+        if (sqlite3_column_type(st, 4) == SQLITE_BLOB) {
+            int klen = sqlite3_column_bytes(st, 4);
+            e.vkey_off = (uint32_t)pool.len;
+            e.vkey_len = (uint32_t)klen;
+            failed |= buf_append(&pool, sqlite3_column_blob(st, 4),
+                                 (size_t)klen);
+        } else {
+            e.vkey_len = RIDX_EMPTY;
+        }
+
+        e.base_url_off = repo_url_off(urls, nurls,
+            (const char *)sqlite3_column_text(st, 5));
+
+        failed |= buf_append(&entries, &e, sizeof(e));
+        cur->entry_count++;
+        nentries++;
+    }
+    sqlite3_finalize(st);
+
+    if (failed)
+        goto fail;
+
+    uint32_t nnames = (uint32_t)(names.len / sizeof(struct ridx_name));
+    struct ridx_name *nv = (struct ridx_name *)names.data;
+
+    /* --- dependencies (table is optional, as in the resolver) --- */
+    uint32_t ndeps = 0;
+    if (sqlite3_prepare_v2(repo,
+            "SELECT package, depends, op, version FROM deps "
+            "ORDER BY package COLLATE BINARY, rowid;",
+            -1, &st, NULL) == SQLITE_OK) {
+
+        uint32_t prev = RIDX_EMPTY;
+
+        while (!failed && sqlite3_step(st) == SQLITE_ROW) {
+            const char *pkg = (const char *)sqlite3_column_text(st, 0);
+            const char *dep = (const char *)sqlite3_column_text(st, 1);
+            const char *ops = (const char *)sqlite3_column_text(st, 2);
+            const char *ver = (const char *)sqlite3_column_text(st, 3);
+            uint32_t id;
+
+            if (!pkg || !dep || !*dep ||
+                !find_name_id(nv, nnames, pool.data, pkg, &id))
+                continue;
+
+            if (id != prev) {
+                nv[id].first_dep = ndeps;
+                prev = id;
+            }
+
+            struct ridx_dep d = {0};
+            dep_op_t op = ver ? parse_op(ops) : DEP_OP_NONE;
+            d.op = (uint32_t)op;
+            failed |= pool_str(&pool, dep, &d.name_off);
+            if (op != DEP_OP_NONE)
+                failed |= pool_str(&pool, ver, &d.version_off);
+
+            failed |= buf_append(&deps, &d, sizeof(d));
+            nv[id].dep_count++;
+            ndeps++;
+        }
+        sqlite3_finalize(st);
+    }
+
+    /* --- base_url --- */
+    uint32_t base_url_off = 0;
+    if (sqlite3_prepare_v2(repo,
+            "SELECT value FROM meta WHERE key = 'base_url';",
+            -1, &st, NULL) == SQLITE_OK) {
+        if (sqlite3_step(st) == SQLITE_ROW)
+            failed |= pool_str(&pool,
+                (const char *)sqlite3_column_text(st, 0), &base_url_off);
+        sqlite3_finalize(st);
+    }
+
+    if (failed || pool.len > UINT32_MAX)
+        goto fail;
+
+    /* --- perfect hash --- */
+    uint32_t nbuckets = nnames / 4 + 1;
+    uint32_t nslots   = nnames + nnames / 4 + 1;
+
+    disp  = calloc(nbuckets, sizeof(*disp));
+    slots = calloc(nslots, sizeof(*slots));
+    if (!disp || !slots ||
+        build_hash(nv, nnames, pool.data, nbuckets, nslots, disp, slots))
+        goto fail;
+
+    /* --- write --- */
+    struct ridx_header hdr = {0};
+    memcpy(hdr.magic, RIDX_MAGIC, 4);
+    hdr.version      = RIDX_VERSION;
+    memcpy(hdr.repo_sha, repo_sha, 64);
+    hdr.nnames       = nnames;
+    hdr.nentries     = nentries;
+    hdr.ndeps        = ndeps;
+    hdr.nbuckets     = nbuckets;
+    hdr.nslots       = nslots;
+    hdr.base_url_off = base_url_off;
+    hdr.pool_bytes   = pool.len;
+
+    f = fopen(tmp_path, "wb");
+    if (!f) {
+        log_error("repo index: cannot create %s: %s",
+                  tmp_path, strerror(errno));
+        goto fail;
+    }
+
+    /* header is rewritten once the section offsets are known */
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+        write_section(f, names.data,   names.len,   &hdr.names_at)   ||
+        write_section(f, entries.data, entries.len, &hdr.entries_at) ||
+        write_section(f, deps.data,    deps.len,    &hdr.deps_at)    ||
+        write_section(f, disp,  nbuckets * sizeof(*disp),  &hdr.disp_at)  ||
+        write_section(f, slots, nslots   * sizeof(*slots), &hdr.slots_at) ||
+        write_section(f, pool.data,    pool.len,    &hdr.pool_at)    ||
+        fseek(f, 0, SEEK_SET) != 0 ||
+        fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+        fflush(f) != 0 || fsync(fileno(f)) != 0)
+        goto fail;
+
+    if (fclose(f) != 0) {
+        f = NULL;
+        goto fail;
+    }
+    f = NULL;
+
+    if (rename(tmp_path, path) != 0)
+        goto fail;
+
+    log_info("repo index: %u names, %u versions, %u deps",
+             nnames, nentries, ndeps);
+
+    free(pool.data);
+    free(names.data);
+    free(entries.data);
+    free(deps.data);
+    free(disp);
+    free(slots);
+    return 0;
+
+fail:
+    if (f)
+        fclose(f);
+    unlink(tmp_path);
+    log_error("repo index: failed to build %s", path);
+    free(pool.data);
+    free(names.data);
+    free(entries.data);
+    free(deps.data);
+    free(disp);
+    free(slots);
+    return 1;
+}
+
+/* =========================================================================
+ * Open / close
+ * ========================================================================= */
+
+static int section_ok(uint64_t at, uint64_t len, size_t size)
+{
+    return at % 4 == 0 && at <= size && len <= size - at;
+}
+
+struct repo_index *repo_index_open(void)
+{
+    int fd = open(FLAPPY_REPO_INDEX_PATH, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 ||
+        (size_t)sb.st_size < sizeof(struct ridx_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)sb.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    const struct ridx_header *h = map;
+    char sha[64];
+
+    if (memcmp(h->magic, RIDX_MAGIC, 4) != 0 ||
+        h->version != RIDX_VERSION ||
+        repo_published_sha(sha) != 0 ||
+        memcmp(sha, h->repo_sha, 64) != 0)
+        goto bad;
+
+    if (!section_ok(h->names_at,
+                    (uint64_t)h->nnames * sizeof(struct ridx_name), size) ||
+        !section_ok(h->entries_at,
+                    (uint64_t)h->nentries * sizeof(struct ridx_entry), size) ||
+        !section_ok(h->deps_at,
+                    (uint64_t)h->ndeps * sizeof(struct ridx_dep), size) ||
+        !section_ok(h->disp_at, (uint64_t)h->nbuckets * 4, size) ||
+        !section_ok(h->slots_at, (uint64_t)h->nslots * 4, size) ||
+        !section_ok(h->pool_at, h->pool_bytes, size) ||
+        h->nbuckets == 0 || h->nslots == 0 || h->pool_bytes == 0)
+        goto bad;
+
+    const char *base = map;
+    if (base[h->pool_at + h->pool_bytes - 1] != '\0')
+        goto bad;
+
+    struct repo_index *idx = calloc(1, sizeof(*idx));
+    if (!idx)
+        goto bad;
+
+    idx->map      = map;
+    idx->map_size = size;
+    idx->hdr      = h;
+    idx->names    = (const struct ridx_name  *)(base + h->names_at);
+    idx->entries  = (const struct ridx_entry *)(base + h->entries_at);
+    idx->deps     = (const struct ridx_dep   *)(base + h->deps_at);
+    idx->disp     = (const uint32_t *)(base + h->disp_at);
+    idx->slots    = (const uint32_t *)(base + h->slots_at);
+    idx->pool     = base + h->pool_at;
+    return idx;
+
+bad:
+    munmap(map, size);
+    return NULL;
+}
+
+void repo_index_close(struct repo_index *idx)
+{
+    if (!idx)
+        return;
+    munmap(idx->map, idx->map_size);
+    free(idx);
+}
+
+/* =========================================================================
+ * Accessors
+ * ========================================================================= */
+
+/* pool string at `off`, or "" if out of range */
+static const char *str_at(const struct repo_index *idx, uint32_t off)
+{
+    return off < idx->hdr->pool_bytes ? idx->pool + off : "";
+}
+
+const char *repo_index_base_url(const struct repo_index *idx)
+{
+    uint32_t off = idx->hdr->base_url_off;
+    return off ? str_at(idx, off) : NULL;
+}
+
+uint32_t repo_index_names(const struct repo_index *idx)
+{
+    return idx->hdr->nnames;
+}
+
+const char *repo_index_name(const struct repo_index *idx, uint32_t id)
+{
+    if (id >= idx->hdr->nnames)
+        return "";
+    return str_at(idx, idx->names[id].name_off);
+}
+
+int repo_index_find(const struct repo_index *idx, const char *name,
+                    uint32_t *id)
+{
+    if (idx->hdr->nnames == 0)
+        return 0;
+
+    uint64_t h = hash_name(name);
+    uint32_t d = idx->disp[h % idx->hdr->nbuckets];
+    uint32_t n = idx->slots[slot_of(h, d, idx->hdr->nslots)];
+
+    if (n >= idx->hdr->nnames || strcmp(repo_index_name(idx, n), name) != 0)
+        return 0;
+
+    *id = n;
+    return 1;
+}
+
+uint32_t repo_index_prefix(const struct repo_index *idx, const char *prefix)
+{
+    uint32_t lo = 0, hi = idx->hdr->nnames;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (strcmp(repo_index_name(idx, mid), prefix) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+size_t repo_index_versions(const struct repo_index *idx, uint32_t id)
+{
+    if (id >= idx->hdr->nnames)
+        return 0;
+    const struct ridx_name *n = &idx->names[id];
+    if ((uint64_t)n->first_entry + n->entry_count > idx->hdr->nentries)
+        return 0;
+    return n->entry_count;
+}
+
+void repo_index_version(const struct repo_index *idx, uint32_t id,
+                        size_t k, struct repo_index_pkg *out)
+{
+    const struct ridx_entry *e = &idx->entries[idx->names[id].first_entry + k];
+
+    out->name     = repo_index_name(idx, id);
+    out->version  = str_at(idx, e->version_off);
+    out->filename = str_at(idx, e->filename_off);
+    out->checksum = str_at(idx, e->checksum_off);
+    out->base_url = e->base_url_off ? str_at(idx, e->base_url_off)
+                                    : repo_index_base_url(idx);
+
+    if (e->vkey_len != RIDX_EMPTY &&
+        (uint64_t)e->vkey_off + e->vkey_len <= idx->hdr->pool_bytes) {
+        out->vkey     = (const unsigned char *)idx->pool + e->vkey_off;
+        out->vkey_len = e->vkey_len;
+    } else {
+        out->vkey     = NULL;
+        out->vkey_len = 0;
+    }
+}
+
+size_t repo_index_deps(const struct repo_index *idx, uint32_t id)
+{
+    if (id >= idx->hdr->nnames)
+        return 0;
+    const struct ridx_name *n = &idx->names[id];
+    if ((uint64_t)n->first_dep + n->dep_count > idx->hdr->ndeps)
+        return 0;
+    return n->dep_count;
+}
+
+void repo_index_dep(const struct repo_index *idx, uint32_t id,
+                    size_t k, struct repo_index_dep *out)
+{
+    const struct ridx_dep *d = &idx->deps[idx->names[id].first_dep + k];
+
+    out->name    = str_at(idx, d->name_off);
+    out->op      = d->op <= DEP_OP_EQ ? (dep_op_t)d->op : DEP_OP_NONE;
+    out->version = str_at(idx, d->version_off);
+}
@@ -5,25 +5,46 @@
  *   - Open repo.db read-only
  *   - Normalize input to lowercase
  *   - Perform deterministic prefix search
- *   - Print results in BINARY alphabetical order
+ *   - Perform ranked full-text search (--text)
+ *   - Perform glob / substring search over names ("*ssl*")
+ *   - Print results in BINARY alphabetical order (prefix) or
+ *     rank order (full-text)
  *
  * Design guarantees:
  *   - No root required
  *   - No mutation of repo DB
- *   - Prefix-only search (term%)
+ *   - Prefix search matches names only (term%)
  *   - Deterministic ORDER BY name COLLATE BINARY
+ *   - Full-text ties are broken by name, so pages are stable
  *   - Fail hard if repo missing
  *
+ * Full-text search uses the packages_fts FTS5 table that repo_update
+ * builds after every download (see index_repo_text in repo_update.c).
+ * Each whitespace-separated word of the query becomes a quoted prefix
+ * term, so user input never reaches the FTS5 query parser as syntax:
+ *
+ *   "http client"   →   "http"* "client"*     (both must match)
+ *
+ * Glob search matches names through the trigram sidecar index
+ * (trigram.c) and then reads versions from repo.db by name.
+ *
+ * Prefix and glob searches read names and versions from the mmap'd
+ * repo index (repo_index.c) when it is current, and fall back to
+ * repo.db otherwise.  Full-text search always needs repo.db.
+ *
+ * Pagination: limit <= 0 means unlimited; page is 1-based.
+ *
  * This module does NOT:
  *   - Interpret dependency metadata
- *   - Perform fuzzy search
- *   - Perform substring search
+ *   - Perform fuzzy search (see trigram_suggest for "did you mean")
  */
 
 #define _POSIX_C_SOURCE 200809L
 
 #include "repo.h"
 #include "flappy.h"
+#include "repo_index.h"
+#include "trigram.h"
 
 #include <sqlite3.h>
 
@@ -44,16 +65,16 @@ static void normalize_lower(char *s)
 }
 
 /* =========================================================================
- * Public Entry: repo_search
+ * Utility: Open / paginate
  * ========================================================================= */
 
-int repo_search(const char *term)
+static sqlite3 *open_repo(void)
 {
     /* Ensure repository database exists */
     if (access(FLAPPY_REPO_DB_PATH, R_OK) != 0) {
         fprintf(stderr,
                 "repository metadata not available (run 'flappy update')\n");
-        return 1;
+        return NULL;
     }
 
     sqlite3 *db = NULL;
@@ -67,9 +88,165 @@ int repo_search(const char *term)
         fprintf(stderr, "failed to open repository database\n");
         if (db)
             sqlite3_close(db);
-        return 1;
+        return NULL;
+    }
+
+    return db;
+}
+
+/*
+ * Binds LIMIT / OFFSET at parameter indexes idx and idx+1.
+ * SQLite treats a negative LIMIT as "no limit".
+ */
+static void bind_page(sqlite3_stmt *st, int idx, long limit, long page)
+{
+    if (limit <= 0) {
+        sqlite3_bind_int64(st, idx,     -1);
+        sqlite3_bind_int64(st, idx + 1, 0);
+        return;
+    }
+
+    if (page < 1)
+        page = 1;
+
+    sqlite3_bind_int64(st, idx,     limit);
+    sqlite3_bind_int64(st, idx + 1, (sqlite3_int64)limit * (page - 1));
+}
+
+/*
+ * build_fts_query
+ *
+ * Turns free text into an FTS5 query of quoted prefix terms.
+ * Embedded double quotes are doubled, per FTS5 string syntax.
+ * Returns a malloc'd string, or NULL if the input has no words.
+ */
+static char *build_fts_query(const char *text)
+{
+    size_t len = strlen(text);
+
+    /* worst case: every char is a quote (doubled) plus "..."* per word */
+    char *out = malloc(len * 2 + len * 4 + 1);
+    if (!out)
+        return NULL;
+
+    size_t o = 0;
+    const char *p = text;
+
+    while (*p) {
+        while (isspace((unsigned char)*p))
+            p++;
+        if (!*p)
+            break;
+
+        if (o)
+            out[o++] = ' ';
+        out[o++] = '"';
+        while (*p && !isspace((unsigned char)*p)) {
+            if (*p == '"')
+                out[o++] = '"';
+            out[o++] = (char)tolower((unsigned char)*p);
+            p++;
+        }
+        out[o++] = '"';
+        out[o++] = '*';
     }
 
+    if (o == 0) {
+        free(out);
+        return NULL;
+    }
+
+    out[o] = '\0';
+    return out;
+}
+
+/*
+ * Pagination state shared by the index-backed walks: rows still to
+ * skip, rows still to print (< 0 = unlimited).
+ */
+struct page_ctx {
+    long skip;
+    long left;
+};
+
+static void page_init(struct page_ctx *pg, long limit, long page)
+{
+    pg->skip = 0;
+    pg->left = -1;
+    if (limit > 0) {
+        pg->left = limit;
+        pg->skip = limit * ((page < 1 ? 1 : page) - 1);
+    }
+}
+
+/* Prints every version of name `id`; returns 0 once the page is full. */
+static int page_print_versions(const struct repo_index *ridx, uint32_t id,
+                               struct page_ctx *pg)
+{
+    size_t n = repo_index_versions(ridx, id);
+
+    for (size_t k = 0; k < n && pg->left != 0; k++) {
+        if (pg->skip > 0) {
+            pg->skip--;
+            continue;
+        }
+        struct repo_index_pkg p;
+        repo_index_version(ridx, id, k, &p);
+        printf("%s %s\n", p.name, p.version);
+        if (pg->left > 0)
+            pg->left--;
+    }
+
+    return pg->left != 0;
+}
+
+/*
+ * Prefix search over the index.  Names are BINARY-sorted, so the
+ * matches are the contiguous run starting at repo_index_prefix.
+ * `prefix` is already lowercased; repository names are lowercase, so
+ * this matches the LIKE path.
+ */
+static void search_index(const struct repo_index *ridx, const char *prefix,
+                         long limit, long page)
+{
+    struct page_ctx pg;
+    page_init(&pg, limit, page);
+
+    size_t   plen = strlen(prefix);
+    uint32_t n    = repo_index_names(ridx);
+
+    for (uint32_t id = repo_index_prefix(ridx, prefix); id < n; id++) {
+        if (strncmp(repo_index_name(ridx, id), prefix, plen) != 0)
+            break;
+        if (!page_print_versions(ridx, id, &pg))
+            break;
+    }
+}
+
+/* =========================================================================
+ * Public Entry: repo_search
+ * ========================================================================= */
+
+int repo_search(const char *term, long limit, long page)
+{
+    struct repo_index *ridx = repo_index_open();
+    if (ridx) {
+        char *prefix = strdup(term ? term : "");
+        if (!prefix) {
+            repo_index_close(ridx);
+            return 1;
+        }
+        normalize_lower(prefix);
+        search_index(ridx, prefix, limit, page);
+        free(prefix);
+        repo_index_close(ridx);
+        return 0;
+    }
+
+    sqlite3 *db = open_repo();
+    if (!db)
+        return 1;
+
     sqlite3_stmt *st = NULL;
     int rc;
 
@@ -83,7 +260,8 @@ int repo_search(const char *term)
             db,
             "SELECT name, version "
             "FROM packages "
-            "ORDER BY name COLLATE BINARY;",
+            "ORDER BY name COLLATE BINARY "
+            "LIMIT ? OFFSET ?;",
             -1, &st, NULL
         );
 
@@ -91,6 +269,8 @@ int repo_search(const char *term)
             sqlite3_close(db);
             return 1;
         }
+
+        bind_page(st, 1, limit, page);
     }
     else {
 
@@ -122,7 +302,8 @@ int repo_search(const char *term)
             "SELECT name, version "
             "FROM packages "
             "WHERE name LIKE ? "
-            "ORDER BY name COLLATE BINARY;",
+            "ORDER BY name COLLATE BINARY "
+            "LIMIT ? OFFSET ?;",
             -1, &st, NULL
         );
 
@@ -134,6 +315,7 @@ int repo_search(const char *term)
         }
 
         sqlite3_bind_text(st, 1, like, -1, SQLITE_TRANSIENT);
+        bind_page(st, 2, limit, page);
 
         free(pattern);
         free(like);
@@ -165,4 +347,168 @@ int repo_search(const char *term)
     sqlite3_close(db);
 
     return 0;
-}
\ No newline at end of file
+}
+
+/* =========================================================================
+ * Public Entry: repo_search_text
+ * ========================================================================= */
+
+int repo_search_text(const char *text, long limit, long page)
+{
+    char *query = build_fts_query(text ? text : "");
+    if (!query) {
+        fprintf(stderr, "search: empty query\n");
+        return 1;
+    }
+
+    sqlite3 *db = open_repo();
+    if (!db) {
+        free(query);
+        return 1;
+    }
+
+    sqlite3_stmt *st = NULL;
+    int rc = sqlite3_prepare_v2(
+        db,
+        "SELECT p.name, p.version, f.description "
+        "FROM packages_fts AS f "
+        "JOIN packages AS p ON p.rowid = f.rowid "
+        "WHERE packages_fts MATCH ? "
+        "ORDER BY f.rank, p.name COLLATE BINARY "
+        "LIMIT ? OFFSET ?;",
+        -1, &st, NULL
+    );
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr,
+                "full-text index not available (run 'flappy update')\n");
+        free(query);
+        sqlite3_close(db);
+        return 1;
+    }
+
+    sqlite3_bind_text(st, 1, query, -1, SQLITE_TRANSIENT);
+    bind_page(st, 2, limit, page);
+    free(query);
+
+    while ((rc = sqlite3_step(st)) == SQLITE_ROW) {
+
+        const unsigned char *name    = sqlite3_column_text(st, 0);
+        const unsigned char *version = sqlite3_column_text(st, 1);
+        const unsigned char *desc    = sqlite3_column_text(st, 2);
+
+        if (!name || !version)
+            continue;
+
+        printf("%s %s\n", name, version);
+        if (desc && *desc)
+            printf("    %s\n", desc);
+    }
+
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "search failed: %s\n", sqlite3_errmsg(db));
+        sqlite3_finalize(st);
+        sqlite3_close(db);
+        return 1;
+    }
+
+    sqlite3_finalize(st);
+    sqlite3_close(db);
+
+    return 0;
+}
+
+/* =========================================================================
+ * Public Entry: repo_search_glob
+ * ========================================================================= */
+
+struct glob_ctx {
+    struct repo_index *ridx;    /* versions from the index, or ... */
+    sqlite3_stmt      *st;      /* SELECT version ... WHERE name = ? */
+    long               skip;    /* rows still to skip (pagination) */
+    long               left;    /* rows still to print, < 0 = unlimited */
+    int                failed;
+};
+
+static void print_glob_match(const char *name, void *arg)
+{
+    struct glob_ctx *g = arg;
+
+    if (g->failed || g->left == 0)
+        return;
+
+    if (g->ridx) {
+        uint32_t id;
+        if (repo_index_find(g->ridx, name, &id)) {
+            struct page_ctx pg = { g->skip, g->left };
+            page_print_versions(g->ridx, id, &pg);
+            g->skip = pg.skip;
+            g->left = pg.left;
+        }
+        return;
+    }
+
+    sqlite3_reset(g->st);
+    sqlite3_bind_text(g->st, 1, name, -1, SQLITE_STATIC);
+
+    int rc = SQLITE_DONE;
+    while (g->left != 0 && (rc = sqlite3_step(g->st)) == SQLITE_ROW) {
+        const unsigned char *version = sqlite3_column_text(g->st, 0);
+        if (!version)
+            continue;
+        if (g->skip > 0) {
+            g->skip--;
+            continue;
+        }
+        printf("%s %s\n", name, version);
+        if (g->left > 0)
+            g->left--;
+    }
+
+    if (g->left != 0 && rc != SQLITE_DONE)
+        g->failed = 1;
+}
+
+int repo_search_glob(const char *pattern, long limit, long page)
+{
+    struct trigram_index *idx = trigram_open(FLAPPY_REPO_TRIGRAM_PATH);
+    if (!idx) {
+        fprintf(stderr,
+                "name index not available (run 'flappy update')\n");
+        return 1;
+    }
+
+    struct page_ctx pg;
+    page_init(&pg, limit, page);
+
+    struct glob_ctx g = { .skip = pg.skip, .left = pg.left };
+    sqlite3 *db = NULL;
+
+    g.ridx = repo_index_open();
+    if (!g.ridx) {
+        db = open_repo();
+        if (!db) {
+            trigram_close(idx);
+            return 1;
+        }
+
+        if (sqlite3_prepare_v2(db,
+                "SELECT version FROM packages WHERE name = ?;",
+                -1, &g.st, NULL) != SQLITE_OK) {
+            sqlite3_close(db);
+            trigram_close(idx);
+            return 1;
+        }
+    }
+
+    trigram_glob(idx, pattern, print_glob_match, &g);
+
+    if (db) {
+        sqlite3_finalize(g.st);
+        sqlite3_close(db);
+    }
+    repo_index_close(g.ridx);
+    trigram_close(idx);
+
+    return g.failed;
+}
@@ -23,13 +23,32 @@
  *      a clear diagnostic instead of letting the first write syscall
  *      fail with a confusing errno message.
  *
- * UX contract (unchanged):
+ *   5. repo.db is fetched as repo.db.zst when the mirror publishes it
+ *      and decompressed while it downloads.  The decompressed bytes
+ *      are hashed as they are written, so the published checksum
+ *      (always that of the plain repo.db) is checked without a second
+ *      read of the file.  Mirrors without repo.db.zst (HTTP error) get
+ *      the plain repo.db, hashed the same way.
+ *
+ *   6. Several repositories (repos.conf, see repo_config.c) are
+ *      fetched concurrently, each verified into its own cache
+ *      directory, then merged by priority into repo.db.  Derived
+ *      indexes and repo.db.sha256 now describe the merged file.
+ *
+ *   7. A repository may publish a BLAKE3 of each package beside its
+ *      SHA256 (packages.blake3, optional).  The merge carries it into
+ *      repo.db when it is well-formed, and lookups then hand out
+ *      "blake3:<hex>" as the package checksum (see digest.h).  The
+ *      SHA256 helpers of items 2 and 3 became digest_file and
+ *      digest_stream in digest.c.
+ *
+ * UX contract:
  *   [INFO] updating repository metadata...
- *   downloading repo.db
+ *   downloading repo.db             (single repository only)
  *   [progress bar]
  *   ✔ download complete
- *   verifying repository...
- *   ✔ verified
+ *   ✔ core: verified                (one line per repository)
+ *   merging repositories...
  *   [INFO] repository updated
  */
 
@@ -38,59 +57,51 @@
 #include "flappy.h"
 #include "version.h"
 #include "repo.h"
-#include "sha256.h"
+#include "digest.h"
+#include "mirror.h"
+#include "netsched.h"
+#include "repo_index.h"
+#include "trigram.h"
 #include "ui.h"
 
 #include <curl/curl.h>
 #include <sqlite3.h>
+#include <zstd.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 /* =========================================================================
  * libcurl download helper
  *
- * Downloads `url` to the file at `out_path`.
- * Shows a progress bar when stdout is a TTY (matches install_download.c).
- * Returns 0 on success, 1 on failure.
- * ========================================================================= */
-
-static size_t write_data(void *ptr, size_t size, size_t nmemb, FILE *stream)
-{
-    return fwrite(ptr, size, nmemb, stream);
-}
-
-/*
- * download_file_ex
- *
- * Core download helper.
+ * Downloads `url`, a file on `mirror`, through `write_fn`.
  * show_progress=1 : hooks up ui_curl_progress_cb when stdout is a TTY.
  * show_progress=0 : always silent (used for small sidecar files).
- */
-static int download_file_ex(const char *url, const char *out_path,
-                            int show_progress)
-{
-    FILE *f = fopen(out_path, "wb");
-    if (!f) {
-        ui_error("cannot create %s: %s", out_path, strerror(errno));
-        return 1;
-    }
+ * The transfer waits for a netsched slot and is throttled there.
+ * Stalls abort the transfer; the outcome is reported to mirror.c.
+ * Returns the curl result; errors are left to the caller to report.
+ * ========================================================================= */
 
+static CURLcode fetch_url(const char *url, const char *mirror,
+                          curl_write_callback write_fn,
+                          void *arg, int show_progress)
+{
     CURL *curl = curl_easy_init();
-    if (!curl) {
-        fclose(f);
-        ui_error("curl init failed");
-        return 1;
-    }
+    if (!curl)
+        return CURLE_FAILED_INIT;
 
     curl_easy_setopt(curl, CURLOPT_URL,            url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,  write_data);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA,      f);
     curl_easy_setopt(curl, CURLOPT_FAILONERROR,    1L);
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    mirror_curl_setopts(curl);
+
+    struct netsched_xfer sx = {0};
+    netsched_begin(&sx, curl, url, write_fn, arg, 1);
 
     if (show_progress && ui_is_tty()) {
         curl_easy_setopt(curl, CURLOPT_NOPROGRESS,       0L);
@@ -101,12 +112,35 @@ static int download_file_ex(const char *url, const char *out_path,
     }
 
     CURLcode res = curl_easy_perform(curl);
+    netsched_end(&sx);
+    mirror_record(mirror, curl, res);
     curl_easy_cleanup(curl);
+
+    if (res != CURLE_OK && show_progress && ui_is_tty())
+        fprintf(stderr, "\n");
+
+    return res;
+}
+
+static size_t write_data(char *ptr, size_t size, size_t nmemb, void *arg)
+{
+    return fwrite(ptr, size, nmemb, (FILE *)arg);
+}
+
+/* Silent download of a small sidecar file to `out_path`. */
+static int download_file_silent(const char *url, const char *mirror,
+                                const char *out_path)
+{
+    FILE *f = fopen(out_path, "wb");
+    if (!f) {
+        ui_error("cannot create %s: %s", out_path, strerror(errno));
+        return 1;
+    }
+
+    CURLcode res = fetch_url(url, mirror, write_data, f, 0);
     fclose(f);
 
     if (res != CURLE_OK) {
-        if (show_progress && ui_is_tty())
-            fprintf(stderr, "\n");
         ui_error("download failed: %s", curl_easy_strerror(res));
         unlink(out_path);
         return 1;
@@ -115,15 +149,152 @@ static int download_file_ex(const char *url, const char *out_path,
     return 0;
 }
 
-/* Convenience wrappers */
-static int download_file(const char *url, const char *out_path)
+/* =========================================================================
+ * repo.db transport: decompress (optional) + write + hash in one pass
+ * ========================================================================= */
+
+struct db_sink {
+    FILE                 *out;
+    struct digest_stream *sha;      /* digest of the bytes written */
+    ZSTD_DStream         *zds;      /* NULL for a plain repo.db */
+    void                 *zbuf;
+    size_t                zbuf_size;
+    size_t                zhint;    /* 0 once a zstd frame is complete */
+    size_t                zerr;     /* ZSTD error code, 0 if none */
+    int                   io_err;
+};
+
+static int sink_emit(struct db_sink *s, const void *data, size_t len)
 {
-    return download_file_ex(url, out_path, 1);
+    if (len == 0)
+        return 0;
+    if (fwrite(data, 1, len, s->out) != len) {
+        s->io_err = 1;
+        return 1;
+    }
+    if (digest_stream_update(s->sha, data, len) != 0) {
+        s->io_err = 1;
+        return 1;
+    }
+    return 0;
 }
 
-static int download_file_silent(const char *url, const char *out_path)
+/* curl write callback: returning short aborts the transfer */
+static size_t sink_write(char *ptr, size_t size, size_t nmemb, void *arg)
 {
-    return download_file_ex(url, out_path, 0);
+    struct db_sink *s = arg;
+    size_t len = size * nmemb;
+
+    if (!s->zds)
+        return sink_emit(s, ptr, len) ? 0 : len;
+
+    ZSTD_inBuffer in = { ptr, len, 0 };
+    ZSTD_outBuffer out;
+
+    /* Keep going while input remains or the decoder filled `out`
+     * (it may still hold buffered output). */
+    do {
+        out.dst  = s->zbuf;
+        out.size = s->zbuf_size;
+        out.pos  = 0;
+
+        size_t r = ZSTD_decompressStream(s->zds, &out, &in);
+        if (ZSTD_isError(r)) {
+            s->zerr = r;
+            return 0;
+        }
+        s->zhint = r;
+
+        if (sink_emit(s, s->zbuf, out.pos))
+            return 0;
+    } while (in.pos < in.size || out.pos == out.size);
+
+    return len;
+}
+
+/*
+ * download_repo_db
+ *
+ * Fetches `url` into `out_path`, decompressing when `compressed` is
+ * set, and writes the SHA256 of the stored bytes to `actual`.
+ *
+ * Returns 0 on success, 1 on failure, 2 if the server answered with
+ * an HTTP error (the caller may try another URL).  Nothing is left
+ * at `out_path` on failure.
+ */
+static int download_repo_db(const char *url, const char *mirror,
+                            const char *out_path,
+                            int compressed, int show_progress,
+                            char actual[65])
+{
+    struct db_sink s = { .zhint = 0 };
+    int rc = 1;
+
+    s.out = fopen(out_path, "wb");
+    if (!s.out) {
+        ui_error("cannot create %s: %s",
+                 out_path, strerror(errno));
+        return 1;
+    }
+
+    s.sha = digest_stream_new(DIGEST_SHA256);
+    if (!s.sha)
+        goto out;
+
+    if (compressed) {
+        s.zds       = ZSTD_createDStream();
+        s.zbuf_size = ZSTD_DStreamOutSize();
+        s.zbuf      = malloc(s.zbuf_size);
+        if (!s.zds || !s.zbuf ||
+            ZSTD_isError(ZSTD_initDStream(s.zds))) {
+            ui_error("zstd: cannot create decompression stream");
+            goto out;
+        }
+    }
+
+    CURLcode res = fetch_url(url, mirror, sink_write, &s, show_progress);
+
+    if (res == CURLE_HTTP_RETURNED_ERROR) {
+        rc = 2;
+        goto out;
+    }
+    if (s.zerr) {
+        ui_error("corrupt repo.db.zst: %s", ZSTD_getErrorName(s.zerr));
+        goto out;
+    }
+    if (s.io_err) {
+        ui_error("cannot write %s", out_path);
+        goto out;
+    }
+    if (res != CURLE_OK) {
+        ui_error("download failed: %s", curl_easy_strerror(res));
+        goto out;
+    }
+    if (compressed && s.zhint != 0) {
+        ui_error("truncated repo.db.zst");
+        goto out;
+    }
+
+    if (fflush(s.out) != 0) {
+        ui_error("cannot write %s: %s",
+                 out_path, strerror(errno));
+        goto out;
+    }
+
+    rc = digest_stream_final(s.sha, actual);
+
+out:
+    if (fclose(s.out) != 0 && rc == 0) {
+        ui_error("cannot write %s: %s",
+                 out_path, strerror(errno));
+        rc = 1;
+    }
+    if (rc != 0)
+        unlink(out_path);
+    ZSTD_freeDStream(s.zds);
+    free(s.zbuf);
+    digest_stream_free(s.sha);
+    return rc;
 }
 
 /* =========================================================================
@@ -172,6 +343,16 @@ static int read_sha_file(const char *path, char out[65])
     return 0;
 }
 
+int repo_published_sha(char out[64])
+{
+    FILE *f = fopen(FLAPPY_REPO_SHA_PATH, "r");
+    if (!f)
+        return 1;
+    size_t n = fread(out, 1, 64, f);
+    fclose(f);
+    return n == 64 ? 0 : 1;
+}
+
 /* =========================================================================
  * Repository DB schema / package validation
  * ========================================================================= */
@@ -210,103 +391,604 @@ static int validate_repo_packages(sqlite3 *db)
     return 0;
 }
 
-/* =========================================================================
- * Public entry
- * ========================================================================= */
-
-int repo_update(const char *base_url)
+/*
+ * index_repo_versions
+ *
+ * Adds packages.version_key (see version_key in version.c) to the
+ * downloaded repo.db and indexes it by (name, version_key), so upgrade
+ * detection and version range queries compare BLOBs instead of parsing
+ * strings.  Runs after the checksum check: the published SHA256 covers
+ * the file as served, not the locally indexed copy.
+ *
+ * A repo.db that already ships the column is re-keyed locally so the
+ * encoding always matches this build.
+ */
+static int index_repo_versions(sqlite3 *db)
 {
-    /*
-     * repo_update writes to /var/lib/flappy/ which is root-owned.
-     * Check early so the operator gets a clear message rather than
-     * a confusing "cannot create /var/lib/flappy/repo.db.tmp: Permission denied"
-     * from deep inside the download path.
-     */
-    if (geteuid() != 0) {
-        ui_error("flappy update requires root privileges");
+    if (version_sql_register(db) != SQLITE_OK)
         return 1;
-    }
 
-    /* Build URLs — no shell interpolation at any point */
-    char url_db[1024], url_sha[1024];
-    snprintf(url_db,  sizeof(url_db),  "%s/repo.db",        base_url);
-    snprintf(url_sha, sizeof(url_sha), "%s/repo.db.sha256", base_url);
-
-    ui_info("updating repository metadata...");
+    sqlite3_stmt *st = NULL;
+    int has_col = (sqlite3_prepare_v2(db,
+        "SELECT version_key FROM packages LIMIT 0;",
+        -1, &st, NULL) == SQLITE_OK);
+    sqlite3_finalize(st);
 
-    /* --- Download repo.db --- */
-    ui_progress_init("repo.db");
-    if (download_file(url_db, FLAPPY_REPO_TMP_PATH) != 0) {
-        ui_error("failed to download repo.db");
+    char *err = NULL;
+    int rc = sqlite3_exec(db,
+        has_col
+        ? "BEGIN;"
+          "UPDATE packages SET version_key = version_key(version);"
+          "CREATE INDEX IF NOT EXISTS packages_name_version_key"
+          "  ON packages(name, version_key);"
+          "COMMIT;"
+        : "BEGIN;"
+          "ALTER TABLE packages ADD COLUMN version_key BLOB;"
+          "UPDATE packages SET version_key = version_key(version);"
+          "CREATE INDEX IF NOT EXISTS packages_name_version_key"
+          "  ON packages(name, version_key);"
+          "COMMIT;",
+        NULL, NULL, &err);
+
+    if (rc != SQLITE_OK) {
+        log_error("repo: version index failed: %s", err ? err : "?");
+        sqlite3_free(err);
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
         return 1;
     }
-    ui_progress_finish();
 
-    /* --- Download checksum sidecar (silent — 65 bytes, no bar needed) --- */
-    const char *sha_tmp = FLAPPY_REPO_SHA_PATH ".tmp";
+    return 0;
+}
 
-    if (download_file_silent(url_sha, sha_tmp) != 0) {
-        unlink(FLAPPY_REPO_TMP_PATH);
-        ui_error("failed to download checksum");
+/*
+ * index_repo_text
+ *
+ * Builds packages_fts, an FTS5 index over package name and description,
+ * used by `flappy search --text`.  The index is always rebuilt locally
+ * so its tokenizer and ranking match this build regardless of what the
+ * server shipped.  rowid mirrors packages.rowid.  A repo.db without a
+ * description column is indexed by name only.
+ *
+ * Names are weighted 10x over descriptions in the bm25 rank.
+ */
+static int index_repo_text(sqlite3 *db)
+{
+    sqlite3_stmt *st = NULL;
+    int has_desc = (sqlite3_prepare_v2(db,
+        "SELECT description FROM packages LIMIT 0;",
+        -1, &st, NULL) == SQLITE_OK);
+    sqlite3_finalize(st);
+
+    char *err = NULL;
+    int rc = sqlite3_exec(db,
+        "BEGIN;"
+        "DROP TABLE IF EXISTS packages_fts;"
+        "CREATE VIRTUAL TABLE packages_fts USING fts5("
+        "  name, description,"
+        "  tokenize = 'unicode61 remove_diacritics 2',"
+        "  prefix = '2 3'"
+        ");",
+        NULL, NULL, &err);
+
+    if (rc == SQLITE_OK)
+        rc = sqlite3_exec(db,
+            has_desc
+            ? "INSERT INTO packages_fts(rowid, name, description) "
+              "SELECT rowid, name, coalesce(description, '') FROM packages;"
+            : "INSERT INTO packages_fts(rowid, name, description) "
+              "SELECT rowid, name, '' FROM packages;",
+            NULL, NULL, &err);
+
+    if (rc == SQLITE_OK)
+        rc = sqlite3_exec(db,
+            "INSERT INTO packages_fts(packages_fts, rank) "
+            "VALUES('rank', 'bm25(10.0, 1.0)');"
+            "INSERT INTO packages_fts(packages_fts) VALUES('optimize');"
+            "COMMIT;",
+            NULL, NULL, &err);
+
+    if (rc != SQLITE_OK) {
+        log_error("repo: text index failed: %s", err ? err : "?");
+        sqlite3_free(err);
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
         return 1;
     }
 
-    /* --- Verify integrity --- */
-    ui_step("verifying repository...");
+    return 0;
+}
+
+/* =========================================================================
+ * Per-repository fetch
+ *
+ * Each repository is cached, as published and verified, in
+ * FLAPPY_REPOS_DIR/<name>/repo.db (+ repo.db.sha256).  Fetches run one
+ * thread per repository; only a single-repository update draws a
+ * progress bar.
+ * ========================================================================= */
+
+struct repo_job {
+    const struct repo_source *src;
+    int                       show_progress;
+    int                       status;       /* 0 = updated */
+    char                      dir[256];
+    char                      db[320];
+};
 
+/* One attempt against the mirror at `base`. */
+static int fetch_repo_from(struct repo_job *j, const char *base)
+{
+    char url_zst[REPO_URL_MAX + 32], url_db[REPO_URL_MAX + 32];
+    char url_sha[REPO_URL_MAX + 32];
+    snprintf(url_zst, sizeof(url_zst), "%s/repo.db.zst",    base);
+    snprintf(url_db,  sizeof(url_db),  "%s/repo.db",        base);
+    snprintf(url_sha, sizeof(url_sha), "%s/repo.db.sha256", base);
+
+    char db_tmp[330], sha_path[330], sha_tmp[340];
+    snprintf(db_tmp,   sizeof(db_tmp),   "%s.tmp",         j->db);
+    snprintf(sha_path, sizeof(sha_path), "%s.sha256",      j->db);
+    snprintf(sha_tmp,  sizeof(sha_tmp),  "%s.sha256.tmp",  j->db);
+
+    /*
+     * --- Checksum sidecar first (silent — 65 bytes) ---
+     * repo.db is hashed while it streams in, so the expected value
+     * must be known before the transfer finishes.
+     */
     char expected[65], actual[65];
 
+    if (download_file_silent(url_sha, base, sha_tmp) != 0) {
+        ui_error("%s: failed to download checksum", j->src->name);
+        return 1;
+    }
+
     if (read_sha_file(sha_tmp, expected) != 0) {
-        unlink(FLAPPY_REPO_TMP_PATH);
         unlink(sha_tmp);
         return 1;
     }
 
-    if (sha256_file(FLAPPY_REPO_TMP_PATH, actual) != 0) {
-        unlink(FLAPPY_REPO_TMP_PATH);
+    /* --- repo.db (compressed if the mirror has it) --- */
+    if (j->show_progress)
+        ui_progress_init("repo.db");
+    int drc = download_repo_db(url_zst, base, db_tmp, 1,
+                               j->show_progress, actual);
+    if (drc == 2)
+        drc = download_repo_db(url_db, base, db_tmp, 0,
+                               j->show_progress, actual);
+    if (drc != 0) {
+        if (drc == 2)
+            ui_error("download failed: %s",
+                     curl_easy_strerror(CURLE_HTTP_RETURNED_ERROR));
         unlink(sha_tmp);
+        ui_error("%s: failed to download repo.db", j->src->name);
         return 1;
     }
+    if (j->show_progress)
+        ui_progress_finish();
 
+    /* --- Verify integrity --- */
     if (strcmp(expected, actual) != 0) {
-        unlink(FLAPPY_REPO_TMP_PATH);
+        unlink(db_tmp);
         unlink(sha_tmp);
-        ui_error("checksum mismatch — repository may be corrupt\n"
+        ui_error("%s: checksum mismatch — repository may be corrupt\n"
                  "  expected: %s\n"
-                 "  actual:   %s", expected, actual);
+                 "  actual:   %s", j->src->name, expected, actual);
         return 1;
     }
 
-    ui_ok("verified");
-
     /* --- Validate schema and package metadata --- */
-    sqlite3 *repo_db = NULL;
-    if (sqlite3_open(FLAPPY_REPO_TMP_PATH, &repo_db) != SQLITE_OK) {
-        unlink(FLAPPY_REPO_TMP_PATH);
+    sqlite3 *db = NULL;
+    const char *why = NULL;
+
+    if (sqlite3_open_v2(db_tmp, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+        why = "cannot open downloaded repository database";
+    else if (validate_repo_schema(db))
+        why = "invalid repository schema";
+    else if (validate_repo_packages(db))
+        why = "invalid repository metadata";
+    sqlite3_close(db);
+
+    if (why) {
+        unlink(db_tmp);
         unlink(sha_tmp);
-        ui_error("cannot open downloaded repository database");
+        ui_error("%s: %s", j->src->name, why);
+        return 1;
+    }
+
+    /* --- Replace the cached copy --- */
+    if (rename(db_tmp, j->db) != 0 || rename(sha_tmp, sha_path) != 0) {
+        unlink(db_tmp);
+        unlink(sha_tmp);
+        ui_error("%s: cannot store %s: %s",
+                 j->src->name, j->db, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Tries each mirror, fastest healthy first (mirror.h), until one
+ * yields a verified repo.db.  A mirror that serves a bad checksum is
+ * treated like one that is down: it may be mid-sync.
+ */
+static int fetch_repo(struct repo_job *j)
+{
+    struct mirror_list list;
+    mirror_list_from(j->src, &list);
+    mirror_probe(&list);
+
+    for (size_t i = 0; i < list.count; i++) {
+        if (i > 0)
+            ui_warn("%s: trying mirror %s", j->src->name, list.url[i]);
+        if (fetch_repo_from(j, list.url[i]) == 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+static void *fetch_repo_thread(void *arg)
+{
+    struct repo_job *j = arg;
+    j->status = fetch_repo(j);
+    return NULL;
+}
+
+/* =========================================================================
+ * Merge
+ *
+ * The merged repo.db has the single-repository schema plus
+ *
+ *   packages.repo     name of the repository the row came from
+ *   repos             (name, priority, base_url) of every repository
+ *   deltas            the optional delta table (install_delta.c) and
+ *   chunk_indexes     chunk index table (install_chunks.c) of every
+ *                     repository, for the packages it provides
+ *
+ * Repositories are merged highest priority first; a package name
+ * already taken by an earlier repository is skipped wholesale (all
+ * versions, and its deps), so readers need exactly one lookup and
+ * never see two providers of the same name.  meta base_url is the
+ * highest-priority repository, for readers that predate `repos`.
+ * ========================================================================= */
+
+static int has_column(sqlite3 *db, const char *sql)
+{
+    sqlite3_stmt *st = NULL;
+    int ok = (sqlite3_prepare_v2(db, sql, -1, &st, NULL) == SQLITE_OK);
+    sqlite3_finalize(st);
+    return ok;
+}
+
+static int exec_bound(sqlite3 *db, const char *sql, const char *arg)
+{
+    sqlite3_stmt *st = NULL;
+    if (sqlite3_prepare_v2(db, sql, -1, &st, NULL) != SQLITE_OK) {
+        log_error("repo merge: %s", sqlite3_errmsg(db));
+        return 1;
+    }
+    if (arg)
+        sqlite3_bind_text(st, 1, arg, -1, SQLITE_STATIC);
+    int rc = sqlite3_step(st);
+    sqlite3_finalize(st);
+    if (rc != SQLITE_DONE) {
+        log_error("repo merge: %s", sqlite3_errmsg(db));
         return 1;
     }
+    return 0;
+}
+
+static int merge_one(sqlite3 *db, const struct repo_source *src,
+                     const char *path)
+{
+    if (exec_bound(db, "ATTACH DATABASE ? AS src;", path))
+        return 1;
+
+    /* A malformed BLAKE3 is dropped here; the SHA256 still applies */
+    char ins[768];
+    snprintf(ins, sizeof(ins),
+             "INSERT INTO packages"
+             "  (name, version, filename, checksum, blake3, description, repo) "
+             "SELECT name, version, filename, checksum, %s, %s, ?1 "
+             "FROM src.packages WHERE name NOT IN (SELECT name FROM taken);",
+             has_column(db, "SELECT blake3 FROM src.packages LIMIT 0;")
+                 ? "CASE WHEN length(blake3) = 64 AND"
+                   "  NOT lower(blake3) GLOB '*[^0-9a-f]*'"
+                   " THEN lower(blake3) END" : "NULL",
+             has_column(db, "SELECT description FROM src.packages LIMIT 0;")
+                 ? "description" : "NULL");
+
+    int has_deps = has_column(db,
+        "SELECT package, depends, op, version FROM src.deps LIMIT 0;");
+    int has_deltas = has_column(db,
+        "SELECT package, from_filename, to_filename, filename, checksum "
+        "FROM src.deltas LIMIT 0;");
+    int has_chunks = has_column(db,
+        "SELECT package, filename, index_filename, checksum "
+        "FROM src.chunk_indexes LIMIT 0;");
+
+    int failed =
+        sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL) != SQLITE_OK ||
+        exec_bound(db, ins, src->name) ||
+        (has_deps && exec_bound(db,
+            "INSERT INTO deps (package, depends, op, version) "
+            "SELECT package, depends, op, version FROM src.deps "
+            "WHERE package IN "
+            "  (SELECT name FROM main.packages WHERE repo = ?1);",
+            src->name)) ||
+        (has_deltas && exec_bound(db,
+            "INSERT INTO deltas "
+            "  (package, from_filename, to_filename, filename, checksum) "
+            "SELECT package, from_filename, to_filename, filename, checksum "
+            "FROM src.deltas WHERE package IN "
+            "  (SELECT name FROM main.packages WHERE repo = ?1);",
+            src->name)) ||
+        (has_chunks && exec_bound(db,
+            "INSERT INTO chunk_indexes "
+            "  (package, filename, index_filename, checksum) "
+            "SELECT package, filename, index_filename, checksum "
+            "FROM src.chunk_indexes WHERE package IN "
+            "  (SELECT name FROM main.packages WHERE repo = ?1);",
+            src->name)) ||
+        exec_bound(db,
+            "INSERT OR IGNORE INTO taken SELECT name FROM src.packages;",
+            NULL) ||
+        sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK;
+
+    if (failed)
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+
+    sqlite3_exec(db, "DETACH DATABASE src;", NULL, NULL, NULL);
+    return failed;
+}
+
+/*
+ * merge_repos
+ *
+ * Writes the merged DB to `out_path` from every job with a cached
+ * repo.db.  Returns the open handle, or NULL on failure.
+ */
+static sqlite3 *merge_repos(struct repo_job *jobs, size_t n,
+                            const char *out_path)
+{
+    unlink(out_path);
+
+    sqlite3 *db = NULL;
+    if (sqlite3_open(out_path, &db) != SQLITE_OK) {
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    char *err = NULL;
+    if (sqlite3_exec(db,
+            "CREATE TABLE meta (key TEXT PRIMARY KEY, value TEXT);"
+            "CREATE TABLE repos (name TEXT PRIMARY KEY,"
+            "                    priority INTEGER, base_url TEXT);"
+            "CREATE TABLE packages (name TEXT, version TEXT,"
+            "                       filename TEXT, checksum TEXT,"
+            "                       blake3 TEXT,"
+            "                       description TEXT, repo TEXT);"
+            "CREATE TABLE deps (package TEXT, depends TEXT,"
+            "                   op TEXT, version TEXT);"
+            "CREATE INDEX deps_package ON deps(package);"
+            "CREATE TABLE deltas (package TEXT, from_filename TEXT,"
+            "                     to_filename TEXT, filename TEXT,"
+            "                     checksum TEXT);"
+            "CREATE INDEX deltas_package ON deltas(package, to_filename);"
+            "CREATE TABLE chunk_indexes (package TEXT, filename TEXT,"
+            "                            index_filename TEXT,"
+            "                            checksum TEXT);"
+            "CREATE INDEX chunk_indexes_filename"
+            "  ON chunk_indexes(filename);"
+            "CREATE TEMP TABLE taken (name TEXT PRIMARY KEY);",
+            NULL, NULL, &err) != SQLITE_OK) {
+        log_error("repo merge: %s", err ? err : "?");
+        sqlite3_free(err);
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    char ver[16];
+    snprintf(ver, sizeof(ver), "%d", FLAPPY_REPO_SCHEMA_VERSION);
+
+    sqlite3_stmt *meta = NULL, *repos = NULL;
+    int failed =
+        sqlite3_prepare_v2(db, "INSERT INTO meta VALUES (?, ?);",
+                           -1, &meta, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, "INSERT INTO repos VALUES (?, ?, ?);",
+                           -1, &repos, NULL) != SQLITE_OK;
+
+    if (!failed) {
+        sqlite3_bind_text(meta, 1, "schema_version", -1, SQLITE_STATIC);
+        sqlite3_bind_text(meta, 2, ver, -1, SQLITE_STATIC);
+        failed = sqlite3_step(meta) != SQLITE_DONE;
+    }
+
+    int merged = 0;
+    for (size_t i = 0; i < n && !failed; i++) {
+        if (access(jobs[i].db, R_OK) != 0)
+            continue;
+
+        const struct repo_source *src = jobs[i].src;
+
+        if (!merged) {
+            sqlite3_reset(meta);
+            sqlite3_bind_text(meta, 1, "base_url", -1, SQLITE_STATIC);
+            sqlite3_bind_text(meta, 2, src->mirrors[0], -1, SQLITE_STATIC);
+            failed = sqlite3_step(meta) != SQLITE_DONE;
+        }
+
+        sqlite3_reset(repos);
+        sqlite3_bind_text(repos, 1, src->name, -1, SQLITE_STATIC);
+        sqlite3_bind_int (repos, 2, src->priority);
+        sqlite3_bind_text(repos, 3, src->mirrors[0], -1, SQLITE_STATIC);
+        failed |= sqlite3_step(repos) != SQLITE_DONE;
+
+        failed |= merge_one(db, src, jobs[i].db);
+        merged++;
+    }
+
+    sqlite3_finalize(meta);
+    sqlite3_finalize(repos);
 
-    if (validate_repo_schema(repo_db)) {
+    if (failed || merged == 0) {
+        if (merged == 0 && !failed)
+            ui_error("no repository metadata available");
+        sqlite3_close(db);
+        unlink(out_path);
+        return NULL;
+    }
+
+    sqlite3_exec(db, "DROP TABLE temp.taken;", NULL, NULL, NULL);
+    return db;
+}
+
+/* =========================================================================
+ * Public entry
+ * ========================================================================= */
+
+int repo_update(const char *url)
+{
+    /*
+     * Root check first: writing to /var/lib/flappy/ requires root.
+     * Without this the user gets a confusing "cannot create
+     * /var/lib/flappy/repo.db.tmp: Permission denied" from deep inside
+     * the download path.
+     */
+    if (geteuid() != 0) {
+        ui_error("flappy update requires root privileges");
+        return 1;
+    }
+
+    struct repo_config cfg;
+    if (url) {
+        memset(&cfg, 0, sizeof(cfg));
+        snprintf(cfg.repos[0].name, REPO_NAME_MAX, "core");
+        snprintf(cfg.repos[0].mirrors[0], REPO_URL_MAX, "%s", url);
+        cfg.repos[0].nmirrors = 1;
+        cfg.count = 1;
+    } else if (repo_config_load(&cfg) != 0) {
+        return 1;
+    }
+
+    if (mkdir(FLAPPY_REPOS_DIR, 0755) != 0 && errno != EEXIST) {
+        ui_error("cannot create %s: %s", FLAPPY_REPOS_DIR, strerror(errno));
+        return 1;
+    }
+
+    struct repo_job jobs[REPO_MAX];
+    memset(jobs, 0, sizeof(jobs));
+
+    for (size_t i = 0; i < cfg.count; i++) {
+        jobs[i].src           = &cfg.repos[i];
+        jobs[i].show_progress = (cfg.count == 1);
+        jobs[i].status        = 1;
+        snprintf(jobs[i].dir, sizeof(jobs[i].dir), "%s/%s",
+                 FLAPPY_REPOS_DIR, cfg.repos[i].name);
+        snprintf(jobs[i].db, sizeof(jobs[i].db), "%s/%s/repo.db",
+                 FLAPPY_REPOS_DIR, cfg.repos[i].name);
+
+        if (mkdir(jobs[i].dir, 0755) != 0 && errno != EEXIST) {
+            ui_error("cannot create %s: %s", jobs[i].dir, strerror(errno));
+            return 1;
+        }
+    }
+
+    ui_info("updating repository metadata...");
+
+    /* --- Fetch every repository concurrently --- */
+    pthread_t threads[REPO_MAX];
+    int       started[REPO_MAX] = {0};
+
+    if (cfg.count == 1) {
+        fetch_repo_thread(&jobs[0]);
+    } else {
+        for (size_t i = 0; i < cfg.count; i++)
+            started[i] = pthread_create(&threads[i], NULL,
+                                        fetch_repo_thread, &jobs[i]) == 0;
+        for (size_t i = 0; i < cfg.count; i++) {
+            if (started[i])
+                pthread_join(threads[i], NULL);
+            else
+                fetch_repo_thread(&jobs[i]);
+        }
+    }
+
+    mirror_state_save();
+
+    int any_failed = 0;
+    for (size_t i = 0; i < cfg.count; i++) {
+        if (jobs[i].status == 0) {
+            ui_ok("%s: verified", cfg.repos[i].name);
+        } else {
+            any_failed = 1;
+            if (access(jobs[i].db, R_OK) == 0)
+                ui_warn("%s: update failed, using cached copy",
+                        cfg.repos[i].name);
+            else
+                ui_warn("%s: update failed, skipped", cfg.repos[i].name);
+        }
+    }
+
+    /* --- Merge by priority into repo.db.tmp --- */
+    ui_step("merging repositories...");
+
+    sqlite3 *repo_db = merge_repos(jobs, cfg.count, FLAPPY_REPO_TMP_PATH);
+    if (!repo_db) {
+        ui_error("failed to merge repositories");
+        return 1;
+    }
+
+    if (index_repo_versions(repo_db)) {
         sqlite3_close(repo_db);
         unlink(FLAPPY_REPO_TMP_PATH);
-        unlink(sha_tmp);
-        ui_error("invalid repository schema");
+        ui_error("failed to index repository versions");
         return 1;
     }
 
-    if (validate_repo_packages(repo_db)) {
+    if (index_repo_text(repo_db)) {
+        sqlite3_close(repo_db);
+        unlink(FLAPPY_REPO_TMP_PATH);
+        ui_error("failed to build search index");
+        return 1;
+    }
+
+    /*
+     * The sidecars are keyed to the checksum of the merged file; if
+     * anything below fails the old repo.db.sha256 stays in place and
+     * they are ignored.  Search, suggestions and the binary index
+     * degrade gracefully to repo.db, so this is not fatal.
+     */
+    char merged_sha[65];
+    if (digest_file(DIGEST_SHA256, FLAPPY_REPO_TMP_PATH, merged_sha) != 0) {
         sqlite3_close(repo_db);
         unlink(FLAPPY_REPO_TMP_PATH);
-        unlink(sha_tmp);
-        ui_error("invalid repository metadata");
         return 1;
     }
 
+    if (trigram_build(repo_db, merged_sha, FLAPPY_REPO_TRIGRAM_PATH) != 0)
+        ui_warn("failed to build name index (glob search unavailable)");
+
+    /* Same contract: without repo.idx every reader uses repo.db. */
+    if (repo_index_build(repo_db, merged_sha, FLAPPY_REPO_INDEX_PATH) != 0)
+        ui_warn("failed to build repository index (using repo.db)");
+
     sqlite3_close(repo_db);
 
     /* --- Atomically install --- */
+    const char *sha_tmp = FLAPPY_REPO_SHA_PATH ".tmp";
+    FILE *f = fopen(sha_tmp, "w");
+    int werr = !f;
+    if (f) {
+        werr |= fprintf(f, "%s  repo.db\n", merged_sha) < 0;
+        werr |= fclose(f) != 0;
+    }
+    if (werr) {
+        unlink(FLAPPY_REPO_TMP_PATH);
+        unlink(sha_tmp);
+        ui_error("cannot write %s", sha_tmp);
+        return 1;
+    }
+
     if (rename(FLAPPY_REPO_TMP_PATH, FLAPPY_REPO_DB_PATH) != 0) {
         unlink(FLAPPY_REPO_TMP_PATH);
         unlink(sha_tmp);
@@ -316,6 +998,11 @@ int repo_update(const char *base_url)
 
     rename(sha_tmp, FLAPPY_REPO_SHA_PATH);
 
+    if (any_failed) {
+        ui_error("some repositories could not be updated");
+        return 1;
+    }
+
     ui_info("repository updated");
     return 0;
-}
\ No newline at end of file
+}
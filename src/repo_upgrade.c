@@ -1,6 +1,13 @@
 /*
  * repo_upgrade.c - Upgrade detection (planner, not executor)
  *
+ * repo_upgrade_plan computes the list in a single query (repo.db is
+ * ATTACHed to the installed DB), or — when the mmap'd repo index is
+ * current — by looking each installed name up in the index;
+ * repo_upgrade prints it.
+ * The executor (`flappy upgrade --apply`) lives in upgrade.c and
+ * consumes the same plan.
+ *
  * UX contract:
  *   [INFO] checking for updates...
  *
@@ -12,7 +19,7 @@
  *   Summary:
  *     total packages: 2
  *
- *   Run 'flappy install <pkg>' to upgrade packages
+ *   Run 'flappy upgrade --apply' to upgrade packages
  *
  *   No updates:
  *   [INFO] system is up to date
@@ -25,138 +32,278 @@
 
 #include "repo.h"
 #include "flappy.h"
+#include "repo_index.h"
+#include "root.h"
 #include "version.h"
 #include "ui.h"
 
 #include <sqlite3.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-int repo_upgrade(void)
+void repo_upgrade_plan_free(struct upgrade_plan *plan)
+{
+    for (size_t i = 0; i < plan->count; i++) {
+        free(plan->entries[i].name);
+        free(plan->entries[i].from);
+        free(plan->entries[i].to);
+    }
+    free(plan->entries);
+    plan->entries = NULL;
+    plan->count   = 0;
+}
+
+/*
+ * Installed packages joined against the newest repository version of
+ * each name.  repo.db is ATTACHed to the installed connection so the
+ * whole comparison is one sorted pass inside SQLite.
+ *
+ * Versions are compared through their binary sort keys (version_key
+ * in version.c): max() picks the newest repository row — SQLite
+ * returns the bare `version` column from that same row — and a plain
+ * BLOB > decides whether it is an upgrade.  NULL keys (invalid
+ * versions) drop out on both sides.
+ *
+ * Each side uses its stored version_key column when present and
+ * falls back to computing version_key(version) for an installed DB
+ * not yet migrated to v3 or a repo.db fetched by an older flappy.
+ */
+static const char *UPGRADE_SQL_FMT =
+    "SELECT p.name, p.version, r.version "
+    "FROM main.packages AS p "
+    "JOIN (SELECT name, version, max(%s) AS vkey "
+    "        FROM repo.packages GROUP BY name) AS r "
+    "  ON r.name = p.name "
+    "WHERE r.vkey > %s "
+    "ORDER BY p.name COLLATE BINARY;";
+
+static int has_version_key(sqlite3 *db, const char *schema)
+{
+    char sql[128];
+    snprintf(sql, sizeof(sql),
+             "SELECT version_key FROM %s.packages LIMIT 0;", schema);
+
+    sqlite3_stmt *st = NULL;
+    int ok = (sqlite3_prepare_v2(db, sql, -1, &st, NULL) == SQLITE_OK);
+    sqlite3_finalize(st);
+    return ok;
+}
+
+/* Appends one entry; returns 1 on allocation failure. */
+static int plan_push(struct upgrade_plan *plan, size_t *cap,
+                     const char *name, const char *from, const char *to)
+{
+    if (plan->count >= *cap) {
+        size_t nc = *cap ? *cap * 2 : 64;
+        struct upgrade_entry *tmp =
+            realloc(plan->entries, nc * sizeof(*tmp));
+        if (!tmp)
+            return 1;
+        plan->entries = tmp;
+        *cap = nc;
+    }
+
+    struct upgrade_entry *e = &plan->entries[plan->count++];
+    e->name = strdup(name);
+    e->from = strdup(from);
+    e->to   = strdup(to);
+    return !e->name || !e->from || !e->to;
+}
+
+/*
+ * Index path: one ordered pass over the installed packages, each
+ * compared against entry 0 (the newest version) of its name in the
+ * repo index.  No repo.db open, no ATTACH.
+ *
+ * Returns 0 on success, 1 on query failure, -1 on allocation failure.
+ */
+static int plan_from_index(sqlite3 *db, const struct repo_index *ridx,
+                           struct upgrade_plan *plan)
+{
+    char sql[160];
+    snprintf(sql, sizeof(sql),
+             "SELECT name, version, %s FROM packages "
+             "ORDER BY name COLLATE BINARY;",
+             has_version_key(db, "main") ? "version_key"
+                                         : "version_key(version)");
+
+    sqlite3_stmt *st = NULL;
+    if (sqlite3_prepare_v2(db, sql, -1, &st, NULL) != SQLITE_OK) {
+        ui_error("failed to query upgrades: %s", sqlite3_errmsg(db));
+        return 1;
+    }
+
+    size_t cap = 0;
+    int rc;
+
+    while ((rc = sqlite3_step(st)) == SQLITE_ROW) {
+        const char *name = (const char *)sqlite3_column_text(st, 0);
+        const char *from = (const char *)sqlite3_column_text(st, 1);
+        const unsigned char *key = sqlite3_column_blob(st, 2);
+        size_t keylen = (size_t)sqlite3_column_bytes(st, 2);
+
+        uint32_t id;
+        if (!name || !from || !key ||
+            !repo_index_find(ridx, name, &id) ||
+            repo_index_versions(ridx, id) == 0)
+            continue;
+
+        struct repo_index_pkg p;
+        repo_index_version(ridx, id, 0, &p);
+        if (!p.vkey ||
+            version_key_cmp(p.vkey, p.vkey_len, key, keylen) <= 0)
+            continue;
+
+        if (plan_push(plan, &cap, name, from, p.version)) {
+            sqlite3_finalize(st);
+            return -1;
+        }
+    }
+
+    if (rc != SQLITE_DONE) {
+        ui_error("failed to query upgrades: %s", sqlite3_errmsg(db));
+        sqlite3_finalize(st);
+        return 1;
+    }
+
+    sqlite3_finalize(st);
+    return 0;
+}
+
+int repo_upgrade_plan(struct upgrade_plan *plan)
 {
+    plan->entries = NULL;
+    plan->count   = 0;
+
     if (access(FLAPPY_REPO_DB_PATH, R_OK) != 0) {
         ui_error("repository not available (run update first)");
         return 1;
     }
 
-    if (access(FLAPPY_DB_PATH, R_OK) != 0) {
+    char db_path[PATH_MAX];
+    if (root_path(db_path, sizeof(db_path), FLAPPY_DB_PATH) != 0 ||
+        access(db_path, R_OK) != 0) {
         ui_error("installed database not found");
         return 1;
     }
 
-    ui_info("checking for updates...");
-
-    sqlite3 *installed_db = NULL;
-    sqlite3 *repo_db = NULL;
+    sqlite3 *db = NULL;
 
-    if (sqlite3_open_v2(FLAPPY_DB_PATH, &installed_db,
-                        SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+    if (sqlite3_open_v2(db_path, &db,
+                        SQLITE_OPEN_READONLY | SQLITE_OPEN_URI,
+                        NULL) != SQLITE_OK) {
         ui_error("failed to open installed database");
-        if (installed_db) sqlite3_close(installed_db);
+        if (db) sqlite3_close(db);
+        return 1;
+    }
+
+    if (version_sql_register(db) != SQLITE_OK) {
+        ui_error("failed to register version functions");
+        sqlite3_close(db);
         return 1;
     }
 
-    if (sqlite3_open_v2(FLAPPY_REPO_DB_PATH, &repo_db,
-                        SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+    struct repo_index *ridx = repo_index_open();
+    if (ridx) {
+        int rc = plan_from_index(db, ridx, plan);
+        repo_index_close(ridx);
+        sqlite3_close(db);
+        if (rc < 0)
+            ui_error("out of memory while computing upgrades");
+        if (rc != 0)
+            repo_upgrade_plan_free(plan);
+        return rc != 0;
+    }
+
+    sqlite3_stmt *st = NULL;
+    int rc = sqlite3_prepare_v2(db,
+        "ATTACH DATABASE ? AS repo;", -1, &st, NULL);
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_text(st, 1, "file:" FLAPPY_REPO_DB_PATH "?mode=ro",
+                          -1, SQLITE_STATIC);
+        rc = sqlite3_step(st);
+        sqlite3_finalize(st);
+        st = NULL;
+    }
+    if (rc != SQLITE_DONE && rc != SQLITE_OK) {
         ui_error("failed to open repository database");
-        sqlite3_close(installed_db);
-        if (repo_db) sqlite3_close(repo_db);
+        sqlite3_close(db);
         return 1;
     }
 
-    sqlite3_stmt *st_inst = NULL;
-    int rc = sqlite3_prepare_v2(installed_db,
-        "SELECT name, version FROM packages ORDER BY name COLLATE BINARY;",
-        -1, &st_inst, NULL);
+    char sql[512];
+    snprintf(sql, sizeof(sql), UPGRADE_SQL_FMT,
+             has_version_key(db, "repo") ? "version_key"
+                                         : "version_key(version)",
+             has_version_key(db, "main") ? "p.version_key"
+                                         : "version_key(p.version)");
+
+    rc = sqlite3_prepare_v2(db, sql, -1, &st, NULL);
     if (rc != SQLITE_OK) {
-        sqlite3_close(installed_db);
-        sqlite3_close(repo_db);
+        ui_error("failed to query upgrades: %s", sqlite3_errmsg(db));
+        sqlite3_close(db);
         return 1;
     }
 
-    sqlite3_stmt *st_repo = NULL;
-    rc = sqlite3_prepare_v2(repo_db,
-        "SELECT version FROM packages WHERE name = ?;",
-        -1, &st_repo, NULL);
-    if (rc != SQLITE_OK) {
-        sqlite3_finalize(st_inst);
-        sqlite3_close(installed_db);
-        sqlite3_close(repo_db);
+    size_t cap = 0;
+    int failed = 0;
+
+    while ((rc = sqlite3_step(st)) == SQLITE_ROW) {
+        const char *name = (const char *)sqlite3_column_text(st, 0);
+        const char *from = (const char *)sqlite3_column_text(st, 1);
+        const char *to   = (const char *)sqlite3_column_text(st, 2);
+
+        if (plan_push(plan, &cap, name, from, to)) { failed = 1; break; }
+    }
+
+    if (!failed && rc != SQLITE_DONE) {
+        ui_error("failed to query upgrades: %s", sqlite3_errmsg(db));
+        sqlite3_finalize(st);
+        sqlite3_close(db);
+        repo_upgrade_plan_free(plan);
         return 1;
     }
 
-    /* Collect upgrades first so we can print the header once */
-    typedef struct { char *name; char *from; char *to; } Upgrade;
-    Upgrade *upgrades = NULL;
-    int upgrade_count = 0;
-    int upgrade_cap   = 0;
-
-    while ((rc = sqlite3_step(st_inst)) == SQLITE_ROW) {
-        const char *name    = (const char *)sqlite3_column_text(st_inst, 0);
-        const char *iv      = (const char *)sqlite3_column_text(st_inst, 1);
-        if (!name || !iv) continue;
-
-        sqlite3_reset(st_repo);
-        sqlite3_clear_bindings(st_repo);
-        sqlite3_bind_text(st_repo, 1, name, -1, SQLITE_STATIC);
-
-        char *best = NULL;
-        while (sqlite3_step(st_repo) == SQLITE_ROW) {
-            const char *rv = (const char *)sqlite3_column_text(st_repo, 0);
-            if (!rv || !version_is_valid(rv)) continue;
-            if (!best) { best = strdup(rv); continue; }
-            if (version_cmp(rv, best) > 0) {
-                char *tmp = strdup(rv);
-                free(best);
-                best = tmp;
-            }
-        }
+    sqlite3_finalize(st);
+    sqlite3_close(db);
 
-        if (best && version_cmp(best, iv) > 0) {
-            if (upgrade_count >= upgrade_cap) {
-                int nc = upgrade_cap ? upgrade_cap * 2 : 8;
-                Upgrade *tmp = realloc(upgrades, nc * sizeof(Upgrade));
-                if (!tmp) { free(best); break; }
-                upgrades = tmp;
-                upgrade_cap = nc;
-            }
-            upgrades[upgrade_count].name = strdup(name);
-            upgrades[upgrade_count].from = strdup(iv);
-            upgrades[upgrade_count].to   = best;
-            upgrade_count++;
-        } else {
-            free(best);
-        }
+    if (failed) {
+        ui_error("out of memory while computing upgrades");
+        repo_upgrade_plan_free(plan);
+        return 1;
     }
 
-    sqlite3_finalize(st_repo);
-    sqlite3_finalize(st_inst);
-    sqlite3_close(installed_db);
-    sqlite3_close(repo_db);
+    return 0;
+}
+
+int repo_upgrade(void)
+{
+    ui_info("checking for updates...");
+
+    struct upgrade_plan plan;
+    if (repo_upgrade_plan(&plan) != 0)
+        return 1;
 
-    if (upgrade_count == 0) {
+    if (plan.count == 0) {
         ui_info("system is up to date");
-        free(upgrades);
         return 0;
     }
 
     fprintf(stdout, "\nPackages to upgrade:\n\n");
-    for (int i = 0; i < upgrade_count; i++) {
+    for (size_t i = 0; i < plan.count; i++) {
         fprintf(stdout, "  %-16s %s -> %s\n",
-                upgrades[i].name,
-                upgrades[i].from,
-                upgrades[i].to);
-        free(upgrades[i].name);
-        free(upgrades[i].from);
-        free(upgrades[i].to);
+                plan.entries[i].name,
+                plan.entries[i].from,
+                plan.entries[i].to);
     }
-    free(upgrades);
 
     fprintf(stdout, "\nSummary:\n");
-    fprintf(stdout, "  total packages: %d\n", upgrade_count);
-    fprintf(stdout, "\nRun 'flappy install <pkg>' to upgrade packages\n");
+    fprintf(stdout, "  total packages: %zu\n", plan.count);
+    fprintf(stdout, "\nRun 'flappy upgrade --apply' to upgrade packages\n");
 
+    repo_upgrade_plan_free(&plan);
     return 0;
-}
\ No newline at end of file
+}
@@ -26,10 +26,20 @@
  *
  * SCOPE
  *
- *   Version constraint satisfaction uses version_satisfies() from
- *   version.c.  If the installed version of a dependency does not
- *   satisfy the constraint declared in repo.db, the resolution aborts
- *   with a clear message before any installation begins.
+ *   Constraints from repo.db are compiled once per edge
+ *   (version_constraint_compile) and tested against the stored
+ *   installed version_key.  A missing dependency is planned at the
+ *   newest repository version that satisfies its constraint, and the
+ *   plan carries that version to install_lookup_version, so what is
+ *   installed is what was checked.  A dependency reached again through
+ *   another dependent keeps the version chosen first, which must
+ *   satisfy that constraint too; there is no backtracking.
+ *
+ *   If the installed version of a dependency does not satisfy the
+ *   constraint declared in repo.db, or no repository version does,
+ *   the resolution aborts with a clear message before any installation
+ *   begins.  Dependencies are declared per name in repo.db, so every
+ *   version of a package has the same ones.
  *
  *   Conflict detection and atomicity are handled by the existing
  *   install pipeline — this module only determines order.
@@ -49,34 +59,37 @@
 #include "resolve.h"
 #include "version.h"
 #include "pkg_meta.h"
+#include "repo_index.h"
+#include "root.h"
+#include "trigram.h"
 
 #include <sqlite3.h>
 
+#include <limits.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define MAX_QUEUE  256
+#define MAX_QUEUE  RESOLVE_MAX
 #define MAX_STACK  256
 
 /* =========================================================================
  * Install queue — ordered list of package names to install
  * ========================================================================= */
 
-typedef struct {
-    char  names[MAX_QUEUE][64];
-    int   count;
-} Queue;
+typedef struct resolve_plan Queue;
 
-static int queue_contains(const Queue *q, const char *name)
+/* Index of `name` in the queue, or -1 */
+static int queue_find(const Queue *q, const char *name)
 {
     for (int i = 0; i < q->count; i++)
         if (strcmp(q->names[i], name) == 0)
-            return 1;
-    return 0;
+            return i;
+    return -1;
 }
 
-static int queue_push(Queue *q, const char *name)
+static int queue_push(Queue *q, const char *name, const char *version)
 {
     if (q->count >= MAX_QUEUE) {
         fprintf(stderr,
@@ -85,6 +98,8 @@ static int queue_push(Queue *q, const char *name)
         return 1;
     }
     snprintf(q->names[q->count], sizeof(q->names[q->count]), "%s", name);
+    snprintf(q->versions[q->count], sizeof(q->versions[q->count]), "%s",
+             version);
     q->count++;
     return 0;
 }
@@ -129,35 +144,6 @@ static void stack_pop(Stack *s)
  * DB helpers
  * ========================================================================= */
 
-/*
- * is_installed
- *
- * Returns 1 if `name` is present in the installed DB, 0 otherwise.
- * Opens its own read-only connection so it does not interfere with
- * the repo.db connection used during resolution.
- */
-static int is_installed(const char *name)
-{
-    sqlite3 *db = NULL;
-    if (sqlite3_open_v2(FLAPPY_DB_PATH, &db,
-                        SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
-        if (db) sqlite3_close(db);
-        return 0;
-    }
-
-    sqlite3_stmt *st = NULL;
-    sqlite3_prepare_v2(db,
-        "SELECT 1 FROM packages WHERE name = ?;",
-        -1, &st, NULL);
-    sqlite3_bind_text(st, 1, name, -1, SQLITE_STATIC);
-
-    int found = (sqlite3_step(st) == SQLITE_ROW);
-
-    sqlite3_finalize(st);
-    sqlite3_close(db);
-    return found;
-}
-
 /*
  * Dependency entry read from repo.db.
  */
@@ -165,6 +151,7 @@ typedef struct {
     char     name[64];
     dep_op_t op;
     char     version[32];  /* empty string if op == DEP_OP_NONE */
+    struct version_constraint constraint;   /* compiled (op, version) */
 } RepoDep;
 
 /*
@@ -177,9 +164,50 @@ typedef struct {
  */
 #define MAX_DEPS 64
 
+/*
+ * Repository source for one resolution: the mmap'd repo index when it
+ * is current, otherwise repo.db.  Exactly one of G_RIDX / the `repo`
+ * handle passed down the DFS is non-NULL.
+ */
+static struct repo_index *G_RIDX = NULL;
+
+/* resolve_closure: plan for another host, ignore the local DB */
+static int G_IGNORE_INSTALLED = 0;
+
+static int installed_here(const char *name)
+{
+    return !G_IGNORE_INSTALLED && db_pkg_installed(name);
+}
+
+static void fill_dep(RepoDep *d, const char *name, dep_op_t op,
+                     const char *version)
+{
+    snprintf(d->name, sizeof(d->name), "%s", name);
+    d->op         = op;
+    d->version[0] = '\0';
+    if (op != DEP_OP_NONE)
+        snprintf(d->version, sizeof(d->version), "%s", version);
+    version_constraint_compile(&d->constraint, d->op, d->version);
+}
+
 static int get_repo_deps(sqlite3 *repo, const char *pkgname,
                          RepoDep *deps)
 {
+    if (G_RIDX) {
+        uint32_t id;
+        if (!repo_index_find(G_RIDX, pkgname, &id))
+            return 0;
+
+        size_t n = repo_index_deps(G_RIDX, id);
+        int count = 0;
+        for (size_t k = 0; k < n && count < MAX_DEPS; k++) {
+            struct repo_index_dep d;
+            repo_index_dep(G_RIDX, id, k, &d);
+            fill_dep(&deps[count++], d.name, d.op, d.version);
+        }
+        return count;
+    }
+
     /*
      * repo.db stores dependencies in a `deps` table with columns:
      *   package   TEXT  (the dependent)
@@ -217,31 +245,175 @@ static int get_repo_deps(sqlite3 *repo, const char *pkgname,
         if (!dep_name || dep_name[0] == '\0')
             continue;
 
-        snprintf(deps[count].name, sizeof(deps[count].name),
-                 "%s", dep_name);
-
-        deps[count].op         = DEP_OP_NONE;
-        deps[count].version[0] = '\0';
+        dep_op_t op = DEP_OP_NONE;
 
         if (op_str && dep_ver) {
-            if      (strcmp(op_str, ">=") == 0) deps[count].op = DEP_OP_GE;
-            else if (strcmp(op_str, "<=") == 0) deps[count].op = DEP_OP_LE;
-            else if (strcmp(op_str, ">")  == 0) deps[count].op = DEP_OP_GT;
-            else if (strcmp(op_str, "<")  == 0) deps[count].op = DEP_OP_LT;
-            else if (strcmp(op_str, "=")  == 0) deps[count].op = DEP_OP_EQ;
-
-            if (deps[count].op != DEP_OP_NONE)
-                snprintf(deps[count].version, sizeof(deps[count].version),
-                         "%s", dep_ver);
+            if      (strcmp(op_str, ">=") == 0) op = DEP_OP_GE;
+            else if (strcmp(op_str, "<=") == 0) op = DEP_OP_LE;
+            else if (strcmp(op_str, ">")  == 0) op = DEP_OP_GT;
+            else if (strcmp(op_str, "<")  == 0) op = DEP_OP_LT;
+            else if (strcmp(op_str, "=")  == 0) op = DEP_OP_EQ;
         }
 
-        count++;
+        fill_dep(&deps[count++], dep_name, op, dep_ver);
     }
 
     sqlite3_finalize(st);
     return count;
 }
 
+static const char *op_symbol(dep_op_t op)
+{
+    switch (op) {
+    case DEP_OP_GE: return ">=";
+    case DEP_OP_LE: return "<=";
+    case DEP_OP_GT: return ">";
+    case DEP_OP_LT: return "<";
+    case DEP_OP_EQ: return "=";
+    default:        return "";
+    }
+}
+
+/*
+ * repo_pick
+ *
+ * Chooses the newest repo.db version of `name` that satisfies `c` and
+ * copies it to `out`.  Returns 1 when one does, 0 when none does, -1
+ * if the candidates could not be held in memory.
+ *
+ * All candidate keys are fetched first, newest first
+ * (packages.version_key, or version_key(version) for a repo.db indexed
+ * by an older flappy), and then tested in one version_constraint_match
+ * pass; the first match wins.  A merged repo.db may carry any number
+ * of versions of a name, so the candidate list grows as it is read;
+ * none is dropped.
+ */
+static int repo_pick(sqlite3 *repo, const char *name,
+                     const struct version_constraint *c,
+                     char *out, size_t outsz)
+{
+    struct version_key_ref *cands = NULL;
+    unsigned char *match = NULL;
+    size_t n = 0;
+    int rc = 0;
+
+    if (G_RIDX) {
+        uint32_t id;
+        if (!repo_index_find(G_RIDX, name, &id))
+            return 0;
+
+        size_t nv = repo_index_versions(G_RIDX, id);
+        cands = malloc((nv ? nv : 1) * sizeof(*cands));
+        match = malloc(nv ? nv : 1);
+        if (!cands || !match) {
+            free(cands);
+            free(match);
+            return -1;
+        }
+
+        for (size_t k = 0; k < nv; k++) {
+            struct repo_index_pkg p;
+            repo_index_version(G_RIDX, id, k, &p);
+            cands[n].key = p.vkey;       /* zero-copy into the mapping */
+            cands[n].len = p.vkey_len;
+            n++;
+        }
+
+        if (version_constraint_match(c, cands, n, match) > 0) {
+            size_t k = 0;
+            while (!match[k])
+                k++;
+            struct repo_index_pkg p;
+            repo_index_version(G_RIDX, id, k, &p);
+            snprintf(out, outsz, "%s", p.version);
+            rc = 1;
+        }
+
+        free(cands);
+        free(match);
+        return rc;
+    }
+
+    sqlite3_stmt *st = NULL;
+    if (sqlite3_prepare_v2(repo,
+            "SELECT version_key, version FROM packages WHERE name = ? "
+            "ORDER BY version_key DESC;",
+            -1, &st, NULL) != SQLITE_OK &&
+        sqlite3_prepare_v2(repo,
+            "SELECT version_key(version), version FROM packages "
+            "WHERE name = ? ORDER BY 1 DESC;",
+            -1, &st, NULL) != SQLITE_OK)
+        return 0;
+
+    sqlite3_bind_text(st, 1, name, -1, SQLITE_STATIC);
+
+    /* keys[i] backs cands[i]; pointers are set once both stop moving */
+    unsigned char (*keys)[VERSION_KEY_MAX] = NULL;
+    char (*vers)[64] = NULL;
+    size_t cap = 0;
+    int oom = 0;
+
+    while (sqlite3_step(st) == SQLITE_ROW) {
+        if (n == cap) {
+            size_t nc = cap ? cap * 2 : 16;
+            struct version_key_ref *tc = realloc(cands, nc * sizeof(*tc));
+            if (tc)
+                cands = tc;
+            unsigned char (*tk)[VERSION_KEY_MAX] =
+                tc ? realloc(keys, nc * sizeof(*tk)) : NULL;
+            if (tk)
+                keys = tk;
+            char (*tv)[64] = tk ? realloc(vers, nc * sizeof(*tv)) : NULL;
+            if (!tv) {
+                oom = 1;
+                break;
+            }
+            vers = tv;
+            cap = nc;
+        }
+
+        const char *v = (const char *)sqlite3_column_text(st, 1);
+        snprintf(vers[n], sizeof(vers[n]), "%s", v ? v : "");
+
+        int len = sqlite3_column_bytes(st, 0);
+        if (sqlite3_column_type(st, 0) != SQLITE_BLOB ||
+            len > VERSION_KEY_MAX) {
+            cands[n].key = NULL;
+            cands[n].len = 0;
+        } else {
+            if (len > 0)
+                memcpy(keys[n], sqlite3_column_blob(st, 0), (size_t)len);
+            cands[n].key = keys[n];     /* re-pointed below */
+            cands[n].len = (size_t)len;
+        }
+        n++;
+    }
+
+    sqlite3_finalize(st);
+
+    rc = -1;
+    if (!oom && (match = malloc(n ? n : 1)) != NULL) {
+        for (size_t k = 0; k < n; k++)
+            if (cands[k].key)
+                cands[k].key = keys[k];
+
+        rc = 0;
+        if (version_constraint_match(c, cands, n, match) > 0) {
+            size_t k = 0;
+            while (!match[k])
+                k++;
+            snprintf(out, outsz, "%s", vers[k]);
+            rc = 1;
+        }
+    }
+
+    free(cands);
+    free(keys);
+    free(vers);
+    free(match);
+    return rc;
+}
+
 /*
  * pkg_exists_in_repo
  *
@@ -249,6 +421,10 @@ static int get_repo_deps(sqlite3 *repo, const char *pkgname,
  */
 static int pkg_exists_in_repo(sqlite3 *repo, const char *name)
 {
+    uint32_t id;
+    if (G_RIDX)
+        return repo_index_find(G_RIDX, name, &id);
+
     sqlite3_stmt *st = NULL;
     sqlite3_prepare_v2(repo,
         "SELECT 1 FROM packages WHERE name = ?;",
@@ -261,25 +437,41 @@ static int pkg_exists_in_repo(sqlite3 *repo, const char *name)
 }
 
 /*
- * get_installed_version_str
+ * get_installed_version
  *
- * Returns installed version of `name` into `out` (must be >= 64 bytes).
+ * Returns installed version of `name` into `out` (must be >= 64 bytes)
+ * and its binary sort key into `key` / *keylen (*keylen = SIZE_MAX if
+ * the installed version is invalid).
  * Returns 1 if found, 0 if not installed.
  * Opens its own connection.
+ *
+ * The key comes from packages.version_key.  An installed DB that has
+ * not been migrated to schema v3 yet (no flappy command has opened it
+ * read-write since the upgrade) has no such column; the key is then
+ * computed from the string instead.
  */
-static int get_installed_version_str(const char *name, char *out, size_t outsz)
+static int get_installed_version(const char *name, char *out, size_t outsz,
+                                 unsigned char *key, size_t *keylen)
 {
     sqlite3 *db = NULL;
-    if (sqlite3_open_v2(FLAPPY_DB_PATH, &db,
+    char path[PATH_MAX];
+    if (root_path(path, sizeof(path), FLAPPY_DB_PATH) != 0 ||
+        sqlite3_open_v2(path, &db,
                         SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
         if (db) sqlite3_close(db);
         return 0;
     }
 
     sqlite3_stmt *st = NULL;
-    sqlite3_prepare_v2(db,
-        "SELECT version FROM packages WHERE name = ?;",
-        -1, &st, NULL);
+    if (sqlite3_prepare_v2(db,
+            "SELECT version, version_key FROM packages WHERE name = ?;",
+            -1, &st, NULL) != SQLITE_OK) {
+        version_sql_register(db);
+        sqlite3_prepare_v2(db,
+            "SELECT version, version_key(version) FROM packages "
+            "WHERE name = ?;",
+            -1, &st, NULL);
+    }
     sqlite3_bind_text(st, 1, name, -1, SQLITE_STATIC);
 
     int found = 0;
@@ -287,6 +479,16 @@ static int get_installed_version_str(const char *name, char *out, size_t outsz)
         const char *v = (const char *)sqlite3_column_text(st, 0);
         if (v) {
             snprintf(out, outsz, "%s", v);
+
+            int n = sqlite3_column_bytes(st, 1);
+            if (sqlite3_column_type(st, 1) == SQLITE_BLOB &&
+                n <= VERSION_KEY_MAX) {
+                if (n > 0)
+                    memcpy(key, sqlite3_column_blob(st, 1), (size_t)n);
+                *keylen = (size_t)n;
+            } else {
+                *keylen = SIZE_MAX;
+            }
             found = 1;
         }
     }
@@ -303,8 +505,23 @@ static int get_installed_version_str(const char *name, char *out, size_t outsz)
  * queue in the correct order.
  * ========================================================================= */
 
+/* Does the version chosen earlier in this run satisfy `c`? */
+static int chosen_satisfies(const char *version,
+                            const struct version_constraint *c)
+{
+    unsigned char key[VERSION_KEY_MAX];
+    size_t len;
+    int valid = version_key(version, key, &len) == 0;
+    return version_constraint_test(c, valid ? key : NULL, len);
+}
+
+/*
+ * `version` is the repository version to install, chosen by the
+ * caller against the dependent's constraint; NULL means the newest.
+ */
 static int dfs(sqlite3 *repo,
                const char *pkgname,
+               const char *version,
                Queue *queue,
                Stack *stack)
 {
@@ -322,7 +539,7 @@ static int dfs(sqlite3 *repo,
     }
 
     /* Already queued in this run — diamond dependency, skip */
-    if (queue_contains(queue, pkgname))
+    if (queue_find(queue, pkgname) >= 0)
         return 0;
 
     /*
@@ -337,9 +554,24 @@ static int dfs(sqlite3 *repo,
         fprintf(stderr,
             "[ERROR] resolve: package '%s' not found in repository\n",
             pkgname);
+        trigram_did_you_mean(pkgname);
         return 1;
     }
 
+    char chosen[64];
+    if (version) {
+        snprintf(chosen, sizeof(chosen), "%s", version);
+    } else {
+        static const struct version_constraint any = {
+            .op = DEP_OP_NONE, .valid = 1,
+        };
+        if (repo_pick(repo, pkgname, &any, chosen, sizeof(chosen)) != 1) {
+            fprintf(stderr,
+                "[ERROR] resolve: cannot read versions of %s\n", pkgname);
+            return 1;
+        }
+    }
+
     /* Push onto DFS stack */
     if (stack_push(stack, pkgname) != 0)
         return 1;
@@ -360,23 +592,22 @@ static int dfs(sqlite3 *repo,
          * If the dependency is already installed, check its version
          * satisfies any constraint before accepting it.
          */
-        if (is_installed(dep_name)) {
+        if (installed_here(dep_name)) {
             if (deps[i].op != DEP_OP_NONE) {
                 char inst_ver[64] = {0};
-                if (get_installed_version_str(dep_name,
-                                              inst_ver, sizeof(inst_ver))) {
-                    if (!version_satisfies(inst_ver,
-                                           deps[i].op,
-                                           deps[i].version)) {
+                unsigned char ikey[VERSION_KEY_MAX];
+                size_t ilen;
+                if (get_installed_version(dep_name,
+                                          inst_ver, sizeof(inst_ver),
+                                          ikey, &ilen)) {
+                    if (!version_constraint_test(&deps[i].constraint,
+                            ilen == SIZE_MAX ? NULL : ikey, ilen)) {
                         fprintf(stderr,
                             "[ERROR] resolve: installed %s %s does not "
                             "satisfy %s %s %s required by %s\n",
                             dep_name, inst_ver,
                             dep_name,
-                            deps[i].op == DEP_OP_GE ? ">=" :
-                            deps[i].op == DEP_OP_LE ? "<=" :
-                            deps[i].op == DEP_OP_GT ? ">"  :
-                            deps[i].op == DEP_OP_LT ? "<"  : "=",
+                            op_symbol(deps[i].op),
                             deps[i].version,
                             pkgname);
                         stack_pop(stack);
@@ -388,8 +619,56 @@ static int dfs(sqlite3 *repo,
             continue;
         }
 
+        /*
+         * Not installed and already chosen in this run: the chosen
+         * version has to satisfy this dependent too.
+         */
+        int q = queue_find(queue, dep_name);
+        if (q >= 0) {
+            if (!chosen_satisfies(queue->versions[q],
+                                  &deps[i].constraint)) {
+                fprintf(stderr,
+                    "[ERROR] resolve: %s %s, chosen for an earlier "
+                    "dependent, does not satisfy %s %s %s required by %s\n",
+                    dep_name, queue->versions[q],
+                    dep_name, op_symbol(deps[i].op), deps[i].version,
+                    pkgname);
+                stack_pop(stack);
+                return 1;
+            }
+            continue;
+        }
+
+        /*
+         * Not installed: install the newest repository version that
+         * satisfies the constraint (the newest of all if there is
+         * none), or fail if the repository has no such version.
+         */
+        char pick[64];
+        int found = 0;
+        if (deps[i].op != DEP_OP_NONE) {
+            found = repo_pick(repo, dep_name, &deps[i].constraint,
+                              pick, sizeof(pick));
+            if (found < 0) {
+                fprintf(stderr,
+                    "[ERROR] resolve: out of memory reading versions "
+                    "of %s\n", dep_name);
+                stack_pop(stack);
+                return 1;
+            }
+            if (found == 0) {
+                fprintf(stderr,
+                    "[ERROR] resolve: no repository version of %s "
+                    "satisfies %s %s required by %s\n",
+                    dep_name, op_symbol(deps[i].op), deps[i].version,
+                    pkgname);
+                stack_pop(stack);
+                return 1;
+            }
+        }
+
         /* Recurse — install dependency before this package */
-        if (dfs(repo, dep_name, queue, stack) != 0) {
+        if (dfs(repo, dep_name, found ? pick : NULL, queue, stack) != 0) {
             stack_pop(stack);
             return 1;
         }
@@ -401,8 +680,8 @@ static int dfs(sqlite3 *repo,
      * Post-order: add this package to the queue after all its deps.
      * Skip if already installed (and not already queued — caught above).
      */
-    if (!is_installed(pkgname)) {
-        if (queue_push(queue, pkgname) != 0)
+    if (!installed_here(pkgname)) {
+        if (queue_push(queue, pkgname, chosen) != 0)
             return 1;
     }
 
@@ -413,25 +692,72 @@ static int dfs(sqlite3 *repo,
  * Public entry
  * ========================================================================= */
 
-int resolve_and_install(const char *pkgname)
+/*
+ * source_open / source_close
+ *
+ * Prefer the mmap'd repo index; otherwise open repo.db read-only
+ * for the duration of resolution.
+ */
+static int source_open(sqlite3 **repo)
 {
-    /* Open repo.db read-only for the duration of resolution */
-    sqlite3 *repo = NULL;
-    if (sqlite3_open_v2(FLAPPY_REPO_DB_PATH, &repo,
+    *repo = NULL;
+    G_RIDX = repo_index_open();
+    if (G_RIDX)
+        return 0;
+
+    if (sqlite3_open_v2(FLAPPY_REPO_DB_PATH, repo,
                         SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
         fprintf(stderr,
             "[ERROR] resolve: cannot open repository database "
             "(run 'flappy update')\n");
-        if (repo) sqlite3_close(repo);
+        if (*repo) sqlite3_close(*repo);
+        *repo = NULL;
         return 1;
     }
+    version_sql_register(*repo);
+    return 0;
+}
+
+static void source_close(sqlite3 *repo)
+{
+    if (repo)
+        sqlite3_close(repo);
+    repo_index_close(G_RIDX);
+    G_RIDX = NULL;
+}
+
+int resolve_closure(const char *const *pkgs, int n, struct resolve_plan *out)
+{
+    sqlite3 *repo;
+    if (source_open(&repo) != 0)
+        return 1;
+
+    memset(out, 0, sizeof(*out));
+    G_IGNORE_INSTALLED = 1;
+
+    int rc = 0;
+    for (int i = 0; i < n && rc == 0; i++) {
+        Stack stack = {0};
+        rc = dfs(repo, pkgs[i], NULL, out, &stack);
+    }
+
+    G_IGNORE_INSTALLED = 0;
+    source_close(repo);
+    return rc;
+}
+
+int resolve_and_install(const char *pkgname)
+{
+    sqlite3 *repo;
+    if (source_open(&repo) != 0)
+        return 1;
 
     Queue queue = {0};
     Stack stack = {0};
 
     /* Build the install order via DFS */
-    int rc = dfs(repo, pkgname, &queue, &stack);
-    sqlite3_close(repo);
+    int rc = dfs(repo, pkgname, NULL, &queue, &stack);
+    source_close(repo);
 
     if (rc != 0)
         return 1;
@@ -446,9 +772,9 @@ int resolve_and_install(const char *pkgname)
     if (queue.count > 1) {
         fprintf(stderr, "[INFO] install order:\n");
         for (int i = 0; i < queue.count; i++)
-            fprintf(stderr, "  %d. %s%s\n",
+            fprintf(stderr, "  %d. %s %s%s\n",
                     i + 1,
-                    queue.names[i],
+                    queue.names[i], queue.versions[i],
                     (strcmp(queue.names[i], pkgname) == 0)
                         ? " (requested)" : " (dependency)");
         fprintf(stderr, "\n");
@@ -456,7 +782,7 @@ int resolve_and_install(const char *pkgname)
 
     /* Install in order — each call goes through the full pipeline */
     for (int i = 0; i < queue.count; i++) {
-        if (install_package(queue.names[i]) != 0) {
+        if (install_package(queue.names[i], queue.versions[i]) != 0) {
             fprintf(stderr,
                 "[ERROR] resolve: failed to install '%s' — "
                 "stopping (subsequent packages not installed)\n",
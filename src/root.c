@@ -0,0 +1,303 @@
+/*
+ * root.c - Installation root (see root.h)
+ *
+ * root_at() resolves with openat2(RESOLVE_IN_ROOT), which does in the
+ * kernel what a chroot would: absolute symlinks restart at the root
+ * and ".." stops there.  The first ENOSYS switches the process to a
+ * component walk with O_NOFOLLOW instead, which cannot tell a link
+ * that stays inside the root from one that leaves it and so refuses
+ * both.  The default root "/" has nothing to escape and skips both.
+ */
+
+#define _GNU_SOURCE          /* realpath, O_PATH, syscall */
+
+#include "root.h"
+
+#include <linux/openat2.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* openat2 retries a RESOLVE_IN_ROOT lookup raced by a rename */
+#define OPENAT2_TRIES 8
+
+static char G_ROOT[PATH_MAX] = "/";
+static int  G_ROOT_FD = -1;
+
+int root_set(const char *dir)
+{
+    char real[PATH_MAX];
+    if (!realpath(dir, real)) {
+        fprintf(stderr, "flappy: invalid root %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+
+    int fd = open(real, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "flappy: cannot open root %s: %s\n",
+                real, strerror(errno));
+        return 1;
+    }
+
+    if (G_ROOT_FD >= 0)
+        close(G_ROOT_FD);
+    G_ROOT_FD = fd;
+    snprintf(G_ROOT, sizeof(G_ROOT), "%s", real);
+    return 0;
+}
+
+int root_is_alt(void)
+{
+    return strcmp(G_ROOT, "/") != 0;
+}
+
+const char *root_dir(void)
+{
+    return G_ROOT;
+}
+
+int root_fd(void)
+{
+    if (G_ROOT_FD < 0) {
+        G_ROOT_FD = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (G_ROOT_FD < 0) {
+            /* root_rel paths would silently resolve against the cwd */
+            fprintf(stderr, "Fatal: cannot open /: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+    return G_ROOT_FD;
+}
+
+const char *root_rel(const char *abs)
+{
+    while (*abs == '/')
+        abs++;
+    return *abs ? abs : ".";
+}
+
+int root_path(char *out, size_t outsz, const char *abs)
+{
+    int n = root_is_alt()
+        ? snprintf(out, outsz, "%s%s", G_ROOT, abs)
+        : snprintf(out, outsz, "%s", abs);
+    return n < 0 || (size_t)n >= outsz;
+}
+
+/* =========================================================================
+ * Confined resolution
+ * ========================================================================= */
+
+static int G_NO_OPENAT2;     /* set once openat2 returned ENOSYS */
+
+/*
+ * walk_dir
+ *
+ * Opens the directory `rel` one component at a time, refusing every
+ * symlink and "..".  The fallback for kernels without openat2.
+ */
+static int walk_dir(const char *rel)
+{
+    int fd = openat(root_fd(), ".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+    while (fd >= 0 && *rel) {
+        size_t len = strcspn(rel, "/");
+        char name[NAME_MAX + 1];
+
+        if (len > NAME_MAX) {
+            close(fd);
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(name, rel, len);
+        name[len] = '\0';
+        rel += len;
+        rel += strspn(rel, "/");
+
+        if (len == 0 || strcmp(name, ".") == 0)
+            continue;
+        if (strcmp(name, "..") == 0) {
+            close(fd);
+            errno = EXDEV;
+            return -1;
+        }
+
+        int next = openat(fd, name,
+                          O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        close(fd);
+        fd = next;
+    }
+    return fd;
+}
+
+/* Opens the directory `rel` (relative to the root) inside the root */
+static int open_dir(const char *rel)
+{
+#ifdef SYS_openat2
+    if (!G_NO_OPENAT2) {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags   = O_PATH | O_DIRECTORY | O_CLOEXEC;
+        how.resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS;
+
+        int fd, tries = 0;
+        do {
+            fd = (int)syscall(SYS_openat2, root_fd(), rel,
+                              &how, sizeof(how));
+        } while (fd < 0 && errno == EAGAIN && ++tries < OPENAT2_TRIES);
+
+        if (fd >= 0 || errno != ENOSYS)
+            return fd;
+        G_NO_OPENAT2 = 1;
+    }
+#endif
+    return walk_dir(rel);
+}
+
+/*
+ * make_dirs
+ *
+ * Opens the directory `rel`, creating each missing component (0755)
+ * inside the directory its prefix resolved to.
+ */
+static int make_dirs(char *rel)
+{
+    int up = open_dir(".");
+
+    for (char *p = rel; up >= 0; p++) {
+        if (*p != '/' && *p != '\0')
+            continue;
+
+        char c = *p;
+        *p = '\0';
+
+        const char *name = strrchr(rel, '/');
+        name = name ? name + 1 : rel;
+
+        int fd = *name ? open_dir(rel) : -1;
+        if (*name && fd < 0 && errno == ENOENT &&
+                (mkdirat(up, name, 0755) == 0 || errno == EEXIST))
+            fd = open_dir(rel);
+
+        *p = c;
+        if (!*name)
+            continue;               /* "a//b" */
+
+        close(up);
+        up = fd;
+        if (c == '\0')
+            break;
+    }
+    return up;
+}
+
+/* mkdir -p of `rel`'s parent directories, for the root "/" */
+static int make_parents(const char *rel)
+{
+    char parent[PATH_MAX];
+    snprintf(parent, sizeof(parent), "%s", rel);
+
+    char *slash = strrchr(parent, '/');
+    if (!slash)
+        return 0;
+    *slash = '\0';
+
+    for (char *p = parent + 1; ; p++) {
+        if (*p != '/' && *p != '\0')
+            continue;
+        char c = *p;
+        *p = '\0';
+        if (mkdirat(root_fd(), parent, 0755) != 0 && errno != EEXIST)
+            return -1;
+        *p = c;
+        if (c == '\0')
+            return 0;
+    }
+}
+
+int root_at(const char *abs, int flags, const char **leaf)
+{
+    const char *rel = root_rel(abs);
+
+    if (!root_is_alt()) {
+        if ((flags & ROOT_AT_MKDIR) && make_parents(rel) != 0)
+            return -1;
+        *leaf = rel;
+        return root_fd();
+    }
+
+    const char *slash = strrchr(rel, '/');
+    const char *name  = slash ? slash + 1 : rel;
+
+    if (!*name || strcmp(name, "..") == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    char parent[PATH_MAX];
+    size_t len = slash ? (size_t)(slash - rel) : 0;
+    if (len >= sizeof(parent)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(parent, rel, len);
+    parent[len] = '\0';
+    if (len == 0)
+        strcpy(parent, ".");
+
+    int fd = open_dir(parent);
+    if (fd < 0 && errno == ENOENT && (flags & ROOT_AT_MKDIR))
+        fd = make_dirs(parent);
+    if (fd < 0)
+        return -1;
+
+    *leaf = name;
+    return fd;
+}
+
+void root_at_done(int dfd)
+{
+    if (dfd >= 0 && dfd != root_fd())
+        close(dfd);
+}
+
+int root_unlink(const char *abs)
+{
+    const char *leaf;
+    int dfd = root_at(abs, 0, &leaf);
+    if (dfd < 0)
+        return -1;
+
+    int rc = unlinkat(dfd, leaf, 0);
+    int saved = errno;
+    root_at_done(dfd);
+    errno = saved;
+    return rc;
+}
+
+int root_rename(const char *from, const char *to)
+{
+    const char *from_leaf, *to_leaf;
+    int from_dfd = root_at(from, 0, &from_leaf);
+    if (from_dfd < 0)
+        return -1;
+    int to_dfd = root_at(to, 0, &to_leaf);
+    if (to_dfd < 0) {
+        root_at_done(from_dfd);
+        return -1;
+    }
+
+    int rc = renameat(from_dfd, from_leaf, to_dfd, to_leaf);
+    int saved = errno;
+    root_at_done(from_dfd);
+    root_at_done(to_dfd);
+    errno = saved;
+    return rc;
+}
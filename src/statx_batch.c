@@ -0,0 +1,445 @@
+/*
+ * statx_batch.c - Batched metadata lookups under the root
+ *
+ * The io_uring path talks to the kernel directly (io_uring_setup /
+ * io_uring_enter and the mmap'ed rings, as described in
+ * <linux/io_uring.h>) rather than through liburing, so it adds no
+ * build dependency.  It is tried once per process; if the ring cannot
+ * be set up (old kernel, io_uring disabled by sysctl or seccomp) or the
+ * kernel rejects IORING_OP_STATX, every batch goes to the thread pool.
+ *
+ * The kernel runs the lookups of one ring on its own worker threads,
+ * so a single submitting thread is enough to keep the whole batch in
+ * flight.
+ *
+ * A ring lookup resolves its path like a plain statx, which under an
+ * alternate root would follow an absolute symlink in the image out to
+ * the host.  Those batches go to the thread pool instead, where each
+ * lookup is made in the directory root_at() opened for it; a worker
+ * keeps the last directory open, so a slice of sorted paths opens each
+ * directory about once.
+ */
+
+#define _GNU_SOURCE     /* statx, syscall */
+
+#include "statx_batch.h"
+#include "flappy.h"
+#include "root.h"
+
+#include <linux/io_uring.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define STATX_MASK (STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_INO | \
+                    STATX_MTIME | STATX_CTIME)
+
+/* Requests handed to a pool thread at a time */
+#define STATX_SLICE 64
+
+static void fill_meta(struct file_meta *m, const struct statx *stx)
+{
+    m->mode     = stx->stx_mode;
+    m->size     = (long long)stx->stx_size;
+    m->dev      = ((unsigned long long)stx->stx_dev_major << 32) |
+                  stx->stx_dev_minor;
+    m->ino      = stx->stx_ino;
+    m->mtime_ns = (long long)stx->stx_mtime.tv_sec * 1000000000LL +
+                  stx->stx_mtime.tv_nsec;
+    m->ctime_ns = (long long)stx->stx_ctime.tv_sec * 1000000000LL +
+                  stx->stx_ctime.tv_nsec;
+}
+
+/* =========================================================================
+ * io_uring
+ * ========================================================================= */
+
+struct ring {
+    int                   fd;
+    unsigned              sq_entries;
+    unsigned              cq_entries;
+
+    unsigned             *sq_head;
+    unsigned             *sq_tail;
+    unsigned             *sq_mask;
+    unsigned             *sq_array;
+    struct io_uring_sqe  *sqes;
+
+    unsigned             *cq_head;
+    unsigned             *cq_tail;
+    unsigned             *cq_mask;
+    struct io_uring_cqe  *cqes;
+
+    void                 *sq_map;
+    size_t                sq_map_len;
+    void                 *cq_map;       /* == sq_map with SINGLE_MMAP */
+    size_t                cq_map_len;
+    size_t                sqes_len;
+};
+
+static void ring_close(struct ring *r)
+{
+    if (r->sqes && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_len);
+    if (r->cq_map && r->cq_map != MAP_FAILED && r->cq_map != r->sq_map)
+        munmap(r->cq_map, r->cq_map_len);
+    if (r->sq_map && r->sq_map != MAP_FAILED)
+        munmap(r->sq_map, r->sq_map_len);
+    if (r->fd >= 0)
+        close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+static int ring_open(struct ring *r, unsigned depth)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+
+    r->fd = (int)syscall(SYS_io_uring_setup, depth, &p);
+    if (r->fd < 0)
+        return 1;
+
+    r->sq_entries = p.sq_entries;
+    r->cq_entries = p.cq_entries;
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes +
+                    p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_len   = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_map_len > r->sq_map_len)
+            r->sq_map_len = r->cq_map_len;
+        r->cq_map_len = r->sq_map_len;
+    }
+
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED)
+        goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_map = r->sq_map;
+    else
+        r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, r->fd,
+                         IORING_OFF_CQ_RING);
+    if (r->cq_map == MAP_FAILED)
+        goto fail;
+
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail;
+
+    char *sq = r->sq_map, *cq = r->cq_map;
+    r->sq_head  = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head  = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+fail:
+    ring_close(r);
+    return 1;
+}
+
+/*
+ * ring_statx
+ *
+ * Runs every lookup through the ring with up to sq_entries in flight,
+ * each into a statx buffer slot of its own until it completes.  The
+ * slot travels in the low 16 bits of user_data, the request index in
+ * the rest.  Returns 1 if the ring is unusable; requests not done keep
+ * err == -1 for the fallback.  *busy is set if lookups may still be
+ * in flight, in which case `bufs` must not be freed.
+ */
+static int ring_statx(struct ring *r, struct statx_req *reqs, size_t count,
+                      struct statx *bufs, unsigned *slots, int *busy)
+{
+    unsigned nfree = r->sq_entries;     /* slots[0 .. nfree) are free */
+    unsigned pending = 0, inflight = 0;
+    size_t next = 0;
+
+    for (unsigned i = 0; i < nfree; i++)
+        slots[i] = i;
+
+    while (next < count || pending || inflight) {
+        /* Queue lookups into the free slots */
+        unsigned tail = *r->sq_tail;
+
+        while (next < count && nfree > 0) {
+            unsigned idx  = tail & *r->sq_mask;
+            unsigned slot = slots[--nfree];
+            struct io_uring_sqe *sqe = &r->sqes[idx];
+
+            /* Only the root "/" gets here, where root_at() is this */
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode      = IORING_OP_STATX;
+            sqe->fd          = root_fd();
+            sqe->addr        = (uint64_t)(uintptr_t)root_rel(reqs[next].path);
+            sqe->len         = STATX_MASK;
+            sqe->off         = (uint64_t)(uintptr_t)&bufs[slot];
+            sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+            sqe->user_data   = ((uint64_t)next << 16) | slot;
+
+            r->sq_array[idx] = idx;
+            tail++;
+            pending++;
+            next++;
+        }
+        __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+        int ret = (int)syscall(SYS_io_uring_enter, r->fd, pending, 1,
+                               IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            *busy = inflight > 0;
+            return 1;
+        }
+        pending  -= (unsigned)ret;
+        inflight += (unsigned)ret;
+
+        /* Reap every completion there is */
+        unsigned head  = *r->cq_head;
+        unsigned ctail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        int unsupported = 0;
+
+        for (; head != ctail; head++) {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            size_t   i    = (size_t)(cqe->user_data >> 16);
+            unsigned slot = (unsigned)(cqe->user_data & 0xffff);
+
+            /* A lookup has no EINVAL of its own: the opcode is unknown */
+            if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+                unsupported = 1;
+            else if (cqe->res < 0)
+                reqs[i].err = -cqe->res;
+            else {
+                fill_meta(&reqs[i].meta, &bufs[slot]);
+                reqs[i].err = 0;
+            }
+            slots[nfree++] = slot;
+            inflight--;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+        if (unsupported) {
+            *busy = inflight > 0 || pending > 0;
+            return 1;
+        }
+    }
+
+    *busy = 0;
+    return 0;
+}
+
+static int uring_batch(struct statx_req *reqs, size_t count)
+{
+    static int unusable;        /* set once, never cleared */
+    struct ring r;
+
+    if (unusable)
+        return 1;
+
+    if (ring_open(&r, STATX_RING_DEPTH) != 0) {
+        log_info("statx: io_uring unavailable (%s), using threads",
+                 strerror(errno));
+        unusable = 1;
+        return 1;
+    }
+
+    struct statx *bufs  = calloc(r.sq_entries, sizeof(*bufs));
+    unsigned     *slots = calloc(r.sq_entries, sizeof(*slots));
+    int busy = 0, rc = 1;
+
+    if (bufs && slots) {
+        rc = ring_statx(&r, reqs, count, bufs, slots, &busy);
+        if (rc != 0) {
+            log_info("statx: io_uring lookups failed, using threads");
+            unusable = 1;
+        }
+    }
+
+    ring_close(&r);
+
+    /* Closing the ring cancels what is in flight, but not synchronously */
+    if (!busy)
+        free(bufs);
+    free(slots);
+    return rc;
+}
+
+/* =========================================================================
+ * Thread pool
+ * ========================================================================= */
+
+struct pool {
+    struct statx_req *reqs;
+    size_t            count;
+    size_t            next;
+    pthread_mutex_t   lock;
+};
+
+/* A worker's last root_at() directory */
+struct parent {
+    int     fd;             /* -1: none */
+    size_t  len;            /* of the path up to the leaf */
+    char    path[PATH_MAX];
+};
+
+static int parent_at(struct parent *d, const char *path, const char **leaf)
+{
+    const char *slash = strrchr(path, '/');
+    size_t len = slash ? (size_t)(slash - path) + 1 : 0;
+
+    if (d->fd >= 0 && len == d->len && memcmp(path, d->path, len) == 0) {
+        *leaf = path + len;
+        return d->fd;
+    }
+
+    root_at_done(d->fd);
+    d->fd = -1;
+
+    int fd = root_at(path, 0, leaf);
+    if (fd >= 0 && len < sizeof(d->path) && *leaf == path + len) {
+        memcpy(d->path, path, len);
+        d->len = len;
+        d->fd  = fd;
+    }
+    return fd;
+}
+
+static void lookup_at(struct statx_req *q, int dfd, const char *leaf)
+{
+    struct statx stx;
+
+    if (statx(dfd, leaf, AT_SYMLINK_NOFOLLOW, STATX_MASK, &stx) == 0) {
+        fill_meta(&q->meta, &stx);
+        q->err = 0;
+        return;
+    }
+
+    if (errno != ENOSYS) {
+        q->err = errno;
+        return;
+    }
+
+    /* statx(2) predates the kernel: the same fields from fstatat */
+    struct stat st;
+    if (fstatat(dfd, leaf, &st, AT_SYMLINK_NOFOLLOW)) {
+        q->err = errno;
+        return;
+    }
+    q->meta.mode     = st.st_mode;
+    q->meta.size     = (long long)st.st_size;
+    q->meta.dev      = st.st_dev;
+    q->meta.ino      = st.st_ino;
+    q->meta.mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL +
+                       st.st_mtim.tv_nsec;
+    q->meta.ctime_ns = (long long)st.st_ctim.tv_sec * 1000000000LL +
+                       st.st_ctim.tv_nsec;
+    q->err = 0;
+}
+
+static void lookup_one(struct statx_req *q, struct parent *d)
+{
+    const char *leaf;
+    int dfd = parent_at(d, q->path, &leaf);
+
+    if (dfd < 0) {
+        q->err = errno;
+        return;
+    }
+    lookup_at(q, dfd, leaf);
+    if (dfd != d->fd)
+        root_at_done(dfd);
+}
+
+static void *pool_worker(void *arg)
+{
+    struct pool *p = arg;
+    struct parent d = { .fd = -1 };
+
+    for (;;) {
+        pthread_mutex_lock(&p->lock);
+        size_t from = p->next;
+        p->next = from + STATX_SLICE < p->count ? from + STATX_SLICE
+                                                : p->count;
+        size_t to = p->next;
+        pthread_mutex_unlock(&p->lock);
+
+        if (from == to) {
+            root_at_done(d.fd);
+            return NULL;
+        }
+
+        for (size_t i = from; i < to; i++)
+            if (p->reqs[i].err == -1)
+                lookup_one(&p->reqs[i], &d);
+    }
+}
+
+static void pool_batch(struct statx_req *reqs, size_t count)
+{
+    struct pool p = { .reqs = reqs, .count = count };
+    pthread_mutex_init(&p.lock, NULL);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nworkers = cpus < 1 ? 4 : (size_t)cpus * 4;
+    if (nworkers > STATX_MAX_WORKERS)
+        nworkers = STATX_MAX_WORKERS;
+    if (nworkers > (count + STATX_SLICE - 1) / STATX_SLICE)
+        nworkers = (count + STATX_SLICE - 1) / STATX_SLICE;
+
+    pthread_t workers[STATX_MAX_WORKERS];
+    size_t started = 0;
+
+    for (size_t i = 0; i < nworkers; i++) {
+        if (pthread_create(&workers[i], NULL, pool_worker, &p) != 0)
+            break;
+        started++;
+    }
+
+    /* This thread takes slices too; alone if no thread started */
+    pool_worker(&p);
+
+    for (size_t i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    pthread_mutex_destroy(&p.lock);
+}
+
+/* =========================================================================
+ * Public entry
+ * ========================================================================= */
+
+void statx_batch(struct statx_req *reqs, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        reqs[i].err = -1;                       /* not looked up yet */
+
+    if (count == 0)
+        return;
+
+    if (!root_is_alt() && uring_batch(reqs, count) == 0)
+        return;
+
+    /* Whatever the ring did not finish */
+    pool_batch(reqs, count);
+}
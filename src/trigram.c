@@ -0,0 +1,699 @@
+/*
+ * trigram.c - Trigram index over repository package names
+ *
+ * FILE LAYOUT (native byte order, 4-byte aligned)
+ *
+ *   struct tg_header
+ *   uint32_t       name_off[nnames + 1]   offsets into names[]
+ *   char           names[names_bytes]     NUL-terminated, BINARY order
+ *   (pad to 4)
+ *   struct tg_tri  tris[ntri]             sorted by trigram
+ *   uint32_t       postings[npostings]    name ids, ascending per list
+ *
+ * Trigrams are taken from the lowercased name padded with two 0x01
+ * bytes on each side, so "zlib" yields
+ *
+ *   \1\1z  \1zl  zli  lib  ib\1  b\1\1
+ *
+ * The padding gives every name — even one or two characters long —
+ * len + 2 trigrams, which is what makes the suggestion filter below
+ * work for short names.  Substring queries only use unpadded trigrams.
+ *
+ * QUERIES
+ *
+ *   glob      trigrams of every literal run of >= 3 characters are
+ *             intersected (shortest list first, binary search in the
+ *             others); survivors are confirmed with fnmatch.
+ *
+ *   suggest   q-gram lemma: one edit destroys at most 3 trigrams, so a
+ *             name within edit distance d of a query with t padded
+ *             trigrams shares at least t - 3d of them.  Shared counts
+ *             are accumulated from the posting lists; only names over
+ *             the threshold (and within d in length) get a full
+ *             edit-distance check.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "trigram.h"
+#include "flappy.h"
+#include "repo.h"
+
+#include <sqlite3.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TG_MAGIC        "FTRG"
+#define TG_VERSION      1
+#define TG_PAD          '\x01'
+#define TG_NAME_MAX     255
+#define TG_MAX_TRIS     (TG_NAME_MAX + 2)
+
+struct tg_header {
+    char     magic[4];
+    uint32_t version;
+    char     repo_sha[64];
+    uint32_t nnames;
+    uint32_t ntri;
+    uint32_t names_bytes;
+    uint32_t npostings;
+};
+
+struct tg_tri {
+    uint32_t tri;
+    uint32_t off;      /* first index into postings[] */
+    uint32_t len;
+};
+
+struct trigram_index {
+    void                 *map;
+    size_t                map_size;
+    const struct tg_header *hdr;
+    const uint32_t       *name_off;
+    const char           *names;
+    const struct tg_tri  *tris;
+    const uint32_t       *postings;
+};
+
+/* =========================================================================
+ * Trigram extraction
+ * ========================================================================= */
+
+static uint32_t tri_pack(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* sorts and dedups tris[0..n), returns the new count */
+static size_t tri_unique(uint32_t *tris, size_t n)
+{
+    if (n == 0)
+        return 0;
+
+    qsort(tris, n, sizeof(*tris), cmp_u32);
+
+    size_t k = 1;
+    for (size_t i = 1; i < n; i++)
+        if (tris[i] != tris[k - 1])
+            tris[k++] = tris[i];
+    return k;
+}
+
+/*
+ * Padded trigrams of `name` (len <= TG_NAME_MAX) into `out`
+ * (TG_MAX_TRIS entries), sorted and unique.
+ */
+static size_t name_trigrams(const char *name, uint32_t *out)
+{
+    unsigned char buf[TG_NAME_MAX + 4];
+    size_t len = strlen(name);
+
+    buf[0] = buf[1] = TG_PAD;
+    for (size_t i = 0; i < len; i++)
+        buf[i + 2] = (unsigned char)tolower((unsigned char)name[i]);
+    buf[len + 2] = buf[len + 3] = TG_PAD;
+
+    size_t n = 0;
+    for (size_t i = 0; i + 3 <= len + 4; i++)
+        out[n++] = tri_pack(buf + i);
+
+    return tri_unique(out, n);
+}
+
+static void lower_copy(char *dst, const char *src, size_t size)
+{
+    size_t i = 0;
+    for (; src[i] && i + 1 < size; i++)
+        dst[i] = (char)tolower((unsigned char)src[i]);
+    dst[i] = '\0';
+}
+
+/* =========================================================================
+ * Build
+ * ========================================================================= */
+
+struct tg_pair {
+    uint32_t tri;
+    uint32_t id;
+};
+
+static int cmp_pair(const void *a, const void *b)
+{
+    const struct tg_pair *x = a, *y = b;
+    if (x->tri != y->tri)
+        return (x->tri > y->tri) - (x->tri < y->tri);
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+int trigram_build(sqlite3 *repo, const char *repo_sha, const char *path)
+{
+    sqlite3_stmt *st = NULL;
+    if (sqlite3_prepare_v2(repo,
+            "SELECT DISTINCT name FROM packages "
+            "WHERE name IS NOT NULL ORDER BY name COLLATE BINARY;",
+            -1, &st, NULL) != SQLITE_OK)
+        return 1;
+
+    char          **names = NULL;
+    size_t          nnames = 0, names_cap = 0, names_bytes = 0;
+    struct tg_pair *pairs = NULL;
+    size_t          npairs = 0, pairs_cap = 0;
+    int             failed = 0;
+
+    while (!failed && sqlite3_step(st) == SQLITE_ROW) {
+        const char *name = (const char *)sqlite3_column_text(st, 0);
+        if (!name || strlen(name) > TG_NAME_MAX)
+            continue;
+
+        if (nnames == names_cap) {
+            size_t nc = names_cap ? names_cap * 2 : 1024;
+            char **tmp = realloc(names, nc * sizeof(*tmp));
+            if (!tmp) { failed = 1; break; }
+            names = tmp;
+            names_cap = nc;
+        }
+
+        uint32_t tris[TG_MAX_TRIS];
+        size_t   nt = name_trigrams(name, tris);
+
+        if (npairs + nt > pairs_cap) {
+            size_t nc = pairs_cap ? pairs_cap * 2 : 8192;
+            while (nc < npairs + nt)
+                nc *= 2;
+            struct tg_pair *tmp = realloc(pairs, nc * sizeof(*tmp));
+            if (!tmp) { failed = 1; break; }
+            pairs = tmp;
+            pairs_cap = nc;
+        }
+
+        names[nnames] = strdup(name);
+        if (!names[nnames]) { failed = 1; break; }
+        names_bytes += strlen(name) + 1;
+
+        for (size_t i = 0; i < nt; i++) {
+            pairs[npairs].tri = tris[i];
+            pairs[npairs].id  = (uint32_t)nnames;
+            npairs++;
+        }
+        nnames++;
+    }
+    sqlite3_finalize(st);
+
+    FILE *f = NULL;
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    if (!failed) {
+        qsort(pairs, npairs, sizeof(*pairs), cmp_pair);
+
+        size_t ntri = 0;
+        for (size_t i = 0; i < npairs; i++)
+            if (i == 0 || pairs[i].tri != pairs[i - 1].tri)
+                ntri++;
+
+        struct tg_header hdr = {0};
+        memcpy(hdr.magic, TG_MAGIC, 4);
+        hdr.version     = TG_VERSION;
+        memcpy(hdr.repo_sha, repo_sha, 64);
+        hdr.nnames      = (uint32_t)nnames;
+        hdr.ntri        = (uint32_t)ntri;
+        hdr.names_bytes = (uint32_t)names_bytes;
+        hdr.npostings   = (uint32_t)npairs;
+
+        f = fopen(tmp_path, "wb");
+        if (!f) {
+            log_error("trigram: cannot create %s: %s",
+                      tmp_path, strerror(errno));
+            failed = 1;
+        }
+
+        if (!failed)
+            failed |= fwrite(&hdr, sizeof(hdr), 1, f) != 1;
+
+        /* name offsets */
+        uint32_t off = 0;
+        for (size_t i = 0; !failed && i <= nnames; i++) {
+            failed |= fwrite(&off, sizeof(off), 1, f) != 1;
+            if (i < nnames)
+                off += (uint32_t)strlen(names[i]) + 1;
+        }
+
+        /* names, then pad to 4 */
+        for (size_t i = 0; !failed && i < nnames; i++)
+            failed |= fwrite(names[i], strlen(names[i]) + 1, 1, f) != 1;
+
+        static const char zero[4] = {0};
+        size_t pad = (4 - names_bytes % 4) % 4;
+        if (!failed && pad)
+            failed |= fwrite(zero, pad, 1, f) != 1;
+
+        /* trigram table */
+        for (size_t i = 0; !failed && i < npairs; ) {
+            struct tg_tri t = { pairs[i].tri, (uint32_t)i, 0 };
+            while (i < npairs && pairs[i].tri == t.tri) {
+                t.len++;
+                i++;
+            }
+            failed |= fwrite(&t, sizeof(t), 1, f) != 1;
+        }
+
+        /* postings */
+        for (size_t i = 0; !failed && i < npairs; i++)
+            failed |= fwrite(&pairs[i].id, sizeof(uint32_t), 1, f) != 1;
+
+        if (f) {
+            if (fflush(f) != 0 || fsync(fileno(f)) != 0)
+                failed = 1;
+            if (fclose(f) != 0)
+                failed = 1;
+        }
+    }
+
+    for (size_t i = 0; i < nnames; i++)
+        free(names[i]);
+    free(names);
+    free(pairs);
+
+    if (!failed && rename(tmp_path, path) != 0)
+        failed = 1;
+
+    if (failed) {
+        unlink(tmp_path);
+        log_error("trigram: failed to build %s", path);
+        return 1;
+    }
+
+    log_info("trigram: indexed %zu names (%zu postings)", nnames, npairs);
+    return 0;
+}
+
+/* =========================================================================
+ * Open / close
+ * ========================================================================= */
+
+struct trigram_index *trigram_open(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(struct tg_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)sb.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    const struct tg_header *hdr = map;
+    char sha[64];
+
+    if (memcmp(hdr->magic, TG_MAGIC, 4) != 0 ||
+        hdr->version != TG_VERSION ||
+        repo_published_sha(sha) != 0 ||
+        memcmp(sha, hdr->repo_sha, 64) != 0)
+        goto bad;
+
+    size_t off = sizeof(*hdr);
+    size_t names_at = off + 4 * ((size_t)hdr->nnames + 1);
+    size_t tris_at  = names_at + hdr->names_bytes;
+    tris_at += (4 - tris_at % 4) % 4;
+    size_t post_at  = tris_at + sizeof(struct tg_tri) * hdr->ntri;
+    size_t end      = post_at + 4 * (size_t)hdr->npostings;
+
+    if (end != size)
+        goto bad;
+
+    struct trigram_index *idx = calloc(1, sizeof(*idx));
+    if (!idx)
+        goto bad;
+
+    idx->map      = map;
+    idx->map_size = size;
+    idx->hdr      = hdr;
+    idx->name_off = (const uint32_t *)((const char *)map + off);
+    idx->names    = (const char *)map + names_at;
+    idx->tris     = (const struct tg_tri *)((const char *)map + tris_at);
+    idx->postings = (const uint32_t *)((const char *)map + post_at);
+
+    if (idx->name_off[hdr->nnames] != hdr->names_bytes ||
+        (hdr->names_bytes && idx->names[hdr->names_bytes - 1] != '\0')) {
+        free(idx);
+        goto bad;
+    }
+
+    return idx;
+
+bad:
+    munmap(map, size);
+    return NULL;
+}
+
+void trigram_close(struct trigram_index *idx)
+{
+    if (!idx)
+        return;
+    munmap(idx->map, idx->map_size);
+    free(idx);
+}
+
+/* =========================================================================
+ * Lookup helpers
+ * ========================================================================= */
+
+/*
+ * Offsets come from the file, which is only keyed by the repo.db it
+ * was built from: anything out of range reads as "" rather than past
+ * the mapping (trigram_open checks that names[] ends in a NUL).
+ */
+static const char *name_at(const struct trigram_index *idx, uint32_t id)
+{
+    if (id >= idx->hdr->nnames)
+        return "";
+    uint32_t off = idx->name_off[id];
+    return off < idx->hdr->names_bytes ? idx->names + off : "";
+}
+
+static const struct tg_tri *find_tri(const struct trigram_index *idx,
+                                     uint32_t tri)
+{
+    size_t lo = 0, hi = idx->hdr->ntri;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint32_t t = idx->tris[mid].tri;
+        if (t == tri)
+            return &idx->tris[mid];
+        if (t < tri)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+/* a posting list is valid if it lies inside postings[] */
+static int list_ok(const struct trigram_index *idx, const struct tg_tri *t)
+{
+    return (size_t)t->off + t->len <= idx->hdr->npostings;
+}
+
+static int list_has(const struct trigram_index *idx,
+                    const struct tg_tri *t, uint32_t id)
+{
+    const uint32_t *p = idx->postings + t->off;
+    size_t lo = 0, hi = t->len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (p[mid] == id)
+            return 1;
+        if (p[mid] < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return 0;
+}
+
+/* =========================================================================
+ * Glob / substring
+ * ========================================================================= */
+
+static int glob_match(const struct trigram_index *idx, uint32_t id,
+                      const char *pattern)
+{
+    if (id >= idx->hdr->nnames)
+        return 0;
+
+    char lower[TG_NAME_MAX + 1];
+    lower_copy(lower, name_at(idx, id), sizeof(lower));
+    return fnmatch(pattern, lower, 0) == 0;
+}
+
+size_t trigram_glob(const struct trigram_index *idx, const char *pattern,
+                    trigram_match_fn cb, void *ctx)
+{
+    size_t plen = strlen(pattern);
+    if (plen > TG_NAME_MAX)
+        return 0;
+
+    /* lowercase; bare words become *word* */
+    char pat[TG_NAME_MAX + 3];
+    int has_wild = strpbrk(pattern, "*?") != NULL;
+    size_t o = 0;
+    if (!has_wild)
+        pat[o++] = '*';
+    for (size_t i = 0; i < plen; i++)
+        pat[o++] = (char)tolower((unsigned char)pattern[i]);
+    if (!has_wild)
+        pat[o++] = '*';
+    pat[o] = '\0';
+
+    /* trigrams of every literal run */
+    uint32_t tris[TG_NAME_MAX];
+    size_t   nt = 0;
+    size_t   run = 0;
+
+    for (size_t i = 0; i <= o; i++) {
+        char c = pat[i];
+        if (c == '\0' || c == '*' || c == '?') {
+            for (size_t j = i - run; run >= 3 && j + 3 <= i; j++)
+                tris[nt++] = tri_pack((const unsigned char *)pat + j);
+            run = 0;
+        } else {
+            run++;
+        }
+    }
+    nt = tri_unique(tris, nt);
+
+    size_t hits = 0;
+
+    /* no usable trigram (short literals): check every name */
+    if (nt == 0) {
+        for (uint32_t id = 0; id < idx->hdr->nnames; id++)
+            if (glob_match(idx, id, pat)) {
+                cb(name_at(idx, id), ctx);
+                hits++;
+            }
+        return hits;
+    }
+
+    const struct tg_tri *lists[TG_NAME_MAX];
+    size_t shortest = 0;
+
+    for (size_t i = 0; i < nt; i++) {
+        lists[i] = find_tri(idx, tris[i]);
+        if (!lists[i] || !list_ok(idx, lists[i]))
+            return 0;
+        if (lists[i]->len < lists[shortest]->len)
+            shortest = i;
+    }
+
+    const struct tg_tri *base = lists[shortest];
+    for (uint32_t k = 0; k < base->len; k++) {
+        uint32_t id = idx->postings[base->off + k];
+
+        int all = 1;
+        for (size_t i = 0; i < nt && all; i++)
+            if (i != shortest && !list_has(idx, lists[i], id))
+                all = 0;
+
+        if (all && glob_match(idx, id, pat)) {
+            cb(name_at(idx, id), ctx);
+            hits++;
+        }
+    }
+
+    return hits;
+}
+
+/* =========================================================================
+ * Suggestions
+ * ========================================================================= */
+
+/*
+ * Optimal string alignment distance (Levenshtein plus adjacent
+ * transposition), abandoned as soon as every cell in a row exceeds
+ * `limit`.  Returns limit + 1 in that case.
+ */
+static int edit_distance(const char *a, size_t la,
+                         const char *b, size_t lb, int limit)
+{
+    int rows[3][TG_NAME_MAX + 1];
+    int *prev2 = rows[0], *prev = rows[1], *cur = rows[2];
+
+    for (size_t j = 0; j <= lb; j++)
+        prev[j] = (int)j;
+
+    for (size_t i = 1; i <= la; i++) {
+        cur[0] = (int)i;
+        int row_min = cur[0];
+
+        for (size_t j = 1; j <= lb; j++) {
+            int cost = a[i - 1] != b[j - 1];
+            int v = prev[j] + 1;
+            if (cur[j - 1] + 1 < v)    v = cur[j - 1] + 1;
+            if (prev[j - 1] + cost < v) v = prev[j - 1] + cost;
+            if (i > 1 && j > 1 &&
+                a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1] &&
+                prev2[j - 2] + 1 < v)
+                v = prev2[j - 2] + 1;
+            cur[j] = v;
+            if (v < row_min)
+                row_min = v;
+        }
+
+        if (row_min > limit)
+            return limit + 1;
+
+        int *t = prev2;
+        prev2 = prev;
+        prev  = cur;
+        cur   = t;
+    }
+
+    return prev[lb];
+}
+
+struct suggestion {
+    uint32_t id;
+    int      dist;
+    unsigned shared;
+};
+
+size_t trigram_suggest(const struct trigram_index *idx, const char *name,
+                       int max_dist, const char **out, size_t max)
+{
+    size_t qlen = strlen(name);
+    if (qlen == 0 || qlen > TG_NAME_MAX || max == 0)
+        return 0;
+
+    char q[TG_NAME_MAX + 1];
+    lower_copy(q, name, sizeof(q));
+
+    uint32_t tris[TG_MAX_TRIS];
+    size_t nt = name_trigrams(q, tris);
+
+    uint32_t nnames = idx->hdr->nnames;
+    uint16_t *shared  = calloc(nnames ? nnames : 1, sizeof(*shared));
+    uint32_t *touched = NULL;
+    size_t    ntouched = 0, touched_cap = 0;
+    struct suggestion *best = calloc(max, sizeof(*best));
+    size_t nbest = 0;
+
+    if (!shared || !best)
+        goto out;
+
+    for (size_t i = 0; i < nt; i++) {
+        const struct tg_tri *t = find_tri(idx, tris[i]);
+        if (!t || !list_ok(idx, t))
+            continue;
+
+        for (uint32_t k = 0; k < t->len; k++) {
+            uint32_t id = idx->postings[t->off + k];
+            if (id >= nnames)
+                continue;
+            if (shared[id]++ == 0) {
+                if (ntouched == touched_cap) {
+                    size_t nc = touched_cap ? touched_cap * 2 : 256;
+                    uint32_t *tmp = realloc(touched, nc * sizeof(*tmp));
+                    if (!tmp)
+                        goto out;
+                    touched = tmp;
+                    touched_cap = nc;
+                }
+                touched[ntouched++] = id;
+            }
+        }
+    }
+
+    long threshold = (long)nt - 3L * max_dist;
+    if (threshold < 1)
+        threshold = 1;
+
+    for (size_t i = 0; i < ntouched; i++) {
+        uint32_t id = touched[i];
+        if (shared[id] < threshold)
+            continue;
+
+        char cand[TG_NAME_MAX + 1];
+        lower_copy(cand, name_at(idx, id), sizeof(cand));
+        size_t clen = strlen(cand);
+
+        long diff = (long)clen - (long)qlen;
+        if (diff > max_dist || -diff > max_dist)
+            continue;
+
+        int d = edit_distance(q, qlen, cand, clen, max_dist);
+        if (d > max_dist)
+            continue;
+
+        /* insertion sort into best[]: distance, then shared, then id */
+        struct suggestion s = { id, d, shared[id] };
+        size_t pos = nbest;
+        while (pos > 0) {
+            const struct suggestion *p = &best[pos - 1];
+            int worse = p->dist > s.dist ||
+                        (p->dist == s.dist && p->shared < s.shared) ||
+                        (p->dist == s.dist && p->shared == s.shared &&
+                         p->id > s.id);
+            if (!worse)
+                break;
+            if (pos < max)
+                best[pos] = *p;
+            pos--;
+        }
+        if (pos < max) {
+            best[pos] = s;
+            if (nbest < max)
+                nbest++;
+        }
+    }
+
+    for (size_t i = 0; i < nbest; i++)
+        out[i] = name_at(idx, best[i].id);
+
+out:
+    free(shared);
+    free(touched);
+    free(best);
+    return nbest;
+}
+
+void trigram_did_you_mean(const char *name)
+{
+    struct trigram_index *idx = trigram_open(FLAPPY_REPO_TRIGRAM_PATH);
+    if (!idx)
+        return;
+
+    const char *hits[3];
+    size_t n = trigram_suggest(idx, name, 2, hits, 3);
+
+    if (n > 0) {
+        fprintf(stderr, "did you mean: ");
+        for (size_t i = 0; i < n; i++)
+            fprintf(stderr, "%s%s", i ? ", " : "", hits[i]);
+        fprintf(stderr, "?\n");
+    }
+
+    trigram_close(idx);
+}
@@ -0,0 +1,738 @@
+/*
+ * upgrade.c - Full-system upgrade executor (`flappy upgrade --apply`)
+ *
+ * PIPELINE
+ *
+ *   plan     repo_upgrade_plan — the same list `flappy upgrade` prints
+ *   lookup   install_lookup_version for the planned version of every
+ *            entry, and install_delta_find: when the repository
+ *            publishes a delta from an archive still in the cache, the
+ *            delta is fetched instead
+ *   fetch    install_download_batch downloads every archive at once
+ *   prepare  worker threads rebuild delta'd archives, verify, extract
+ *            and read .PKGINFO, which must name the planned version.
+ *            A package is queued for a worker the moment its
+ *            download completes, so extraction overlaps the remaining
+ *            transfers.  A delta that fails to download or rebuild is
+ *            followed by a second round fetching the full archives.
+ *   commit   sequential, dependencies first within the upgrade set:
+ *              new dependencies (resolve_and_install)
+ *              → conflict check → pre_upgrade
+ *              → install_commit_upgrade → post_upgrade
+ *
+ * The commit step stays sequential on purpose: it owns the single DB
+ * connection and each package is an independent atomic swap, so a
+ * failure stops the run with every earlier package fully upgraded and
+ * every later one untouched.
+ *
+ * Before the first commit the staged packages are checked against
+ * each other (a new path two of them ship) and each against the
+ * installed owners: a path another package of the set drops (say,
+ * moved from A to B) is no conflict, and whichever of the two commits
+ * first, install_commit_upgrade hands the file's row to its new owner.
+ *
+ * If any package fails to download, verify, extract or the conflict
+ * check, nothing is committed and all staging directories are removed.
+ *
+ * PREFETCH (`flappy upgrade --download-only`)
+ *
+ *   Runs plan, lookup and fetch as above and stops after verifying:
+ *   every archive of the upgrade set ends up in the package cache
+ *   (deltas rebuilt into full archives), so a later --apply only
+ *   re-checks cache hits.  Meant for a timer, it:
+ *     - takes a non-blocking lock on PREFETCH_LOCK_PATH and exits if
+ *       another prefetch holds it;
+ *     - drops to nice 19 and the idle I/O class before any thread
+ *       starts, so the workers inherit both;
+ *     - downloads in netsched's background class: capped by
+ *       --limit-rate (or background_rate), and slowed to the yield
+ *       rate while an interactive flappy is downloading.
+ *   Transfers publish into the cache by rename, so a concurrent
+ *   --apply never sees a partial archive.  Nothing is extracted and
+ *   the installed system is not touched.
+ *
+ * UX contract:
+ *   [INFO] checking for updates...
+ *   downloading <file>            (one line per transfer)
+ *   [OK] downloaded <file>
+ *   [OK] rebuilt <file> from delta
+ *   [WARN] delta for <pkg> failed — downloading the full archive
+ *   [OK] staged <pkg> <ver>
+ *   [OK] upgraded: <pkg> <old> -> <new>
+ *   [INFO] upgraded N package(s)
+ *   [INFO] N archive(s) ready in the package cache   (--download-only)
+ */
+
+#define _GNU_SOURCE     /* syscall (ioprio_set) */
+
+#include "upgrade.h"
+#include "flappy.h"
+#include "hooks.h"
+#include "install.h"
+#include "netsched.h"
+#include "pkg_meta.h"
+#include "repo.h"
+#include "resolve.h"
+#include "ui.h"
+#include "version.h"
+#include "workq.h"
+
+#include <sqlite3.h>
+#include <pthread.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define MAX_PREPARE_WORKERS 8
+
+#define PREFETCH_LOCK_PATH FLAPPY_REPO_DIR "/prefetch.lock"
+#define PREFETCH_NICE      19
+
+/* linux/ioprio.h */
+#define IOPRIO_WHO_PROCESS  1
+#define IOPRIO_CLASS_IDLE   3
+#define IOPRIO_CLASS_SHIFT  13
+
+struct upgrade_job {
+    const struct upgrade_entry *entry;
+    char                filename[256];
+    char                checksum[128];
+    char                base_url[REPO_URL_MAX];
+    struct download_req *req;       /* entry in the batch array */
+    struct delta_info   delta;
+    int                 use_delta;  /* req fetches delta.filename */
+    int                 rebuilt;    /* delta applied and verified */
+    char                staging[512];
+    struct flappy_pkg  *meta;
+    int                 prepared;   /* verify + extract succeeded */
+    int                 committed;  /* used for dependency ordering */
+};
+
+/* =========================================================================
+ * Prepare queue — filled by the download callback, drained by workers
+ * ========================================================================= */
+
+struct prep_queue {
+    struct workq  q;
+    int           fetch_only;       /* verify only, no extraction */
+};
+
+static void on_downloaded(struct download_req *req, void *ctx)
+{
+    struct prep_queue *q = ctx;
+    if (req->status == 0)
+        workq_push(&q->q, req->user);
+}
+
+/*
+ * is_planned
+ *
+ * Is `got`, the archive's "pkgver-pkgrel", the version the plan chose?
+ * A repository that lists bare pkgver versions plans "2.0" for any
+ * release of 2.0.
+ */
+static int is_planned(const char *got, const char *planned)
+{
+    if (version_cmp(got, planned) == 0)
+        return 1;
+    if (strchr(planned, '-'))
+        return 0;
+
+    char pkgver[64];
+    snprintf(pkgver, sizeof(pkgver), "%s", got);
+    char *rel = strrchr(pkgver, '-');
+    if (!rel)
+        return 0;
+    *rel = '\0';
+    return version_cmp(pkgver, planned) == 0;
+}
+
+static void *prepare_worker(void *arg)
+{
+    struct prep_queue *q = arg;
+    struct upgrade_job *job;
+
+    while ((job = workq_pop(&q->q)) != NULL) {
+        /* local_path becomes the rebuilt archive, verified already */
+        if (job->use_delta) {
+            char delta_path[sizeof(job->req->local_path)];
+            memcpy(delta_path, job->req->local_path, sizeof(delta_path));
+
+            if (install_delta_apply(&job->delta, delta_path, job->filename,
+                                    job->checksum,
+                                    job->req->local_path) != 0)
+                continue;
+
+            job->rebuilt = 1;
+            ui_ok("rebuilt %s from delta", job->filename);
+        } else if (install_verify(job->req->local_path,
+                                  job->checksum) != 0) {
+            ui_error("integrity verification failed: %s", job->filename);
+            continue;
+        }
+
+        if (q->fetch_only) {
+            job->prepared = 1;
+            continue;
+        }
+
+        if (install_extract(job->req->local_path, job->staging) != 0) {
+            ui_error("extraction failed: %s", job->filename);
+            continue;
+        }
+
+        job->meta = pkg_read_from_file(job->req->local_path);
+        if (!job->meta || strcmp(job->meta->name, job->entry->name) != 0) {
+            ui_error("package metadata mismatch: %s", job->filename);
+            continue;
+        }
+
+        if (!is_planned(job->meta->version, job->entry->to)) {
+            ui_error("%s is version %s, planned %s — not upgraded",
+                     job->filename, job->meta->version, job->entry->to);
+            continue;
+        }
+
+        job->prepared = 1;
+        ui_ok("staged %s %s", job->entry->name, job->meta->version);
+    }
+
+    return NULL;
+}
+
+/* =========================================================================
+ * Helpers
+ * ========================================================================= */
+
+static void remove_staging(const char *staging_dir)
+{
+    if (!staging_dir || staging_dir[0] == '\0')
+        return;
+    char cmd[512 + 32];
+    snprintf(cmd, sizeof(cmd), "rm -rf \"%s\"", staging_dir);
+    (void)system(cmd);
+}
+
+static struct upgrade_job *find_job(struct upgrade_job *jobs, size_t n,
+                                    const char *name)
+{
+    for (size_t i = 0; i < n; i++)
+        if (strcmp(jobs[i].entry->name, name) == 0)
+            return &jobs[i];
+    return NULL;
+}
+
+/*
+ * next_job
+ *
+ * Picks the next uncommitted job whose in-set dependencies have all
+ * been committed.  Jobs are in name order, so ties resolve
+ * deterministically.  A dependency cycle inside the upgrade set falls
+ * back to name order rather than deadlocking.
+ */
+static struct upgrade_job *next_job(struct upgrade_job *jobs, size_t n)
+{
+    struct upgrade_job *fallback = NULL;
+
+    for (size_t i = 0; i < n; i++) {
+        struct upgrade_job *job = &jobs[i];
+        if (job->committed)
+            continue;
+        if (!fallback)
+            fallback = job;
+
+        int ready = 1;
+        for (size_t d = 0; d < job->meta->depends_count && ready; d++) {
+            struct upgrade_job *dep =
+                find_job(jobs, n, job->meta->depends[d].name);
+            if (dep && dep != job && !dep->committed)
+                ready = 0;
+        }
+        if (ready)
+            return job;
+    }
+
+    return fallback;
+}
+
+/*
+ * install_new_deps
+ *
+ * The new version may declare dependencies the old one did not.
+ * Install those through the normal resolver before the upgrade commit,
+ * which requires every dependency to be present.
+ */
+static int install_new_deps(const struct upgrade_job *job)
+{
+    const struct flappy_pkg *meta = job->meta;
+    char **missing = calloc(meta->depends_count + 1, sizeof(char *));
+    if (!missing)
+        return 1;
+
+    size_t count = 0;
+
+    db_open_or_die();
+    for (size_t i = 0; i < meta->depends_count; i++) {
+        if (!db_pkg_installed(meta->depends[i].name))
+            missing[count++] = meta->depends[i].name;
+    }
+    db_close();
+
+    int rc = 0;
+    for (size_t i = 0; i < count && rc == 0; i++) {
+        ui_info("%s %s requires new dependency %s",
+                meta->name, meta->version, missing[i]);
+        rc = resolve_and_install(missing[i]);
+    }
+
+    free(missing);
+    return rc;
+}
+
+/*
+ * check_conflicts
+ *
+ * The conflict check for `job` against the uncommitted rest of the
+ * set, so a path moving to it from another package of the set is no
+ * conflict whichever of the two commits first.  `set` has room for n
+ * entries.  The DB must be open.
+ */
+static int check_conflicts(const struct upgrade_job *jobs, size_t n,
+                           const struct upgrade_job *job,
+                           struct staged_pkg *set)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (&jobs[i] == job || jobs[i].committed)
+            continue;
+        set[count].name        = jobs[i].entry->name;
+        set[count].staging_dir = jobs[i].staging;
+        count++;
+    }
+
+    return install_conflict_staged_set(job->entry->name, job->staging,
+                                       set, count);
+}
+
+static int commit_job(const struct upgrade_job *jobs, size_t n,
+                      struct upgrade_job *job, struct staged_pkg *set)
+{
+    const char *name = job->entry->name;
+    const char *from = job->entry->from;
+    const char *to   = job->meta->version;
+
+    if (install_new_deps(job) != 0)
+        return 1;
+
+    db_open_or_die();
+
+    if (check_conflicts(jobs, n, job, set) != 0) {
+        db_close();
+        return 1;
+    }
+
+    if (hook_install_from_pkg(name, job->req->local_path) != 0) {
+        ui_error("cannot install hook script for %s", name);
+        db_close();
+        return 1;
+    }
+
+    char hook[256];
+    hook_path(name, hook, sizeof(hook));
+
+    if (run_hook(hook, "pre_upgrade", to, from) != 0) {
+        ui_error("pre_upgrade hook failed for %s — not upgraded", name);
+        db_close();
+        return 1;
+    }
+
+    if (install_commit_upgrade(name, job->req->local_path,
+                               job->staging) != 0) {
+        db_close();
+        return 1;
+    }
+
+    db_close();
+
+    if (run_hook(hook, "post_upgrade", to, from) != 0)
+        ui_warn("post_upgrade hook failed for %s", name);
+
+    ui_ok("upgraded: %s %s -> %s", name, from, to);
+    log_info("upgrade: %s %s -> %s", name, from, to);
+    return 0;
+}
+
+/*
+ * fetch_prepare
+ *
+ * Downloads `reqs` and prepares each job as its download completes
+ * (with `fetch_only`, only rebuilds and verifies it).  `slots` has
+ * room for n jobs.  Returns 1 if no worker could start.
+ */
+static int fetch_prepare(struct download_req *reqs, size_t n,
+                         void **slots, int fetch_only)
+{
+    struct prep_queue q = {
+        .q          = WORKQ_INIT(slots),
+        .fetch_only = fetch_only,
+    };
+
+    int nworkers = workq_workers(n, MAX_PREPARE_WORKERS);
+    pthread_t workers[MAX_PREPARE_WORKERS];
+    int started = 0;
+
+    for (int i = 0; i < nworkers; i++) {
+        if (pthread_create(&workers[i], NULL, prepare_worker, &q) != 0)
+            break;
+        started++;
+    }
+
+    if (started == 0) {
+        ui_error("cannot start worker threads");
+        return 1;
+    }
+
+    install_download_batch(reqs, n, on_downloaded, &q);
+
+    workq_close(&q.q);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    return 0;
+}
+
+/*
+ * fetch_full
+ *
+ * Second round for the jobs whose delta did not download or rebuild:
+ * the full archive, prepared the same way.
+ */
+static int fetch_full(struct upgrade_job *jobs, size_t n,
+                      void **slots, int fetch_only,
+                      struct download_req **retry_out)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++)
+        count += jobs[i].use_delta && !jobs[i].rebuilt;
+
+    *retry_out = NULL;
+    if (count == 0)
+        return 0;
+
+    struct download_req *retry = calloc(count, sizeof(*retry));
+    if (!retry) {
+        ui_error("out of memory");
+        return 1;
+    }
+    *retry_out = retry;
+
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        struct upgrade_job *job = &jobs[i];
+        if (!job->use_delta || job->rebuilt)
+            continue;
+
+        ui_warn("delta for %s failed — downloading the full archive",
+                job->entry->name);
+        job->use_delta   = 0;
+        retry[k].filename = job->filename;
+        retry[k].checksum = job->checksum;
+        retry[k].base_url = job->base_url;
+        retry[k].user     = job;
+        job->req          = &retry[k++];
+    }
+
+    return fetch_prepare(retry, count, slots, fetch_only);
+}
+
+/*
+ * lookup_jobs
+ *
+ * Fills one job and one download request per plan entry: the archive
+ * of exactly the planned version, or a delta to it when
+ * install_delta_find has one.  Returns 1 if a
+ * package is missing from the repository.
+ */
+static int lookup_jobs(const struct upgrade_plan *plan,
+                       struct upgrade_job *jobs, struct download_req *reqs)
+{
+    int failed = 0;
+
+    for (size_t i = 0; i < plan->count; i++) {
+        jobs[i].entry = &plan->entries[i];
+        if (install_lookup_version(plan->entries[i].name,
+                                   plan->entries[i].to, jobs[i].filename,
+                                   jobs[i].checksum, jobs[i].base_url) != 0) {
+            ui_error("package not found in repository: %s %s",
+                     plan->entries[i].name, plan->entries[i].to);
+            failed = 1;
+        }
+        reqs[i].filename = jobs[i].filename;
+        reqs[i].checksum = jobs[i].checksum;
+        reqs[i].base_url = jobs[i].base_url;
+        reqs[i].user     = &jobs[i];
+        jobs[i].req      = &reqs[i];
+
+        if (!failed && install_delta_find(plan->entries[i].name,
+                                          jobs[i].filename,
+                                          &jobs[i].delta) == 0) {
+            jobs[i].use_delta = 1;
+            reqs[i].filename  = jobs[i].delta.filename;
+            reqs[i].checksum  = jobs[i].delta.checksum;
+        }
+    }
+
+    return failed;
+}
+
+/*
+ * prefetch_lock
+ *
+ * Non-blocking exclusive lock held until the process exits.  Returns
+ * 0 when taken, 1 if another prefetch holds it, -1 on error.
+ */
+static int prefetch_lock(void)
+{
+    int fd = open(PREFETCH_LOCK_PATH, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ui_error("cannot open %s: %s", PREFETCH_LOCK_PATH, strerror(errno));
+        return -1;
+    }
+
+    struct flock fl = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+    if (fcntl(fd, F_SETLK, &fl) == 0)
+        return 0;
+
+    int busy = (errno == EACCES || errno == EAGAIN);
+    if (!busy)
+        ui_error("cannot lock %s: %s", PREFETCH_LOCK_PATH, strerror(errno));
+    close(fd);
+    return busy ? 1 : -1;
+}
+
+/*
+ * background_priority
+ *
+ * Lowest CPU priority and the idle I/O class for this thread and every
+ * thread started after it.  Best effort: a kernel or I/O scheduler
+ * without I/O classes just keeps the default.
+ */
+static void background_priority(void)
+{
+    if (setpriority(PRIO_PROCESS, 0, PREFETCH_NICE) != 0)
+        log_info("prefetch: setpriority: %s", strerror(errno));
+
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+        log_info("prefetch: ioprio_set: %s", strerror(errno));
+}
+
+/* =========================================================================
+ * Public entry
+ * ========================================================================= */
+
+int upgrade_apply(void)
+{
+    if (install_guard()) {
+        ui_error("root privileges required");
+        return 1;
+    }
+
+    ui_info("checking for updates...");
+
+    struct upgrade_plan plan;
+    if (repo_upgrade_plan(&plan) != 0)
+        return 1;
+
+    if (plan.count == 0) {
+        ui_info("system is up to date");
+        return 0;
+    }
+
+    size_t n = plan.count;
+    struct upgrade_job  *jobs  = calloc(n, sizeof(*jobs));
+    struct download_req *reqs  = calloc(n, sizeof(*reqs));
+    void **slots = calloc(n, sizeof(*slots));
+    struct staged_pkg   *set   = calloc(n, sizeof(*set));
+    if (!jobs || !reqs || !slots || !set) {
+        ui_error("out of memory");
+        free(jobs);
+        free(reqs);
+        free(slots);
+        free(set);
+        repo_upgrade_plan_free(&plan);
+        return 1;
+    }
+
+    /* --- lookup --- */
+    int failed = lookup_jobs(&plan, jobs, reqs);
+
+    if (failed) {
+        free(jobs);
+        free(reqs);
+        free(slots);
+        free(set);
+        repo_upgrade_plan_free(&plan);
+        return 1;
+    }
+
+    /* --- fetch + prepare, overlapped; full archives for failed deltas --- */
+    struct download_req *retry = NULL;
+
+    if (fetch_prepare(reqs, n, slots, 0) != 0 ||
+            fetch_full(jobs, n, slots, 0, &retry) != 0) {
+        for (size_t i = 0; i < n; i++) {
+            remove_staging(jobs[i].staging);
+            pkg_meta_free(jobs[i].meta);
+        }
+        free(retry);
+        free(jobs);
+        free(reqs);
+        free(slots);
+        free(set);
+        repo_upgrade_plan_free(&plan);
+        return 1;
+    }
+
+    for (size_t i = 0; i < n; i++)
+        if (!jobs[i].prepared)
+            failed = 1;
+
+    /* --- conflicts, for the whole set before anything commits --- */
+    if (!failed) {
+        for (size_t i = 0; i < n; i++) {
+            set[i].name        = jobs[i].entry->name;
+            set[i].staging_dir = jobs[i].staging;
+        }
+        failed = install_conflict_within(set, n) != 0;
+    }
+    if (!failed) {
+        db_open_or_die();
+        for (size_t i = 0; i < n && !failed; i++)
+            if (check_conflicts(jobs, n, &jobs[i], set) != 0)
+                failed = 1;
+        db_close();
+    }
+
+    if (failed) {
+        ui_error("upgrade aborted — no packages were changed");
+        for (size_t i = 0; i < n; i++) {
+            remove_staging(jobs[i].staging);
+            pkg_meta_free(jobs[i].meta);
+        }
+        free(retry);
+        free(jobs);
+        free(reqs);
+        free(slots);
+        free(set);
+        repo_upgrade_plan_free(&plan);
+        return 1;
+    }
+
+    /* --- commit, dependencies first --- */
+    size_t done = 0;
+    struct upgrade_job *job;
+
+    while (done < n && (job = next_job(jobs, n)) != NULL) {
+        if (commit_job(jobs, n, job, set) != 0) {
+            ui_error("failed to upgrade '%s' — stopping "
+                     "(%zu package(s) not upgraded)",
+                     job->entry->name, n - done);
+            failed = 1;
+            break;
+        }
+        job->committed = 1;
+        done++;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (!jobs[i].committed)
+            remove_staging(jobs[i].staging);
+        pkg_meta_free(jobs[i].meta);
+    }
+
+    if (!failed)
+        ui_info("upgraded %zu package(s)", done);
+
+    free(retry);
+    free(jobs);
+    free(reqs);
+    free(slots);
+    free(set);
+    repo_upgrade_plan_free(&plan);
+    return failed;
+}
+
+int upgrade_download_only(long long rate_limit)
+{
+    if (install_guard()) {
+        ui_error("root privileges required");
+        return 1;
+    }
+
+    int lock = prefetch_lock();
+    if (lock != 0) {
+        if (lock > 0)
+            ui_info("another prefetch is running — nothing to do");
+        return lock < 0;
+    }
+
+    background_priority();
+    netsched_set_class(NETSCHED_BACKGROUND);
+    netsched_set_rate(rate_limit);
+
+    ui_info("checking for updates...");
+
+    struct upgrade_plan plan;
+    if (repo_upgrade_plan(&plan) != 0)
+        return 1;
+
+    if (plan.count == 0) {
+        ui_info("system is up to date");
+        repo_upgrade_plan_free(&plan);
+        return 0;
+    }
+
+    size_t n = plan.count;
+    struct upgrade_job  *jobs  = calloc(n, sizeof(*jobs));
+    struct download_req *reqs  = calloc(n, sizeof(*reqs));
+    void **slots = calloc(n, sizeof(*slots));
+    struct download_req *retry = NULL;
+    int failed = 1;
+
+    if (!jobs || !reqs || !slots) {
+        ui_error("out of memory");
+        goto out;
+    }
+
+    if (lookup_jobs(&plan, jobs, reqs) != 0 ||
+        fetch_prepare(reqs, n, slots, 1) != 0 ||
+        fetch_full(jobs, n, slots, 1, &retry) != 0)
+        goto out;
+
+    size_t ready = 0;
+    for (size_t i = 0; i < n; i++)
+        ready += jobs[i].prepared;
+
+    failed = ready != n;
+    if (failed)
+        ui_error("%zu of %zu archive(s) could not be fetched", n - ready, n);
+    else
+        ui_info("%zu archive(s) ready in the package cache", n);
+    log_info("prefetch: %zu of %zu archive(s) cached", ready, n);
+
+out:
+    free(retry);
+    free(jobs);
+    free(reqs);
+    free(slots);
+    repo_upgrade_plan_free(&plan);
+    return failed;
+}
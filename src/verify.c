@@ -1,9 +1,38 @@
 /*
  * verify.c - System integrity verification
  *
+ * Every files row is checked against the disk without following
+ * symlinks, looked up VERIFY_BATCH rows at a time with statx_batch
+ * (statx_batch.h) so hundreds of lookups are in flight instead of one.
+ * A regular file must still be a regular file, a symlink a
+ * symlink pointing where it was packaged to (files.link_target, or the
+ * sha256 of the target string on rows recorded before link_target
+ * existed).  Rows with no recorded mode (installed before schema v4)
+ * accept either.
+ *
+ * With `deep`, every regular file with a recorded sha256 is also read
+ * back and hashed.  A size that differs from files.size is drift
+ * without reading a byte; the rest are handed to digest_batch
+ * (digest.h) in one batch, which keeps a fast SSD's queues busy while
+ * every core hashes.  Results are kept per row and printed in row
+ * order once the batch is done, so the report does not depend on
+ * thread timing.
+ *
+ * A file found intact is remembered in verify_cache with its dev,
+ * inode, size, mtime and ctime as looked up before hashing.  The next
+ * deep check rehashes only files whose metadata no longer matches, or
+ * whose recorded sha256 changed since (an upgrade); VERIFY_FULL
+ * ignores the cache and rehashes everything.  ctime cannot be set
+ * from user space, so content written since the last check is always
+ * seen, short of the clock being turned back or the filesystem being
+ * edited offline — which is what VERIFY_FULL is for.
+ *
  * UX contract:
  *   missing: /usr/bin/curl (owned by curl)
  *   invalid: /usr/lib/libssl.so (expected file)
+ *   invalid: /usr/lib/libz.so (expected symlink)
+ *   modified: /usr/bin/curl (owned by curl)
+ *   unreadable: /usr/bin/curl (Permission denied)
  *   verification failed
  *
  *   Clean:
@@ -14,73 +43,695 @@
 
 #include "flappy.h"
 #include "db_guard.h"
+#include "maintenance.h"
+#include "root.h"
+#include "digest.h"
+#include "statx_batch.h"
 #include "ui.h"
 
 #include <sqlite3.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
+#define VERIFY_BATCH     16384      /* rows looked up per statx_batch */
+
+enum vstate {
+    V_OK,
+    V_MISSING,
+    V_NOT_FILE,
+    V_NOT_LINK,
+    V_MODIFIED,
+    V_UNREADABLE,
+};
 
-int verify_system(void)
+/* One package, in report order */
+struct vpkg {
+    sqlite3_int64  id;
+    char          *name;
+    size_t         nfiles;      /* files rows loaded */
+};
+
+/* One files row and what the check found */
+struct vfile {
+    char        *path;          /* absolute, as stored */
+    size_t       pkg;           /* index into vset.pkgs */
+    long long    size;          /* -1: unknown */
+    unsigned     mode;          /* 0: unknown (pre-v4 row) */
+    char         sha256[65];    /* "" : unknown */
+    char        *link_target;   /* NULL: unknown or not a link */
+    int          hash;          /* deep: needs its content hashed */
+    int          cached;        /* deep: `meta` holds a cache entry */
+    struct file_meta meta;      /* cache entry, then as looked up */
+    enum vstate  state;
+    int          err;           /* errno, V_UNREADABLE */
+};
+
+struct vset {
+    struct vpkg  *pkgs;         /* sorted by name */
+    size_t        npkgs;
+    struct vfile *files;        /* sorted by package, then path */
+    size_t        count;
+    int           check_empty;  /* report packages with no rows */
+};
+
+static void vset_free(struct vset *v)
 {
-    sqlite3 *db = db_handle();
-    if (!db) return 1;
+    for (size_t i = 0; i < v->npkgs; i++)
+        free(v->pkgs[i].name);
+    for (size_t i = 0; i < v->count; i++) {
+        free(v->files[i].path);
+        free(v->files[i].link_target);
+    }
+    free(v->pkgs);
+    free(v->files);
+    memset(v, 0, sizeof(*v));
+}
 
-    int issues = 0;
+/* Package ids mapped to their report position, for bsearch */
+struct vpkg_id {
+    sqlite3_int64 id;
+    size_t        pkg;
+};
+
+static int cmp_pkg_id(const void *a, const void *b)
+{
+    sqlite3_int64 x = ((const struct vpkg_id *)a)->id;
+    sqlite3_int64 y = ((const struct vpkg_id *)b)->id;
+    return (x > y) - (x < y);
+}
+
+static int cmp_vfile(const void *a, const void *b)
+{
+    const struct vfile *x = a, *y = b;
+    if (x->pkg != y->pkg)
+        return x->pkg < y->pkg ? -1 : 1;
+    return strcmp(x->path, y->path);
+}
+
+static int cmp_vpkg(const void *a, const void *b)
+{
+    return strcmp(((const struct vpkg *)a)->name,
+                  ((const struct vpkg *)b)->name);
+}
 
-    /* Check 1: every file exists and is a regular file */
+static int add_package(struct vset *v, size_t *cap, sqlite3_int64 id,
+                       const char *name)
+{
+    if (v->npkgs == *cap) {
+        size_t newcap = *cap ? *cap * 2 : 64;
+        struct vpkg *tmp = realloc(v->pkgs, newcap * sizeof(*tmp));
+        if (!tmp)
+            return 1;
+        v->pkgs = tmp;
+        *cap    = newcap;
+    }
+
+    struct vpkg *p = &v->pkgs[v->npkgs];
+    p->id     = id;
+    p->nfiles = 0;
+    if (!(p->name = strdup(name)))
+        return 1;
+    v->npkgs++;
+    return 0;
+}
+
+/*
+ * load_packages
+ *
+ * The packages in scope, sorted by name: the named ones, each looked
+ * up by its unique index, or all of them.  *ids maps their ids back.
+ */
+static int load_packages(sqlite3 *db, struct vset *v, struct vpkg_id **ids,
+                         const struct verify_scope *scope)
+{
     sqlite3_stmt *st = NULL;
-    int rc = sqlite3_prepare_v2(db,
-        "SELECT f.path, p.name "
-        "FROM files f "
-        "JOIN packages p ON f.package_id = p.id "
-        "ORDER BY p.name COLLATE BINARY ASC, f.path ASC;",
-        -1, &st, NULL);
+    size_t cap = 0;
+    int rc;
+
+    if (scope && scope->npkgs) {
+        rc = sqlite3_prepare_v2(db,
+            "SELECT id FROM packages WHERE name = ?;",
+            -1, &st, NULL);
+        if (rc != SQLITE_OK)
+            db_die(db, rc, "verify package prepare");
+
+        rc = SQLITE_DONE;
+        for (size_t i = 0; i < scope->npkgs && rc == SQLITE_DONE; i++) {
+            sqlite3_reset(st);
+            sqlite3_bind_text(st, 1, scope->pkgs[i], -1, SQLITE_STATIC);
+
+            rc = sqlite3_step(st);
+            if (rc == SQLITE_DONE) {
+                fprintf(stderr, "verify: package '%s' is not installed\n",
+                        scope->pkgs[i]);
+                rc = SQLITE_ERROR;
+            } else if (rc == SQLITE_ROW) {
+                rc = add_package(v, &cap, sqlite3_column_int64(st, 0),
+                                 scope->pkgs[i]) ? SQLITE_NOMEM
+                                                 : SQLITE_DONE;
+            }
+        }
+        sqlite3_finalize(st);
+        if (rc != SQLITE_DONE)
+            return 1;
+
+        /* Named twice: keep one */
+        qsort(v->pkgs, v->npkgs, sizeof(*v->pkgs), cmp_vpkg);
+        size_t n = 0;
+        for (size_t i = 0; i < v->npkgs; i++) {
+            if (n && v->pkgs[n - 1].id == v->pkgs[i].id)
+                free(v->pkgs[i].name);
+            else
+                v->pkgs[n++] = v->pkgs[i];
+        }
+        v->npkgs = n;
+    } else {
+        rc = sqlite3_prepare_v2(db,
+            "SELECT id, name FROM packages ORDER BY name COLLATE BINARY ASC;",
+            -1, &st, NULL);
+        if (rc != SQLITE_OK)
+            db_die(db, rc, "verify packages prepare");
+
+        while ((rc = sqlite3_step(st)) == SQLITE_ROW) {
+            const char *name = (const char *)sqlite3_column_text(st, 1);
+            if (name && add_package(v, &cap, sqlite3_column_int64(st, 0),
+                                    name) != 0)
+                break;
+        }
+        sqlite3_finalize(st);
+        if (rc != SQLITE_DONE) {
+            fprintf(stderr, "verify: cannot load the package list\n");
+            return 1;
+        }
+    }
+
+    *ids = malloc((v->npkgs ? v->npkgs : 1) * sizeof(**ids));
+    if (!*ids)
+        return 1;
+    for (size_t i = 0; i < v->npkgs; i++) {
+        (*ids)[i].id  = v->pkgs[i].id;
+        (*ids)[i].pkg = i;
+    }
+    qsort(*ids, v->npkgs, sizeof(**ids), cmp_pkg_id);
+    return 0;
+}
+
+/* Appends the row `st` is on.  Returns 0, or 1 out of memory. */
+static int add_file(struct vset *v, size_t *cap, sqlite3_stmt *st,
+                    const struct vpkg_id *ids)
+{
+    const char *path   = (const char *)sqlite3_column_text(st, 0);
+    const char *sha    = (const char *)sqlite3_column_text(st, 4);
+    const char *target = (const char *)sqlite3_column_text(st, 5);
+    struct vpkg_id key = { .id = sqlite3_column_int64(st, 1) };
+    const struct vpkg_id *owner =
+        bsearch(&key, ids, v->npkgs, sizeof(*ids), cmp_pkg_id);
+
+    if (!path || !owner)
+        return 0;
+
+    if (v->count == *cap) {
+        size_t newcap = *cap ? *cap * 2 : 1024;
+        struct vfile *tmp = realloc(v->files, newcap * sizeof(*tmp));
+        if (!tmp)
+            return 1;
+        v->files = tmp;
+        *cap     = newcap;
+    }
+
+    struct vfile *f = &v->files[v->count];
+    memset(f, 0, sizeof(*f));
+    f->path = strdup(path);
+    if (target)
+        f->link_target = strdup(target);
+    v->count++;
+    if (!f->path || (target && !f->link_target))
+        return 1;
+
+    f->pkg  = owner->pkg;
+    f->size = sqlite3_column_type(st, 2) == SQLITE_NULL
+              ? -1 : sqlite3_column_int64(st, 2);
+    f->mode = (unsigned)sqlite3_column_int64(st, 3);
+    if (sha && strlen(sha) == 64)
+        memcpy(f->sha256, sha, 65);
+    v->pkgs[f->pkg].nfiles++;
+
+    if (sqlite3_column_type(st, 6) != SQLITE_NULL) {
+        f->cached        = 1;
+        f->meta.dev      = (unsigned long long)sqlite3_column_int64(st, 6);
+        f->meta.ino      = (unsigned long long)sqlite3_column_int64(st, 7);
+        f->meta.size     = sqlite3_column_int64(st, 8);
+        f->meta.mtime_ns = sqlite3_column_int64(st, 9);
+        f->meta.ctime_ns = sqlite3_column_int64(st, 10);
+    }
+    return 0;
+}
+
+/*
+ * load_files
+ *
+ * The packages and files rows in scope with their fingerprints, in
+ * report order: by package name, then path.
+ *
+ * A full check reads the table in its own order and sorts here, which
+ * is far cheaper than having SQLite sort the join.  A scoped one asks
+ * only for what it needs, by index: files_package_id for each named
+ * package, the files primary key for each path prefix (the path itself
+ * and the range of paths under it).
+ */
+static int load_files(sqlite3 *db, struct vset *v, int flags,
+                      const struct verify_scope *scope)
+{
+    struct vpkg_id *ids = NULL;
+
+    if (load_packages(db, v, &ids, scope) != 0) {
+        free(ids);
+        return 1;
+    }
+
+    int by_pkg  = scope && scope->npkgs;
+    int by_path = scope && scope->npaths;
+
+    /* The cache entry counts only for the sha256 it was taken against */
+    char sql[512];
+    snprintf(sql, sizeof(sql),
+             "SELECT f.path, f.package_id, f.size, f.mode, f.sha256, "
+             "       f.link_target, %s "
+             "FROM files f %s "
+             "WHERE %s AND %s;",
+             (flags & VERIFY_DEEP) && !(flags & VERIFY_FULL)
+                 ? "c.dev, c.ino, c.size, c.mtime, c.ctime"
+                 : "NULL, NULL, NULL, NULL, NULL",
+             (flags & VERIFY_DEEP) && !(flags & VERIFY_FULL)
+                 ? "LEFT JOIN verify_cache c "
+                   "  ON c.path = f.path AND c.sha256 = f.sha256"
+                 : "",
+             by_pkg  ? "f.package_id = ?1" : "1",
+             by_path ? "(f.path = ?2 OR (f.path >= ?3 AND f.path < ?4))"
+                     : "1");
+
+    sqlite3_stmt *st = NULL;
+    int rc = sqlite3_prepare_v2(db, sql, -1, &st, NULL);
     if (rc != SQLITE_OK)
         db_die(db, rc, "verify files prepare");
 
-    while (sqlite3_step(st) == SQLITE_ROW) {
-        const char *path    = (const char *)sqlite3_column_text(st, 0);
-        const char *pkgname = (const char *)sqlite3_column_text(st, 1);
-        if (!path || !pkgname) continue;
+    size_t cap = 0;
+    size_t npkgs  = by_pkg  ? v->npkgs      : 1;
+    size_t npaths = by_path ? scope->npaths : 1;
+    rc = SQLITE_DONE;
+
+    for (size_t i = 0; i < npkgs && rc == SQLITE_DONE; i++) {
+        for (size_t j = 0; j < npaths && rc == SQLITE_DONE; j++) {
+            char lo[PATH_MAX + 1], hi[PATH_MAX + 1];
+
+            sqlite3_reset(st);
+            if (by_pkg)
+                sqlite3_bind_int64(st, 1, v->pkgs[i].id);
+            if (by_path) {
+                /* "/usr/lib": itself, and "/usr/lib/" <= path < "/usr/lib0" */
+                snprintf(lo, sizeof(lo), "%s/", scope->paths[j]);
+                snprintf(hi, sizeof(hi), "%s0", scope->paths[j]);
+                sqlite3_bind_text(st, 2, scope->paths[j], -1, SQLITE_STATIC);
+                sqlite3_bind_text(st, 3, lo, -1, SQLITE_TRANSIENT);
+                sqlite3_bind_text(st, 4, hi, -1, SQLITE_TRANSIENT);
+            }
+
+            while ((rc = sqlite3_step(st)) == SQLITE_ROW)
+                if (add_file(v, &cap, st, ids) != 0)
+                    break;
+        }
+    }
+
+    sqlite3_finalize(st);
+    free(ids);
+
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "verify: cannot load the file list\n");
+        return 1;
+    }
+
+    qsort(v->files, v->count, sizeof(*v->files), cmp_vfile);
+
+    /* Overlapping prefixes load a row twice */
+    if (npaths > 1) {
+        size_t n = 0;
+        for (size_t i = 0; i < v->count; i++) {
+            if (n && strcmp(v->files[n - 1].path, v->files[i].path) == 0) {
+                v->pkgs[v->files[i].pkg].nfiles--;
+                free(v->files[i].path);
+                free(v->files[i].link_target);
+            } else {
+                v->files[n++] = v->files[i];
+            }
+        }
+        v->count = n;
+    }
+
+    /* A path subset says nothing about packages it does not reach */
+    v->check_empty = !by_path;
+    return 0;
+}
+
+/* =========================================================================
+ * Metadata check
+ * ========================================================================= */
+
+/* Does the symlink at f->path still point where it was packaged to? */
+static int link_matches(const struct vfile *f)
+{
+    char target[PATH_MAX];
+    const char *leaf;
+    int dfd = root_at(f->path, 0, &leaf);
+    if (dfd < 0)
+        return 0;
+    ssize_t len = readlinkat(dfd, leaf, target, sizeof(target) - 1);
+    root_at_done(dfd);
+    if (len < 0)
+        return 0;
+    target[len] = '\0';
+
+    if (f->link_target)
+        return strcmp(target, f->link_target) == 0;
 
-        struct stat s;
-        if (stat(path, &s) != 0) {
-            fprintf(stdout, "missing: %s (owned by %s)\n", path, pkgname);
-            issues++;
+    /* Recorded before link_target: compare the hash of the target */
+    if (f->sha256[0]) {
+        char sha[65];
+        struct digest_stream *hash = digest_stream_new(DIGEST_SHA256);
+        int ok = hash &&
+                 digest_stream_update(hash, target, (size_t)len) == 0 &&
+                 digest_stream_final(hash, sha) == 0 &&
+                 strcmp(sha, f->sha256) == 0;
+        digest_stream_free(hash);
+        return ok;
+    }
+
+    return 1;
+}
+
+static int same_meta(const struct file_meta *a, const struct file_meta *b)
+{
+    return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+           a->mtime_ns == b->mtime_ns && a->ctime_ns == b->ctime_ns;
+}
+
+static void check_entry(struct vfile *f, const struct statx_req *q,
+                        int deep)
+{
+    if (q->err != 0) {
+        f->state = q->err == ENOENT || q->err == ENOTDIR ? V_MISSING
+                                                         : V_UNREADABLE;
+        f->err   = q->err;
+        return;
+    }
+
+    const struct file_meta *s = &q->meta;
+
+    if (S_ISLNK(f->mode) || (f->mode == 0 && S_ISLNK(s->mode))) {
+        if (!S_ISLNK(s->mode))
+            f->state = V_NOT_LINK;
+        else if (!link_matches(f))
+            f->state = V_MODIFIED;
+        return;
+    }
+
+    if (!S_ISREG(s->mode)) {
+        f->state = V_NOT_FILE;
+        return;
+    }
+
+    if (!deep || !f->sha256[0])
+        return;
+
+    if (f->size >= 0 && s->size != f->size) {
+        f->state = V_MODIFIED;
+        return;
+    }
+
+    /* Unchanged since the last deep check found it intact */
+    if (f->cached && same_meta(&f->meta, s))
+        return;
+
+    f->hash = 1;
+    f->meta = *s;
+}
+
+/* =========================================================================
+ * Deep check: hashing
+ * ========================================================================= */
+
+/*
+ * hash_files
+ *
+ * Hashes every entry marked `hash` inside the root (root_at), refusing
+ * to follow a symlink swapped in since the metadata check, and sets its
+ * state.  *bytes is the amount read.  Returns the number of files
+ * hashed.
+ */
+static size_t hash_files(struct vfile *files, size_t count, long long *bytes)
+{
+    size_t ntodo = 0;
+    *bytes = 0;
+
+    for (size_t i = 0; i < count; i++)
+        if (files[i].hash)
+            ntodo++;
+
+    struct digest_job *jobs = calloc(ntodo ? ntodo : 1, sizeof(*jobs));
+    if (!jobs) {
+        for (size_t i = 0; i < count; i++)
+            if (files[i].hash) {
+                files[i].state = V_UNREADABLE;
+                files[i].err   = ENOMEM;
+            }
+        return 0;
+    }
+
+    for (size_t i = 0, j = 0; i < count; i++)
+        if (files[i].hash)
+            jobs[j++].path = files[i].path;
+
+    digest_batch(DIGEST_SHA256, DIGEST_AT_ROOT, O_NOFOLLOW, jobs, ntodo);
+
+    for (size_t i = 0, j = 0; i < count; i++) {
+        struct vfile *f = &files[i];
+        if (!f->hash)
+            continue;
+
+        const struct digest_job *job = &jobs[j++];
+        if (job->err) {
+            f->state = job->err == ENOENT ? V_MISSING : V_UNREADABLE;
+            f->err   = job->err;
             continue;
         }
-        if (!S_ISREG(s.st_mode)) {
-            fprintf(stdout, "invalid: %s (expected file)\n", path);
-            issues++;
+        if (strcmp(job->hex, f->sha256) != 0)
+            f->state = V_MODIFIED;
+        *bytes += job->bytes;
+    }
+
+    log_info("verify: hashed %zu files (%lld bytes)", ntodo, *bytes);
+    free(jobs);
+    return ntodo;
+}
+
+/*
+ * save_cache
+ *
+ * Records every file hashed intact in this run, and forgets the ones
+ * found modified.  A failure only costs the next run some hashing.
+ */
+static void save_cache(sqlite3 *db, const struct vset *v)
+{
+    sqlite3_stmt *put = NULL, *del = NULL;
+    size_t saved = 0;
+
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK)
+        goto fail;
+
+    if (sqlite3_prepare_v2(db,
+            "INSERT INTO verify_cache"
+            "  (path, sha256, dev, ino, size, mtime, ctime) "
+            "VALUES(?, ?, ?, ?, ?, ?, ?) "
+            "ON CONFLICT(path) DO UPDATE SET"
+            "  sha256 = excluded.sha256, dev = excluded.dev,"
+            "  ino = excluded.ino, size = excluded.size,"
+            "  mtime = excluded.mtime, ctime = excluded.ctime;",
+            -1, &put, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db,
+            "DELETE FROM verify_cache WHERE path = ?;",
+            -1, &del, NULL) != SQLITE_OK)
+        goto rollback;
+
+    for (size_t i = 0; i < v->count; i++) {
+        const struct vfile *f = &v->files[i];
+        sqlite3_stmt *st;
+
+        if (f->hash && f->state == V_OK) {
+            st = put;
+            sqlite3_reset(st);
+            sqlite3_bind_text (st, 2, f->sha256, -1, SQLITE_STATIC);
+            sqlite3_bind_int64(st, 3, (sqlite3_int64)f->meta.dev);
+            sqlite3_bind_int64(st, 4, (sqlite3_int64)f->meta.ino);
+            sqlite3_bind_int64(st, 5, f->meta.size);
+            sqlite3_bind_int64(st, 6, f->meta.mtime_ns);
+            sqlite3_bind_int64(st, 7, f->meta.ctime_ns);
+            saved++;
+        } else if (f->cached && f->state != V_OK) {
+            st = del;
+            sqlite3_reset(st);
+        } else {
+            continue;
         }
+
+        sqlite3_bind_text(st, 1, f->path, -1, SQLITE_STATIC);
+        if (sqlite3_step(st) != SQLITE_DONE)
+            goto rollback;
     }
-    sqlite3_finalize(st);
 
-    /* Check 2: every package has at least one file */
-    rc = sqlite3_prepare_v2(db,
-        "SELECT p.name "
-        "FROM packages p "
-        "LEFT JOIN files f ON f.package_id = p.id "
-        "GROUP BY p.id "
-        "HAVING COUNT(f.path) = 0 "
-        "ORDER BY p.name COLLATE BINARY ASC;",
-        -1, &st, NULL);
-    if (rc != SQLITE_OK)
-        db_die(db, rc, "verify empty packages prepare");
+    sqlite3_finalize(put);
+    sqlite3_finalize(del);
+    if (sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK)
+        goto rollback_only;
+
+    log_info("verify: cached %zu intact files", saved);
+    return;
+
+rollback:
+    sqlite3_finalize(put);
+    sqlite3_finalize(del);
+rollback_only:
+    sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+fail:
+    ui_warn("cannot save the verify cache: %s", sqlite3_errmsg(db));
+    log_error("verify: cache not saved: %s", sqlite3_errmsg(db));
+}
+
+/* =========================================================================
+ * Public entry
+ * ========================================================================= */
 
-    while (sqlite3_step(st) == SQLITE_ROW) {
-        const char *name = (const char *)sqlite3_column_text(st, 0);
-        if (!name) continue;
-        fprintf(stdout, "missing files: %s (no files registered)\n", name);
+static int report(const struct vset *v)
+{
+    int issues = 0;
+
+    for (size_t i = 0; i < v->count; i++) {
+        const struct vfile *f = &v->files[i];
+        const char *pkg = v->pkgs[f->pkg].name;
+
+        switch (f->state) {
+        case V_OK:
+            continue;
+        case V_MISSING:
+            fprintf(stdout, "missing: %s (owned by %s)\n", f->path, pkg);
+            break;
+        case V_NOT_FILE:
+            fprintf(stdout, "invalid: %s (expected file)\n", f->path);
+            break;
+        case V_NOT_LINK:
+            fprintf(stdout, "invalid: %s (expected symlink)\n", f->path);
+            break;
+        case V_MODIFIED:
+            fprintf(stdout, "modified: %s (owned by %s)\n", f->path, pkg);
+            break;
+        case V_UNREADABLE:
+            fprintf(stdout, "unreadable: %s (%s)\n",
+                    f->path, strerror(f->err));
+            break;
+        }
         issues++;
     }
-    sqlite3_finalize(st);
+
+    /* Every package has at least one file */
+    for (size_t i = 0; i < v->npkgs && v->check_empty; i++) {
+        if (v->pkgs[i].nfiles)
+            continue;
+        fprintf(stdout, "missing files: %s (no files registered)\n",
+                v->pkgs[i].name);
+        issues++;
+    }
+
+    return issues;
+}
+
+int verify_system(int flags, const struct verify_scope *scope)
+{
+    sqlite3 *db = db_handle();
+    if (!db) return 1;
+
+    int deep = (flags & (VERIFY_DEEP | VERIFY_FULL)) != 0;
+    if (deep)
+        flags |= VERIFY_DEEP;
+
+    struct vset v = {0};
+    if (load_files(db, &v, flags, scope) != 0) {
+        vset_free(&v);
+        return 1;
+    }
+
+    struct vfile *files = v.files;
+    size_t count = v.count;
+
+    struct statx_req *reqs = malloc(VERIFY_BATCH * sizeof(*reqs));
+    if (!reqs) {
+        fprintf(stderr, "verify: out of memory\n");
+        vset_free(&v);
+        return 1;
+    }
+
+    size_t unhashed = 0, unchanged = 0;
+    for (size_t base = 0; base < count; base += VERIFY_BATCH) {
+        size_t n = count - base < VERIFY_BATCH ? count - base : VERIFY_BATCH;
+
+        for (size_t i = 0; i < n; i++)
+            reqs[i].path = files[base + i].path;
+        statx_batch(reqs, n);
+
+        for (size_t i = 0; i < n; i++) {
+            struct vfile *f = &files[base + i];
+            check_entry(f, &reqs[i], deep);
+            if (!deep || f->state != V_OK || f->hash || S_ISLNK(f->mode))
+                continue;
+            if (f->sha256[0])
+                unchanged++;
+            else
+                unhashed++;
+        }
+    }
+    free(reqs);
+
+    if (deep) {
+        long long bytes = 0;
+        size_t hashed = hash_files(files, count, &bytes);
+        ui_info("hashed %zu files (%lld MiB), %zu unchanged since the "
+                "last check", hashed, (bytes + (1 << 20) - 1) >> 20,
+                unchanged);
+        save_cache(db, &v);
+        if (unhashed)
+            ui_warn("%zu files have no recorded hash; "
+                    "reinstall or upgrade their packages to record one",
+                    unhashed);
+    }
+
+    int issues = report(&v);
+    size_t checked = v.count;
+    vset_free(&v);
 
     if (issues == 0) {
-        ui_info("system is consistent");
+        if (!scope || (!scope->npkgs && !scope->npaths))
+            ui_info("system is consistent");
+        else if (checked == 0)
+            ui_warn("no installed files under the given paths");
+        else
+            ui_info("%zu checked files are consistent", checked);
         return 0;
     }
 
     fprintf(stdout, "\nverification failed\n");
     return 1;
-}
\ No newline at end of file
+}
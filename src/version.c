@@ -24,6 +24,8 @@
  * outside the normal {-1, 0, 1} range and callers can detect it.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "version.h"
 #include "pkg_meta.h"
 
@@ -196,4 +198,193 @@ int version_satisfies(const char *installed,
     case DEP_OP_EQ: return cmp == 0;
     default:        return 0;
     }
-}
\ No newline at end of file
+}
+
+/* =========================================================================
+ * Binary sort keys
+ * ========================================================================= */
+
+int version_key(const char *v, unsigned char *key, size_t *len)
+{
+    if (!version_is_valid(v))
+        return -1;
+
+    size_t pos   = 0;
+    size_t keep  = 0;   /* key length up to the last non-zero segment */
+    const char *p = v;
+
+    while (*p) {
+        unsigned long long value = 0;
+        int digits = 0;
+
+        while (isdigit((unsigned char)*p)) {
+            /* skip leading zeros so "007" counts as one digit */
+            if (value == 0 && *p == '0') {
+                p++;
+                continue;
+            }
+            if (++digits > 19)
+                return -1;
+            value = value * 10 + (unsigned long long)(*p - '0');
+            p++;
+        }
+        if (*p == '.' || *p == '-')
+            p++;
+
+        unsigned char be[8];
+        int n = 0;
+        for (unsigned long long x = value; x; x >>= 8)
+            be[n++] = (unsigned char)(x & 0xff);
+
+        if (pos + 1 + (size_t)n > VERSION_KEY_MAX)
+            return -1;
+
+        key[pos++] = (unsigned char)n;
+        while (n > 0)
+            key[pos++] = be[--n];
+
+        if (value != 0)
+            keep = pos;
+    }
+
+    *len = keep;
+    return 0;
+}
+
+int version_key_cmp(const unsigned char *a, size_t alen,
+                    const unsigned char *b, size_t blen)
+{
+    size_t n = alen < blen ? alen : blen;
+    int c = n ? memcmp(a, b, n) : 0;
+
+    if (c == 0)
+        c = (alen > blen) - (alen < blen);
+
+    return (c > 0) - (c < 0);
+}
+
+/* =========================================================================
+ * Compiled constraints
+ * ========================================================================= */
+
+int version_constraint_compile(struct version_constraint *c,
+                               dep_op_t op, const char *required)
+{
+    c->op    = op;
+    c->valid = 1;
+    c->len   = 0;
+
+    if (op == DEP_OP_NONE)
+        return 0;
+
+    size_t len;
+    if (version_key(required, c->key, &len) != 0) {
+        c->valid = 0;
+        return -1;
+    }
+
+    c->len = (unsigned char)len;
+    return 0;
+}
+
+/*
+ * Maps a three-way comparison to the operator's verdict.  Kept inline
+ * so version_constraint_match's loop is one memcmp and a switch.
+ */
+static inline int op_accepts(dep_op_t op, int cmp)
+{
+    switch (op) {
+    case DEP_OP_GE: return cmp >= 0;
+    case DEP_OP_LE: return cmp <= 0;
+    case DEP_OP_GT: return cmp >  0;
+    case DEP_OP_LT: return cmp <  0;
+    case DEP_OP_EQ: return cmp == 0;
+    default:        return 0;
+    }
+}
+
+int version_constraint_test(const struct version_constraint *c,
+                            const unsigned char *key, size_t len)
+{
+    if (c->op == DEP_OP_NONE)
+        return 1;
+
+    if (!c->valid || !key)
+        return 0;
+
+    return op_accepts(c->op, version_key_cmp(key, len, c->key, c->len));
+}
+
+size_t version_constraint_match(const struct version_constraint *c,
+                                const struct version_key_ref *cands,
+                                size_t n, unsigned char *match)
+{
+    size_t hits = 0;
+
+    if (c->op == DEP_OP_NONE || !c->valid) {
+        unsigned char all = (c->op == DEP_OP_NONE);
+        if (match)
+            memset(match, all, n);
+        return all ? n : 0;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        int ok = cands[i].key &&
+                 op_accepts(c->op, version_key_cmp(cands[i].key, cands[i].len,
+                                                   c->key, c->len));
+        if (match)
+            match[i] = (unsigned char)ok;
+        hits += (size_t)ok;
+    }
+
+    return hits;
+}
+
+/* =========================================================================
+ * SQL functions
+ * ========================================================================= */
+
+static void sql_version_cmp(sqlite3_context *ctx, int argc,
+                            sqlite3_value **argv)
+{
+    (void)argc;
+
+    const char *a = (const char *)sqlite3_value_text(argv[0]);
+    const char *b = (const char *)sqlite3_value_text(argv[1]);
+
+    int cmp = version_cmp(a, b);
+    if (cmp == INT_MIN)
+        sqlite3_result_null(ctx);
+    else
+        sqlite3_result_int(ctx, cmp);
+}
+
+static void sql_version_key(sqlite3_context *ctx, int argc,
+                            sqlite3_value **argv)
+{
+    (void)argc;
+
+    unsigned char key[VERSION_KEY_MAX];
+    size_t len;
+
+    const char *v = (const char *)sqlite3_value_text(argv[0]);
+    if (version_key(v, key, &len) != 0) {
+        sqlite3_result_null(ctx);
+        return;
+    }
+
+    sqlite3_result_blob(ctx, key, (int)len, SQLITE_TRANSIENT);
+}
+
+int version_sql_register(sqlite3 *db)
+{
+    int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+
+    int rc = sqlite3_create_function(db, "version_cmp", 2, flags, NULL,
+                                     sql_version_cmp, NULL, NULL);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    return sqlite3_create_function(db, "version_key", 1, flags, NULL,
+                                   sql_version_key, NULL, NULL);
+}
@@ -0,0 +1,51 @@
+/*
+ * workq.c - Hand-off queue between a download batch and its workers
+ * (see workq.h)
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "workq.h"
+
+#include <unistd.h>
+
+void workq_push(struct workq *q, void *item)
+{
+    pthread_mutex_lock(&q->lock);
+    q->items[q->tail++] = item;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void workq_close(struct workq *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void *workq_pop(struct workq *q)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->head == q->tail && !q->closed)
+        pthread_cond_wait(&q->cond, &q->lock);
+
+    void *item = NULL;
+    if (q->head < q->tail)
+        item = q->items[q->head++];
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+int workq_workers(size_t jobs, int max)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        cpus = 1;
+    if (cpus > max)
+        cpus = max;
+    if ((size_t)cpus > jobs)
+        cpus = (long)jobs;
+    return (int)cpus;
+}
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""
+httpd.py - loopback HTTP server for the tests
+
+  httpd.py DIR PORTFILE LOG [--delay SECONDS] [--mode-file FILE]
+
+Serves DIR on an ephemeral 127.0.0.1 port, written to PORTFILE once
+listening.  Every finished GET is logged to LOG as
+
+  <start> <end> <bytes> <path>
+
+(Unix times), which is what the tests assert on: which server a file
+came from, how many transfers overlapped and how fast they went.
+
+--delay sleeps before answering every request, HEAD included, so the
+mirror probe sees it as first-byte latency.
+
+--mode-file names a file holding one word, re-read per request so a
+test can change a running server's behaviour (absent = ok).  Modes
+other than ok apply to package archives only, so `flappy update` keeps
+working against the server:
+
+  ok     serve normally
+  fail   answer 503
+  stall  send the headers and 100 bytes, then nothing
+"""
+
+import argparse
+import http.server
+import os
+import threading
+import time
+
+ap = argparse.ArgumentParser()
+ap.add_argument("dir")
+ap.add_argument("portfile")
+ap.add_argument("log")
+ap.add_argument("--delay", type=float, default=0.0)
+ap.add_argument("--mode-file")
+args = ap.parse_args()
+
+log_lock = threading.Lock()
+
+
+def mode():
+    try:
+        with open(args.mode_file) as f:
+            return f.read().strip() or "ok"
+    except (OSError, TypeError):
+        return "ok"
+
+
+class Handler(http.server.SimpleHTTPRequestHandler):
+    def __init__(self, *a, **k):
+        super().__init__(*a, directory=args.dir, **k)
+
+    def log_message(self, *a):
+        pass
+
+    def do_HEAD(self):
+        time.sleep(args.delay)
+        super().do_HEAD()
+
+    def do_GET(self):
+        time.sleep(args.delay)
+        path = os.path.join(args.dir, self.path.lstrip("/"))
+        if not os.path.isfile(path):
+            return self.send_error(404)
+
+        m = mode() if self.path.endswith(".pkg.tar.zst") else "ok"
+        if m == "fail":
+            return self.send_error(503)
+
+        with open(path, "rb") as f:
+            data = f.read()
+        start = time.time()
+        self.send_response(200)
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+
+        if m == "stall":
+            self.wfile.write(data[:100])
+            self.wfile.flush()
+            time.sleep(3600)
+            return
+
+        for i in range(0, len(data), 16384):
+            self.wfile.write(data[i:i + 16384])
+        with log_lock, open(args.log, "a") as f:
+            f.write("%.3f %.3f %d %s\n" %
+                    (start, time.time(), len(data), self.path))
+
+
+server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), Handler)
+server.daemon_threads = True
+with open(args.portfile + ".tmp", "w") as f:
+    f.write("%d\n" % server.server_address[1])
+os.rename(args.portfile + ".tmp", args.portfile)
+server.serve_forever()
@@ -0,0 +1,120 @@
+# tests/lib.sh - helpers for the loopback tests, sourced by run.sh
+#
+# Each test runs in its own subshell with:
+#
+#   T                its scratch directory
+#   FLAPPY           the binary under test
+#   TESTS            the tests/ directory
+#
+# and fresh, empty /etc/flappy, /var/lib/flappy and /var/cache/flappy
+# (bind mounts private to the test run), and an initialised --root
+# at $T/root.
+
+SERVERS=""
+
+# fail MESSAGE: the test fails
+fail() {
+    echo "    $*" >&2
+    exit 1
+}
+
+# flappy ARGS...: the binary under test, on the test's root
+flappy() {
+    "$FLAPPY" --root "$T/root" "$@"
+}
+
+# mkrepo DIR SPEC...: repository fixture (see mkrepo.py)
+mkrepo() {
+    python3 "$TESTS/mkrepo.py" "$@" || fail "mkrepo $*"
+}
+
+# serve NAME DIR [--delay SECONDS]: start httpd.py for DIR.  Its GETs
+# are logged to $T/NAME.log; set_mode changes its behaviour.
+serve() {
+    name=$1
+    dir=$2
+    shift 2
+    rm -f "$T/$name.port"
+    python3 "$TESTS/httpd.py" "$dir" "$T/$name.port" "$T/$name.log" \
+        --mode-file "$T/$name.mode" "$@" &
+    echo $! > "$T/$name.pid"
+    SERVERS="$SERVERS $!"
+
+    i=0
+    while [ ! -s "$T/$name.port" ]; do
+        i=$((i + 1))
+        [ $i -le 100 ] || fail "server $name did not start"
+        sleep 0.1
+    done
+}
+
+# url NAME: base URL of a running server
+url() {
+    echo "http://127.0.0.1:$(cat "$T/$1.port")"
+}
+
+# set_mode NAME ok|fail|stall (see httpd.py)
+set_mode() {
+    echo "$2" > "$T/$1.mode"
+}
+
+# stop NAME: kill a server; its port now refuses connections
+stop() {
+    kill "$(cat "$T/$1.pid")" 2>/dev/null
+    wait "$(cat "$T/$1.pid")" 2>/dev/null
+}
+
+stop_all() {
+    for pid in $SERVERS; do
+        kill "$pid" 2>/dev/null
+    done
+    wait 2>/dev/null
+}
+
+# repos_conf URL [MIRROR...]: a single [core] repository
+repos_conf() {
+    {
+        echo "[core]"
+        echo "url = $1"
+        shift
+        for m in "$@"; do
+            echo "mirror = $m"
+        done
+    } > /etc/flappy/repos.conf
+}
+
+# fetched FILE NAME: 0 if server NAME served FILE
+fetched() {
+    grep -q " /packages/$1\$" "$T/$2.log" 2>/dev/null
+}
+
+# mirror_fails URL: consecutive failures mirrors.state records for URL
+mirror_fails() {
+    awk -v u="$1" '$5 == u { print $3 }' /var/lib/flappy/mirrors.state
+}
+
+# transfer_stats NAME...: "<archives> <most at once> <KiB/s>" for the
+# package archives the servers sent, the rate over the span from the
+# first start to the last end
+transfer_stats() {
+    logs=""
+    for name in "$@"; do
+        logs="$logs $T/$name.log"
+    done
+    python3 - $logs <<'PY'
+import sys
+rows = []
+for log in sys.argv[1:]:
+    for line in open(log):
+        start, end, size, path = line.split()
+        if path.endswith(".pkg.tar.zst"):
+            rows.append((float(start), float(end), int(size)))
+events = sorted([(r[0], 1) for r in rows] + [(r[1], -1) for r in rows])
+now = most = 0
+for _, d in events:
+    now += d
+    most = max(most, now)
+span = max(r[1] for r in rows) - min(r[0] for r in rows)
+print(len(rows), most, int(sum(r[2] for r in rows) / 1024 / max(span, 1e-3)))
+PY
+}
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+"""
+mkrepo.py - build a repository fixture for the tests
+
+  mkrepo.py OUT SPEC...
+
+  SPEC  name=version[,version...][@KiB[xFILES]]
+        dep:name,depends,op,version
+
+Writes OUT/repo.db (+ .sha256) and OUT/packages/<name>-<version>.
+pkg.tar.zst, one archive per version.  Each package ships
+/usr/share/<name>/version; @KiB adds /usr/share/<name>/blob of that
+many KiB of random (incompressible) data, for transfers that take
+measurable time, and @KiBxFILES that many such files spread over
+/usr/share/<name>/d0..d7 instead.  dep: rows also become depend lines
+in the package's .PKGINFO (op and version may be empty).  Archives are
+compressed with the zstd command.
+"""
+
+import hashlib
+import io
+import os
+import sqlite3
+import subprocess
+import sys
+import tarfile
+
+out = sys.argv[1]
+os.makedirs(out + "/packages", exist_ok=True)
+if os.path.exists(out + "/repo.db"):
+    os.unlink(out + "/repo.db")
+
+db = sqlite3.connect(out + "/repo.db")
+db.execute("CREATE TABLE meta (key TEXT PRIMARY KEY, value TEXT)")
+db.execute("INSERT INTO meta VALUES ('schema_version', '1')")
+db.execute("CREATE TABLE packages (name TEXT, version TEXT, filename TEXT,"
+           " checksum TEXT, description TEXT)")
+db.execute("CREATE TABLE deps (package TEXT, depends TEXT, op TEXT,"
+           " version TEXT)")
+
+
+def add_file(tf, path, data):
+    ti = tarfile.TarInfo("./" + path)
+    ti.size = len(data)
+    ti.mode = 0o644
+    tf.addfile(ti, io.BytesIO(data))
+
+
+def add_dir(tf, path):
+    ti = tarfile.TarInfo("./" + path)
+    ti.type = tarfile.DIRTYPE
+    ti.mode = 0o755
+    tf.addfile(ti)
+
+
+def package(name, version, kib, files):
+    info = ("pkgname = %s\npkgver = %s\npkgrel = 1\n"
+            "arch = x86_64\npkgdesc = test package\n" % (name, version))
+    for dep in deps.get(name, []):
+        info += "depend = %s\n" % " ".join(x for x in dep if x)
+
+    buf = io.BytesIO()
+    with tarfile.open(fileobj=buf, mode="w",
+                      format=tarfile.USTAR_FORMAT) as tf:
+        add_file(tf, ".PKGINFO", info.encode())
+        for d in ("usr", "usr/share", "usr/share/" + name):
+            add_dir(tf, d)
+        add_file(tf, "usr/share/%s/version" % name,
+                 ("%s %s\n" % (name, version)).encode())
+        if kib and not files:
+            add_file(tf, "usr/share/%s/blob" % name, os.urandom(kib * 1024))
+        for d in range(min(files, 8)):
+            add_dir(tf, "usr/share/%s/d%d" % (name, d))
+        for i in range(files):
+            add_file(tf, "usr/share/%s/d%d/f%04d" % (name, i % 8, i),
+                     os.urandom(kib * 1024))
+
+    filename = "%s-%s.pkg.tar.zst" % (name, version)
+    path = out + "/packages/" + filename
+    subprocess.run(["zstd", "-q", "-f", "-o", path],
+                   input=buf.getvalue(), check=True)
+    with open(path, "rb") as f:
+        checksum = hashlib.sha256(f.read()).hexdigest()
+    db.execute("INSERT INTO packages VALUES (?, ?, ?, ?, ?)",
+               (name, version, filename, checksum, "test package"))
+
+
+deps = {}
+for spec in sys.argv[2:]:
+    if spec.startswith("dep:"):
+        row = spec[4:].split(",")
+        db.execute("INSERT INTO deps VALUES (?, ?, ?, ?)", row)
+        deps.setdefault(row[0], []).append(row[1:])
+
+for spec in sys.argv[2:]:
+    if spec.startswith("dep:"):
+        continue
+    name, _, rest = spec.partition("=")
+    versions, _, size = rest.partition("@")
+    kib, _, files = size.partition("x")
+    for version in versions.split(","):
+        package(name, version, int(kib or 0), int(files or 0))
+
+db.commit()
+db.close()
+
+with open(out + "/repo.db", "rb") as f:
+    digest = hashlib.sha256(f.read()).hexdigest()
+with open(out + "/repo.db.sha256", "w") as f:
+    f.write(digest + "\n")
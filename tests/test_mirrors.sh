@@ -0,0 +1,42 @@
+# Mirror ranking and failover (mirror.c): one repository served by
+# three mirrors with different injected latencies.
+
+mkrepo "$T/repo" m1=1.0 m2=1.0 m3=1.0 m4=1.0
+serve slow "$T/repo" --delay 0.4
+serve fast "$T/repo" --delay 0.02
+serve mid  "$T/repo" --delay 0.15
+repos_conf "$(url slow)" "$(url fast)" "$(url mid)"
+
+# the probe ranks by first-byte latency, not configuration order
+flappy update || fail "update"
+ranked=$(sort -n /var/lib/flappy/mirrors.state | awk '{ printf "%s ", $5 }')
+[ "$ranked" = "$(url fast) $(url mid) $(url slow) " ] ||
+    fail "ranking after update: $ranked"
+
+flappy install m1 || fail "install m1"
+fetched m1-1.0.pkg.tar.zst fast || fail "m1 not fetched from the fastest mirror"
+
+# an error fails over to the next mirror and backs the first one off
+set_mode fast fail
+flappy install m2 || fail "install m2"
+fetched m2-1.0.pkg.tar.zst mid || fail "m2 not fetched from mid after fast failed"
+[ "$(mirror_fails "$(url fast)")" = 1 ] || fail "fast's failure not recorded"
+
+# a stall (under 1 KiB/s for 20 s) is a failure too; fast is still
+# backing off, so slow is next
+set_mode mid stall
+flappy install m3 || fail "install m3"
+fetched m3-1.0.pkg.tar.zst slow || fail "m3 not fetched from slow after mid stalled"
+[ "$(mirror_fails "$(url mid)")" = 1 ] || fail "mid's stall not recorded"
+
+# with the only healthy mirror down, the backed-off ones are still
+# tried, oldest failure first, and one success clears the back-off
+set_mode fast ok
+stop slow
+flappy install m4 || fail "install m4"
+fetched m4-1.0.pkg.tar.zst fast || fail "m4 not fetched from fast"
+[ "$(mirror_fails "$(url fast)")" = 0 ] || fail "fast's back-off not cleared"
+[ "$(mirror_fails "$(url slow)")" = 1 ] || fail "slow's failure not recorded"
+
+ls "$T/root/usr/share" | tr '\n' ' ' | grep -qx "m1 m2 m3 m4 " ||
+    fail "installed: $(ls "$T/root/usr/share")"
@@ -0,0 +1,50 @@
+# Download scheduler (netsched.c): two hosts under one process rate,
+# one of them holding its transfers to a lower rate of its own.
+#
+# 127.0.0.1 serves repository "a" and is capped at 512K; localhost
+# serves "b", whose transfers should get what a leaves of the process
+# rate instead of an equal share (4M / 6 transfers each, 2M for b).
+# Each host gets its host_connections of 3 at once.
+
+mkrepo "$T/a" a1=1.0@1024 a2=1.0@1024 a3=1.0@1024
+mkrepo "$T/b" b1=1.0@1536 b2=1.0@1536 b3=1.0@1536 b4=1.0@1536 \
+              b5=1.0@1536 b6=1.0@1536 b7=1.0@1536 b8=1.0@1536 all=1.0 \
+              dep:all,a1,, dep:all,a2,, dep:all,a3,, \
+              dep:all,b1,, dep:all,b2,, dep:all,b3,, dep:all,b4,, \
+              dep:all,b5,, dep:all,b6,, dep:all,b7,, dep:all,b8,,
+serve a "$T/a"
+serve b "$T/b"
+
+cat > /etc/flappy/repos.conf <<CONF
+[a]
+url = $(url a)
+
+[b]
+url = http://localhost:$(cat "$T/b.port")
+CONF
+
+cat > /etc/flappy/download.conf <<CONF
+host_connections = 3
+rate             = 4M
+
+[127.0.0.1]
+rate = 512K
+CONF
+
+flappy update || fail "update"
+flappy install --bootstrap all || fail "install --bootstrap all"
+
+set -- $(transfer_stats a)
+echo "a: $1 archives, at most $2 at once, $3 KiB/s"
+[ "$1" = 3 ] && [ "$2" -le 3 ] || fail "a: connections"
+[ "$3" -le 640 ] || fail "a: over its 512K rate"
+
+set -- $(transfer_stats b)
+echo "b: $1 archives, at most $2 at once, $3 KiB/s"
+[ "$1" = 9 ] && [ "$2" = 3 ] || fail "b: expected 3 connections at once"
+[ "$3" -ge 2867 ] || fail "b: a's unused share not redistributed"
+[ "$3" -le 4300 ] || fail "b: over the process rate"
+
+# the batch opens as many connections as the scheduler admits
+set -- $(transfer_stats a b)
+[ "$2" = 6 ] || fail "$2 connections at once, expected 3 per host"